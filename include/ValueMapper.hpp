@@ -1,14 +1,15 @@
 #ifndef VALUE_MAPPER_H
 #define VALUE_MAPPER_H
 
-#include <unordered_map>
+#include "compactMap.hpp"
 #include "logger.hpp"
 
 using namespace std;
 
 /**
- * Simple wrapper around std::map for virtualizing values like inodes.
- * Template parameter Virtual must be an integral type.
+ * Simple wrapper around a compactMap for virtualizing values like inodes.
+ * Template parameter Virtual must be an integral type. Virtual values are
+ * handed out in order and never reused, even after eraseRealValue.
  */
 template <typename Real, typename Virtual>
 class ValueMapper {
@@ -19,7 +20,7 @@ protected:
    * C++ doesn't support that unless I use phantom types and wrapper classes...
    */
 
-  unordered_map<Real, Virtual>
+  compactMap<Real, Virtual>
       realToVirtualValue; /**< A mapping from Real to Virtual. */
   Virtual freshValue; /**< Next available Virtual value to be added to map. */
   logger& myLogger; /**< A logger. */
@@ -50,7 +51,7 @@ public:
     // it is nondet whether this realValue (typically an inode) has been seen
     // before, so we need to print either way to keep log message IDs
     // deterministic
-    if (realToVirtualValue.find(realValue) != realToVirtualValue.end()) {
+    if (realToVirtualValue.count(realValue) != 0) {
       myLogger.writeToLog(Importance::extra, "Overwriting old value in map.\n");
     } else {
       myLogger.writeToLog(Importance::extra, "Allocating new value in map.\n");
@@ -64,7 +65,7 @@ public:
         "  (Real value was: " + to_string(realValue) + ")\n");
 
     Virtual vValue = freshValue++;
-    realToVirtualValue[realValue] = vValue;
+    realToVirtualValue.set(realValue, vValue);
     return vValue;
   }
 
@@ -75,8 +76,8 @@ public:
    * @return virtual value that is mapped to the real one.
    */
   Virtual getVirtualValue(Real realValue) {
-    if (realToVirtualValue.find(realValue) != realToVirtualValue.end()) {
-      Virtual virtValue = realToVirtualValue.at(realValue);
+    if (const Virtual* found = realToVirtualValue.find(realValue)) {
+      Virtual virtValue = *found;
       myLogger.writeToLog(
           Importance::info, mappingName + " fetched virtual value: " +
                                 to_string(virtValue) + "\n");
@@ -97,14 +98,38 @@ public:
    * @return True if real value exists, otherwise False.
    */
   bool realValueExists(Real realValue) {
-    bool keyExists =
-        realToVirtualValue.find(realValue) != realToVirtualValue.end();
+    bool keyExists = realToVirtualValue.count(realValue) != 0;
     myLogger.writeToLog(
         Importance::extra, mappingName + "realValueExists(" +
                                to_string(realValue) +
                                ") = " + to_string(keyExists) + "\n");
     return keyExists;
   }
+
+  /**
+   * Forget a real value, e.g. an inode whose file was deleted. Its virtual
+   * value is not handed out again.
+   * @param realValue real value to remove.
+   * @return True if it was in the map.
+   */
+  bool eraseRealValue(Real realValue) {
+    bool erased = realToVirtualValue.erase(realValue) != 0;
+    myLogger.writeToLog(
+        Importance::extra, mappingName + " eraseRealValue(" +
+                               to_string(realValue) +
+                               ") = " + to_string(erased) + "\n");
+    return erased;
+  }
+
+  /**
+   * @return number of real values in the map.
+   */
+  size_t size() const { return realToVirtualValue.size(); }
+
+  /**
+   * @return rough number of heap bytes used by the map.
+   */
+  size_t memoryBytes() const { return realToVirtualValue.memoryBytes(); }
 };
 
 #endif
@@ -0,0 +1,251 @@
+#ifndef ACTION_CACHE_H
+#define ACTION_CACHE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Storage behind the action cache. Actions are small records keyed by the
+ * digest of a run's inputs, blobs are file contents keyed by their SHA-256.
+ * A store shared between machines only has to implement these.
+ */
+class actionCacheBackend {
+public:
+  virtual ~actionCacheBackend() {}
+
+  /**
+   * @return false if there is no action for key.
+   */
+  virtual bool readAction(const string& key, string& record) = 0;
+
+  virtual void writeAction(const string& key, const string& record) = 0;
+
+  /**
+   * Whether the store has a blob already, so we can skip storing it.
+   */
+  virtual bool hasBlob(const string& digest) = 0;
+
+  /**
+   * Write a blob's contents to fd.
+   * @return false if the store does not have it.
+   */
+  virtual bool fetchBlob(const string& digest, int fd) = 0;
+
+  /**
+   * Store the contents of the file at path under digest.
+   */
+  virtual void storeBlob(const string& digest, const string& path) = 0;
+};
+
+/**
+ * Backend in a local directory: actions/<key>, blobs/<first two hex
+ * digits>/<digest> and tmp/ for files on their way in. Everything is renamed
+ * into place, so several dettrace processes can share a directory.
+ */
+class localActionCache : public actionCacheBackend {
+public:
+  explicit localActionCache(const string& dir);
+
+  bool readAction(const string& key, string& record) override;
+  void writeAction(const string& key, const string& record) override;
+  bool hasBlob(const string& digest) override;
+  bool fetchBlob(const string& digest, int fd) override;
+  void storeBlob(const string& digest, const string& path) override;
+
+private:
+  string blobPath(const string& digest);
+
+  string dir;
+};
+
+/**
+ * Digests of files, keyed by what stat tells us about them: device, inode,
+ * size, modification and change time. A file is only read again once one of
+ * those changes. Saved next to the cache so later runs start out warm.
+ *
+ * Files modified in the last couple of seconds are hashed but not saved, the
+ * timestamps may not tell a later write apart from them.
+ */
+class fileDigestIndex {
+public:
+  /**
+   * @param path file the index is loaded from and saved to, may not exist.
+   */
+  explicit fileDigestIndex(const string& path);
+
+  /**
+   * SHA-256 of the regular file at path.
+   * @return empty if it cannot be read.
+   */
+  string digest(const string& path, const struct stat& st);
+
+  /**
+   * Write the index back, if anything changed.
+   */
+  void save();
+
+private:
+  using key = tuple<dev_t, ino_t, off_t, long, long, long, long>;
+
+  struct entry {
+    string digest;
+    bool racy; /**< Modified too recently to save. */
+  };
+
+  string path;
+  map<key, entry> digests;
+  bool dirty = false;
+  time_t loaded;
+};
+
+/**
+ * A file, directory or symbolic link in a tree.
+ */
+struct treeEntry {
+  mode_t mode;
+  /**
+   * Digest for regular files, target for symbolic links, device number for
+   * devices, empty otherwise.
+   */
+  string content;
+
+  bool operator==(const treeEntry& other) const {
+    return mode == other.mode && content == other.content;
+  }
+  bool operator!=(const treeEntry& other) const { return !(*this == other); }
+};
+
+/**
+ * Entries of a tree by path relative to its root, "" being the root itself.
+ */
+using treeSnapshot = map<string, treeEntry>;
+
+/**
+ * Opt-in cache of whole dettrace runs, see --action-cache.
+ *
+ * A run is keyed by the digest of its inputs: the command line, environment
+ * and options, which the caller passes as a string, plus the contents of the
+ * input trees (working directory, mounted volumes, the program). On a hit we
+ * restore what the recorded run left behind in those trees and its output, and
+ * return its exit code without tracing anything. On a miss the caller runs the
+ * program, and record() stores the difference between the trees before and
+ * after, stdout, stderr and the exit code.
+ *
+ * Files the run looked at outside the trees, like headers under /usr on the
+ * host, are not part of the key. The record lists them with their digests,
+ * and restore() only replays it while they are all still the same. A run that
+ * changed anything outside the trees is not recorded, we could not restore
+ * it. Trees are not followed into other file systems.
+ */
+class actionCache {
+public:
+  /**
+   * @param backend where actions and blobs live.
+   * @param localDir directory for the fileDigestIndex and temporary files.
+   * The trees are never looked at below it.
+   * @param trees paths of the input trees, files or directories.
+   */
+  actionCache(
+      unique_ptr<actionCacheBackend> backend,
+      const string& localDir,
+      vector<string> trees);
+
+  /**
+   * Snapshot the trees and hash them together with inputs.
+   * @return the key of this run.
+   */
+  string computeKey(const string& inputs);
+
+  /**
+   * Whether computeKey() could read all of the trees. Otherwise the key does
+   * not capture every input and must not be used.
+   */
+  bool cacheable() const { return complete; }
+
+  /**
+   * Replay a recorded run: apply its changes to the trees and write its output
+   * to our stdout and stderr.
+   * @return false on a miss.
+   */
+  bool restore(const string& key, int& exitCode);
+
+  /**
+   * Append a file access of a run to the log at fd, for readAccessLog(). A
+   * write also notes what stat says about path before it, so a file that is
+   * only looked at, or put back the way it was, does not count as changed.
+   * Called from the tracer process, see TraceOptions::file_access.
+   */
+  static void logAccess(int fd, const char* path, bool write);
+
+  /**
+   * Go through the accesses logged for the run that just finished, before
+   * record(). Files read outside the trees become inputs of the record. A
+   * change outside the trees makes the run uncacheable.
+   * @param ignored paths the tracee does not share with the host, like mount
+   * targets and its own /tmp, or that hold no files, like /proc.
+   */
+  void readAccessLog(const string& logPath, const vector<string>& ignored);
+
+  /**
+   * A new empty file to capture output into.
+   * @return its path, fd is set to it opened for writing.
+   */
+  string captureFile(int& fd);
+
+  /**
+   * Record the run that just finished. stdoutPath and stderrPath hold what it
+   * printed, and are removed.
+   */
+  void record(
+      const string& key,
+      int exitCode,
+      const string& stdoutPath,
+      const string& stderrPath);
+
+private:
+  treeSnapshot snapshot(const string& root);
+
+  void walk(const string& root, const string& relative, treeSnapshot& tree);
+
+  /**
+   * What an input outside the trees holds, to tell whether it changed. Covers
+   * a symbolic link at path and what it points to.
+   * @return empty if it cannot be read.
+   */
+  string inputDigest(const string& path);
+
+  unique_ptr<actionCacheBackend> backend;
+  string localDir;
+  fileDigestIndex index;
+  vector<string> trees;
+  dev_t rootDevice = 0; /**< Device of the tree walk() is in. */
+  dev_t skipDevice = 0;
+  ino_t skipInode = 0;
+  bool complete = true;
+
+  /**
+   * The trees as computeKey() saw them, before the run.
+   */
+  vector<treeSnapshot> before;
+
+  /**
+   * Digests of the files the run read outside the trees, by path.
+   */
+  map<string, string> inputs;
+};
+
+/**
+ * Copy everything written to outPipe and errPipe to our stdout and stderr, and
+ * to outCopy and errCopy, until both pipes are closed.
+ */
+void teeOutput(int outPipe, int errPipe, int outCopy, int errCopy);
+
+#endif
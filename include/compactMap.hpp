@@ -0,0 +1,171 @@
+#ifndef COMPACT_MAP_H
+#define COMPACT_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Rough number of heap bytes held by an unordered container with the
+ * libstdc++ layout: one pointer per bucket, and per element a node with the
+ * value and a next pointer.
+ */
+template <typename Container>
+size_t approxHashBytes(const Container& c) {
+  return c.bucket_count() * sizeof(void*) +
+         c.size() * (sizeof(typename Container::value_type) + sizeof(void*));
+}
+
+/**
+ * Shrink an unordered container's bucket array once most of it is empty.
+ * Buckets are never given back on erase, so a set that once held many entries
+ * would otherwise keep that footprint forever.
+ */
+template <typename Container>
+void shrinkIfSparse(Container& c) {
+  if (c.bucket_count() > 64 && c.size() < c.bucket_count() / 8) {
+    c.rehash(0);
+  }
+}
+
+/**
+ * Map for long lived tables with many small entries, like inode numbers.
+ *
+ * Most entries live in a vector sorted by key, 16 bytes each for a pair of
+ * 64-bit integers instead of a hash node plus bucket. New keys go to a small
+ * hash map first and get merged into the vector once that map grows too big,
+ * so inserts stay cheap. Erased entries in the vector are only marked, and
+ * dropped at the next merge.
+ */
+template <typename Key, typename Value>
+class compactMap {
+private:
+  /** Bulk of the entries, sorted by key. */
+  vector<pair<Key, Value>> sorted;
+
+  /** Entries of sorted that were erased, same indices. */
+  vector<bool> erased;
+  size_t erasedCount = 0;
+
+  /** Entries whose keys are not in sorted. */
+  unordered_map<Key, Value> recent;
+
+  /** Merge once recent plus erased entries exceed this, or sorted / 8. */
+  static const size_t minRecent = 1024;
+
+  /**
+   * @return index of key in sorted, or sorted.size() if it isn't there.
+   */
+  size_t indexOf(const Key& key) const {
+    auto it = lower_bound(
+        sorted.begin(), sorted.end(), key,
+        [](const pair<Key, Value>& entry, const Key& k) {
+          return entry.first < k;
+        });
+    if (it == sorted.end() || it->first != key) {
+      return sorted.size();
+    }
+    return it - sorted.begin();
+  }
+
+  /**
+   * Move recent into sorted, dropping erased entries.
+   */
+  void merge() {
+    vector<pair<Key, Value>> merged;
+    merged.reserve(sorted.size() - erasedCount + recent.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+      if (!erased[i]) {
+        merged.push_back(sorted[i]);
+      }
+    }
+    size_t middle = merged.size();
+    merged.insert(merged.end(), recent.begin(), recent.end());
+    auto byKey = [](const pair<Key, Value>& a, const pair<Key, Value>& b) {
+      return a.first < b.first;
+    };
+    sort(merged.begin() + middle, merged.end(), byKey);
+    inplace_merge(
+        merged.begin(), merged.begin() + middle, merged.end(), byKey);
+
+    sorted.swap(merged);
+    erased.assign(sorted.size(), false);
+    erasedCount = 0;
+    // clear() would keep the buckets around.
+    unordered_map<Key, Value>().swap(recent);
+  }
+
+  void mergeIfNeeded() {
+    if (recent.size() + erasedCount > max(minRecent, sorted.size() / 8)) {
+      merge();
+    }
+  }
+
+public:
+  /**
+   * @return the value for key, or nullptr. Valid until the next change.
+   */
+  const Value* find(const Key& key) const {
+    size_t i = indexOf(key);
+    if (i != sorted.size()) {
+      return erased[i] ? nullptr : &sorted[i].second;
+    }
+    auto it = recent.find(key);
+    return it == recent.end() ? nullptr : &it->second;
+  }
+
+  size_t count(const Key& key) const { return find(key) != nullptr ? 1 : 0; }
+
+  /**
+   * Add key, or overwrite its value if it is already there.
+   */
+  void set(const Key& key, const Value& value) {
+    size_t i = indexOf(key);
+    if (i != sorted.size()) {
+      sorted[i].second = value;
+      if (erased[i]) {
+        erased[i] = false;
+        erasedCount--;
+      }
+      return;
+    }
+    recent[key] = value;
+    mergeIfNeeded();
+  }
+
+  /**
+   * @return number of entries removed (0 or 1).
+   */
+  size_t erase(const Key& key) {
+    size_t i = indexOf(key);
+    if (i != sorted.size()) {
+      if (erased[i]) {
+        return 0;
+      }
+      erased[i] = true;
+      erasedCount++;
+      mergeIfNeeded();
+      return 1;
+    }
+    return recent.erase(key);
+  }
+
+  size_t size() const { return sorted.size() - erasedCount + recent.size(); }
+
+  /**
+   * Rough number of heap bytes used, for statistics.
+   */
+  size_t memoryBytes() const {
+    return sorted.capacity() * sizeof(pair<Key, Value>) +
+           erased.capacity() / 8 + approxHashBytes(recent);
+  }
+};
+
+template <typename Key, typename Value>
+const size_t compactMap<Key, Value>::minRecent;
+
+#endif
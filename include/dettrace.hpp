@@ -1,10 +1,14 @@
 #ifndef DETTRACE_H
 #define DETTRACE_H
 
+#include <stdint.h>
 #include <time.h>
 
 extern "C" {
 
+// Default metrics_interval, in ptrace events.
+#define DETTRACE_METRICS_INTERVAL 10000
+
 struct SyscallState {
   bool noop;
 };
@@ -36,6 +40,61 @@ typedef long (*SysExit)(
     unsigned long arg4,
     unsigned long arg5);
 
+/**
+ * Snapshot of the tracer's counters, see TraceOptions::metrics. Fixed layout,
+ * only ever append new fields.
+ */
+struct TraceMetrics {
+  // Zero from the tracer. When the snapshot is copied into shared memory the
+  // writer bumps it to an odd value before updating the fields below, and to
+  // the next even value once done, so a reader can retry until it gets a
+  // consistent copy.
+  uint64_t sequence;
+
+  // ptrace events handled so far, of any kind.
+  uint64_t events;
+  uint64_t system_call_events;
+  uint64_t rdtsc_events;
+  uint64_t rdtscp_events;
+  uint64_t process_spawn_events;
+  uint64_t read_retry_events;
+  uint64_t write_retry_events;
+  uint64_t replays_due_to_blocking;
+  uint64_t total_replays;
+  uint64_t injected_system_calls;
+  uint64_t ptrace_peeks;
+  uint64_t process_vm_reads;
+  uint64_t process_vm_writes;
+
+  // Current shape of the process tree.
+  uint64_t live_processes;
+  uint64_t live_threads;
+  uint64_t blocked_processes;
+
+  // Logical time of the last tracee we handled, in microseconds since the
+  // Unix epoch.
+  int64_t logical_time_us;
+
+  // Tracer bookkeeping, to spot unbounded growth in long sessions. Byte counts
+  // are estimates.
+  uint64_t inodes_tracked;
+  uint64_t inodes_reclaimed;
+  uint64_t inode_map_bytes;
+  uint64_t mtime_map_bytes;
+  uint64_t dir_entries_bytes;
+  uint64_t thread_tracking_bytes;
+
+  // Set in the last snapshot, once every tracee has exited and the tracer is
+  // about to return the exit status. Stays zero when the tracer fails.
+  uint64_t finished;
+};
+
+typedef void (*MetricsCallback)(void* data, const struct TraceMetrics* m);
+
+// A tracee is about to read or write the file at path, see
+// TraceOptions::file_access.
+typedef void (*FileAccessCallback)(void* data, const char* path, bool write);
+
 /// Represents a mount. These parameters are passed directly to mount(2).
 typedef struct {
   const char* source;
@@ -118,6 +177,57 @@ typedef struct {
   bool use_color;
   bool print_statistics;
   const char* log_file;
+
+  // Callback to run every metrics_interval ptrace events, and once more when
+  // the tracee exits, with the current counters. Runs in the tracer process,
+  // so keep it cheap. Gets user_data as its first argument. If NULL, the
+  // callback is not executed.
+  MetricsCallback metrics;
+  // 0 means DETTRACE_METRICS_INTERVAL.
+  unsigned long metrics_interval;
+
+  // Deterministic limits, 0 means unlimited. Unlike timeout, these count
+  // logical events, so a runaway job is killed at the same point every run.
+  // Intercepted system call events (pre-hooks).
+  unsigned long max_syscall_events;
+  // Processes and threads spawned.
+  unsigned long max_processes;
+  // Logical time any tracee may reach, in microseconds past epoch.
+  unsigned long max_logical_time;
+  // Times a single system call may be replayed because it would block.
+  unsigned long max_blocked_replays;
+
+  // Number of CPUs the tracee sees through sched_getaffinity, CPUID,
+  // /proc/cpuinfo, /proc/stat and /sys/devices/system/cpu. 0 only virtualizes
+  // CPUID, as a single core, and leaves the rest to the host.
+  unsigned vcpus;
+
+  // Poll for ptrace stops for an adaptive window before blocking. Lowers the
+  // latency of each stop but keeps a core busy.
+  bool spin_wait;
+
+  // Serve clock_gettime, gettimeofday and time from the vdso without a stop,
+  // trapping on every 64th call only. Threads of a process, and CLONE_VM
+  // children that are not vforks, share its clock, so their times differ from
+  // a run without it. A vfork child's calls do not move its parent's clock.
+  bool time_shim;
+
+  // Derive virtual inodes from the path a file was first seen at, plus how
+  // often that path was recreated, rather than from the order of first sight.
+  bool path_inodes;
+
+  // Write every handler call, with the registers and tracee memory it used, to
+  // this file for offline replays, see handlerTrace.hpp. NULL records nothing.
+  const char* handler_trace;
+
+  // Called with file_access_data before every system call that looks up,
+  // reads or executes a path, or creates, removes, renames or changes the file
+  // at it. path is absolute, as the tracee sees it. Reported once per path
+  // and kind, whether or not the call goes on to succeed. Runs in the tracer
+  // process. If NULL, paths are not tracked and the system calls that are only
+  // intercepted for it are not.
+  FileAccessCallback file_access;
+  void* file_access_data;
 } TraceOptions;
 
 /**
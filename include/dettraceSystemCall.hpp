@@ -7,7 +7,9 @@
 #include "util.hpp"
 #include "utilSystemCalls.hpp"
 
+#include <fcntl.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <sys/syscall.h> /* For SYS_xxx definitions */
 
 using namespace std;
@@ -79,7 +81,7 @@ public:
  *
  * This is deterministic and jailed thanks to our jail. We keep it here to print
  it's
- * path for debugging!
+ * path for debugging, and to track the working directory in state::openFiles.
  *
  */
 class chdirSystemCall {
@@ -93,6 +95,22 @@ public:
   const string syscallName = "chdir";
 };
 // =======================================================================================
+/**
+ * int fchdir(int fd);
+ *
+ * Tracked like chdir, for the working directory in state::openFiles.
+ */
+class fchdirSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_fchdir;
+  const string syscallName = "fchdir";
+};
+// =======================================================================================
 /**
  * int chmod(const char *pathname, mode_t mode);
  *
@@ -207,6 +225,22 @@ public:
   const string syscallName = "dup2";
 };
 // =======================================================================================
+/**
+ * int dup3(int oldfd, int newfd, int flags);
+ *
+ * dup2 with flags, handled the same.
+ */
+class dup3SystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_dup3;
+  const string syscallName = "dup3";
+};
+// =======================================================================================
 class exit_groupSystemCall {
 public:
   static bool handleDetPre(
@@ -256,6 +290,23 @@ public:
   const string syscallName = "faccessat";
 };
 // =======================================================================================
+/**
+ * int fchmodat(int dirfd, const char *pathname, mode_t mode, int flags);
+ *
+ * Only intercepted when tracking paths for TraceOptions::file_access. See
+ * chmod.
+ */
+class fchmodatSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_fchmodat;
+  const string syscallName = "fchmodat";
+};
+// =======================================================================================
 
 /**
  * ssize_t fgetxattr(int fd, const char *name, static void *value, size_t size);
@@ -633,6 +684,80 @@ public:
   const string syscallName = "ioctl";
 };
 // =======================================================================================
+/**
+ * int io_uring_setup(u32 entries, struct io_uring_params *p);
+ *
+ * Sets up an io_uring instance. We map its rings into the tracer, see
+ * ioUring. Setups we cannot determinize, like SQPOLL, fail with EINVAL. On
+ * kernels without pidfd_getfd(2) io_uring is not available at all (ENOSYS),
+ * programs then fall back to plain system calls.
+ */
+class io_uring_setupSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_io_uring_setup;
+  const string syscallName = "io_uring_setup";
+};
+// =======================================================================================
+/**
+ * int io_uring_enter(unsigned int fd, unsigned int to_submit,
+ *                    unsigned int min_complete, unsigned int flags,
+ *                    sigset_t *sig);
+ *
+ * Submissions on local files run one at a time in submission order, and we
+ * wait for all of them before returning. Others complete with EINVAL.
+ */
+class io_uring_enterSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_io_uring_enter;
+  const string syscallName = "io_uring_enter";
+};
+// =======================================================================================
+/**
+ * int io_uring_register(unsigned int fd, unsigned int opcode, void *arg,
+ *                       unsigned int nr_args);
+ *
+ * Registering ring descriptors is not supported. Probes only report the
+ * operations io_uring_enter lets through.
+ */
+class io_uring_registerSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_io_uring_register;
+  const string syscallName = "io_uring_register";
+};
+// =======================================================================================
+/**
+ * int kill(pid_t pid, int sig);
+ *
+ * Send a signal to a process or process group. We only watch: the receivers
+ * get it in state::sharedPendingSignals if they block it, and are woken if
+ * parked waiting for one.
+ */
+class killSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_kill;
+  const string syscallName = "kill";
+};
+// =======================================================================================
 /*
  * ssize_t llistxattr(const char *path, char *list, size_t size);
  *
@@ -738,6 +863,23 @@ public:
   const string syscallName = "nanosleep";
 };
 // =======================================================================================
+/**
+ * int clock_nanosleep(clockid_t clockid, int flags,
+ *                     const struct timespec *request, struct timespec *remain);
+ *
+ * What glibc's nanosleep() and usleep() use. Handled like nanosleep.
+ */
+class clock_nanosleepSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_clock_nanosleep;
+  const string syscallName = "clock_nanosleep";
+};
+// =======================================================================================
 /**
  *
  * int mkdir(const char *pathname, mode_t mode);
@@ -1313,7 +1455,8 @@ public:
  * int rt_sigprocmask(int how, const sigset_t* set, const sigset_t* oldset,
  * size_t sigsetsize);
  *
- * change signal mask for calling thread.
+ * change signal mask for calling thread. We mirror the new mask in
+ * state::blockedSignals.
  */
 class rt_sigprocmaskSystemCall {
 public:
@@ -1344,10 +1487,12 @@ public:
 };
 // =======================================================================================
 /**
- * int sigaction(int signum, const struct sigaction *act, struct sigaction
- * *oldact);
+ * int rt_sigtimedwait(const sigset_t *set, siginfo_t *info,
+ * const struct timespec *timeout, size_t sigsetsize);
  *
- * Setup a signal handler. Currently only used for determinizing alarm()
+ * Wait for a signal in set. Run with a zero timeout: if nothing is pending we
+ * park until a signal is sent to us, then replay. A signal it consumes is
+ * removed from our pending set.
  */
 class rt_sigtimedwaitSystemCall {
 public:
@@ -1362,10 +1507,11 @@ public:
 
 // =======================================================================================
 /**
- * int sigaction(int signum, const struct sigaction *act, struct sigaction
- * *oldact);
+ * int rt_sigsuspend(const sigset_t *mask, size_t sigsetsize);
  *
- * Setup a signal handler. Currently only used for determinizing alarm()
+ * Never allowed to block. If our pending set (state::pendingSignals) has a
+ * signal mask lets through, we unblock it so it is delivered, otherwise we
+ * park until a signal is sent to us and replay.
  */
 class rt_sigsuspendSystemCall {
 public:
@@ -1378,6 +1524,23 @@ public:
   const string syscallName = "rt_sigsuspend";
 };
 // =======================================================================================
+/**
+ * int rt_sigreturn(void);
+ *
+ * Return from a signal handler. Restores the blocked mask saved on the signal
+ * frame, which we mirror in state::blockedSignals.
+ */
+class rt_sigreturnSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_rt_sigreturn;
+  const string syscallName = "rt_sigreturn";
+};
+// =======================================================================================
 /**
  * int sigaction(int signum, const struct sigaction *act, struct sigaction
  * *oldact);
@@ -1395,6 +1558,74 @@ public:
   const string syscallName = "rt_sigpending";
 };
 // =======================================================================================
+/**
+ * int signalfd(int fd, const sigset_t *mask, size_t sizemask);
+ *
+ * Always converted to a non-blocking signalfd4, like pipe to pipe2.
+ */
+class signalfdSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_signalfd;
+  const string syscallName = "signalfd";
+};
+// =======================================================================================
+/**
+ * int signalfd4(int fd, const sigset_t *mask, size_t sizemask, int flags);
+ *
+ * Create a file descriptor for reading signals. Made non-blocking so a read
+ * waits in our scheduler, and reads dequeue what they return from our pending
+ * set, see readSystemCall.
+ */
+class signalfd4SystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_signalfd4;
+  const string syscallName = "signalfd4";
+};
+// =======================================================================================
+/**
+ * int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
+ *
+ * Only intercepted with --vcpus. We answer it ourselves, as if the machine had
+ * exactly that many CPUs and every tracee could run on all of them.
+ */
+class sched_getaffinitySystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sched_getaffinity;
+  const string syscallName = "sched_getaffinity";
+};
+// =======================================================================================
+/**
+ * int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask);
+ *
+ * Only intercepted with --vcpus. Virtual CPUs need not exist on the host and we
+ * run one tracee at a time anyways, so pinning is accepted and ignored.
+ */
+class sched_setaffinitySystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sched_setaffinity;
+  const string syscallName = "sched_setaffinity";
+};
+// =======================================================================================
 /**
  * int stat(const char *pathname, struct stat *statbuf);
  *
@@ -1545,6 +1776,22 @@ public:
   const string syscallName = "tgkill";
 };
 // =======================================================================================
+/**
+ * int tkill(int tid, int sig);
+ *
+ * Obsolete tgkill without the thread group. Tracked the same way.
+ */
+class tkillSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_tkill;
+  const string syscallName = "tkill";
+};
+// =======================================================================================
 /**
  * time_t time(time_t *tloc);
  *
@@ -2001,6 +2248,71 @@ public:
   const string syscallName = "writev";
 };
 // =======================================================================================
+/**
+ * ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset);
+ *
+ * Only intercepted so the first write after open updates the file's logical
+ * mtime. Short writes are not retried.
+ */
+class pwrite64SystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_pwrite64;
+  const string syscallName = "pwrite64";
+};
+// =======================================================================================
+/**
+ * ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ *
+ * Same as pwrite64.
+ */
+class pwritevSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_pwritev;
+  const string syscallName = "pwritev";
+};
+// =======================================================================================
+/**
+ * int ftruncate(int fd, off_t length);
+ *
+ * Modifies the file, which gets a new logical mtime.
+ */
+class ftruncateSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_ftruncate;
+  const string syscallName = "ftruncate";
+};
+// =======================================================================================
+/**
+ * int truncate(const char *path, off_t length);
+ *
+ * Modifies the file, which gets a new logical mtime.
+ */
+class truncateSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_truncate;
+  const string syscallName = "truncate";
+};
+// =======================================================================================
 /**
  * ssize_t write(int fd, const void *buf, size_t count);
  *
@@ -2025,6 +2337,61 @@ public:
   const string syscallName = "write";
 };
 
+// =======================================================================================
+/**
+ * ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
+ *
+ * Copies data between two file descriptors inside the kernel. Like write, it
+ * may transfer fewer than count bytes depending on timing, so we replay it
+ * until everything was copied, EOF, or an error. The tracee sees one call.
+ */
+class sendfileSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_sendfile;
+  const string syscallName = "sendfile";
+};
+// =======================================================================================
+/**
+ * ssize_t copy_file_range(int fd_in, loff_t* off_in, int fd_out,
+ *                         loff_t* off_out, size_t len, unsigned int flags);
+ *
+ * In-kernel copy between two files. Short copies are retried like sendfile.
+ */
+class copy_file_rangeSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_copy_file_range;
+  const string syscallName = "copy_file_range";
+};
+// =======================================================================================
+/**
+ * ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out,
+ *                size_t len, unsigned int flags);
+ *
+ * Moves data between a pipe and another file descriptor. Our pipes are really
+ * non-blocking, so a splice on a pipe the tracee thinks is blocking is replayed
+ * until it completes, like read and write.
+ */
+class spliceSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_splice;
+  const string syscallName = "splice";
+};
+
 // =======================================================================================
 /**
  * int socket(int domain, int type, int protocol);
@@ -2045,6 +2412,26 @@ public:
   const string syscallName = "socket";
 };
 
+// =======================================================================================
+/**
+ * int socketpair(int domain, int type, int protocol, int sv[2]);
+ *
+ * socketpair() creates an unnamed pair of connected sockets in the specified
+ * domain, of the specified type, and using the optionally specified protocol.
+ *
+ * Only AF_UNIX is supported by Linux. Both ends are tracked like a pipe.
+ */
+class socketpairSystemCall {
+public:
+  static bool handleDetPre(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+  static void handleDetPost(
+      globalState& gs, state& s, ptracer& t, scheduler& sched);
+
+  const int syscallNumber = SYS_socketpair;
+  const string syscallName = "socketpair";
+};
+
 // =======================================================================================
 /**
  * int listen(int sockfd, int backlog)
@@ -2113,10 +2500,14 @@ public:
 // =======================================================================================
 // Iterate through our vector of entries, which represent the binary memory for
 // linux_dirents or linux_dirent64. We virtualize the inodes and add entries to
-// our inodeMap.
+// our inodeMap. dirPath is the directory's path for --path-inodes, see
+// inodePathFor(), and dirFd our descriptor for it, if any.
 template <typename DirEntry>
 void virtualizeEntries(
-    vector<uint8_t>& entries, ValueMapper<ino_t, ino_t>& inodeMap) {
+    vector<uint8_t>& entries,
+    inodeMapper& inodeMap,
+    const string& dirPath = "",
+    int dirFd = -1) {
   // Variable size data, we cannot "iterate" over the entries in the array.
   uint8_t* position = entries.data();
 
@@ -2129,11 +2520,29 @@ void virtualizeEntries(
     // be using it.
     currentEntry->d_off = 0;
 
-    // Virtualize our inode.
+    // Virtualize our inode. At a mount point d_ino is the covered directory
+    // while stat reports the mounted one. Paths map to a single inode, so go by
+    // stat, or the path would look recreated depending on which came first.
     ino64_t inode = currentEntry->d_ino;
-    currentEntry->d_ino = !inodeMap.realValueExists(inode)
-                              ? inodeMap.addRealValue(inode)
-                              : inodeMap.getVirtualValue(inode);
+    struct stat st;
+    if (dirFd >= 0 &&
+        fstatat(dirFd, currentEntry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+      inode = st.st_ino;
+    }
+    if (inodeMap.realValueExists(inode)) {
+      currentEntry->d_ino = inodeMap.getVirtualValue(inode);
+    } else if (dirPath.empty()) {
+      currentEntry->d_ino = inodeMap.addRealValue(inode);
+    } else {
+      string name = currentEntry->d_name;
+      string path = dirPath;
+      if (name == "..") {
+        path = path.substr(0, max<size_t>(path.rfind('/'), 1));
+      } else if (name != ".") {
+        path += (path == "/" ? "" : "/") + name;
+      }
+      currentEntry->d_ino = inodeMap.addRealValue(inode, path);
+    }
 
     // Next entry...
     position += entrySize;
@@ -2158,9 +2567,10 @@ void handleDents(globalState& gs, state& s, ptracer& t, scheduler& sched) {
     auto msg = "Tracee requested getdents for the first time for fd: %d.\n";
     gs.log.writeToLog(Importance::info, msg, fd);
 
-    s.dirEntries.emplace(
-        fd, directoryEntries<linux_dirent>{s.dirEntriesBytes, gs.log});
+    s.dirEntries.emplace(fd, directoryEntries<linux_dirent>{gs.log});
   }
+  auto& entries = s.dirEntries.at(fd);
+  size_t bytesBefore = entries.memoryBytes();
 
   // We have read zero bytes. We're done!
   if (t.getReturnValue() == 0) {
@@ -2171,9 +2581,19 @@ void handleDents(globalState& gs, state& s, ptracer& t, scheduler& sched) {
     // We want to fill up to traceeBufferSize which is the size the tracee
     // originally asked for.
 
-    vector<uint8_t> filledVector =
-        s.dirEntries.at(fd).getSortedEntries(traceeBufferSize);
-    virtualizeEntries<T>(filledVector, gs.inodeMap);
+    vector<uint8_t> filledVector = entries.getSortedEntries(traceeBufferSize);
+    gs.dirEntriesResized(bytesBefore, entries.memoryBytes());
+    string dirPath = inodePathFor(gs, s.traceePid, fd);
+    int dirFd = -1;
+    if (!dirPath.empty()) {
+      string procPath =
+          "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(fd);
+      dirFd = open(procPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    virtualizeEntries<T>(filledVector, gs.inodeMap, dirPath, dirFd);
+    if (dirFd >= 0) {
+      close(dirFd);
+    }
 
     gs.log.writeToLog(
         Importance::info, "Returning %d bytes!\n", filledVector.size());
@@ -2205,7 +2625,8 @@ void handleDents(globalState& gs, state& s, ptracer& t, scheduler& sched) {
     vector<uint8_t> newChunk{localBuffer, localBuffer + bytesToCopy};
 
     // Copy chunks over to our directory entry for this file descriptor.
-    s.dirEntries.at(fd).addChunk(newChunk);
+    entries.addChunk(newChunk);
+    gs.dirEntriesResized(bytesBefore, entries.memoryBytes());
 
     gs.log.writeToLog(
         Importance::info, "Replaying system call to read more bytes...\n");
@@ -50,14 +50,11 @@ public:
 
   /**
    * Constructor.
-   * Dynamically allocate enough memory to hold all directory entries by the
-   * user.
-   * @param bytes total bytes
+   * Memory for the entries is allocated as chunks come in, most directories
+   * are small.
    * @param log log file handler
    */
-  directoryEntries(size_t bytes, logger& log) : log(log) {
-    rawEntries.reserve(bytes);
-  }
+  explicit directoryEntries(logger& log) : log(log) {}
 
   /**
    * Add a chunk of count size to our internal buffer.
@@ -106,14 +103,31 @@ public:
        */
       entries.pop_front();
 
-      /** Copy over entry based on address and size of struct. */
-      toFill.insert(
-          toFill.end(), get<1>(tupleEntry), get<1>(tupleEntry) + entrySize);
+      /** Copy over entry based on offset and size of struct. */
+      const uint8_t* entry = rawEntries.data() + get<1>(tupleEntry);
+      toFill.insert(toFill.end(), entry, entry + entrySize);
+    }
+
+    /** Everything was handed out, only end of directory is left. */
+    if (entries.empty()) {
+      vector<uint8_t>().swap(rawEntries);
+      deque<tuple<string, size_t, size_t>>().swap(entries);
     }
 
     return toFill;
   }
 
+  /**
+   * @return rough number of heap bytes used, for statistics.
+   */
+  size_t memoryBytes() const {
+    size_t bytes = rawEntries.capacity();
+    for (const auto& entry : entries) {
+      bytes += sizeof(entry) + get<0>(entry).capacity();
+    }
+    return bytes;
+  }
+
 private:
   /**
    * This vector represents contigious linux_dirent entries as a raw array of
@@ -141,7 +155,8 @@ private:
       size_t entrySize = currentEntry->d_reclen;
 
       entries.push_back(make_tuple(
-          string{currentEntry->d_name}, (uint8_t*)currentEntry, entrySize));
+          string{currentEntry->d_name},
+          (size_t)(position - rawEntries.data()), entrySize));
       position += entrySize;
     }
 
@@ -152,11 +167,12 @@ private:
   }
 
   /**
-   * Turn our entries into a vector of (name, address, byteSize) for easy
-   * sorting. Each address is it's location on our array this way, we can "sort"
-   * the variable sized structs by their filename.
+   * Turn our entries into a vector of (name, offset, byteSize) for easy
+   * sorting. Each offset is it's location on our array this way, we can "sort"
+   * the variable sized structs by their filename. Offsets rather than pointers,
+   * so a copy (on fork) stays valid on its own.
    */
-  deque<tuple<string, uint8_t*, size_t>> entries;
+  deque<tuple<string, size_t, size_t>> entries;
 };
 
 #endif
@@ -4,22 +4,50 @@
 #include "ValueMapper.hpp"
 #include "dettrace.hpp"
 #include "dettraceSystemCall.hpp"
+#include "flightRecorder.hpp"
 #include "globalState.hpp"
+#include "handlerTrace.hpp"
 #include "logger.hpp"
 #include "logicalclock.hpp"
 #include "ptracer.hpp"
 #include "scheduler.hpp"
+#include "stopWaiter.hpp"
 #include "state.hpp"
+#include "stateTable.hpp"
+#include "syscallBatch.hpp"
 #include "systemCallList.hpp"
 #include "util.hpp"
 #include "vdso.hpp"
 
+#include <csignal>
 #include <map>
 #include <stack>
+#include <unordered_set>
 
 #define ARCH_GET_CPUID 0x1011
 #define ARCH_SET_CPUID 0x1012
 
+/**
+ * Deterministic resource limits, see TraceOptions. 0 means unlimited.
+ */
+struct traceLimits {
+  uint64_t maxSystemCallEvents = 0;
+  uint64_t maxProcesses = 0;
+  logical_clock::duration maxLogicalTime = logical_clock::duration::zero();
+  uint64_t maxBlockedReplays = 0;
+};
+
+/**
+ * What the tracer's long lived tables currently hold, see memoryUsage().
+ */
+struct tracerMemory {
+  uint64_t inodesTracked = 0;
+  uint64_t inodeMapBytes = 0;
+  uint64_t mtimeMapBytes = 0;
+  uint64_t dirEntriesBytes = 0;
+  uint64_t threadTrackingBytes = 0;
+};
+
 /**
  * Execution class.
  * This class handles the event driven loop that is a process execution. Events
@@ -80,11 +108,9 @@ private:
    * System call state map.
    * State represents all state we wish to maintain between subsequent system
    * calls, e.g. logical time, etc. Since we may have multiple processes and
-   * threads, we hold a state per pid.
-   * TODO: do different threads have the same pid but different tid? I think so,
-   * tid might be a better choice for keys.
+   * threads, we hold a state per pid (for threads, this is the tid).
    */
-  map<pid_t, state> states;
+  stateTable<state> states;
 
   /**
    * Global inode mapper.
@@ -146,9 +172,84 @@ private:
    */
   uint32_t processSpawnEvents = 0;
 
+  /**
+   * Number of new tracees, counted once per fork event unlike
+   * processSpawnEvents. Checked against limits.maxProcesses.
+   */
+  uint64_t traceesSpawned = 0;
+
+  /**
+   * Recent events, dumped if we die on an error or timeout.
+   */
+  flightRecorder recorder;
+
+  /**
+   * Writes every handler call to a file, see --record-handlers. Null unless
+   * asked for.
+   */
+  unique_ptr<handlerRecorder> handlerTrace;
+
+  /**
+   * Record a system call event with the arguments currently in tracer.
+   */
+  flightRecord& recordSystemCall(
+      flightEvent event, pid_t traceesPid, int syscallNum);
+
+  /**
+   * What the handler just did with the current system call, as flightDecision
+   * bits.
+   * @param replaysBefore value of globalState::totalReplays before the handler
+   */
+  uint8_t systemCallDecision(const state& currState, uint32_t replaysBefore);
+
   std::vector<VDSOSymbol> vdsoFuncs;
 
-  void disableVdso(pid_t traceesPid);
+  /**
+   * Replacement bytes for the vdso functions, computed once by planVdsoPatch
+   * and written at vdsoPatchOffset into every new [vdso].
+   */
+  std::vector<unsigned char> vdsoPatch;
+  unsigned long vdsoPatchOffset = 0;
+
+  /**
+   * Serve time calls from a shim in the tracee, see --time-shim.
+   */
+  bool useTimeShim;
+
+  /**
+   * Stubs in vdsoPatch jumping into the time shim: where each one starts in
+   * vdsoPatch and the offset of its target in the shim. Their addresses are
+   * filled in for every exec.
+   */
+  std::vector<std::pair<unsigned long, unsigned long>> timeShimStubs;
+
+  /**
+   * [vvar] starts vvarDistance bytes below [vdso]. vvarSize is 0 if there is
+   * no [vvar].
+   */
+  unsigned long vvarDistance = 0;
+  unsigned long vvarSize = 0;
+
+  /**
+   * Work out vdsoPatch and the [vvar] layout from our own address space.
+   */
+  void planVdsoPatch();
+
+  /**
+   * Queue an mprotect hiding [vvar].
+   * @param vdsoBase start of the tracee's [vdso], 0 if it has none.
+   * @return index of the mprotect in setup, or -1 if there was nothing to hide.
+   */
+  long hideVvar(unsigned long vdsoBase, syscallBatch& setup);
+
+  /**
+   * Patch the vdso functions.
+   * @param memFd the tracee's /proc/<pid>/mem
+   * @param vdsoBase start of the tracee's [vdso], 0 if it has none.
+   * @param timeShim address of the tracee's time shim, 0 if the vdso functions
+   * make the system calls themselves.
+   */
+  void disableVdso(int memFd, unsigned long vdsoBase, uint64_t timeShim);
 
   /**
    * starting epoch
@@ -164,6 +265,98 @@ private:
   SysExit sys_exit_hook = nullptr;
   void* user_data;
 
+  MetricsCallback metrics_hook = nullptr;
+  unsigned long metrics_interval;
+
+  FileAccessCallback fileAccessHook = nullptr;
+  void* fileAccessData;
+
+  /**
+   * Paths already handed to fileAccessHook, for reading and for writing.
+   */
+  unordered_set<string> reportedReads;
+  unordered_set<string> reportedWrites;
+
+  /**
+   * Hand the paths the system call currentState's tracee is stopped at looks
+   * up or changes to fileAccessHook, before any handler rewrites its arguments.
+   */
+  void reportFileAccesses(state& currState, int syscallNum);
+
+  traceLimits limits;
+
+  /**
+   * Waits for ptrace stops in getNextEvent(), see --spin-wait.
+   */
+  stopWaiter stops;
+
+  /**
+   * A deterministic limit was hit: kill every tracee and fail with a message
+   * naming the limit and the event we stopped at.
+   */
+  void limitExceeded(const string& what, uint64_t limit);
+
+  /**
+   * Number of ptrace events handled, drives metrics_hook.
+   */
+  uint64_t events = 0;
+
+  /**
+   * Of those, events handled by runAlone().
+   */
+  uint64_t aloneEvents = 0;
+
+  /**
+   * Count an event of currState's tracee, check the limits on it and publish
+   * metrics when due.
+   */
+  void countEvent(state& currState);
+
+  /**
+   * Check --max-blocked-replays after a handler ran, and start over once the
+   * system call went through.
+   * @param completed the system call ran without a replay
+   */
+  void checkBlockedReplays(
+      state& currState, const string& syscallName, bool completed);
+
+  /**
+   * Handle a seccomp stop or a post system call stop, the events a tracee
+   * spends most of its time in.
+   * @return false if ret is some other event, which is left to the caller.
+   */
+  bool handleSystemCallEvent(
+      state& currState, ptraceEvent ret, pid_t traceesPid);
+
+  /**
+   * Lean event loop for when the scheduler has a single tracee left, the
+   * common case for tools that never fork: there is nobody to schedule, so
+   * system call events are handled back to back on currState without asking
+   * the scheduler or looking the state up again.
+   * @return true with the first other event in ret, traceesPid and status,
+   * e.g. a fork, exec, signal or exit, for runProgram() to handle. false if
+   * a handler left another tracee to run next.
+   */
+  bool runAlone(
+      state& currState, ptraceEvent& ret, pid_t& traceesPid, int& status);
+
+  /**
+   * Logical time of the tracee we last handled an event for.
+   */
+  logical_clock::time_point lastLogicalTime;
+
+  /**
+   * Fill in a TraceMetrics snapshot and hand it to metrics_hook.
+   * @param finished whether this is the snapshot of a completed run.
+   */
+  void publishMetrics(bool finished = false);
+
+  /**
+   * Size of the per inode, per directory and per thread tables. Byte counts
+   * are estimates.
+   */
+  tracerMemory memoryUsage();
+
 public:
   /**
    * Constructor.
@@ -188,7 +381,17 @@ public:
       logical_clock::duration clock_step,
       SysEnter sys_enter_hook,
       SysExit sys_exit_hook,
-      void* user_data);
+      void* user_data,
+      MetricsCallback metrics_hook = nullptr,
+      unsigned long metrics_interval = 0,
+      traceLimits limits = traceLimits{},
+      unsigned vcpus = 0,
+      bool spinWait = false,
+      bool timeShim = false,
+      bool pathInodes = false,
+      string handlerTracePath = "",
+      FileAccessCallback fileAccessHook = nullptr,
+      void* fileAccessData = nullptr);
 
   /**
    * Handles exit from current process.
@@ -235,17 +438,35 @@ public:
   /**
    * Handle the fork event part of @handleFork. Pushes parent to our process
    * hierarchy and creates state for child.
+   * @param parentState State of the forking pid
    * @param traceesPid the pid of the tracee
+   * @param isVfork the child shares our memory while we wait for it
    * @see handleFork.
    */
-  pid_t handleForkEvent(const pid_t traceesPid, bool isThread);
+  pid_t handleForkEvent(
+      state& parentState, const pid_t traceesPid, bool isThread, bool isVfork);
+
+  /**
+   * Record which pid a new tracee has in its pid namespace, see
+   * globalState::hostPids.
+   */
+  void trackVpid(state& s);
+
+  /**
+   * A vfork child is done with its parent's time shim (it exec'd or is
+   * exiting): give the parent its clock back, so the child's time calls do not
+   * show up in the parent.
+   * @param child State of the vfork child
+   */
+  void returnTimeShim(state& child);
 
   /**
    * Handle signal event in trace.
+   * @param currState State of current pid
    * @param signum signal number
    * @param traceesPid the pid of the tracee
    */
-  void handleSignal(int signum, const pid_t traceesPid);
+  void handleSignal(state& currState, int signum, const pid_t traceesPid);
 
   /**
    * Handle the signal part of @handleFork.
@@ -258,11 +479,12 @@ public:
    * Handle seccomp event.
    * This happens everytime we intercept a system call before the system call is
    * called.
+   * @param currState State of current pid
    * @param traceesPid the pid of the tracee
    * @return Return value dictates whether the postHook should be called as
    * well.
    */
-  bool handleSeccomp(const pid_t traceesPid);
+  bool handleSeccomp(state& currState, const pid_t traceesPid);
 
   /**
    * Handle seccomp event.
@@ -274,18 +496,19 @@ public:
 
   /**
    * Call system call handler based on system call number, if number is not a
-   * system call an runtime_error will be thrown.
+   * system call an runtime_error will be thrown. Only touches its arguments,
+   * so replays can call it without an execution.
    * @param syscallNumber
    * @param syscallName
    */
-  bool callPreHook(
+  static bool callPreHook(
       int syscallNumber,
       globalState& gs,
       state& s,
       ptracer& t,
       scheduler& sched);
 
-  void callPostHook(
+  static void callPostHook(
       int syscallNumber,
       globalState& gs,
       state& s,
@@ -296,6 +519,7 @@ public:
    * Catch next event from any process that we are tracing. Return the event
    * type as well as the pid for the process that created this event, also set
    * the status.
+   * @param currState: state of currentPid.
    * @param currentPid: the pid of the previously intercepted process. If this
    * is the first time calling, it is the original process to trace.
    * @param ptraceSyscall continue with a PTRACE_SYSCALL as the action, if
@@ -304,7 +528,7 @@ public:
    * process we just intercepted, and status retured by waitpid.
    */
   tuple<ptraceEvent, pid_t, int> getNextEvent(
-      pid_t currentPid, bool ptraceSystemCall);
+      state& currState, pid_t currentPid, bool ptraceSystemCall);
 
   /**
    * Gets PtraceEvent type.
@@ -324,6 +548,35 @@ public:
   pair<bool, ptraceEvent> loopOnWaitpid(pid_t currentPid);
 
   void killAllProcesses() { myScheduler.killAllProcesses(); }
+
+  /**
+   * Set by the SIGALRM handler for --timeoutSeconds, which can do nothing
+   * else safely. runProgram() checks it between events, a waitpid() it
+   * interrupts fails with EINTR.
+   */
+  static volatile sig_atomic_t timeoutExpired;
+
+  /**
+   * Dump the flight recorder to stderr. Only the first call prints anything.
+   */
+  void dumpFlightRecorder() { recorder.dump(stderr); }
+
+  /**
+   * Write out the handler calls recorded so far, for when we die on an error
+   * or a timeout.
+   */
+  void flushHandlerTrace() {
+    if (handlerTrace) {
+      handlerTrace->flush();
+    }
+  }
 };
 
+/**
+ * Inject arch_prctl(ARCH_SET_CPUID) in place of the current system call, so
+ * CPUID instructions trap. The arch_prctl post-hook restores the original
+ * call.
+ */
+void trapCPUID(globalState& gs, state& s, ptracer& t);
+
 #endif
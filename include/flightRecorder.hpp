@@ -0,0 +1,92 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * Kind of event stored in a flightRecord.
+ */
+enum class flightEvent : uint8_t {
+  preHook, /*< seccomp stop, pre-hook ran. number is the system call. */
+  postHook, /*< system call exit stop, post-hook ran. */
+  signal, /*< signal-delivery-stop. number is the signal. */
+  spawn, /*< fork, vfork or clone event. number is the new pid. */
+  exec, /*< execve event. */
+  exit, /*< tracee exited or was killed. number is the waitpid status. */
+};
+
+/**
+ * Bits for flightRecord::decision, what the handler did with the event.
+ */
+enum flightDecision : uint8_t {
+  FLIGHT_POST_HOOK = 1 << 0, /*< pre-hook asked for the post-hook */
+  FLIGHT_REPLAY = 1 << 1, /*< handler rewound the system call */
+  FLIGHT_INJECTED = 1 << 2, /*< handler injected a system call */
+  FLIGHT_NOOP = 1 << 3, /*< handler turned the system call into a noop */
+  FLIGHT_SUPPRESSED = 1 << 4, /*< signal was emulated, not delivered */
+};
+
+/**
+ * One event, stored as-is. No formatting happens until we dump.
+ */
+struct flightRecord {
+  uint64_t seq; /**< Event number, counting from 1. */
+  uint64_t args[6]; /**< System call arguments, if any. */
+  int64_t retval; /**< System call return value, for post-hooks. */
+  pid_t pid; /**< Tracee the event came from. */
+  pid_t nextPid; /**< Tracee the scheduler picked to run next. */
+  int32_t number; /**< Meaning depends on event, see flightEvent. */
+  flightEvent event;
+  uint8_t decision; /**< flightDecision bits. */
+};
+
+/**
+ * Always-on, fixed size ring buffer of the most recent events seen by the
+ * tracer. Recording is a handful of stores, so this stays enabled at debug
+ * level 0. When dettrace dies on a runtime error or a timeout we dump it, which
+ * gives some context without rerunning at a high debug level.
+ */
+class flightRecorder {
+private:
+  vector<flightRecord> ring;
+  uint64_t recorded = 0;
+  bool dumped = false;
+
+public:
+  /**
+   * @param capacity number of events to keep, older ones are overwritten.
+   */
+  explicit flightRecorder(size_t capacity = 4096);
+
+  /**
+   * Claim the next slot in the ring. The caller fills in the fields it knows
+   * about, everything else is zeroed.
+   * @param event kind of event
+   * @param pid tracee the event came from
+   * @return slot to fill in, valid until the next call.
+   */
+  flightRecord& record(flightEvent event, pid_t pid) {
+    flightRecord& r = ring[recorded % ring.size()];
+    r = flightRecord{};
+    r.seq = ++recorded;
+    r.event = event;
+    r.pid = pid;
+    return r;
+  }
+
+  /**
+   * Write the recorded events, oldest first, in readable form. Only the first
+   * call does anything, so both the timeout handler and the exception path can
+   * call this.
+   * @param out stream to write to
+   */
+  void dump(FILE* out);
+};
+
+#endif
@@ -1,12 +1,16 @@
 #ifndef GLOBAL_STATE_H
 #define GLOBAL_STATE_H
 
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "PRNG.hpp"
-#include "ValueMapper.hpp"
+#include "inodeMapper.hpp"
 #include "logicalclock.hpp"
+#include "stateTable.hpp"
+
+class state;
 
 /**
  * Mapping of inodes to modification times. When we observe the creation of an
@@ -14,7 +18,7 @@
  * of modification times for files in order to present a consistent view of
  * time.
  */
-using ModTimeMap = std::unordered_map<ino_t, logical_clock::time_point>;
+using ModTimeMap = compactMap<ino_t, logical_clock::time_point>;
 
 /**
  * Class to hold global state shared among all processes, this includes the
@@ -27,15 +31,17 @@ public:
    * @param log global program log
    * @param inodeMap map of inodes and virtual nodes
    * @param mtimeMap map of inode to modification times
+   * @param vcpus number of virtual CPUs, 0 if not virtualized
    */
   globalState(
       logger& log,
-      ValueMapper<ino_t, ino_t> inodeMap,
+      inodeMapper inodeMap,
       ModTimeMap mtimeMap,
       bool kernelPre4_12,
       unsigned prngSeed,
       logical_clock::time_point epoch,
-      bool allow_network = false);
+      bool allow_network = false,
+      unsigned vcpus = 0);
 
   /**
    * Reference to our global program logger.
@@ -45,7 +51,7 @@ public:
   /**
    * Isomorphism between inodes and virtual inodes.
    */
-  ValueMapper<ino_t, ino_t> inodeMap;
+  inodeMapper inodeMap;
 
   /**
    * Tracker of modification times.
@@ -69,6 +75,43 @@ public:
    */
   logical_clock::time_point epoch;
 
+  /**
+   * The newest modification time handed out so far, see setMtime().
+   */
+  logical_clock::time_point latestMtime;
+
+  /**
+   * Record a new modification time for inode. A created file gets the clock of
+   * the process creating it, but never less than latestMtime, so files keep the
+   * order they were touched in even across processes with different clocks.
+   * A modification (write, truncate, rename-over) moves one clock step past
+   * latestMtime, so make and ninja see the modified file as strictly newer
+   * than everything touched before it without running far ahead of the clock.
+   * @param inode real inode of the file
+   * @param s the process touching the file, for its clock and clock step
+   * @param modified true for a modification, false for a creation
+   */
+  void setMtime(ino_t inode, const state& s, bool modified);
+
+  /**
+   * Drop everything we remember about an inode whose last link is gone. The
+   * kernel may hand the inode out again, and the new file would be recorded as
+   * created anyways, so the old entries are dead weight.
+   * @param inode real inode of the deleted file
+   */
+  void forgetInode(ino_t inode);
+
+  /**
+   * Account for a tracee's dirEntries going from before to after bytes, see
+   * dirEntriesBytes.
+   */
+  void dirEntriesResized(size_t before, size_t after);
+
+  /**
+   * Rough number of heap bytes used by the thread tracking containers below.
+   */
+  size_t threadTrackingBytes() const;
+
   // Kept here as they're ticked up in the function hooks.
   /**
    * Counter for keeping track of total number of read retries.
@@ -99,6 +142,11 @@ public:
    */
   uint32_t timeCalls = 0;
 
+  /**
+   * Time calls the time shim served in the tracee, without a stop.
+   */
+  uint32_t timeShimCalls = 0;
+
   /**
    * Counter for keeping track of number of replays due to blocking events.
    */
@@ -115,11 +163,40 @@ public:
    */
   uint32_t injectedSystemCalls = 0;
 
+  /**
+   * Counter for io_uring submissions, each costing no stop of its own.
+   */
+  uint32_t ioUringOperations = 0;
+
+  /**
+   * Counter for inodes dropped by forgetInode().
+   */
+  uint32_t reclaimedInodes = 0;
+
+  /**
+   * Bytes of getdents results buffered over all tracees, and the most seen at
+   * once.
+   */
+  uint64_t dirEntriesBytes = 0;
+  uint64_t peakDirEntriesBytes = 0;
+
+  /**
+   * How many state::openFiles entries name each (device, real inode), over
+   * all fd tables. A deleted file keeps its entries while it is in here.
+   */
+  map<pair<dev_t, ino_t>, uint32_t> openInodes;
+
   /**
    * Keeps track of live threads in our program.
    */
   unordered_set<pid_t> liveThreads;
 
+  /**
+   * The tracer's per-tracee states, for handlers that affect another tracee
+   * (e.g. tgkill to a sibling thread). Null outside a live execution.
+   */
+  stateTable<state>* states = nullptr;
+
   /**
    * Keeps track of thread groups, each thread groups is composed of the threads
    * and the single parent process that belongs to that thread group. The
@@ -144,11 +221,37 @@ public:
    */
   unordered_map<pid_t, pid_t> threadGroupNumber;
 
+  /**
+   * Our pid for each tracee, by the pid it has in its pid namespace. For
+   * system calls that take pids, like kill.
+   */
+  unordered_map<pid_t, pid_t> hostPids;
+
+  /**
+   * What we tracked about a descriptor sent with SCM_RIGHTS, see
+   * sendmsgSystemCall. The receiving process gets the same entries.
+   */
+  struct passedDescriptor {
+    bool nonBlocking; /**< User asked for non-blocking I/O. */
+    int socketType; /**< Type of Unix socket, -1 for pipes. */
+  };
+
+  /**
+   * Descriptors in flight over Unix sockets, by real inode.
+   */
+  unordered_map<ino_t, passedDescriptor> passedFds;
+
   /**
    * Allow non-deterministic socket/networking
    */
   bool allow_network;
 
+  /**
+   * Number of CPUs the tracees see, from --vcpus. 0 means we don't virtualize
+   * the CPU count, CPUID still reports a single core.
+   */
+  unsigned vcpus;
+
   /**
    * allow trap CPUID. this can be set to false
    * when arch_prctl(SET_CPUID) returned error
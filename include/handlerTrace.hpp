@@ -0,0 +1,227 @@
+#ifndef HANDLER_TRACE_H
+#define HANDLER_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logicalclock.hpp"
+#include "traceeBackend.hpp"
+
+using namespace std;
+
+class state;
+
+/**
+ * A range of tracee memory and its contents.
+ */
+struct memoryRegion {
+  uint64_t address;
+  vector<uint8_t> bytes;
+
+  bool operator==(const memoryRegion& other) const {
+    return address == other.address && bytes == other.bytes;
+  }
+};
+
+/**
+ * Sparse copy of tracee memory: what we know of it, merged into disjoint
+ * regions. Adjacent stores end up in one region, so memory reads the same
+ * however it was put together.
+ */
+class memoryImage {
+public:
+  /**
+   * Store bytes at address, over whatever we had there.
+   */
+  void store(uint64_t address, const void* bytes, size_t size);
+
+  /**
+   * Copy the known bytes from address on, up to size of them.
+   * @return bytes copied, 0 if we know nothing at address.
+   */
+  size_t load(uint64_t address, void* bytes, size_t size) const;
+
+  vector<memoryRegion> regions() const;
+
+  void clear() { memory.clear(); }
+
+private:
+  /** Contents by start address, disjoint and never adjacent. */
+  map<uint64_t, vector<uint8_t>> memory;
+};
+
+/**
+ * Settings of the traced run the handlers depend on, so a replay starts from
+ * the same global state.
+ */
+struct handlerTraceHeader {
+  int64_t epoch; /**< Microseconds since the Unix epoch. */
+  int64_t clockStep; /**< Microseconds. */
+  uint32_t prngSeed;
+  uint32_t vcpus;
+  uint8_t allowNetwork;
+  uint8_t pathInodes;
+  uint8_t kernelPre4_12;
+};
+
+/**
+ * What a handlerEvent is about.
+ */
+enum class handlerEventKind : uint8_t {
+  preHook,
+  postHook,
+  /** The tracer injected arch_prctl(ARCH_SET_CPUID), see trapCPUID(). */
+  cpuidTrap,
+  /** A new tracee, replays need to set up its state. */
+  spawn,
+  /** An execve, which resets part of the tracee's state. */
+  exec,
+};
+
+/**
+ * One call of a handler as the tracee saw it, or a spawn or exec.
+ */
+struct handlerEvent {
+  handlerEventKind kind;
+  pid_t pid;
+  /** System call for hooks and traps, the new pid for spawns. */
+  int32_t number;
+  bool thread; /**< Spawns only: the new tracee is a thread. */
+  bool callPostHook; /**< Pre-hooks only: what the handler returned. */
+  /**
+   * The handler only used registers and memory. Others, like handlers that
+   * injected a system call, cannot be replayed.
+   */
+  bool replayable;
+  /** Hooks and traps: the tracee's logical time before, in microseconds. */
+  int64_t clock;
+  struct user_regs_struct regsBefore;
+  struct user_regs_struct regsAfter; /**< As last set in the tracee. */
+  vector<memoryRegion> reads; /**< Memory as the handler read it, in order. */
+  vector<memoryRegion> writes; /**< Memory the handler wrote, in order. */
+
+  /** Execs only: what the tracer set up in the new address space. */
+  uint64_t mmapPage;
+  uint64_t timeShim;
+  bool cpuidTrapSet;
+};
+
+/**
+ * Writes the handler calls of a run to a file, see --record-handlers. While a
+ * handler runs the recorder is the activeTraceeBackend: requests go on to the
+ * kernel, and we note what went in and out.
+ */
+class handlerRecorder : public traceeBackend {
+public:
+  handlerRecorder(const string& path, const handlerTraceHeader& header);
+  ~handlerRecorder();
+
+  /**
+   * A handler for pid is about to run, with the tracee in regs and its
+   * logical time at clock.
+   */
+  void begin(
+      handlerEventKind kind,
+      pid_t pid,
+      int syscallNumber,
+      const struct user_regs_struct& regs,
+      logical_clock::time_point clock);
+
+  /**
+   * The handler since begin() returned.
+   * @param callPostHook what a pre-hook returned.
+   */
+  void end(bool callPostHook = false);
+
+  void spawn(pid_t parent, pid_t child, bool thread);
+
+  /**
+   * pid finished its execve, s is its state after the tracer's setup.
+   */
+  void exec(pid_t pid, state& s);
+
+  void flush() { fflush(out); }
+
+  long ptraceRequest(
+      enum __ptrace_request request, pid_t pid, void* addr, void* data)
+      override;
+  ssize_t readMemory(
+      pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes)
+      override;
+  ssize_t writeMemory(
+      pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes)
+      override;
+  /**
+   * What the host said is not in the trace, the event cannot be replayed.
+   */
+  void hostQuery(pid_t pid) override;
+
+private:
+  FILE* out;
+  kernelTracee kernel;
+  handlerEvent current;
+};
+
+/**
+ * A tracee that only exists in our memory: registers, and the memory a
+ * recorded handler read. Nothing reaches the kernel, host queries fail.
+ * Writes go anywhere, as they did when recorded.
+ */
+class offlineTracee : public traceeBackend {
+public:
+  /**
+   * Start over from the registers and memory an event started with.
+   */
+  void load(const handlerEvent& e);
+
+  struct user_regs_struct regs;
+  memoryImage memory;
+  memoryImage written; /**< What was written since load(). */
+
+  long ptraceRequest(
+      enum __ptrace_request request, pid_t pid, void* addr, void* data)
+      override;
+  ssize_t readMemory(
+      pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes)
+      override;
+  ssize_t writeMemory(
+      pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes)
+      override;
+  void hostQuery(pid_t pid) override;
+};
+
+/**
+ * Reads a file written by handlerRecorder.
+ */
+class handlerTraceReader {
+public:
+  explicit handlerTraceReader(const string& path);
+  ~handlerTraceReader();
+
+  handlerTraceHeader header;
+
+  /**
+   * @return false at the end of the trace.
+   */
+  bool next(handlerEvent& e);
+
+private:
+  FILE* in;
+};
+
+/**
+ * Replay a trace through execution::callPreHook and callPostHook against an
+ * offlineTracee, see --replay-handlers. Events that do not have the same
+ * effect on registers and memory as recorded, or whose handler throws, are
+ * reported to err. out gets the time spent per handler.
+ * @return the number of events that did not replay as recorded.
+ */
+uint64_t replayHandlerTrace(const string& path, FILE* out, FILE* err);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef INODE_MAPPER_H
+#define INODE_MAPPER_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "ValueMapper.hpp"
+
+/**
+ * Map of real inodes to the virtual inodes tracees see.
+ *
+ * By default virtual inodes are handed out in the order files are first
+ * observed, like any ValueMapper. With --path-inodes they are instead derived
+ * from a hash of the file's canonical path inside the chroot when we first see
+ * it, plus a generation bumped each time that path is recreated as a different
+ * file. A file then gets the same virtual inode no matter which files were
+ * looked at before it, in this run or another.
+ *
+ * Files we cannot name (anonymous O_TMPFILE files, deleted files) and callers
+ * that pass no path fall back to the ordered numbering, which stays below
+ * pathInodeBase. Should two identities hash to the same value, the one seen
+ * later probes the next hash, so collisions are resolved deterministically as
+ * long as the two files are observed in the same order.
+ */
+class inodeMapper : public ValueMapper<ino_t, ino_t> {
+public:
+  /**
+   * @param logr initialized logger to write data to.
+   * @param pathDerived derive virtual inodes from paths, see --path-inodes.
+   */
+  inodeMapper(logger& logr, bool pathDerived = false);
+
+  using ValueMapper<ino_t, ino_t>::addRealValue;
+
+  /**
+   * Map a real inode first seen at path.
+   * @param realValue real inode.
+   * @param path canonical path of the file inside the chroot, empty if
+   * unknown. Ignored unless pathDerived().
+   * @return the mapped virtual inode.
+   */
+  ino_t addRealValue(ino_t realValue, const string& path);
+
+  /**
+   * Whether virtual inodes are derived from paths. Callers only need to work
+   * out paths for addRealValue() when this is set.
+   */
+  bool pathDerived() const { return derived; }
+
+  /**
+   * @return rough number of heap bytes used by the map, paths included.
+   */
+  size_t memoryBytes() const;
+
+  /**
+   * Lowest virtual inode derived from a path. Ordered values stay below it.
+   */
+  static constexpr ino_t pathInodeBase = 1UL << 32;
+
+private:
+  /**
+   * What we know about a path: the file last seen there and how many times it
+   * was recreated.
+   */
+  struct pathEntry {
+    ino_t real;
+    uint32_t generation;
+  };
+
+  /**
+   * FNV-1a hash of a path.
+   */
+  static uint64_t hashPath(const string& path);
+
+  /**
+   * Virtual inode for a path's hash and generation, with probe picking further
+   * candidates after collisions. Always at least pathInodeBase.
+   */
+  static ino_t derive(uint64_t pathHash, uint32_t generation, uint32_t probe);
+
+  bool derived;
+
+  /**
+   * Paths we handed out virtual inodes for.
+   */
+  unordered_map<string, pathEntry> paths;
+
+  /**
+   * Owner of each virtual inode derived from a path, as the path and its
+   * generation, to detect collisions.
+   */
+  unordered_map<ino_t, pair<string, uint32_t>> owners;
+};
+
+#endif
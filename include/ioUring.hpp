@@ -0,0 +1,161 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * The tracer's view of an io_uring instance set up by a tracee.
+ *
+ * We duplicate the ring's file descriptor into the tracer with pidfd_getfd(2)
+ * and map the submission and completion rings ourselves. The memory is shared
+ * with the tracee, so pending submissions and new completions can be read, and
+ * submissions adjusted, without any ptrace or process_vm calls.
+ *
+ * io_uring_enter is made deterministic by letting through only operations on
+ * local files, which complete in bounded time, forcing them to run one after
+ * the other in submission order (IOSQE_IO_DRAIN) and waiting for all of them
+ * before the system call returns. The tracee then always finds the same
+ * completions, in the same order, in its ring.
+ */
+class ioUring {
+public:
+  /**
+   * Attach to ring fd of thread group tgid, set up with params as returned
+   * by io_uring_setup.
+   */
+  ioUring(pid_t tgid, int fd, const struct io_uring_params& params);
+
+  ~ioUring();
+
+  ioUring(const ioUring&) = delete;
+  ioUring& operator=(const ioUring&) = delete;
+
+  /**
+   * Whether this kernel lets us attach to a tracee's ring (Linux 5.6).
+   */
+  static bool supported();
+
+  /**
+   * Whether io_uring_setup flags only ask for features we can determinize.
+   * In particular no SQPOLL, where a kernel thread consumes submissions
+   * without the tracee ever making a system call.
+   */
+  static bool allowedSetupFlags(uint32_t flags);
+
+  /**
+   * Whether we let through io_uring_register opcode.
+   */
+  static bool allowedRegisterOpcode(unsigned opcode);
+
+  /**
+   * Whether we let through submissions with opcode. Ops that wait on time,
+   * other processes or the network are not.
+   */
+  static bool allowedOpcode(uint8_t opcode);
+
+  /**
+   * Whether completions of opcode count as writes to their file.
+   */
+  static bool isWrite(uint8_t opcode);
+
+  /**
+   * An opcode no kernel knows. Submissions rewritten to it complete with
+   * -EINVAL as soon as they are submitted, ignoring IOSQE_IO_DRAIN, so they
+   * are always submitted on their own.
+   */
+  static const uint8_t rejectedOpcode = 0xff;
+
+  /**
+   * Submissions the tracee queued that the kernel has not consumed yet.
+   */
+  uint32_t queuedSubmissions() const;
+
+  /**
+   * The i-th queued submission, nullptr if the tracee queued an invalid
+   * index, where the kernel stops consuming.
+   */
+  struct io_uring_sqe* submission(uint32_t i) const;
+
+  /**
+   * Completions posted but not yet consumed by the tracee.
+   */
+  uint32_t readyCompletions() const;
+
+  /**
+   * The i-th completion not yet consumed by the tracee.
+   */
+  const struct io_uring_cqe& completion(uint32_t i) const;
+
+  uint32_t completionEntries() const { return cqEntries; }
+
+  /**
+   * Whether the ring keeps submitting past a submission that fails early.
+   */
+  bool submitsAll() const { return (setupFlags & IORING_SETUP_SUBMIT_ALL); }
+
+  /**
+   * A submission let through by the current io_uring_enter.
+   */
+  struct operation {
+    uint8_t opcode;
+    int fd;
+  };
+
+  /**
+   * Submissions of the io_uring_enter in progress, in order, for its post
+   * hook. Only one tracee runs at a time, so one list per ring suffices even
+   * when the ring is shared.
+   */
+  vector<operation> inFlight;
+
+  /**
+   * readyCompletions() when the io_uring_enter in progress was made.
+   */
+  uint32_t completionsBefore = 0;
+
+  /**
+   * Submissions already made by earlier rounds of the io_uring_enter in
+   * progress. A batch is split at every rejected submission and the call
+   * replayed for the rest, see io_uring_enterSystemCall.
+   */
+  uint32_t submittedBefore = 0;
+
+  /**
+   * Whether the io_uring_enter in progress is being replayed for the rest of
+   * its batch.
+   */
+  bool continuing = false;
+
+private:
+  int fd = -1;
+  uint32_t setupFlags;
+
+  void* sqRing = nullptr;
+  size_t sqRingBytes;
+  void* cqRing = nullptr;
+  size_t cqRingBytes;
+  uint8_t* sqes = nullptr;
+  size_t sqesBytes;
+  size_t sqeBytes;
+  size_t cqeBytes;
+
+  uint32_t* sqHead;
+  uint32_t* sqTail;
+  uint32_t sqMask;
+  uint32_t* sqArray;
+  uint32_t sqEntries;
+
+  uint32_t* cqHead;
+  uint32_t* cqTail;
+  uint32_t cqMask;
+  uint8_t* cqes;
+  uint32_t cqEntries;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MOUNT_TREES_H
+#define MOUNT_TREES_H
+
+#include <map>
+#include <string>
+#include <tuple>
+
+/**
+ * Bind mounts for setting up the container.
+ *
+ * With the new mount API (Linux 5.12) a bind is an open_tree(2) clone of the
+ * source as a detached mount tree, one mount_setattr(2) setting propagation and
+ * read-only on every mount in that tree, and a move_mount(2) into place.
+ * Sources bound more than once can be announced up front with prepare(): they
+ * are then looked up and cloned once, and every bind attaches a clone of that
+ * tree. Where the kernel cannot clone a detached tree yet, every bind but the
+ * last clones the source path again.
+ *
+ * On older kernels, or where the new calls are not permitted, we fall back to
+ * mount(2) for good.
+ */
+class mountTrees {
+public:
+  mountTrees() = default;
+  mountTrees(const mountTrees&) = delete;
+  mountTrees& operator=(const mountTrees&) = delete;
+  ~mountTrees();
+
+  /**
+   * Announce a bind() of source, with the same arguments, so the detached
+   * tree for it is only made once however often it is bound. Later binds
+   * attach the source as it was at the first one.
+   */
+  void prepare(const std::string& source, bool recursive, bool readOnly);
+
+  /**
+   * Bind mount source onto target, made private.
+   * @param recursive include the mounts below source, like MS_REC.
+   * @param readOnly make the mounts read-only. The mount(2) fallback only
+   * makes the top one read-only.
+   */
+  void bind(
+      const std::string& source,
+      const std::string& target,
+      bool recursive,
+      bool readOnly = false);
+
+  /**
+   * Whether binds use the new mount API, false once we fell back.
+   */
+  bool newApi() const { return useNewApi; }
+
+private:
+  using key = std::tuple<std::string, bool, bool>;
+
+  /**
+   * A detached tree for source, made with the given attributes.
+   * @return -1 with errno set on failure. useNewApi is cleared if that is
+   * because the new mount API is not usable.
+   */
+  int detachedTree(const std::string& source, bool recursive, bool readOnly);
+
+  /**
+   * A tree to attach for the next bind of source: the prepared tree itself
+   * for its last bind, a clone of it before that, or a new one.
+   * @return -1 on failure, like detachedTree().
+   */
+  int attachableTree(const std::string& source, bool recursive, bool readOnly);
+
+  void bindWithMount(
+      const std::string& source,
+      const std::string& target,
+      bool recursive,
+      bool readOnly);
+
+  struct preparedTree {
+    int fd; /**< -1 until the first bind. */
+    unsigned binds; /**< Binds of it still to come. */
+  };
+
+  /**
+   * Trees made by prepare(), by source, recursive and readOnly.
+   */
+  std::map<key, preparedTree> trees;
+
+  bool useNewApi = true;
+
+  /**
+   * Cleared once the kernel refused to clone a detached tree.
+   */
+  bool cloneDetached = true;
+};
+
+#endif
@@ -94,6 +94,16 @@ public:
    */
   ptracer(pid_t pid);
 
+  /**
+   * Create a ptracer for a process we are not tracing, holding the given
+   * registers, which are not fetched from pid. Lets benchmarks and replays
+   * run handlers against a fake tracee, served by an offlineTracee as the
+   * activeTraceeBackend.
+   * @param pid process whose memory we access
+   * @param regs register values the handlers will see
+   */
+  ptracer(pid_t pid, struct user_regs_struct regs);
+
   /**
    * Retrieves value for arg1: rdi register.
    * @return rdi register value
@@ -57,6 +57,41 @@ public:
    */
   void preemptAndScheduleNext();
 
+  /**
+   * Park the current process until other processes have made progress the
+   * given number of times, see madeProgress(), or the others went through a
+   * whole round without any: they are blocked or polling too, maybe waiting
+   * for the parked process.
+   * Used for threads that only sleep and poll the time: parking stands in for
+   * the sleep, measured in logical time instead of wall clock time.
+   * @param progressEvents how much progress to wait for, at least one
+   */
+  void parkAndScheduleNext(uint64_t progressEvents);
+
+  /**
+   * Park the current process until a signal is sent to it, see wake(), or the
+   * others went through a whole round without progress. Used for sigsuspend
+   * and sigtimedwait, which would otherwise be replayed on every round.
+   */
+  void parkUntilSignalAndScheduleNext();
+
+  /**
+   * A signal was sent to process: if parked, it goes to the blocked heap.
+   */
+  void wake(pid_t process);
+
+  /**
+   * Some process made progress. Parked processes that waited long enough may
+   * run again. They go to the blocked heap, so processes that are already
+   * runnable go first.
+   */
+  void madeProgress() {
+    if (!parkedProcesses.empty()) {
+      progress++;
+      unparkUntil(progress);
+    }
+  }
+
   /**
    * Adds new process to scheduler.
    * This new process will be scheduled to run next.
@@ -84,6 +119,26 @@ public:
   // Keep track of how many times scheduleNextProcess was called:
   uint32_t callsToScheduleNextProcess = 0;
 
+  /**
+   * Whether exactly one process is left and it is runnable: nothing blocked,
+   * parked, or finished and waiting for children. Scheduling is then a no-op,
+   * see execution::runAlone().
+   */
+  bool alone() const {
+    return runnableHeap.size() == 1 && blockedHeap.empty() &&
+           parkedProcesses.empty() && finishedProcesses.empty();
+  }
+
+  /**
+   * Number of processes waiting in the blocked heap.
+   */
+  size_t blockedCount() const { return blockedHeap.size(); }
+
+  /**
+   * Number of times a process was parked, see parkAndScheduleNext().
+   */
+  uint32_t parkedPolls = 0;
+
   void killAllProcesses() {
     while (!runnableHeap.empty()) {
       pid_t pid = runnableHeap.top();
@@ -95,6 +150,10 @@ public:
       kill(pid, SIGKILL);
       blockedHeap.pop();
     }
+    for (auto& parked : parkedProcesses) {
+      kill(parked.first, SIGKILL);
+    }
+    parkedProcesses.clear();
   }
 
 private:
@@ -114,6 +173,29 @@ private:
   priority_queue<pid_t> runnableHeap;
   priority_queue<pid_t> blockedHeap;
 
+  /**
+   * Processes parked by parkAndScheduleNext(), in neither heap. Maps each to
+   * the progress count it may run again at, UINT64_MAX if it waits for a
+   * signal.
+   */
+  map<pid_t, uint64_t> parkedProcesses;
+
+  /**
+   * Times madeProgress() was called while something was parked.
+   */
+  uint64_t progress = 0;
+
+  /**
+   * progress when the heaps were last swapped, see scheduleNextProcess().
+   */
+  uint64_t progressAtSwap = 0;
+
+  /**
+   * Move parked processes due at or before the given progress count to the
+   * blocked heap.
+   */
+  void unparkUntil(uint64_t until);
+
   /**
    * Set of finished processes.
    */
@@ -47,8 +47,12 @@ private:
   /**
    * Code defining all system call that we implement or let through.
    * @param debug True for debug mode. (Extra logging if true).
+   * @param virtualCpus True to intercept the CPU affinity calls for --vcpus.
+   * @param trackFiles True to intercept every system call on a path, for
+   * TraceOptions::file_access.
    */
-  void loadRules(bool debug, bool convertUids);
+  void loadRules(
+      bool debug, bool convertUids, bool virtualCpus, bool trackFiles);
 
   /**
    * Add system call to whitelist but no call to ptrace.
@@ -84,8 +88,11 @@ public:
    * PTRACEME should be called by the tracee before this call.
    *
    * @param debugLevel: If 4 or 5, will intercept several more system calls.
+   * @param virtualCpus: If true, intercept the CPU affinity calls.
+   * @param trackFiles: If true, intercept every system call on a path.
    */
-  seccomp(int debugLevel, bool convertUids);
+  seccomp(
+      int debugLevel, bool convertUids, bool virtualCpus, bool trackFiles);
 
   /**
    * Used to avoid raise conditions between the tracee and tracee of a ptrace
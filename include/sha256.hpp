@@ -0,0 +1,44 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/**
+ * Incremental SHA-256, for content addressing in the action cache. We don't
+ * link against a crypto library, and this is all we need of one.
+ */
+class sha256 {
+public:
+  sha256();
+
+  /**
+   * Hash size more bytes.
+   */
+  void update(const void* data, size_t size);
+
+  void update(const std::string& data) { update(data.data(), data.size()); }
+
+  /**
+   * Finish hashing. The object must not be updated afterwards.
+   * @return the digest as 64 lowercase hex digits.
+   */
+  std::string hexDigest();
+
+private:
+  void compress(const uint8_t* block);
+
+  uint32_t state[8];
+  uint8_t buffer[64];
+  size_t buffered = 0;
+  uint64_t length = 0;
+};
+
+/**
+ * SHA-256 of a string, as hex.
+ */
+std::string sha256Hex(const std::string& data);
+
+#endif
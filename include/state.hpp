@@ -18,6 +18,7 @@
 #include "mappedMemory.hpp"
 #include "ptracer.hpp"
 #include "registerSaver.hpp"
+#include "timeShim.hpp"
 
 using namespace std;
 
@@ -52,6 +53,34 @@ enum class descriptorType {
 
 // Needed to avoid recursive dependencies between classes.
 class mappedMemory;
+class ioUring;
+
+/**
+ * Rarely used per-tracee data for select and partial read/write retries. Kept
+ * out of line so it does not bloat every state record.
+ */
+class retryState {
+public:
+  /*
+   * register values from (the post-hook) before any retries
+   */
+  struct user_regs_struct beforeRetry = {0};
+
+  /**
+   * Number of total bytes.
+   */
+  uint64_t totalBytes = 0;
+
+  bool rdfsNotNull = false; /**< Indicates whether rdfs is NULL. */
+  bool wrfsNotNull = false; /**< Indicates whether wrfs is NULL. */
+  bool exfsNotNull = false; /**< Indicates whether exfs is NULL. */
+  fd_set origRdfs; /**< Original file descriptors set to watch for read
+                      availability. */
+  fd_set origWrfs; /**< Original file descriptors set to watch for write
+                      availability. */
+  fd_set
+      origExfs; /**< Original file descriptors set to watch for exceptions. */
+};
 
 /**
  * Class to hold all state that we will need to update in between system calls
@@ -74,7 +103,81 @@ private:
    */
   logical_clock::duration clock_step;
 
+  /**
+   * The time shim's clock as last read, valid while shimClockFresh.
+   */
+  mutable logical_clock::time_point shimClock;
+  mutable bool shimClockFresh = false;
+
 public:
+  // Hot fields: touched by the event loop on (nearly) every ptrace stop. Keep
+  // them together at the front of the record.
+
+  /**
+   * The pid of the process represented by this state.
+   */
+  pid_t traceePid;
+
+  /**
+   * traceePid as the tracee knows it, in its pid namespace, see
+   * globalState::hostPids.
+   */
+  pid_t vpid = 0;
+
+  /*
+   * Per process bool to know if we should go into the post hook.
+   */
+  bool callPostHook = false;
+
+  /**
+   * Signal to be delivered the next time this process runs. If 0, no signal
+   * will be delivered. Otherwise the value represents the signal number.
+   */
+  int signalToDeliver = 0;
+
+  /*
+   * Per process bool to know if this is the pre or post hook event as ptrace
+   * does not track this for us. Only used for older kernel vesions.
+   */
+  bool onPreExitEvent = true;
+
+  /*
+   * Indicator to differentiate between a syscall we are injecting and one that
+   * has already been replayed. Used since Ptrace cannot tell the difference.
+   *
+   * If true, system call is being injected for the first try.
+   * If false, system call is being replayed.
+   */
+  bool firstTrySystemcall = true;
+
+  /** Flag to let us know if the current system call was artifically injected by
+   * us. */
+  bool syscallInjected = false;
+
+  /** Whether we have injected a noop system call. Return value of the noop
+      (currently, getpid) needs to be fixed up so that tracee doesn't notice
+      the noop. */
+  bool noopSystemCall = false;
+
+  /** Whether we've injected a signal for alarm/timer modeling. */
+  bool signalInjected = false;
+
+  /** Flag to tell us to setup cpuid interception via an injected prctl(). */
+  bool CPUIDTrapSet = false;
+
+  /**
+   * Keeps track of whether this process just exit_group-ed, we need to remember
+   * this since there is no post-hook for exit group.
+   */
+  bool isExitGroup = false;
+
+  /**
+   * Whether the current pre-hook stop came from the legacy vsyscall page. Set
+   * by handleSeccomp from the registers it already fetched, so resuming for
+   * the post-hook does not need another PTRACE_GETREGS just to check this.
+   */
+  bool onVsyscall = false;
+
   /**
    * Constructor.
    * Initialize traceePid and debugLevel to the provided values, and
@@ -124,32 +227,23 @@ public:
    */
   unordered_map<int, directoryEntries<linux_dirent>> dirEntries;
 
-  /**
-   * The pid of the process represented by this state.
-   */
-  pid_t traceePid;
-
   /**
    * Remember whether wait4 was originally blocking or not.
    */
   bool wait4Blocking = false;
 
-  /*
-   * Per process bool to know if this is the pre or post hook event as ptrace
-   * does not track this for us. Only used for older kernel vesions.
+  /**
+   * Replays of the current system call because it would have blocked. Reset
+   * once a system call completes without a replay.
    */
-  bool onPreExitEvent = true;
-
-  /*
-   * Per process bool to know if we should go into the post hook.
-   */
-  bool callPostHook = false;
+  uint32_t blockedReplays = 0;
 
   /**
-   * Signal to be delivered the next time this process runs. If 0, no signal
-   * will be delivered. Otherwise the value represents the signal number.
+   * Sleep and time system calls this thread made in a row, without any other
+   * system call in between. A thread that does nothing else is polling, see
+   * nanosleepSystemCall.
    */
-  int signalToDeliver = 0;
+  uint32_t idlePolls = 0;
 
   /**
    * inode number to be deleted.
@@ -182,37 +276,6 @@ public:
    */
   ino_t inodeToDelete = -1;
 
-  /*
-   * register values from (the post-hook) before any retries
-   */
-  struct user_regs_struct beforeRetry = {0};
-
-  /**
-   * Number of total bytes.
-   */
-  uint64_t totalBytes = 0;
-
-  /*
-   * Indicator to differentiate between a syscall we are injecting and one that
-   * has already been replayed. Used since Ptrace cannot tell the difference.
-   *
-   * If true, system call is being injected for the first try.
-   * If false, system call is being replayed.
-   */
-  bool firstTrySystemcall = true;
-
-  /** Flag to let us know if the current system call was artifically injected by
-   * us. */
-  bool syscallInjected = false;
-
-  /** Whether we have injected a noop system call. Return value of the noop
-      (currently, getpid) needs to be fixed up so that tracee doesn't notice
-      the noop. */
-  bool noopSystemCall = false;
-
-  /** Whether we've injected a signal for alarm/timer modeling. */
-  bool signalInjected = false;
-
   /** What kind of signal handler this tracee has requested via
       signal/sigaction. The currentSignalHandlers map is updated iff the syscall
       completes successfully. */
@@ -226,25 +289,114 @@ public:
    * registered. */
   shared_ptr<unordered_map<int, enum sighandler_type>> currentSignalHandlers;
 
+  /**
+   * What the kernel does to the blocked mask when it runs a custom handler:
+   * adds sa_mask (and the signal itself, unless SA_NODEFER), and with
+   * SA_RESETHAND goes back to SIG_DFL, see enterSignalHandler().
+   */
+  struct handlerMask {
+    uint64_t mask;
+    bool oneShot;
+  };
+
+  /**
+   * handlerMask for each signal with a custom handler. Shared like
+   * currentSignalHandlers, dropped on execve.
+   */
+  shared_ptr<unordered_map<int, handlerMask>> signalHandlerMasks;
+
+  /** handlerMask for requestedSignalHandler, if custom. */
+  handlerMask requestedHandlerMask = {0, false};
+
+  /**
+   * Our model of this thread's blocked signal mask, one bit per signal (bit
+   * signum - 1), same layout as SigBlk in /proc/pid/status. Kept up to date by
+   * the rt_sigprocmask and rt_sigreturn handlers and on handler entry, see
+   * enterSignalHandler(). Inherited across fork, clone and execve.
+   */
+  uint64_t blockedSignals = 0;
+
+  /**
+   * Signals we know are pending for this thread only, e.g. sent with tgkill to
+   * this thread while blocked. Only blocked signals are ever pending: anything
+   * else is delivered (or discarded) right away by the kernel.
+   */
+  uint64_t threadPendingSignals = 0;
+
+  /**
+   * Signals we know are pending for the whole thread group, e.g. SIGCHLD from
+   * an exited child. Shared between threads, fresh for a forked child.
+   */
+  shared_ptr<uint64_t> sharedPendingSignals;
+
+  /**
+   * Which rt_sigprocmask operation (SIG_BLOCK, ...) the tracee requested, -1 if
+   * it is only reading the mask. Applied in the post-hook iff the call
+   * succeeds.
+   */
+  int requestedMaskHow = -1;
+
+  /** The signal set passed to rt_sigprocmask, see requestedMaskHow. */
+  uint64_t requestedMask = 0;
+
+  /**
+   * Bit for signum in our signal masks.
+   */
+  static uint64_t signalBit(int signum) { return 1UL << (signum - 1); }
+
+  /**
+   * All signals pending for this thread, thread-directed or not.
+   */
+  uint64_t pendingSignals() const {
+    return threadPendingSignals | *sharedPendingSignals;
+  }
+
+  /**
+   * Record that signum was sent to this thread (or its thread group, if
+   * shared). Only recorded if blocked, see threadPendingSignals.
+   */
+  void queueSignal(int signum, bool shared);
+
+  /**
+   * Record that signum was dequeued, either delivered to a handler or consumed
+   * by sigtimedwait.
+   */
+  void signalDequeued(int signum);
+
+  /**
+   * Update the blocked signal mask after a successful rt_sigprocmask, or when
+   * rt_sigreturn restores the one saved on the signal frame.
+   */
+  void setBlockedSignals(uint64_t mask);
+
+  /**
+   * signum is being delivered: if it runs a custom handler, block what the
+   * handler blocks, see signalHandlerMasks. rt_sigreturn restores the mask.
+   */
+  void enterSignalHandler(int signum);
+
   /** track timers created via timer_create */
   shared_ptr<unordered_map<timerID_t, timerInfo>> timerCreateTimers;
 
-  bool rdfsNotNull = false; /**< Indicates whether rdfs is NULL. */
-  bool wrfsNotNull = false; /**< Indicates whether wrfs is NULL. */
-  bool exfsNotNull = false; /**< Indicates whether exfs is NULL. */
-  fd_set origRdfs; /**< Original file descriptors set to watch for read
-                      availability. */
-  fd_set origWrfs; /**< Original file descriptors set to watch for write
-                      availability. */
-  fd_set
-      origExfs; /**< Original file descriptors set to watch for exceptions. */
-
   /** Flag to differentiate between our injected timeout into a system call from
    * a user one. */
   bool userDefinedTimeout = false;
 
-  /** Flag to tell us to setup cpuid interception via an injected prctl(). */
-  bool CPUIDTrapSet = false;
+  /**
+   * Select and read/write retry data. Only a handful of tracees ever need it,
+   * so it is allocated on first use through retry().
+   */
+  unique_ptr<retryState> coldRetry;
+
+  /**
+   * Get the retry data for this tracee, allocating it if needed.
+   */
+  retryState& retry() {
+    if (!coldRetry) {
+      coldRetry.reset(new retryState());
+    }
+    return *coldRetry;
+  }
 
   /** A register saver used to store the previous register state and retrieve at
    * a later stage */
@@ -273,20 +425,60 @@ public:
   const int debugLevel;
 
   /**
-   * Bytes to allocate for our directory entries. We use the standard size used
-   * in glibc.
+   * Function to increase value of internal logical clock.
    */
-  const size_t dirEntriesBytes = 32768;
+  void incrementTime();
 
   /**
-   * Function to increase value of internal logical clock.
+   * Function to get value of internal logical clock. With a time shim the value
+   * read from the tracee is kept until forgetLogicalTime().
+   */
+  logical_clock::time_point getLogicalTime() const;
+
+  /**
+   * Set our copy of the logical clock, for replays of recorded handler calls.
    */
-  void incrementTime() { clock += clock_step; }
+  void setLogicalTime(logical_clock::time_point time) {
+    clock = time;
+    shimClockFresh = false;
+  }
 
   /**
-   * Function to get value of internal logical clock.
+   * The tracee is about to run and may move its time shim's clock: read it
+   * again on the next getLogicalTime().
    */
-  logical_clock::time_point getLogicalTime() const { return clock; }
+  void forgetLogicalTime() { shimClockFresh = false; }
+
+  /**
+   * The process' time shim (--time-shim). While there is one, its clock is the
+   * logical clock and ours only a copy of it.
+   */
+  traceePtr<timeShimData> timeShim = traceePtr<timeShimData>(nullptr);
+
+  /**
+   * Catch up with the time shim: refresh our copy of its clock and collect the
+   * calls it served since the last time.
+   * @return calls served in the tracee, 0 without a time shim.
+   */
+  uint32_t syncTimeShim();
+
+  /**
+   * A vfork child runs on its parent's time shim until it execs or exits. The
+   * parent's pid, so its clock can be put back then; 0 otherwise.
+   */
+  pid_t timeShimLender = 0;
+
+  /**
+   * Put our copy of the clock back into the time shim, after a vfork child
+   * used it.
+   * @return calls the time shim served since it was last synced.
+   */
+  uint32_t resetTimeShim();
+
+  /**
+   * How much incrementTime() advances the clock by.
+   */
+  logical_clock::duration getClockStep() const { return clock_step; }
 
   /**
    * We must keep track of file creation. For open and openat, we set this flag.
@@ -296,10 +488,12 @@ public:
   bool fileExisted = false;
 
   /**
-   * Keeps track of whether this process just exit_group-ed, we need to remember
-   * this since there is no post-hook for exit group.
+   * Set by the unlink, unlinkat and rmdir pre-hooks when the call is about to
+   * remove the last link to an inode we track, so the post-hook can forget it.
+   * 0 otherwise.
    */
-  bool isExitGroup = false;
+  ino_t lastLinkInode = 0;
+  dev_t lastLinkDevice = 0;
 
   /**
    * Keep track of places where it's okay to see a stuck thread versus where
@@ -357,6 +551,90 @@ public:
   bool fd_is_signalfd(int fd) const {
     return signalfds->find(fd) != signalfds->end();
   }
+
+  /**
+   * Unix domain sockets, fd to socket type (SOCK_STREAM, SOCK_DGRAM or
+   * SOCK_SEQPACKET). Like pipes they are made non-blocking in the kernel, with
+   * the user's choice kept in fdStatus, so blocking transfers wait in the
+   * scheduler instead of the kernel.
+   */
+  std::shared_ptr<std::unordered_map<int, int>> unixSockets;
+
+  /**
+   * check whether a file descriptor is a Unix domain socket
+   */
+  bool fd_is_unix(int fd) const {
+    return unixSockets->find(fd) != unixSockets->end();
+  }
+
+  /**
+   * newfd was duplicated from fd, it is the same socket, if any.
+   */
+  void copyUnixSocketFd(int fd, int newfd) {
+    auto it = unixSockets->find(fd);
+    if (it != unixSockets->end()) {
+      (*unixSockets)[newfd] = it->second;
+    } else {
+      unixSockets->erase(newfd);
+    }
+  }
+
+  /**
+   * Files opened for writing that have not been written through this
+   * descriptor yet, fd to real inode. The first write, see noteFdWritten(),
+   * gives the file a new logical mtime. Later writes through the same
+   * descriptor leave it alone.
+   */
+  std::shared_ptr<std::unordered_map<int, ino_t>> unwrittenFds;
+
+  /**
+   * newfd was duplicated from fd (dup, dup2, fcntl), it shares fd's entry in
+   * unwrittenFds, if any.
+   */
+  void copyUnwrittenFd(int fd, int newfd) {
+    auto it = unwrittenFds->find(fd);
+    if (it != unwrittenFds->end()) {
+      (*unwrittenFds)[newfd] = it->second;
+    } else {
+      unwrittenFds->erase(newfd);
+    }
+  }
+
+  /**
+   * Files opened by path, fd to (device, real inode), with the working
+   * directory under AT_FDCWD. Counted in globalState::openInodes, see
+   * fileOpened() and fileClosed().
+   */
+  std::shared_ptr<std::unordered_map<int, std::pair<dev_t, ino_t>>> openFiles;
+
+  /**
+   * Rough number of heap bytes in dirEntries, for statistics.
+   */
+  size_t dirEntriesBytes() const {
+    size_t bytes = 0;
+    for (const auto& entry : dirEntries) {
+      bytes += entry.second.memoryBytes();
+    }
+    return bytes;
+  }
+
+  /**
+   * io_uring instances by file descriptor, see io_uring_setupSystemCall.
+   * Duplicated descriptors and forked children refer to the same ring.
+   */
+  std::shared_ptr<std::unordered_map<int, std::shared_ptr<ioUring>>> ioUrings;
+
+  /**
+   * newfd was duplicated from fd, it refers to the same ring, if any.
+   */
+  void copyIoUringFd(int fd, int newfd) {
+    auto it = ioUrings->find(fd);
+    if (it != ioUrings->end()) {
+      (*ioUrings)[newfd] = it->second;
+    } else {
+      ioUrings->erase(newfd);
+    }
+  }
 };
 
 #endif
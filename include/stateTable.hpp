@@ -0,0 +1,177 @@
+#ifndef STATE_TABLE_H
+#define STATE_TABLE_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Pid-indexed table of per-tracee records.
+ *
+ * Records live in fixed size slabs so that references stay valid until the
+ * record is erased (we routinely hold a parent's state while emplacing its
+ * child). Lookups go through a direct-mapped index on the pid: tracees live in
+ * their own pid namespace, so pids are small and dense and a flat vector beats
+ * walking a red-black tree several times per ptrace event. Freed slots are
+ * reused LIFO so a short lived thread lands on still-warm memory.
+ */
+template <typename T, size_t SlabSize = 64>
+class stateTable {
+private:
+  /** A block of raw storage for SlabSize records. */
+  struct slab {
+    typename aligned_storage<sizeof(T), alignof(T)>::type slots[SlabSize];
+  };
+
+  /** Sentinel for "no record for this pid" in slotOf. */
+  static const int32_t noSlot = -1;
+
+  /** Maps a pid to its slot number, or noSlot. */
+  vector<int32_t> slotOf;
+
+  /** Backing storage, never moved once allocated. */
+  vector<unique_ptr<slab>> slabs;
+
+  /** Slots previously used and now available again. */
+  vector<uint32_t> freeSlots;
+
+  /** Number of live records. */
+  size_t live = 0;
+
+  T* slotPtr(uint32_t slot) const {
+    return reinterpret_cast<T*>(
+        &slabs[slot / SlabSize]->slots[slot % SlabSize]);
+  }
+
+  uint32_t allocateSlot() {
+    if (freeSlots.empty()) {
+      uint32_t base = slabs.size() * SlabSize;
+      slabs.emplace_back(new slab);
+      // Push in reverse so the lowest slot is handed out first.
+      for (uint32_t i = SlabSize; i > 0; i--) {
+        freeSlots.push_back(base + i - 1);
+      }
+    }
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+  }
+
+public:
+  stateTable() = default;
+  stateTable(const stateTable&) = delete;
+  stateTable& operator=(const stateTable&) = delete;
+  ~stateTable() { clear(); }
+
+  /**
+   * Construct a record for pid in place, like map::emplace.
+   * @return pointer to the record for pid, and whether it was newly inserted.
+   */
+  template <typename... Args>
+  pair<T*, bool> emplace(pid_t pid, Args&&... args) {
+    if (pid < 0) {
+      throw out_of_range("stateTable: negative pid " + to_string(pid));
+    }
+    if ((size_t)pid >= slotOf.size()) {
+      slotOf.resize(max((size_t)pid + 1, slotOf.size() * 2), noSlot);
+    } else if (slotOf[pid] != noSlot) {
+      return make_pair(slotPtr(slotOf[pid]), false);
+    }
+
+    uint32_t slot = allocateSlot();
+    T* record;
+    try {
+      record = new (slotPtr(slot)) T(forward<Args>(args)...);
+    } catch (...) {
+      freeSlots.push_back(slot);
+      throw;
+    }
+    slotOf[pid] = slot;
+    live++;
+    return make_pair(record, true);
+  }
+
+  /**
+   * @return the record for pid, or nullptr if there is none.
+   */
+  T* find(pid_t pid) const {
+    if (pid < 0 || (size_t)pid >= slotOf.size() || slotOf[pid] == noSlot) {
+      return nullptr;
+    }
+    return slotPtr(slotOf[pid]);
+  }
+
+  /**
+   * @return the record for pid. Throws out_of_range if there is none.
+   */
+  T& at(pid_t pid) const {
+    T* record = find(pid);
+    if (record == nullptr) {
+      throw out_of_range("stateTable: no state for pid " + to_string(pid));
+    }
+    return *record;
+  }
+
+  /**
+   * Destroy the record for pid, if any.
+   * @return number of records removed (0 or 1).
+   */
+  size_t erase(pid_t pid) {
+    T* record = find(pid);
+    if (record == nullptr) {
+      return 0;
+    }
+    record->~T();
+    freeSlots.push_back(slotOf[pid]);
+    slotOf[pid] = noSlot;
+    live--;
+    return 1;
+  }
+
+  size_t count(pid_t pid) const { return find(pid) != nullptr ? 1 : 0; }
+
+  size_t size() const { return live; }
+
+  bool empty() const { return live == 0; }
+
+  /**
+   * Number of record slots allocated, live or free.
+   */
+  size_t capacity() const { return slabs.size() * SlabSize; }
+
+  /**
+   * Call f(pid, record) for every live record, in pid order.
+   */
+  template <typename F>
+  void forEach(F f) const {
+    for (size_t pid = 0; pid < slotOf.size(); pid++) {
+      if (slotOf[pid] != noSlot) {
+        f((pid_t)pid, *slotPtr(slotOf[pid]));
+      }
+    }
+  }
+
+  /**
+   * Destroy all records. Slabs are kept for reuse.
+   */
+  void clear() {
+    for (size_t pid = 0; pid < slotOf.size() && live != 0; pid++) {
+      if (slotOf[pid] != noSlot) {
+        erase(pid);
+      }
+    }
+  }
+};
+
+template <typename T, size_t SlabSize>
+const int32_t stateTable<T, SlabSize>::noSlot;
+
+#endif
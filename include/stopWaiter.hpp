@@ -0,0 +1,84 @@
+#ifndef STOP_WAITER_H
+#define STOP_WAITER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <chrono>
+
+/**
+ * Waits for the next ptrace stop of a tracee, like waitpid(pid, &status, 0).
+ *
+ * With spinning enabled (--spin-wait) we first poll with waitid(WNOHANG |
+ * WNOWAIT) for a while, so a stop that arrives soon is picked up without the
+ * scheduler wakeup a blocking waitpid costs. The spin window adapts to recent
+ * stops: twice the moving average of how long they took to arrive, or no
+ * spinning at all while stops take longer than maxSpin. This burns a core on
+ * the tracer, which only pays off on hosts dedicated to the build.
+ */
+class stopWaiter {
+public:
+  /**
+   * @param spin whether to spin, ignored when we may only use one CPU.
+   */
+  explicit stopWaiter(bool spin);
+
+  /**
+   * Wait for the next event of pid.
+   * @return what waitpid returns.
+   */
+  pid_t wait(pid_t pid, int* status);
+
+  /**
+   * Whether we spin at all.
+   */
+  bool spinning() const { return spin; }
+
+  /**
+   * Longest we ever spin for a single stop.
+   */
+  static constexpr std::chrono::nanoseconds maxSpin =
+      std::chrono::microseconds(100);
+
+  /**
+   * Stops picked up while spinning.
+   */
+  uint64_t spinHits = 0;
+
+  /**
+   * Stops we had to block for, including those where we did not spin.
+   */
+  uint64_t spinMisses = 0;
+
+  /**
+   * Time spent polling, whether it found the stop or not.
+   */
+  std::chrono::nanoseconds spinTime{0};
+
+  /**
+   * Time spent blocked in waitpid.
+   */
+  std::chrono::nanoseconds blockedTime{0};
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * Fold the time the last stop took to arrive into averageWait.
+   */
+  void observe(std::chrono::nanoseconds waited);
+
+  bool spin;
+
+  /**
+   * Moving average (1/8 weight) of how long stops took to arrive.
+   */
+  std::chrono::nanoseconds averageWait{0};
+
+  /**
+   * How long to spin for the next stop.
+   */
+  std::chrono::nanoseconds window{0};
+};
+
+#endif
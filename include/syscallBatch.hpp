@@ -0,0 +1,69 @@
+#ifndef SYSCALL_BATCH_H
+#define SYSCALL_BATCH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+using namespace std;
+
+/**
+ * A list of system calls to run in a stopped tracee with a single resume.
+ *
+ * run() writes a small loop into the tracee which loads each call's number and
+ * arguments from a table, executes it, and stores the result back into the
+ * table. The loop ends in an int3, at which point we read every result and
+ * restore the tracee's registers and memory.
+ *
+ * Only meant for tracees stopped outside of a system call we still have to
+ * handle, like the execve event. Injections that replay the current system
+ * call through the event loop use regSaver instead.
+ */
+class syscallBatch {
+public:
+  /**
+   * Queue a system call.
+   * @return index of its result, see result().
+   */
+  size_t add(
+      long number,
+      uint64_t arg1 = 0,
+      uint64_t arg2 = 0,
+      uint64_t arg3 = 0,
+      uint64_t arg4 = 0,
+      uint64_t arg5 = 0,
+      uint64_t arg6 = 0);
+
+  size_t size() const { return calls.size(); }
+
+  /**
+   * Run all queued system calls in pid, in order.
+   * @param memFd the tracee's /proc/<pid>/mem, see openTraceeMem().
+   * @param code where to put the loop, at least codeBytes() mapped bytes. May
+   * be read only.
+   * @param data memory for the table, at least dataBytes() bytes.
+   * Both are restored afterwards.
+   */
+  void run(pid_t pid, int memFd, uint64_t code, uint64_t data);
+
+  /**
+   * @return raw return value of call i, -errno on failure.
+   */
+  long result(size_t i) const { return calls[i].ret; }
+
+  static size_t codeBytes();
+  size_t dataBytes() const { return calls.size() * sizeof(call); }
+
+private:
+  /** Table entry, layout is fixed by the loop's machine code. */
+  struct call {
+    uint64_t number;
+    uint64_t args[6];
+    int64_t ret;
+  };
+
+  vector<call> calls;
+};
+
+#endif
@@ -7,7 +7,7 @@
  * The count of system calls.
  * @see systemCallMappings
  */
-const int SYSTEM_CALL_COUNT = 333;
+const int SYSTEM_CALL_COUNT = 451;
 
 /**
  * A list of system calls. This information was scraped from
@@ -24,6 +24,9 @@ const int SYSTEM_CALL_COUNT = 333;
  * machine. If you are using a more recent version of the Linux kernel,
  * you may have additional system calls that are not present in this list.
  * If so, please run the script and add them!
+ *
+ * Entries from io_pgetevents (333) on were added from <asm/unistd_64.h>.
+ * Numbers 335 to 423 are not used on x86_64 and are left empty.
  */
 const std::string systemCallMappings[SYSTEM_CALL_COUNT] = {
     "read",
@@ -358,6 +361,134 @@ const std::string systemCallMappings[SYSTEM_CALL_COUNT] = {
     "pkey_mprotect",
     "pkey_alloc",
     "pkey_free",
-    "statx"};
+    "statx",
+    "io_pgetevents",
+    "rseq",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "",
+    "pidfd_send_signal",
+    "io_uring_setup",
+    "io_uring_enter",
+    "io_uring_register",
+    "open_tree",
+    "move_mount",
+    "fsopen",
+    "fsconfig",
+    "fsmount",
+    "fspick",
+    "pidfd_open",
+    "clone3",
+    "close_range",
+    "openat2",
+    "pidfd_getfd",
+    "faccessat2",
+    "process_madvise",
+    "epoll_pwait2",
+    "mount_setattr",
+    "quotactl_fd",
+    "landlock_create_ruleset",
+    "landlock_add_rule",
+    "landlock_restrict_self",
+    "memfd_secret",
+    "process_mrelease",
+    "futex_waitv",
+    "set_mempolicy_home_node"};
+
+/**
+ * Name of system call number, also for numbers outside systemCallMappings.
+ */
+inline std::string systemCallName(int number) {
+  if (0 <= number && number < SYSTEM_CALL_COUNT) {
+    return systemCallMappings[number];
+  }
+  return "syscall_" + std::to_string(number);
+}
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef TIME_SHIM_H
+#define TIME_SHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "vdso.hpp"
+
+/**
+ * Data of the time shim, at the start of its page in the tracee. The layout is
+ * fixed by the shim's machine code.
+ */
+struct timeShimData {
+  /** The process' logical time in microseconds, see logical_clock. */
+  int64_t clock;
+  /** How much each call advances clock. */
+  int64_t step;
+  /** Calls served since the tracer last collected them. */
+  uint32_t calls;
+  /** The call that would make calls reach this traps instead. */
+  uint32_t trapEvery;
+};
+
+/**
+ * --time-shim: code in the tracee serving clock_gettime, gettimeofday and time
+ * from the logical clock without a stop. The patched vdso functions jump to it.
+ *
+ * Every timeShimTrapEvery-th call, and calls with arguments the shim does not
+ * handle (a timezone, a clock without a logical time), make the real system
+ * call instead. The tracer then collects the served calls and preempts the
+ * process, like it does on every time call without the shim.
+ *
+ * The shim lives in the page after the tracee's scratch memory.
+ */
+constexpr size_t timeShimSize = 0x1000;
+
+constexpr uint32_t timeShimTrapEvery = 64;
+
+/**
+ * Size of the stub replacing a vdso function, see writeTimeShimStub().
+ */
+constexpr size_t timeShimStubSize = 16;
+
+/**
+ * The shim's code and data, to be written at the start of its page.
+ * @param clock initial logical time in microseconds.
+ * @param step microseconds each call advances the clock by.
+ */
+std::vector<unsigned char> timeShimImage(int64_t clock, int64_t step);
+
+/**
+ * @return offset of the shim's implementation of func, 0 if it has none.
+ */
+unsigned long timeShimEntry(enum VDSOFunc func);
+
+/**
+ * Write a vdso stub jumping to entry, timeShimStubSize bytes.
+ */
+void writeTimeShimStub(unsigned char* code, uint64_t entry);
+
+#endif
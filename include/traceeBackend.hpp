@@ -0,0 +1,82 @@
+#ifndef TRACEE_BACKEND_H
+#define TRACEE_BACKEND_H
+
+#include <stdint.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+
+/**
+ * Everything handlers do to a tracee through the kernel: ptrace requests, see
+ * ptracer::doPtrace, and reads and writes of its memory, see readVmTraceeRaw
+ * and writeVmTraceeRaw. These are plain system calls unless a backend is
+ * installed in activeTraceeBackend, then they go through it instead. That
+ * lets us record what handlers did, or run them against a tracee that only
+ * exists in our memory, see handlerTrace.hpp. Handlers also ask the host
+ * about tracees, e.g. through /proc/pid, see hostTraceeQuery().
+ */
+class traceeBackend {
+public:
+  virtual ~traceeBackend() {}
+
+  /**
+   * Like ptrace(2): -1 with errno set on failure, the data for PTRACE_PEEK*.
+   */
+  virtual long ptraceRequest(
+      enum __ptrace_request request, pid_t pid, void* addr, void* data) = 0;
+
+  /**
+   * Like process_vm_readv(2) with one iovec on each side.
+   * @return bytes read, fewer at the end of readable memory, or -1.
+   */
+  virtual ssize_t readMemory(
+      pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes) = 0;
+
+  /**
+   * Like process_vm_writev(2) with one iovec on each side.
+   */
+  virtual ssize_t writeMemory(
+      pid_t pid,
+      uint64_t traceeMemory,
+      const void* localMemory,
+      size_t bytes) = 0;
+
+  /**
+   * A handler is about to ask the host about pid, not through the requests
+   * above, so we cannot see the answer. Throws if it cannot be answered.
+   */
+  virtual void hostQuery(pid_t pid) {}
+};
+
+/**
+ * The installed backend, nullptr while we talk to the kernel directly. Only
+ * set for the duration of a handler, so the common case costs one branch.
+ */
+extern traceeBackend* activeTraceeBackend;
+
+/**
+ * Call before looking at pid through /proc/pid, getpgid() and the like,
+ * see traceeBackend::hostQuery().
+ */
+inline void hostTraceeQuery(pid_t pid) {
+  if (activeTraceeBackend != nullptr) {
+    activeTraceeBackend->hostQuery(pid);
+  }
+}
+
+/**
+ * Passes everything on to the kernel, for backends wrapping a real tracee.
+ */
+class kernelTracee : public traceeBackend {
+public:
+  long ptraceRequest(
+      enum __ptrace_request request, pid_t pid, void* addr, void* data)
+      override;
+  ssize_t readMemory(
+      pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes)
+      override;
+  ssize_t writeMemory(
+      pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes)
+      override;
+};
+
+#endif
@@ -15,6 +15,7 @@
 
 #include <linux/futex.h>
 
+#include "traceeBackend.hpp"
 #include "traceePtr.hpp"
 
 using namespace std;
@@ -87,6 +88,10 @@ ssize_t readVmTraceeRaw(
     T* localMemory,
     size_t numberOfBytes,
     pid_t traceePid) {
+  if (activeTraceeBackend != nullptr) {
+    return activeTraceeBackend->readMemory(
+        traceePid, (uint64_t)traceeMemory.ptr, localMemory, numberOfBytes);
+  }
   iovec remoteIoVec = {traceeMemory.ptr, numberOfBytes};
   iovec localIoVec = {localMemory, numberOfBytes};
   const unsigned long flags = 0;
@@ -94,6 +99,29 @@ ssize_t readVmTraceeRaw(
   return process_vm_readv(traceePid, &localIoVec, 1, &remoteIoVec, 1, flags);
 }
 // =======================================================================================
+/**
+ * Write bytes to tracee memory using process_vm_writev. Like readVmTraceeRaw,
+ * errors are left to the caller, e.g. to fail the tracee's system call with
+ * EFAULT for a bad pointer.
+ * @return bytes written, -1 on error.
+ */
+template <typename T>
+ssize_t tryWriteVmTraceeRaw(
+    T* localMemory,
+    traceePtr<T> traceeMemory,
+    size_t numberOfBytes,
+    pid_t traceePid) {
+  if (activeTraceeBackend != nullptr) {
+    return activeTraceeBackend->writeMemory(
+        traceePid, (uint64_t)traceeMemory.ptr, localMemory, numberOfBytes);
+  }
+  iovec remoteIoVec = {traceeMemory.ptr, numberOfBytes};
+  iovec localIoVec = {localMemory, numberOfBytes};
+  const unsigned long flags = 0;
+
+  return process_vm_writev(traceePid, &localIoVec, 1, &remoteIoVec, 1, flags);
+}
+// =======================================================================================
 /**
  * Write bytes to tracee memory using process_vm_writev while safely
  * handling errors. The type T does not affect the behavior of the
@@ -110,16 +138,43 @@ void writeVmTraceeRaw(
     traceePtr<T> traceeMemory,
     size_t numberOfBytes,
     pid_t traceePid) {
-  iovec remoteIoVec = {traceeMemory.ptr, numberOfBytes};
-  iovec localIoVec = {localMemory, numberOfBytes};
-  const unsigned long flags = 0;
-
   doWithCheck(
-      process_vm_writev(traceePid, &localIoVec, 1, &remoteIoVec, 1, flags),
+      tryWriteVmTraceeRaw(localMemory, traceeMemory, numberOfBytes, traceePid),
       "writeVmTraceeRaw: Error calling process_vm_writev");
-
-  return;
 }
+// =======================================================================================
+/**
+ * Open /proc/<pid>/mem for readTraceeMem and writeTraceeMem. The file is tied
+ * to the address space, so it has to be reopened after an execve.
+ * @return the file descriptor, the caller closes it.
+ */
+int openTraceeMem(pid_t traceePid);
+
+/**
+ * The pid process pid has in its own pid namespace, the last NSpid field of
+ * /proc/<pid>/status. Same as pid without a namespace, or if the kernel does
+ * not say (before 4.1).
+ */
+pid_t namespacePid(pid_t pid);
+
+/**
+ * Read bytes from tracee memory through /proc/<pid>/mem.
+ * @param memFd descriptor from openTraceeMem()
+ */
+void readTraceeMem(
+    int memFd, uint64_t traceeMemory, void* localMemory, size_t numberOfBytes);
+
+/**
+ * Write bytes to tracee memory through /proc/<pid>/mem. Unlike
+ * process_vm_writev this works on read only mappings like text, and unlike
+ * PTRACE_POKETEXT it is a single system call for any length.
+ * @param memFd descriptor from openTraceeMem()
+ */
+void writeTraceeMem(
+    int memFd,
+    uint64_t traceeMemory,
+    const void* localMemory,
+    size_t numberOfBytes);
 
 void throw_runtime_error_if_fail(
     bool cond,
@@ -52,6 +52,12 @@ void printInfoString(
 
 void injectPause(globalState& gs, state& s, ptracer& t);
 
+/**
+ * Record the result of arch_prctl(ARCH_SET_CPUID, 0) we injected into s.
+ * On failure CPUID interception is given up on for good.
+ */
+void cpuidTrapResult(globalState& gs, state& s, long ret);
+
 pair<int, int> getPipeFds(globalState& gs, state& s, ptracer& t);
 
 /* Turn system call into a noop by changing it into a time. This should be
@@ -94,6 +100,43 @@ ino_t readInodeFor(logger& log, pid_t traceePid, int fd);
 ino_t inode_from_tracee(
     const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd);
 
+/**
+ * Canonical path, inside the tracee's root, of the file open as fd. This is
+ * what --path-inodes derives virtual inodes from. Empty when inodes are not
+ * path derived or the file has no name anymore.
+ */
+string inodePathFor(globalState& gs, pid_t traceePid, int fd);
+
+/**
+ * Like inodePathFor(), for a path the tracee used. The last component is not
+ * followed, like inode_from_tracee() does, unless followLast is set (stat and
+ * friends without AT_SYMLINK_NOFOLLOW).
+ */
+string inode_path_from_tracee(
+    globalState& gs,
+    const string& traceePath,
+    pid_t traceePid,
+    int traceeDirFd,
+    bool followLast = false);
+
+/**
+ * Count a replay of the current system call because it would have blocked,
+ * towards --max-blocked-replays. Call it wherever such a replay is issued.
+ */
+void countBlockedReplay(globalState& gs, state& s);
+
+/**
+ * signum was sent to thread pid, or with toThreadGroup to the whole thread
+ * group pid (our pids, see globalState::hostPids). Record it as pending where
+ * it is blocked, and wake receivers parked waiting for a signal.
+ */
+void signalSent(
+    globalState& gs,
+    scheduler& sched,
+    pid_t pid,
+    int signum,
+    bool toThreadGroup);
+
 /**
  *
  * Replays system call if the value of errnoValue is equal to the errno value
@@ -148,6 +191,14 @@ void replaySystemCall(globalState& gs, ptracer& t, uint64_t systemCall);
 bool sendTraceeSignalNow(
     int signum, globalState& gs, state& s, ptracer& t, scheduler& sched);
 
+/**
+ * Read the C string at path without failing on bad pointers, a page at a time
+ * as process_vm_readv stops at the first unmapped one.
+ * @return False if the string is unreadable or longer than PATH_MAX, the
+ * kernel reports that to the tracee.
+ */
+bool tryReadTraceePath(pid_t pid, uint64_t path, string& result);
+
 /**
  * Given a path used by the tracee, either relative or absolute, resolve the
  * exact file the tracee refered to. Uses combination of /proc/traceePid/cwd,
@@ -163,6 +214,49 @@ string resolve_tracee_path(
  */
 bool tracee_file_exists(
     const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd);
+/**
+ * lstat a file relative to a tracee. Calls resolve_tracee_path.
+ * @return False if the file can't be stat'ed.
+ */
+bool lstat_from_tracee(
+    const string& traceePath,
+    pid_t traceePid,
+    logger& log,
+    int traceeDirFd,
+    struct stat& statbuf);
+/**
+ * Check whether any tracee still has a file open, or as its working directory,
+ * see globalState::openInodes.
+ */
+bool inode_open_by_tracees(globalState& gs, ino_t inode, dev_t device);
+/**
+ * fd was opened by path, or the working directory changed for AT_FDCWD: add
+ * the file it names to s.openFiles, replacing what fd named before.
+ */
+void fileOpened(globalState& gs, state& s, int fd);
+/**
+ * fd was closed, or replaced by dup2, drop it from s.openFiles.
+ */
+void fileClosed(globalState& gs, state& s, int fd);
+/**
+ * newfd was duplicated from fd (dup, dup2, dup3, fcntl), it names the same
+ * file in s.openFiles, if any.
+ */
+void copyOpenFile(globalState& gs, state& s, int fd, int newfd);
+/**
+ * s has a fresh copy of its parent's s.openFiles (fork), count its entries.
+ */
+void openFilesInherited(globalState& gs, state& s);
+/**
+ * The last user of s.openFiles is gone, uncount and clear its entries.
+ */
+void openFilesReleased(globalState& gs, state& s);
+/**
+ * Rebuild s.openFiles from /proc/pid/fd and /proc/pid/cwd. For the first
+ * tracee, which inherits our descriptors, and after execve, which closes the
+ * close-on-exec ones.
+ */
+void scanOpenFiles(globalState& gs, state& s);
 /**
  * Handler for open and openat. Checks if the file exists and sets
  * s.fileExisted, if O_CREAT was set. This way we know whether a new file was
@@ -182,4 +276,12 @@ void handlePreOpens(
  * to get the anonymous inode.
  */
 void handlePostOpens(globalState& gs, state& s, ptracer& t, int flags);
+
+/**
+ * Called after a successful write-like system call on fd. If this is the first
+ * write since fd was opened, give the file a new logical mtime, see
+ * globalState::setMtime().
+ */
+void noteFdWritten(globalState& gs, state& s, int fd);
+
 #endif
@@ -27,6 +27,7 @@ enum VDSOFunc {
   VDSO_getcpu,
   VDSO_gettimeofday,
   VDSO_time,
+  VDSO_getrandom,
 };
 
 struct VDSOSymbol {
@@ -48,6 +49,11 @@ int proc_get_map_entries(pid_t pid, struct ProcMapEntry* ep, int size);
 int proc_get_vdso_vvar(
     pid_t pid, struct ProcMapEntry* vdso, struct ProcMapEntry* vvar);
 
+/// read one entry of /proc/<pid>/auxv, like AT_SYSINFO_EHDR for the base
+/// of [vdso]. Much cheaper than parsing the maps.
+/// returns 0 if there is no such entry.
+unsigned long proc_get_auxv_entry(pid_t pid, unsigned long type);
+
 /// get vdso symbols from vdso
 /// returns number of vdso functions found.
 int proc_get_vdso_symbols(
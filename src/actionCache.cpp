@@ -0,0 +1,781 @@
+#include "actionCache.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "sha256.hpp"
+#include "util.hpp"
+
+// Records and the input digest are sequences of length prefixed fields, so
+// paths and outputs may contain any byte.
+static void putField(string& out, const string& field) {
+  out += to_string(field.size()) + ":" + field + "\n";
+}
+
+static bool getField(istream& in, string& field) {
+  size_t size;
+  if (!(in >> size) || in.get() != ':' ||
+      (streamsize)size > in.rdbuf()->in_avail()) {
+    return false;
+  }
+  field.resize(size);
+  in.read(&field[0], size);
+  return in && in.get() == '\n';
+}
+
+/**
+ * Parse a decimal number from an action record without throwing, damaged
+ * records are a miss.
+ */
+static bool getNumber(
+    const string& field, unsigned long long max, unsigned long long& value) {
+  if (field.empty() || field.size() > 20 ||
+      field.find_first_not_of("0123456789") != string::npos) {
+    return false;
+  }
+  errno = 0;
+  value = strtoull(field.c_str(), nullptr, 10);
+  return errno == 0 && value <= max;
+}
+
+static void makeDir(const string& path) {
+  if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+    sysError(("Unable to create directory " + path).c_str());
+  }
+}
+
+// Copy everything from in to out.
+static bool copyFd(int in, int out) {
+  char buf[65536];
+  for (;;) {
+    ssize_t n = read(in, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n == 0;
+    }
+    for (ssize_t done = 0; done < n;) {
+      ssize_t written = write(out, buf + done, n - done);
+      if (written == -1 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      done += written;
+    }
+  }
+}
+
+static string fileSha256(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1) {
+    return "";
+  }
+  sha256 h;
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0 || (n == -1 && errno == EINTR)) {
+    if (n > 0) {
+      h.update(buf, n);
+    }
+  }
+  close(fd);
+  return n == 0 ? h.hexDigest() : "";
+}
+
+static int checked(int ret, const string& what) {
+  return doWithCheck(ret, what.c_str());
+}
+
+// Create a file in dir that is renamed into place once complete.
+static int makeTemp(const string& dir, string& path) {
+  path = dir + "/XXXXXX";
+  int fd = mkostemp(&path[0], O_CLOEXEC);
+  if (fd == -1) {
+    sysError(("Unable to create a file in " + dir).c_str());
+  }
+  return fd;
+}
+
+// Drop empty and "." components, the tracer reports paths like "//usr/./lib".
+// ".." stays, where it leads depends on symbolic links.
+static string cleanPath(const string& path) {
+  string clean;
+  for (size_t start = 0; start <= path.size();) {
+    size_t end = min(path.find('/', start), path.size());
+    string part = path.substr(start, end - start);
+    if (!part.empty() && part != ".") {
+      clean += "/" + part;
+    }
+    start = end + 1;
+  }
+  return clean.empty() ? "/" : clean;
+}
+
+// path with symbolic links resolved, as far as it exists.
+static string realPath(const string& path) {
+  char real[PATH_MAX];
+  if (realpath(path.c_str(), real) != nullptr) {
+    return real;
+  }
+  size_t slash = path.rfind('/');
+  if (slash != string::npos && slash > 0 &&
+      realpath(path.substr(0, slash).c_str(), real) != nullptr) {
+    return real + path.substr(slash);
+  }
+  return path;
+}
+
+static bool isUnderAny(const string& path, const vector<string>& roots) {
+  for (const auto& root : roots) {
+    if (path.compare(0, root.size(), root) == 0 &&
+        (path.size() == root.size() || root.back() == '/' ||
+         path[root.size()] == '/')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// What lstat says about path, to tell whether something changed it. Owners
+// are left out, the tracer sees them through its user namespace.
+static string statStamp(const string& path) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) == -1) {
+    return errno == ENOENT || errno == ENOTDIR ? "-" : "?" + to_string(errno);
+  }
+  ostringstream stamp;
+  stamp << st.st_dev << ' ' << st.st_ino << ' ' << st.st_mode << ' '
+        << st.st_nlink << ' ' << st.st_rdev << ' ' << st.st_size << ' '
+        << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << ' '
+        << st.st_ctim.tv_sec << '.' << st.st_ctim.tv_nsec;
+  return stamp.str();
+}
+
+// =======================================================================================
+localActionCache::localActionCache(const string& dir) : dir(dir) {
+  makeDir(dir);
+  makeDir(dir + "/actions");
+  makeDir(dir + "/blobs");
+  makeDir(dir + "/tmp");
+}
+
+string localActionCache::blobPath(const string& digest) {
+  return dir + "/blobs/" + digest.substr(0, 2) + "/" + digest;
+}
+
+bool localActionCache::readAction(const string& key, string& record) {
+  ifstream in(dir + "/actions/" + key, ios::binary);
+  if (!in) {
+    return false;
+  }
+  ostringstream contents;
+  contents << in.rdbuf();
+  record = contents.str();
+  return true;
+}
+
+void localActionCache::writeAction(const string& key, const string& record) {
+  string tmp;
+  int fd = makeTemp(dir + "/tmp", tmp);
+  bool ok = write(fd, record.data(), record.size()) == (ssize_t)record.size();
+  close(fd);
+  if (!ok || rename(tmp.c_str(), (dir + "/actions/" + key).c_str()) == -1) {
+    unlink(tmp.c_str());
+    sysError("Unable to store action");
+  }
+}
+
+bool localActionCache::hasBlob(const string& digest) {
+  return access(blobPath(digest).c_str(), F_OK) == 0;
+}
+
+bool localActionCache::fetchBlob(const string& digest, int fd) {
+  int in = open(blobPath(digest).c_str(), O_RDONLY | O_CLOEXEC);
+  if (in == -1) {
+    return false;
+  }
+  bool ok = copyFd(in, fd);
+  close(in);
+  return ok;
+}
+
+void localActionCache::storeBlob(const string& digest, const string& path) {
+  int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in == -1) {
+    sysError(("Unable to read " + path).c_str());
+  }
+  string tmp;
+  int out = makeTemp(dir + "/tmp", tmp);
+  bool ok = copyFd(in, out);
+  close(in);
+  close(out);
+  makeDir(dir + "/blobs/" + digest.substr(0, 2));
+  if (!ok || rename(tmp.c_str(), blobPath(digest).c_str()) == -1) {
+    unlink(tmp.c_str());
+    sysError(("Unable to store " + path).c_str());
+  }
+}
+
+// =======================================================================================
+fileDigestIndex::fileDigestIndex(const string& path)
+    : path(path), loaded(time(nullptr)) {
+  ifstream in(path);
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  long mtime, mtimeNs, ctime, ctimeNs;
+  string digest;
+  while (in >> dev >> ino >> size >> mtime >> mtimeNs >> ctime >> ctimeNs >>
+         digest) {
+    digests[key(dev, ino, size, mtime, mtimeNs, ctime, ctimeNs)] =
+        entry{digest, false};
+  }
+}
+
+string fileDigestIndex::digest(const string& file, const struct stat& st) {
+  key k(
+      st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+      st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+  auto found = digests.find(k);
+  if (found != digests.end()) {
+    return found->second.digest;
+  }
+  string digest = fileSha256(file);
+  if (!digest.empty()) {
+    // Timestamps are coarse, a write right after we hashed might not change
+    // them.
+    bool racy = st.st_mtime >= loaded - 2 || st.st_ctime >= loaded - 2;
+    digests[k] = entry{digest, racy};
+    dirty = dirty || !racy;
+  }
+  return digest;
+}
+
+void fileDigestIndex::save() {
+  if (!dirty) {
+    return;
+  }
+  string tmp = path + ".tmp." + to_string(getpid());
+  {
+    ofstream out(tmp);
+    for (const auto& d : digests) {
+      if (d.second.racy) {
+        continue;
+      }
+      const key& k = d.first;
+      out << get<0>(k) << ' ' << get<1>(k) << ' ' << get<2>(k) << ' '
+          << get<3>(k) << ' ' << get<4>(k) << ' ' << get<5>(k) << ' '
+          << get<6>(k) << ' ' << d.second.digest << '\n';
+    }
+    if (!out) {
+      unlink(tmp.c_str());
+      return;
+    }
+  }
+  // Losing the index only costs rehashing, so don't fail the run over it.
+  if (rename(tmp.c_str(), path.c_str()) == -1) {
+    unlink(tmp.c_str());
+  }
+  dirty = false;
+}
+
+// =======================================================================================
+actionCache::actionCache(
+    unique_ptr<actionCacheBackend> backend,
+    const string& localDir,
+    vector<string> trees)
+    : backend(move(backend)),
+      localDir(localDir),
+      index(localDir + "/index"),
+      trees(trees) {
+  makeDir(localDir);
+  makeDir(localDir + "/tmp");
+  struct stat st;
+  checked(stat(localDir.c_str(), &st), "stat " + localDir);
+  skipDevice = st.st_dev;
+  skipInode = st.st_ino;
+}
+
+void actionCache::walk(
+    const string& root, const string& relative, treeSnapshot& tree) {
+  string path = relative.empty() ? root : root + "/" + relative;
+  struct stat st;
+  if (lstat(path.c_str(), &st) == -1) {
+    complete = false;
+    return;
+  }
+  if (S_ISDIR(st.st_mode) && st.st_dev == skipDevice &&
+      st.st_ino == skipInode) {
+    return;
+  }
+
+  treeEntry entry{st.st_mode, ""};
+  if (S_ISREG(st.st_mode)) {
+    entry.content = index.digest(path, st);
+    complete = complete && !entry.content.empty();
+  } else if (S_ISLNK(st.st_mode)) {
+    char target[PATH_MAX + 1] = {0};
+    complete = complete && readlink(path.c_str(), target, PATH_MAX) != -1;
+    entry.content = target;
+  } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+    entry.content = to_string(st.st_rdev);
+  }
+  tree[relative] = entry;
+
+  // Stay on the root's file system.
+  if (!S_ISDIR(st.st_mode)) {
+    return;
+  }
+  if (relative.empty()) {
+    rootDevice = st.st_dev;
+  } else if (st.st_dev != rootDevice) {
+    return;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    complete = false;
+    return;
+  }
+  vector<string> names;
+  while (struct dirent* d = readdir(dir)) {
+    if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+      names.push_back(d->d_name);
+    }
+  }
+  closedir(dir);
+  for (const auto& name : names) {
+    walk(root, relative.empty() ? name : relative + "/" + name, tree);
+  }
+}
+
+treeSnapshot actionCache::snapshot(const string& root) {
+  treeSnapshot tree;
+  walk(root, "", tree);
+  return tree;
+}
+
+string actionCache::computeKey(const string& inputs) {
+  sha256 h;
+  string fields;
+  putField(fields, "dettrace action key 1");
+  putField(fields, inputs);
+  h.update(fields);
+
+  before.clear();
+  for (const auto& root : trees) {
+    before.push_back(snapshot(root));
+    fields.clear();
+    putField(fields, root);
+    for (const auto& e : before.back()) {
+      putField(fields, e.first);
+      putField(fields, to_string(e.second.mode));
+      putField(fields, e.second.content);
+    }
+    h.update(fields);
+  }
+  index.save();
+  return h.hexDigest();
+}
+
+string actionCache::inputDigest(const string& path) {
+  string digest;
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+    char target[PATH_MAX + 1] = {0};
+    if (readlink(path.c_str(), target, PATH_MAX) == -1) {
+      return "";
+    }
+    putField(digest, string("l") + target);
+  }
+  if (stat(path.c_str(), &st) == -1) {
+    if (errno != ENOENT && errno != ENOTDIR) {
+      return "";
+    }
+    // Missing, or a dangling link. Creating it is a change too.
+    putField(digest, "-");
+  } else if (S_ISREG(st.st_mode)) {
+    string content = index.digest(path, st);
+    if (content.empty()) {
+      return "";
+    }
+    putField(digest, "f" + content);
+  } else if (S_ISDIR(st.st_mode)) {
+    // Lookups in a directory, e.g. along a search path, depend on its names.
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+      return "";
+    }
+    vector<string> names;
+    while (struct dirent* d = readdir(dir)) {
+      if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+        names.push_back(d->d_name);
+      }
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    string fields;
+    for (const auto& name : names) {
+      putField(fields, name);
+    }
+    sha256 h;
+    h.update(fields);
+    putField(digest, "d" + h.hexDigest());
+  } else {
+    putField(
+        digest, "s" + to_string(st.st_mode) + ":" + to_string(st.st_rdev));
+  }
+  return digest;
+}
+
+void actionCache::logAccess(int fd, const char* path, bool write) {
+  string entry;
+  putField(entry, write ? "w" : "r");
+  putField(entry, path);
+  if (write) {
+    putField(entry, statStamp(path));
+  }
+  if (::write(fd, entry.data(), entry.size()) != (ssize_t)entry.size()) {
+    sysError("Unable to log file access");
+  }
+}
+
+void actionCache::readAccessLog(
+    const string& logPath, const vector<string>& ignored) {
+  // The trees are keyed already. Check both what the tracee named and where
+  // it leads on the host, either may go through a symbolic link.
+  vector<string> internal;
+  for (const auto& root : trees) {
+    internal.push_back(cleanPath(root));
+    internal.push_back(realPath(root));
+  }
+  for (const auto& root : ignored) {
+    internal.push_back(cleanPath(root));
+    internal.push_back(realPath(root));
+  }
+  internal.push_back(realPath(localDir));
+
+  ifstream file(logPath, ios::binary);
+  ostringstream contents;
+  contents << file.rdbuf();
+  istringstream in(contents.str());
+  while (complete && in.peek() != EOF) {
+    string kind, path, stamp;
+    if (!getField(in, kind) || !getField(in, path) ||
+        (kind == "w" && !getField(in, stamp))) {
+      complete = false;
+      return;
+    }
+    path = cleanPath(path);
+    // With "..", a path that starts in a tree may lead out of it.
+    bool dotDot = (path + "/").find("/../") != string::npos;
+    if ((!dotDot && isUnderAny(path, internal)) ||
+        isUnderAny(realPath(path), internal)) {
+      continue;
+    }
+    if (kind == "r") {
+      inputs[path] = "";
+    } else if (statStamp(path) != stamp) {
+      fprintf(
+          stderr, "dettrace: %s changed outside the trees, not caching.\n",
+          path.c_str());
+      complete = false;
+    }
+  }
+
+  for (auto& input : inputs) {
+    if (!complete) {
+      return;
+    }
+    input.second = inputDigest(input.first);
+    if (input.second.empty()) {
+      fprintf(
+          stderr, "dettrace: cannot read input %s, not caching.\n",
+          input.first.c_str());
+      complete = false;
+    }
+  }
+  index.save();
+}
+
+// Kinds of changes in a record.
+static const char changedFile = 'f';
+static const char changedLink = 'l';
+static const char changedDir = 'd';
+static const char changedSpecial = 's';
+static const char deleted = 'x';
+
+namespace {
+struct change {
+  size_t tree;
+  char kind;
+  mode_t mode;
+  string content;
+  string path;
+};
+} // namespace
+
+static char kindOf(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return changedFile;
+  } else if (S_ISLNK(mode)) {
+    return changedLink;
+  } else if (S_ISDIR(mode)) {
+    return changedDir;
+  }
+  return changedSpecial;
+}
+
+// Make path hold what c says, whatever is there now.
+static void applyChange(
+    const string& path, const change& c, actionCacheBackend& backend) {
+  struct stat st;
+  bool exists = lstat(path.c_str(), &st) == 0;
+  if (exists && S_ISDIR(st.st_mode) != (c.kind == changedDir)) {
+    // Anything that was inside a replaced directory is deleted already.
+    checked(remove(path.c_str()), "remove " + path);
+    exists = false;
+  }
+
+  mode_t permissions = c.mode & 07777;
+  string tmp = path + ".dettrace-restore";
+  unlink(tmp.c_str());
+  switch (c.kind) {
+  case changedDir:
+    if (!exists) {
+      checked(mkdir(path.c_str(), permissions), "mkdir " + path);
+    }
+    checked(chmod(path.c_str(), permissions), "chmod " + path);
+    return;
+  case changedFile: {
+    int fd = checked(
+        open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600),
+        "open " + tmp);
+    bool ok = backend.fetchBlob(c.content, fd) && fchmod(fd, permissions) == 0;
+    close(fd);
+    if (!ok) {
+      unlink(tmp.c_str());
+      runtimeError("Unable to restore " + path + " from the action cache");
+    }
+    break;
+  }
+  case changedLink:
+    checked(symlink(c.content.c_str(), tmp.c_str()), "symlink " + tmp);
+    break;
+  default:
+    checked(
+        mknod(
+            tmp.c_str(), c.mode,
+            c.content.empty() ? 0 : (dev_t)stoull(c.content)),
+        "mknod " + tmp);
+    break;
+  }
+  checked(rename(tmp.c_str(), path.c_str()), "rename to " + path);
+}
+
+bool actionCache::restore(const string& key, int& exitCode) {
+  string record;
+  if (!backend->readAction(key, record)) {
+    return false;
+  }
+
+  istringstream in(record);
+  string magic, code, out, err, count;
+  unsigned long long codeValue, changeCount;
+  // Every change takes several fields, so there cannot be more of them than
+  // bytes in the record.
+  if (!getField(in, magic) || magic != "dettrace action 2" ||
+      !getField(in, code) || !getField(in, out) || !getField(in, err) ||
+      !getField(in, count) || !getNumber(code, 255, codeValue) ||
+      !getNumber(count, record.size(), changeCount)) {
+    return false;
+  }
+  vector<change> changes(changeCount);
+  for (auto& c : changes) {
+    string tree, kind, mode;
+    unsigned long long treeValue, modeValue;
+    if (!getField(in, tree) || !getField(in, kind) || !getField(in, mode) ||
+        !getField(in, c.content) || !getField(in, c.path) ||
+        !getNumber(tree, trees.size() - 1, treeValue) ||
+        !getNumber(mode, UINT_MAX, modeValue) || kind.size() != 1) {
+      return false;
+    }
+    c.tree = treeValue;
+    c.kind = kind[0];
+    c.mode = modeValue;
+  }
+  string inputCount;
+  unsigned long long inputValue;
+  if (!getField(in, inputCount) ||
+      !getNumber(inputCount, record.size(), inputValue)) {
+    return false;
+  }
+  // The run read these outside the trees, it may have done something else
+  // with different ones.
+  for (unsigned long long i = 0; i < inputValue; i++) {
+    string path, digest;
+    if (!getField(in, path) || !getField(in, digest) ||
+        inputDigest(path) != digest) {
+      index.save();
+      return false;
+    }
+  }
+  index.save();
+
+  // Don't touch anything unless we can restore all of it.
+  for (const auto& c : changes) {
+    if (c.kind == changedFile && !backend->hasBlob(c.content)) {
+      return false;
+    }
+  }
+  if (!backend->hasBlob(out) || !backend->hasBlob(err)) {
+    return false;
+  }
+
+  auto pathOf = [&](const change& c) {
+    return c.path.empty() ? trees[c.tree] : trees[c.tree] + "/" + c.path;
+  };
+  // Deepest first, so directories are empty by the time we get to them.
+  for (auto c = changes.rbegin(); c != changes.rend(); c++) {
+    if (c->kind == deleted) {
+      string path = pathOf(*c);
+      if (remove(path.c_str()) == -1 && errno != ENOENT) {
+        sysError(("Unable to remove " + path).c_str());
+      }
+    }
+  }
+  for (const auto& c : changes) {
+    if (c.kind != deleted) {
+      applyChange(pathOf(c), c, *backend);
+    }
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  backend->fetchBlob(out, STDOUT_FILENO);
+  backend->fetchBlob(err, STDERR_FILENO);
+  exitCode = codeValue;
+  return true;
+}
+
+string actionCache::captureFile(int& fd) {
+  string path;
+  fd = makeTemp(localDir + "/tmp", path);
+  return path;
+}
+
+void actionCache::record(
+    const string& key,
+    int exitCode,
+    const string& stdoutPath,
+    const string& stderrPath) {
+  vector<change> changes;
+  for (size_t i = 0; i < trees.size() && complete; i++) {
+    treeSnapshot after = snapshot(trees[i]);
+    for (const auto& e : before[i]) {
+      if (after.count(e.first) == 0) {
+        changes.push_back(change{i, deleted, 0, "", e.first});
+      }
+    }
+    for (const auto& e : after) {
+      auto old = before[i].find(e.first);
+      if (old == before[i].end() || old->second != e.second) {
+        changes.push_back(change{i, kindOf(e.second.mode), e.second.mode,
+                                 e.second.content, e.first});
+      }
+    }
+  }
+  index.save();
+
+  string out = fileSha256(stdoutPath);
+  string err = fileSha256(stderrPath);
+  // Something we cannot read now was not part of the key either.
+  if (complete && !out.empty() && !err.empty()) {
+    for (size_t i = 0; i < changes.size(); i++) {
+      const change& c = changes[i];
+      if (c.kind == changedFile && !backend->hasBlob(c.content)) {
+        string root = trees[c.tree];
+        string path = c.path.empty() ? root : root + "/" + c.path;
+        backend->storeBlob(c.content, path);
+      }
+    }
+    for (const auto& output : {make_pair(out, stdoutPath),
+                               make_pair(err, stderrPath)}) {
+      if (!backend->hasBlob(output.first)) {
+        backend->storeBlob(output.first, output.second);
+      }
+    }
+
+    string record;
+    putField(record, "dettrace action 2");
+    putField(record, to_string(exitCode));
+    putField(record, out);
+    putField(record, err);
+    putField(record, to_string(changes.size()));
+    for (const auto& c : changes) {
+      putField(record, to_string(c.tree));
+      putField(record, string(1, c.kind));
+      putField(record, to_string(c.mode));
+      putField(record, c.content);
+      putField(record, c.path);
+    }
+    putField(record, to_string(inputs.size()));
+    for (const auto& input : inputs) {
+      putField(record, input.first);
+      putField(record, input.second);
+    }
+    backend->writeAction(key, record);
+  }
+  unlink(stdoutPath.c_str());
+  unlink(stderrPath.c_str());
+}
+
+// =======================================================================================
+void teeOutput(int outPipe, int errPipe, int outCopy, int errCopy) {
+  struct pollfd fds[2] = {{outPipe, POLLIN, 0}, {errPipe, POLLIN, 0}};
+  const int copies[2] = {outCopy, errCopy};
+  const int ours[2] = {STDOUT_FILENO, STDERR_FILENO};
+  int open = 2;
+  char buf[65536];
+  while (open > 0) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      sysError("poll on tracee output");
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd == -1 || fds[i].revents == 0) {
+        continue;
+      }
+      ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        fds[i].fd = -1;
+        open--;
+        continue;
+      }
+      // Our own stdout going away must not stop the capture.
+      ssize_t passed = write(ours[i], buf, n);
+      (void)passed;
+      if (write(copies[i], buf, n) != n) {
+        sysError("Unable to capture tracee output");
+      }
+    }
+  }
+}
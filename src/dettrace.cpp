@@ -25,6 +25,7 @@
 #include "devrand.hpp"
 #include "execution.hpp"
 #include "logicalclock.hpp"
+#include "mountTrees.hpp"
 #include "seccomp.hpp"
 #include "tempfile.hpp"
 #include "util.hpp"
@@ -41,7 +42,8 @@ static int _dettrace_child(const CloneArgs* opts);
 static int runTracee(
     const TraceOptions& opts,
     const char* devrandFifoPath,
-    const char* devUrandFifoPath);
+    const char* devUrandFifoPath,
+    const char* vcpuDir);
 
 // See user_namespaces(7)
 static void update_map(char* mapping, char* map_file);
@@ -61,13 +63,14 @@ extern "C" pid_t dettrace(const TraceOptions* opts) {
   return -1;
 }
 
-static execution* globalExeObject = nullptr;
-
+/**
+ * Only async-signal-safe calls here, the tracer may be anywhere, e.g. in
+ * malloc. The main loop does the rest, see execution::timeoutExpired. Rearm,
+ * in case we went off between its check and a waitpid() that never returns.
+ */
 void sigalrmHandler(int _) {
-  VERIFY(nullptr != globalExeObject);
-  globalExeObject->killAllProcesses();
-  // TODO: print out message about timeout expiring
-  runtimeError("dettrace timeout expired\n");
+  execution::timeoutExpired = 1;
+  alarm(1);
 }
 
 /**
@@ -80,9 +83,10 @@ static bool fileExists(const char* file) {
 }
 
 /**
- * Wrapper around mount with strings.
+ * Recursively bind mount source onto target, see mountTrees::bind().
  */
-static void mountDir(const char* source, const char* target) {
+static void mountDir(
+    mountTrees& binds, const char* source, const char* target) {
   /* Check if source path exists*/
   if (!fileExists(source)) {
     runtimeError(
@@ -97,25 +101,17 @@ static void mountDir(const char* source, const char* target) {
         std::string{target} + ". Target file does not exist.\n");
   }
 
-  // TODO: Marking it as private here shouldn't be necessary since we already
-  // unshared the entire namespace as private? Notice that we want a bind mount,
-  // so MS_BIND is necessary. MS_REC is also necessary to properly work when
-  // mounting dirs that are themselves bind mounts, otherwise you will get an
-  // error EINVAL as per `man 2 mount`: EINVAL In an unprivileged mount
-  // namespace (i.e., a mount namespace owned by  a  user
-  //             namespace  that  was created by an unprivileged user), a bind
-  //             mount operation (MS_BIND)  was  attempted  without  specifying
-  //             (MS_REC),  which  would  have revealed the filesystem tree
-  //             underneath one of the submounts of the directory being bound.
-
-  // Note this line causes spurious false positives when running under valgrind.
-  // It's okay that these areguments are nullptr.
-  if (mount(source, target, nullptr, MS_BIND | MS_PRIVATE | MS_REC, nullptr) ==
-      -1) {
-    auto err = "Unable to bind mount: " + std::string{source} + " to " +
-               std::string{target};
-    sysError(err.c_str());
-  }
+  binds.bind(source, target, true);
+}
+
+/**
+ * Whether m is a bind mount, maybe read-only, and nothing else. Those go
+ * through mountTrees, e.g. every --volume.
+ */
+static bool isPlainBind(const Mount* m) {
+  return (m->flags & MS_BIND) &&
+         (m->flags & ~(MS_BIND | MS_REC | MS_RDONLY)) == 0 && m->source &&
+         m->target && !m->data;
 }
 
 /**
@@ -138,6 +134,105 @@ static void createFileIfNotExist(const std::string& path) {
   return;
 }
 
+/**
+ * Create a file with the given contents, or fail.
+ */
+static void writeFile(const std::string& path, const std::string& contents) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+  if (fd == -1) {
+    auto err = "Unable to create file: " + path;
+    sysError(err.c_str());
+  }
+  if (write(fd, contents.data(), contents.size()) != (ssize_t)contents.size()) {
+    auto err = "Unable to write file: " + path;
+    sysError(err.c_str());
+  }
+  close(fd);
+}
+
+/**
+ * Synthesize the /proc/cpuinfo, /proc/stat and /sys/devices/system/cpu views
+ * for --vcpus into dir, as cpuinfo, stat and cpu/. cpuinfo describes the CPU of
+ * the canonical CPUID values in execution.cpp, and the counters in stat are
+ * all zero since they only tell how busy the host is.
+ */
+static void writeVcpuViews(
+    const std::string& dir, unsigned vcpus, time_t epoch) {
+  std::string n = std::to_string(vcpus);
+  std::string cpuinfo;
+  // Field names are padded with tabs like the real thing.
+  auto field = [&cpuinfo](const char* name, const std::string& value) {
+    cpuinfo += std::string{name} + "\t: " + value + "\n";
+  };
+  for (unsigned i = 0; i < vcpus; i++) {
+    std::string id = std::to_string(i);
+    field("processor", id);
+    field("vendor_id", "GenuineIntel");
+    field("cpu family", "6");
+    field("model\t", "6");
+    field("model name", "QEMU Virtual CPU version 2.5+");
+    field("stepping", "3");
+    field("cpu MHz\t", "2000.000");
+    field("physical id", "0");
+    field("siblings", n);
+    field("core id\t", id);
+    field("cpu cores", n);
+    field("apicid\t", id);
+    field("fpu\t", "yes");
+    field("cpuid level", "13");
+    field(
+        "flags\t",
+        "fpu de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 "
+        "clflush mmx fxsr sse sse2 syscall nx lm pni cx16 x2apic hypervisor "
+        "lahf_lm");
+    field("bogomips", "4000.00");
+    field("clflush size", "64");
+    field("cache_alignment", "64");
+    field("address sizes", "40 bits physical, 48 bits virtual");
+    cpuinfo += "\n";
+  }
+  writeFile(dir + "/cpuinfo", cpuinfo);
+
+  const std::string zeros = " 0 0 0 0 0 0 0 0 0 0\n";
+  std::string stat = "cpu " + zeros;
+  for (unsigned i = 0; i < vcpus; i++) {
+    stat += "cpu" + std::to_string(i) + zeros;
+  }
+  stat += "intr 0\nctxt 0\nbtime " + std::to_string(epoch) +
+          "\nprocesses 1\nprocs_running 1\nprocs_blocked 0\nsoftirq 0\n";
+  writeFile(dir + "/stat", stat);
+
+  std::string cpuDir = dir + "/cpu";
+  doWithCheck(mkdir(cpuDir.c_str(), 0755), "mkdir vcpus cpu directory");
+  std::string range =
+      vcpus == 1 ? "0\n" : "0-" + std::to_string(vcpus - 1) + "\n";
+  writeFile(cpuDir + "/online", range);
+  writeFile(cpuDir + "/possible", range);
+  writeFile(cpuDir + "/present", range);
+  // Older libcs count the cpuN directories instead.
+  for (unsigned i = 0; i < vcpus; i++) {
+    std::string cpu = cpuDir + "/cpu" + std::to_string(i);
+    doWithCheck(mkdir(cpu.c_str(), 0755), "mkdir vcpus cpuN directory");
+  }
+}
+
+/**
+ * Remove what writeVcpuViews created, and dir itself.
+ */
+static void removeVcpuViews(const std::string& dir, unsigned vcpus) {
+  std::string cpuDir = dir + "/cpu";
+  for (unsigned i = 0; i < vcpus; i++) {
+    rmdir((cpuDir + "/cpu" + std::to_string(i)).c_str());
+  }
+  unlink((cpuDir + "/online").c_str());
+  unlink((cpuDir + "/possible").c_str());
+  unlink((cpuDir + "/present").c_str());
+  rmdir(cpuDir.c_str());
+  unlink((dir + "/cpuinfo").c_str());
+  unlink((dir + "/stat").c_str());
+  rmdir(dir.c_str());
+}
+
 static pid_t _dettrace(const TraceOptions* opts) {
   if (!opts) {
     return -1;
@@ -273,6 +368,16 @@ static int _dettrace_child(const CloneArgs* clone_args) {
     close(fd);
   }
 
+  // The synthesized CPU views for --vcpus. Bind mounted by the tracee, removed
+  // by us once it is done.
+  char vcpuDir[] = "/tmp/dt-XXXXXX";
+  if (opts->vcpus != 0) {
+    if (mkdtemp(vcpuDir) == nullptr) {
+      sysError("failed to mkdtemp vcpus directory");
+    }
+    writeVcpuViews(vcpuDir, opts->vcpus, opts->epoch);
+  }
+
   pid_t pid = fork();
   if (pid < 0) {
     runtimeError("fork() failed.\n");
@@ -294,7 +399,8 @@ static int _dettrace_child(const CloneArgs* clone_args) {
               "none", "/dev/pts", "devpts", MS_MGC_VAL,
               "newinstance,ptmxmode=0666"),
           "tracer mounting devpts failed");
-      mountDir("/dev/ptmx", "/dev/pts/ptmx");
+      mountTrees binds;
+      mountDir(binds, "/dev/ptmx", "/dev/pts/ptmx");
     }
 
     if (!fileExists(devrandFifoPath)) {
@@ -325,6 +431,12 @@ static int _dettrace_child(const CloneArgs* clone_args) {
 
     const char* log_file = opts->log_file ? opts->log_file : "";
 
+    traceLimits limits;
+    limits.maxSystemCallEvents = opts->max_syscall_events;
+    limits.maxProcesses = opts->max_processes;
+    limits.maxLogicalTime = chrono::microseconds(opts->max_logical_time);
+    limits.maxBlockedReplays = opts->max_blocked_replays;
+
     execution exe{opts->debug_level,
                   pid,
                   opts->use_color,
@@ -338,9 +450,18 @@ static int _dettrace_child(const CloneArgs* clone_args) {
                   chrono::microseconds(opts->clock_step),
                   opts->sys_enter,
                   opts->sys_exit,
-                  opts->user_data};
+                  opts->user_data,
+                  opts->metrics,
+                  opts->metrics_interval,
+                  limits,
+                  opts->vcpus,
+                  opts->spin_wait,
+                  opts->time_shim,
+                  opts->path_inodes,
+                  opts->handler_trace ? opts->handler_trace : "",
+                  opts->file_access,
+                  opts->file_access_data};
 
-    globalExeObject = &exe;
     struct sigaction sa;
     sa.sa_handler = sigalrmHandler;
     doWithCheck(sigemptyset(&sa.sa_mask), "sigemptyset");
@@ -348,7 +469,23 @@ static int _dettrace_child(const CloneArgs* clone_args) {
     doWithCheck(sigaction(SIGALRM, &sa, NULL), "sigaction(SIGALRM)");
     alarm(opts->timeout);
 
-    int exit_code = exe.runProgram();
+    int exit_code;
+    try {
+      exit_code = exe.runProgram();
+    } catch (...) {
+      // Whatever we were doing, maybe a waitpid() failing with EINTR, a
+      // timeout is why we stopped.
+      if (execution::timeoutExpired) {
+        alarm(0);
+        exe.killAllProcesses();
+      }
+      exe.dumpFlightRecorder();
+      exe.flushHandlerTrace();
+      if (execution::timeoutExpired) {
+        runtimeError("dettrace timeout expired\n");
+      }
+      throw;
+    }
 
     // Clean up
     dev_random.shutdown();
@@ -363,6 +500,9 @@ static int _dettrace_child(const CloneArgs* clone_args) {
 
     unlink(devrandFifoPath);
     unlink(devUrandFifoPath);
+    if (opts->vcpus != 0) {
+      removeVcpuViews(vcpuDir, opts->vcpus);
+    }
 
     return exit_code;
   } else if (pid == 0) {
@@ -370,7 +510,9 @@ static int _dettrace_child(const CloneArgs* clone_args) {
     doWithCheck(
         read(pipefds[0], &ready, sizeof(int)), "spawnTracerTracee, pipe read");
     VERIFY(ready == 1);
-    return runTracee(*opts, devrandFifoPath, devUrandFifoPath);
+    return runTracee(
+        *opts, devrandFifoPath, devUrandFifoPath,
+        opts->vcpus != 0 ? vcpuDir : nullptr);
   }
 
   return -1;
@@ -380,7 +522,8 @@ static int _dettrace_child(const CloneArgs* clone_args) {
 static int runTracee(
     const TraceOptions& opts,
     const char* devrandFifoPath,
-    const char* devUrandFifoPath) {
+    const char* devUrandFifoPath,
+    const char* vcpuDir) {
   // Set stdio file descriptors. This gives the parent process the ability to
   // control the stdio file descriptors. Note that dup2 closes the destination
   // file descriptor and will do nothing if both file descriptor arguments are
@@ -402,6 +545,8 @@ static int runTracee(
   }
 
   if ((opts.clone_ns_flags & CLONE_NEWNS) == CLONE_NEWNS) {
+    mountTrees binds;
+
     if (!fileExists("/dev/null")) {
       // we're running under reprotest as sudo, so we can use real mknod
       // hat tip to:
@@ -414,9 +559,9 @@ static int runTracee(
 
     if (opts.with_devrand_overrides) {
       createFileIfNotExist("/dev/random");
-      mountDir(devrandFifoPath, "/dev/random");
+      mountDir(binds, devrandFifoPath, "/dev/random");
       createFileIfNotExist("/dev/urandom");
-      mountDir(devUrandFifoPath, "/dev/urandom");
+      mountDir(binds, devUrandFifoPath, "/dev/urandom");
     }
 
     // if (opts.mount.chroot_dir) {
@@ -439,8 +584,19 @@ static int runTracee(
     if (opts.mounts) {
       auto mounts = opts.mounts;
 
+      for (auto m = mounts; *m; ++m) {
+        if (isPlainBind(*m)) {
+          binds.prepare(
+              (*m)->source, (*m)->flags & MS_REC, (*m)->flags & MS_RDONLY);
+        }
+      }
+
       while (const Mount* m = *mounts) {
-        if (mount(m->source, m->target, m->fstype, m->flags, m->data) == -1) {
+        if (isPlainBind(m)) {
+          binds.bind(
+              m->source, m->target, m->flags & MS_REC, m->flags & MS_RDONLY);
+        } else if (
+            mount(m->source, m->target, m->fstype, m->flags, m->data) == -1) {
           auto err = "Unable to bind mount: " +
                      std::string{m->source ? m->source : "none"} + " to " +
                      std::string{m->target ? m->target : "none"};
@@ -450,6 +606,17 @@ static int runTracee(
       }
     }
 
+    // After the other mounts, so --vcpus wins over the static /proc/stat.
+    if (vcpuDir) {
+      const std::string dir{vcpuDir};
+      mountDir(binds, (dir + "/cpuinfo").c_str(), "/proc/cpuinfo");
+      mountDir(binds, (dir + "/stat").c_str(), "/proc/stat");
+      // Not every container has a sysfs.
+      if (fileExists("/sys/devices/system/cpu")) {
+        mountDir(binds, (dir + "/cpu").c_str(), "/sys/devices/system/cpu");
+      }
+    }
+
     // chroot
     if (opts.chroot_dir) {
       if (chroot(opts.chroot_dir) == -1) {
@@ -485,7 +652,8 @@ static int runTracee(
   // Set up seccomp + bpf filters using libseccomp.
   // Default action to take when no rule applies to system call. We send a
   // PTRACE_SECCOMP event message to the tracer with a unique data: INT16_MAX
-  seccomp myFilter{opts.debug_level, opts.convert_uids};
+  seccomp myFilter{opts.debug_level, opts.convert_uids, opts.vcpus != 0,
+                   opts.file_access != nullptr};
 
   // Stop ourselves until the tracer is ready. This ensures the tracer has time
   // to get set up.
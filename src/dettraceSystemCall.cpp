@@ -10,6 +10,7 @@
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/select.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -32,6 +33,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <ucontext.h>
 #include <utime.h>
 #include <unordered_map>
 
@@ -39,6 +41,7 @@
 
 #include "dettraceSystemCall.hpp"
 #include "execution.hpp"
+#include "ioUring.hpp"
 #include "ptracer.hpp"
 #include "utilSystemCalls.hpp"
 
@@ -49,7 +52,18 @@
 
 using namespace std;
 
+// Sleep and time system calls in a row before a sleeping thread is parked.
+// Go's sysmon makes two or three per loop iteration.
+static const uint32_t idlePollsBeforeParking = 4;
+
 static bool fd_is_nonblocking(state& s, int fd);
+static void retryTransferUntilComplete(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int countArg,
+    bool nonBlocking);
 
 // =======================================================================================
 bool accessSystemCall::handleDetPre(
@@ -95,16 +109,7 @@ void arch_prctlSystemCall::handleDetPost(
         "set.");
   }
 
-  // arch_prctl could return ENODEV when `cpuid_fault` flag is absent (cpuinfo).
-  if (0 != t.getReturnValue()) {
-    string errmsg("cpuid interception (cpuid_fault) via arch_prctl failed: ");
-    errmsg += strerror(-t.getReturnValue());
-    errmsg += "\nPlease check `cpuid_fault` flag from `cat /proc/cpuinfo`";
-    gs.log.writeToLog(Importance::inter, errmsg);
-    gs.allow_trapCPUID = false;
-  } else {
-    s.CPUIDTrapSet = true;
-  }
+  cpuidTrapResult(gs, s, t.getReturnValue());
 
   s.syscallInjected = false;
   // I don't believe arch_prctl(ARCH_SET_CPUID) writes to tracee memory at all.
@@ -133,12 +138,26 @@ bool chdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
 
-  return false;
+  return true;
 }
 
 void chdirSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  if (t.getReturnValue() == 0) {
+    fileOpened(gs, s, AT_FDCWD);
+  }
+}
+// =======================================================================================
+bool fchdirSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return true;
+}
+
+void fchdirSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.getReturnValue() == 0) {
+    fileOpened(gs, s, AT_FDCWD);
+  }
 }
 // =======================================================================================
 bool chmodSystemCall::handleDetPre(
@@ -160,6 +179,9 @@ bool clock_gettimeSystemCall::handleDetPre(
 void clock_gettimeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   gs.timeCalls++;
+  // With --time-shim we only see every so many calls, or the ones it could not
+  // serve.
+  gs.timeShimCalls += s.syncTimeShim();
   struct timespec* tp = (struct timespec*)t.arg2();
 
   if (tp != nullptr) {
@@ -190,6 +212,7 @@ void closeSystemCall::handleDetPost(
   if (result != s.dirEntries.end()) {
     gs.log.writeToLog(
         Importance::info, "Removing directory entries for fd: %d!\n", fd);
+    gs.dirEntriesResized(result->second.memoryBytes(), 0);
     s.dirEntries.erase(result);
   }
 
@@ -208,6 +231,10 @@ void closeSystemCall::handleDetPost(
   if (s.fd_is_signalfd(fd)) {
     s.signalfds->erase(fd);
   }
+  s.unwrittenFds->erase(fd);
+  s.ioUrings->erase(fd);
+  s.unixSockets->erase(fd);
+  fileClosed(gs, s, fd);
 }
 // =======================================================================================
 // TODO
@@ -245,7 +272,11 @@ bool connectSystemCall::handleDetPre(
 
 void connectSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  // A Unix listener with a full backlog.
+  int fd = (int)t.arg1();
+  if (s.fd_is_unix(fd) && !fd_is_nonblocking(s, fd)) {
+    replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+  }
 }
 // =======================================================================================
 bool creatSystemCall::handleDetPre(
@@ -268,8 +299,11 @@ void creatSystemCall::handleDetPost(
   // here to be safe. (Not sure how we could use this information to optimze
   // anyways.)
   auto inode = readInodeFor(gs.log, s.traceePid, t.getReturnValue());
-  gs.mtimeMap[inode] = s.getLogicalTime();
-  gs.inodeMap.addRealValue(inode);
+  gs.setMtime(inode, s, false);
+  gs.inodeMap.addRealValue(
+      inode, inodePathFor(gs, s.traceePid, t.getReturnValue()));
+  (*s.unwrittenFds)[t.getReturnValue()] = inode;
+  fileOpened(gs, s, t.getReturnValue());
   s.incrementTime();
 
   return;
@@ -289,6 +323,10 @@ void dupSystemCall::handleDetPost(
   }
 
   // dup succeeded.
+  s.copyUnwrittenFd(fd, newfd);
+  s.copyIoUringFd(fd, newfd);
+  s.copyUnixSocketFd(fd, newfd);
+  copyOpenFile(gs, s, fd, newfd);
   if (s.countFdStatus(fd) != 0) { // Only for pipes
     s.setFdStatus(newfd, s.getFdStatus(fd)); // copy over status.
     if (s.fd_is_remote(fd)) {
@@ -313,6 +351,10 @@ void dup2SystemCall::handleDetPost(
   }
 
   // dup2 succeeded.
+  s.copyUnwrittenFd(fd, newfd);
+  s.copyIoUringFd(fd, newfd);
+  s.copyUnixSocketFd(fd, newfd);
+  copyOpenFile(gs, s, fd, newfd);
   if (s.countFdStatus(fd) != 0) { // Only for pipes
 
     // Semantics of dup2 say old fd could be closed and overwritten, we do that
@@ -331,6 +373,16 @@ void dup2SystemCall::handleDetPost(
     gs.log.writeToLog(Importance::info, "%d = dup2(%d)\n", newfd, fd);
   }
 }
+// =======================================================================================
+bool dup3SystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return true;
+}
+
+void dup3SystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  dup2SystemCall::handleDetPost(gs, s, t, sched);
+}
 
 static const char* epoll_op(int op) {
   switch (op) {
@@ -521,6 +573,10 @@ bool execveSystemCall::handleDetPre(
     gs.log.writeToLogNoFormat(Importance::info, msg2);
   }
 
+  // The time shim goes away with the address space, keep its clock. Should the
+  // execve fail the shim just carries on.
+  gs.timeShimCalls += s.syncTimeShim();
+
   // WARNING: Never change this, there is no execve post-hook event. You will
   // end up and the next system call. In the past, we have seen a brk.
   return false;
@@ -616,6 +672,12 @@ bool fcntlSystemCall::handleDetPre(
   if (cmd == F_GETFD) {
     return false;
   }
+  // Unix sockets stay non-blocking in the kernel, we only remember what the
+  // user asked for.
+  if (cmd == F_SETFL && s.fd_is_unix((int)t.arg1())) {
+    s.originalArg3 = t.arg3();
+    t.writeArg3(t.arg3() | O_NONBLOCK);
+  }
   return true;
 }
 
@@ -630,10 +692,14 @@ void fcntlSystemCall::handleDetPost(
       Importance::extra, "fcntl(" + to_string(fd) + ", " + to_string(cmd) +
                              "..) = " + to_string(retval) + "\n");
 
-  if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
+  if ((cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) && retval >= 0) {
     auto str = "found fcntl(%d, FDUPFD || F_DUPFD_CLOCEXEC) = %d\n";
     int newfd = retval;
     gs.log.writeToLog(Importance::info, str, fd, newfd);
+    s.copyUnwrittenFd(fd, newfd);
+    s.copyIoUringFd(fd, newfd);
+    s.copyUnixSocketFd(fd, newfd);
+    copyOpenFile(gs, s, fd, newfd);
     auto it = s.fdStatus.get()->find(fd);
     auto end = s.fdStatus.get()->end();
     if (it != end) {
@@ -652,6 +718,18 @@ void fcntlSystemCall::handleDetPost(
     }
   }
 
+  if (cmd == F_SETFL && s.fd_is_unix(fd)) {
+    t.writeArg3(s.originalArg3);
+    arg = s.originalArg3;
+    if (retval == 0 && (arg & O_NONBLOCK) == 0) {
+      (*s.fdStatus.get())[fd] = descriptorType::blocking;
+    }
+  }
+  if (cmd == F_GETFL && retval >= 0 && s.fd_is_unix(fd) &&
+      !fd_is_nonblocking(s, fd)) {
+    t.setReturnRegister(retval & ~O_NONBLOCK);
+  }
+
   // User attempting to change blocked status.
   if (cmd == F_SETFL && ((arg & O_NONBLOCK) != 0)) {
     gs.log.writeToLog(
@@ -673,6 +751,19 @@ void faccessatSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+bool fchmodatSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  printInfoString(t.arg2(), gs.log, s.traceePid, t);
+
+  return false;
+}
+
+void fchmodatSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  runtimeError("fchmodat post hook should never be called.");
+  return;
+}
+// =======================================================================================
 bool fgetxattrSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return true;
@@ -1050,6 +1141,7 @@ void gettimeofdaySystemCall::handleDetPost(
       Importance::info, "Inside gettimeofday post-hook, sending tv_sec=%d\n",
       s.getLogicalTime().time_since_epoch().count());
   gs.timeCalls++;
+  gs.timeShimCalls += s.syncTimeShim();
   struct timeval* tp = (struct timeval*)t.arg1();
   if (nullptr != tp) {
     const auto myTv = logical_clock::to_timeval(s.getLogicalTime());
@@ -1193,6 +1285,347 @@ void ioctlSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+bool io_uring_setupSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  auto paramsPtr =
+      traceePtr<struct io_uring_params>((struct io_uring_params*)t.arg2());
+  if (paramsPtr.ptr == nullptr) {
+    // Fails with EFAULT.
+    return true;
+  }
+
+  if (!ioUring::supported()) {
+    gs.log.writeToLog(
+        Importance::inter,
+        "io_uring_setup: kernel cannot share rings with us, failing with "
+        "ENOSYS\n");
+    failSystemCall(gs, s, t, ENOSYS);
+    return false;
+  }
+
+  auto params = t.readFromTracee(paramsPtr, s.traceePid);
+  if (!ioUring::allowedSetupFlags(params.flags)) {
+    gs.log.writeToLog(
+        Importance::inter, "io_uring_setup: unsupported flags 0x%x\n",
+        params.flags);
+    failSystemCall(gs, s, t, EINVAL);
+    return false;
+  }
+  return true;
+}
+
+void io_uring_setupSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int fd = t.getReturnValue();
+  if (fd < 0) {
+    return;
+  }
+
+  auto params = t.readFromTracee(
+      traceePtr<struct io_uring_params>((struct io_uring_params*)t.arg2()),
+      s.traceePid);
+  pid_t tgid = gs.threadGroupNumber.at(s.traceePid);
+  (*s.ioUrings)[fd] = make_shared<ioUring>(tgid, fd, params);
+  gs.log.writeToLog(
+      Importance::info, "io_uring_setup: fd %d, %u sqes, %u cqes\n", fd,
+      params.sq_entries, params.cq_entries);
+}
+// =======================================================================================
+/**
+ * Whether we can let sqe of s through, see ioUring. Reads and writes have to
+ * be on regular files, a pipe or socket could wait on a tracee we are not
+ * running. Registered files are not allowed as we cannot tell what they are.
+ * We also need exactly one completion per submission.
+ */
+static bool determinizable(state& s, const struct io_uring_sqe& sqe) {
+  if (!ioUring::allowedOpcode(sqe.opcode) ||
+      (sqe.flags & (IOSQE_FIXED_FILE | IOSQE_CQE_SKIP_SUCCESS)) != 0) {
+    return false;
+  }
+
+  switch (sqe.opcode) {
+  case IORING_OP_READV:
+  case IORING_OP_WRITEV:
+  case IORING_OP_READ_FIXED:
+  case IORING_OP_WRITE_FIXED:
+  case IORING_OP_READ:
+  case IORING_OP_WRITE: {
+    hostTraceeQuery(s.traceePid);
+    string path =
+        "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(sqe.fd);
+    struct stat st;
+    // Bad descriptors fail the same way every time.
+    return stat(path.c_str(), &st) == -1 || S_ISREG(st.st_mode);
+  }
+  default:
+    return true;
+  }
+}
+
+bool io_uring_enterSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int fd = t.arg1();
+  uint32_t toSubmit = t.arg2();
+  uint32_t minComplete = t.arg3();
+  uint32_t flags = t.arg4();
+
+  auto it = s.ioUrings->find(fd);
+  if (it == s.ioUrings->end()) {
+    // Not a ring, or one we did not see being set up.
+    gs.log.writeToLog(
+        Importance::inter, "io_uring_enter: unknown ring %d\n", fd);
+    failSystemCall(gs, s, t, EOPNOTSUPP);
+    return false;
+  }
+  if ((flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG)) != 0) {
+    gs.log.writeToLog(
+        Importance::inter, "io_uring_enter: unsupported flags 0x%x\n", flags);
+    failSystemCall(gs, s, t, EINVAL);
+    return false;
+  }
+  ioUring& ring = *it->second;
+
+  // Every submission needs room for its completion, so that all of them are
+  // in the ring by the time we return.
+  uint32_t ready = ring.readyCompletions();
+  uint32_t room =
+      ring.completionEntries() - min(ready, ring.completionEntries());
+  uint32_t queued = min(min(toSubmit, ring.queuedSubmissions()), room);
+
+  // The kernel fails a rejected submission, and posts its completion, right
+  // away instead of after the ones before it. So we submit the allowed ones
+  // up to the first rejected one, then the rejected one on its own, and
+  // replay the call for the rest from the post hook.
+  ring.inFlight.clear();
+  for (uint32_t i = 0; i < queued; i++) {
+    struct io_uring_sqe* sqe = ring.submission(i);
+    if (sqe == nullptr) {
+      gs.log.writeToLog(
+          Importance::info, "io_uring_enter: invalid submission index\n");
+      break;
+    }
+
+    bool allowed = determinizable(s, *sqe);
+    if (!allowed && i > 0) {
+      break;
+    }
+    if (!allowed) {
+      gs.log.writeToLog(
+          Importance::info, "io_uring_enter: rejecting opcode %u on fd %d\n",
+          sqe->opcode, sqe->fd);
+      sqe->opcode = ioUring::rejectedOpcode;
+    }
+    // One at a time in submission order, so completions are posted in that
+    // order too.
+    sqe->flags |= IOSQE_IO_DRAIN;
+    ring.inFlight.push_back({sqe->opcode, sqe->fd});
+    if (!allowed) {
+      break;
+    }
+  }
+  uint32_t submitting = ring.inFlight.size();
+
+  if (!ring.continuing && submitting == 0 &&
+      (flags & IORING_ENTER_GETEVENTS) != 0 && minComplete > ready) {
+    // Everything we let through has completed, only another tracee sharing
+    // the ring can change that. Without one the call would block forever,
+    // fail it as if a signal had interrupted the wait.
+    bool shared = s.ioUrings.use_count() > 1 || it->second.use_count() > 1;
+    if (!shared) {
+      gs.log.writeToLog(
+          Importance::info,
+          "io_uring_enter would block forever, failing with EINTR\n");
+      failSystemCall(gs, s, t, EINTR);
+      return false;
+    }
+    gs.log.writeToLog(
+        Importance::info, "io_uring_enter would have blocked! Replaying\n");
+    countBlockedReplay(gs, s);
+    cancelSystemCall(gs, s, t);
+    sched.preemptAndScheduleNext();
+    replaySystemCall(gs, t, SYS_io_uring_enter);
+    return false;
+  }
+
+  gs.log.writeToLog(
+      Importance::info, "io_uring_enter: submitting %u of %u, %u ready\n",
+      submitting, toSubmit, ready);
+  if (!ring.continuing) {
+    s.originalArg2 = toSubmit;
+    s.originalArg3 = minComplete;
+    s.originalArg4 = flags;
+    s.originalArg5 = t.arg5();
+    ring.submittedBefore = 0;
+  }
+  ring.continuing = false;
+  ring.completionsBefore = ready;
+  t.writeArg2(submitting);
+  t.writeArg3(ready + submitting);
+  t.writeArg4(flags | IORING_ENTER_GETEVENTS);
+
+  if ((flags & IORING_ENTER_EXT_ARG) != 0 && t.arg5() != 0) {
+    auto argPtr = traceePtr<struct io_uring_getevents_arg>(
+        (struct io_uring_getevents_arg*)t.arg5());
+    auto arg = t.readFromTracee(argPtr, s.traceePid);
+    if (arg.ts != 0) {
+      // A timeout could end the wait before our submissions complete.
+      arg.ts = 0;
+      auto copy = traceePtr<struct io_uring_getevents_arg>(
+          (struct io_uring_getevents_arg*)s.mmapMemory.getAddr().ptr);
+      t.writeToTracee(copy, arg, s.traceePid);
+      t.writeArg5((uint64_t)copy.ptr);
+    }
+  }
+  return true;
+}
+
+void io_uring_enterSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  ioUring& ring = *s.ioUrings->at((int)t.arg1());
+  t.writeArg3(s.originalArg3);
+  t.writeArg4(s.originalArg4);
+  t.writeArg5(s.originalArg5);
+
+  long submitted = t.getReturnValue();
+  gs.log.writeToLog(
+      Importance::info, "io_uring_enter submitted %ld\n", submitted);
+
+  bool more = false;
+  if (submitted > 0) {
+    // Completions follow submission order, see handleDetPre.
+    uint32_t completed = ring.readyCompletions() - ring.completionsBefore;
+    for (uint32_t i = 0; i < ring.inFlight.size() && i < completed; i++) {
+      const auto& op = ring.inFlight[i];
+      if (ioUring::isWrite(op.opcode) &&
+          ring.completion(ring.completionsBefore + i).res > 0) {
+        noteFdWritten(gs, s, op.fd);
+      }
+    }
+    gs.ioUringOperations += submitted;
+    ring.submittedBefore += submitted;
+
+    // The kernel stops at a failed submission unless the ring submits all.
+    bool stopped = (size_t)submitted < ring.inFlight.size() ||
+                   (ring.inFlight.back().opcode == ioUring::rejectedOpcode &&
+                    !ring.submitsAll());
+    more = !stopped && ring.submittedBefore < s.originalArg2 &&
+           ring.queuedSubmissions() > 0;
+  }
+  ring.inFlight.clear();
+
+  if (more) {
+    gs.log.writeToLog(
+        Importance::info, "io_uring_enter: replaying for the rest\n");
+    ring.continuing = true;
+    t.writeArg2(s.originalArg2 - ring.submittedBefore);
+    replaySystemCall(gs, t, SYS_io_uring_enter);
+    return;
+  }
+
+  t.writeArg2(s.originalArg2);
+  if (ring.submittedBefore > 0) {
+    t.setReturnRegister(ring.submittedBefore);
+  }
+  ring.submittedBefore = 0;
+}
+// =======================================================================================
+bool io_uring_registerSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  unsigned opcode = t.arg2();
+  if (!ioUring::allowedRegisterOpcode(opcode)) {
+    gs.log.writeToLog(
+        Importance::inter, "io_uring_register: unsupported opcode %u\n",
+        opcode);
+    failSystemCall(gs, s, t, EINVAL);
+    return false;
+  }
+  return opcode == IORING_REGISTER_PROBE;
+}
+
+void io_uring_registerSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.getReturnValue() < 0) {
+    return;
+  }
+
+  // Only advertise operations io_uring_enter lets through.
+  size_t count = min((size_t)t.arg4(), (size_t)256);
+  size_t bytes =
+      sizeof(struct io_uring_probe) + count * sizeof(struct io_uring_probe_op);
+  vector<uint8_t> buffer(bytes);
+  traceePtr<uint8_t> probePtr((uint8_t*)t.arg3());
+  doWithCheck(
+      readVmTraceeRaw(probePtr, buffer.data(), bytes, s.traceePid),
+      "io_uring_register: unable to read probe");
+  auto probe = (struct io_uring_probe*)buffer.data();
+  for (size_t i = 0; i < probe->ops_len && i < count; i++) {
+    if (!ioUring::allowedOpcode(probe->ops[i].op)) {
+      probe->ops[i].flags &= ~IO_URING_OP_SUPPORTED;
+    }
+  }
+  writeVmTraceeRaw(buffer.data(), probePtr, bytes, s.traceePid);
+}
+// =======================================================================================
+bool killSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "kill(pid = %d, signal = %d)\n", (int)t.arg1(),
+      (int)t.arg2());
+  return true;
+}
+
+void killSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  pid_t pid = (pid_t)t.arg1();
+  int signal = (int)t.arg2();
+  if (t.getReturnValue() != 0 || signal == 0) {
+    return;
+  }
+
+  if (pid > 0) {
+    auto target = gs.hostPids.find(pid);
+    if (target != gs.hostPids.end()) {
+      auto group = gs.threadGroupNumber.find(target->second);
+      if (group != gs.threadGroupNumber.end()) {
+        signalSent(gs, sched, group->second, signal, true);
+      }
+    }
+    return;
+  }
+
+  // A process group, or with -1 everybody but ourselves and init. A group
+  // whose leader is gone is not ours to find, its members go without.
+  pid_t pgid = -1;
+  if (pid != -1) {
+    // Process groups are only known to the kernel, see getpgid below.
+    hostTraceeQuery(s.traceePid);
+  }
+  if (pid == 0) {
+    pgid = getpgid(s.traceePid);
+  } else if (pid < -1) {
+    auto leader = gs.hostPids.find(-pid);
+    if (leader == gs.hostPids.end()) {
+      return;
+    }
+    pgid = leader->second;
+  }
+  pid_t self = gs.threadGroupNumber.at(s.traceePid);
+  for (const auto& member : gs.threadGroupNumber) {
+    pid_t process = member.second;
+    state* processState =
+        gs.states != nullptr ? gs.states->find(process) : nullptr;
+    // Once per thread group.
+    if (member.first != process || processState == nullptr) {
+      continue;
+    }
+    bool receives = pid == -1 ? process != self && processState->vpid != 1
+                              : getpgid(process) == pgid;
+    if (receives) {
+      signalSent(gs, sched, process, signal, true);
+    }
+  }
+}
+// =======================================================================================
 // TODO
 bool llistxattrSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -1243,17 +1676,65 @@ void mmapSystemCall::handleDetPost(
   }
 }
 // =======================================================================================
-bool nanosleepSystemCall::handleDetPre(
-    globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // Write 0 seconds to time. Required to skip waiting at all.
-  struct timespec* req = (struct timespec*)t.arg1();
+/**
+ * Shared by nanosleep and clock_nanosleep: park the thread if it is polling,
+ * then make the sleep return right away.
+ * @param reqArg argument holding the requested struct timespec, 1 or 3
+ * @param absolute the request is an absolute time (TIMER_ABSTIME)
+ */
+static void skipSleep(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int reqArg,
+    bool absolute) {
+  struct timespec* req =
+      (struct timespec*)(reqArg == 1 ? t.arg1() : t.arg3());
+
+  // With the sleep gone, a thread that only sleeps and checks the time (Go's
+  // sysmon, JVM housekeeping threads) spins through zero length sleeps and
+  // gets scheduled over and over while the threads it waits on sit idle. Park
+  // it instead, one clock step of the requested sleep per system call other
+  // threads make, see isIdlePoll in execution.cpp.
+  if (req != nullptr && s.idlePolls > idlePollsBeforeParking) {
+    uint64_t steps = 1;
+    if (!absolute) {
+      struct timespec sleep =
+          t.readFromTracee(traceePtr<struct timespec>(req), s.traceePid);
+      if (sleep.tv_sec < 0 || sleep.tv_nsec < 0 ||
+          sleep.tv_nsec >= 1000000000) {
+        // Leave the request alone, the kernel fails it with EINVAL.
+        return;
+      }
+      auto requested = chrono::seconds(sleep.tv_sec) +
+                       chrono::nanoseconds(sleep.tv_nsec);
+      steps = chrono::duration_cast<logical_clock::duration>(requested) /
+              s.getClockStep();
+    }
+    gs.log.writeToLog(
+        Importance::info, "Sleeping after %u polls, parking.\n", s.idlePolls);
+    sched.parkAndScheduleNext(steps);
+  }
+
+  // Write 0 seconds to time. Required to skip waiting at all. As an absolute
+  // time this is long gone, so that returns right away too.
   if (req != nullptr) {
     struct timespec* myReq = (timespec*)s.mmapMemory.getAddr().ptr;
     struct timespec localReq = {0};
 
     t.writeToTracee(traceePtr<struct timespec>(myReq), localReq, s.traceePid);
-    t.writeArg1((uint64_t)myReq);
+    if (reqArg == 1) {
+      t.writeArg1((uint64_t)myReq);
+    } else {
+      t.writeArg3((uint64_t)myReq);
+    }
   }
+}
+
+bool nanosleepSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  skipSleep(gs, s, t, sched, 1, false);
   return false;
 }
 
@@ -1262,6 +1743,17 @@ void nanosleepSystemCall::handleDetPost(
   runtimeError("nanosleep post-hook should never be called.");
 }
 // =======================================================================================
+bool clock_nanosleepSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  skipSleep(gs, s, t, sched, 3, (t.arg2() & TIMER_ABSTIME) != 0);
+  return false;
+}
+
+void clock_nanosleepSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  runtimeError("clock_nanosleep post-hook should never be called.");
+}
+// =======================================================================================
 bool mkdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
@@ -1277,8 +1769,9 @@ void mkdirSystemCall::handleDetPost(
         t.readTraceeCString(traceePtr<char>((char*)t.arg1()), s.traceePid);
     auto inode = inode_from_tracee(strPath, s.traceePid, gs.log, -1);
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, strPath, s.traceePid, -1));
       s.incrementTime();
     }
   }
@@ -1299,8 +1792,9 @@ void mkdiratSystemCall::handleDetPost(
     string strPath = t.readTraceeCString(traceePtr<char>(path), s.traceePid);
     auto inode = inode_from_tracee(strPath, s.traceePid, gs.log, t.arg1());
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, strPath, s.traceePid, t.arg1()));
       s.incrementTime();
     }
   }
@@ -1448,6 +1942,7 @@ bool pipeSystemCall::handleDetPre(
       Importance::info, "Making this pipe non-blocking via pipe2\n");
 
   s.syscallInjected = true;
+  gs.injectedSystemCalls++;
   t.changeSystemCall(SYS_pipe2);
 
   // Set so we can restore in pipe2 later.
@@ -1640,22 +2135,23 @@ bool readSystemCall::handleDetPre(
 
 void readSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  retryState& r = s.retry();
   int fd = t.arg1();
   auto resetState = [&]() {
     // Restore user regs so that it appears as if only one syscall occurred
-    t.setReturnRegister(s.totalBytes);
-    t.writeArg2(s.beforeRetry.rsi);
-    t.writeArg3(s.beforeRetry.rdx);
+    t.setReturnRegister(r.totalBytes);
+    t.writeArg2(r.beforeRetry.rsi);
+    t.writeArg3(r.beforeRetry.rdx);
 
     // reset for next syscall that we may have to retry
     s.firstTrySystemcall = true;
-    s.totalBytes = 0;
+    r.totalBytes = 0;
   };
 
   if (s.fd_is_timerfd(fd)) {
     t.writeToTracee(
         traceePtr<unsigned long>((unsigned long*)t.arg2()), 1UL, s.traceePid);
-    s.totalBytes = sizeof(unsigned long);
+    r.totalBytes = sizeof(unsigned long);
     resetState();
     sched.preemptAndScheduleNext();
     return;
@@ -1674,12 +2170,22 @@ void readSystemCall::handleDetPost(
         resetState();
         t.setReturnRegister((uint64_t)-EAGAIN);
       } else {
-        auto totalBytes = s.totalBytes;
+        auto totalBytes = r.totalBytes;
         resetState();
         t.setReturnRegister(totalBytes);
       }
       return;
     }
+  } else if (s.fd_is_signalfd(fd)) {
+    // Blocking signalfd, we made it non-blocking: wait for a signal to be sent
+    // to us.
+    if (t.getReturnValue() == -EAGAIN) {
+      gs.readRetryEvents++;
+      countBlockedReplay(gs, s);
+      sched.parkUntilSignalAndScheduleNext();
+      replaySystemCall(gs, t, t.getSystemCallNumber());
+      return;
+    }
   } else {
     bool preemptAndTryLater = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
     if (preemptAndTryLater) {
@@ -1705,18 +2211,37 @@ void readSystemCall::handleDetPost(
     // gs.log.writeToLog(Importance::extra, "\"\n");
   }
 
+  // Signals read from a signalfd were consumed without being delivered.
+  if (bytes_read > 0 && s.fd_is_signalfd(fd)) {
+    size_t bytes = bytes_read - bytes_read % sizeof(struct signalfd_siginfo);
+    vector<struct signalfd_siginfo> infos(
+        bytes / sizeof(struct signalfd_siginfo));
+    auto buffer = traceePtr<struct signalfd_siginfo>(
+        (struct signalfd_siginfo*)t.arg2());
+    if (readVmTraceeRaw(buffer, infos.data(), bytes, s.traceePid) ==
+        (ssize_t)bytes) {
+      for (const auto& info : infos) {
+        s.signalDequeued(info.ssi_signo);
+      }
+    }
+  }
+
   // Replay system call if not enought bytes were read.
-  s.totalBytes += bytes_read;
+  r.totalBytes += bytes_read;
 
   if (s.firstTrySystemcall) {
     gs.log.writeToLog(Importance::info, "First time seeing this read!\n");
     s.firstTrySystemcall = false;
-    s.beforeRetry = t.getRegs();
+    r.beforeRetry = t.getRegs();
   }
 
-  // EOF, or read returned everything we asked for.
+  // EOF, or read returned everything we asked for. Unix sockets and signalfds
+  // return what is there, request/response protocols would never see the
+  // response otherwise. What is there does not depend on timing, tracees run
+  // one at a time.
   if (bytes_read == 0 || // EOF
-      s.totalBytes == s.beforeRetry.rdx) { // original bytes requested
+      r.totalBytes == r.beforeRetry.rdx || // original bytes requested
+      s.fd_is_unix(fd) || s.fd_is_signalfd(fd)) {
     gs.log.writeToLog(Importance::info, "EOF or read all bytes.\n");
     resetState();
   } else {
@@ -1773,6 +2298,192 @@ static bool fd_is_nonblocking(state& s, int fd) {
   return false;
 }
 
+/**
+ * How a transfer on a Unix socket or pipe passes its data, see
+ * retryLocalTransfer().
+ */
+enum class transferArgs {
+  buffer, /**< Buffer and length in arg2 and arg3 (sendto, recvfrom). */
+  iovecs, /**< iovec array and count in arg2 and arg3 (writev). */
+  message, /**< msghdr in arg2 (sendmsg, recvmsg). */
+};
+
+/**
+ * Write what is left of the tracee's iovec array iov[0, count) after its
+ * first done bytes to dest, also in the tracee.
+ * @return number of iovecs written, 0 if nothing is left.
+ */
+static size_t remainingIovecs(
+    state& s, uint64_t iov, size_t count, uint64_t done, struct iovec* dest) {
+  vector<struct iovec> iovs(count);
+  size_t bytes = count * sizeof(struct iovec);
+  if (readVmTraceeRaw(
+          traceePtr<struct iovec>((struct iovec*)iov), iovs.data(), bytes,
+          s.traceePid) != (ssize_t)bytes) {
+    sysError("Unable to read tracee's iovecs");
+  }
+
+  size_t first = 0;
+  while (first < count && done >= iovs[first].iov_len) {
+    done -= iovs[first].iov_len;
+    first++;
+  }
+  size_t left = count - first;
+  if (left == 0) {
+    return 0;
+  }
+  iovs[first].iov_base = (char*)iovs[first].iov_base + done;
+  iovs[first].iov_len -= done;
+  writeVmTraceeRaw(
+      &iovs[first], traceePtr<struct iovec>(dest), left * sizeof(struct iovec),
+      s.traceePid);
+  return left;
+}
+
+/**
+ * Shared post-hook for transfers on Unix sockets, and writev on pipes. Unless
+ * the tracee asked for non-blocking I/O, a call that would block is replayed
+ * after other tracees ran, like read and write on pipes. With untilComplete a
+ * short transfer is also replayed with what is left, the remaining iovecs and
+ * message header live in our scratch page. The tracee sees a single call
+ * returning the total.
+ * @return whether the call is done, i.e. not replayed.
+ */
+static bool retryLocalTransfer(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    transferArgs args,
+    bool nonBlocking,
+    bool untilComplete) {
+  retryState& r = s.retry();
+  auto resetState = [&]() {
+    if (!s.firstTrySystemcall) {
+      t.setReturnRegister(r.totalBytes);
+      t.writeArg2(r.beforeRetry.rsi);
+      t.writeArg3(r.beforeRetry.rdx);
+    }
+    s.firstTrySystemcall = true;
+    r.totalBytes = 0;
+  };
+
+  ssize_t retval = t.getReturnValue();
+  if (retval == -EAGAIN) {
+    if (nonBlocking) {
+      // Let -EAGAIN through on the first try, otherwise report what we have.
+      resetState();
+      return true;
+    }
+    if (replaySyscallIfBlocked(gs, s, t, sched, EAGAIN)) {
+      return false;
+    }
+  }
+
+  if (retval < 0) {
+    // Errors after some progress are reported as a short transfer.
+    resetState();
+    return true;
+  }
+
+  r.totalBytes += retval;
+  if (s.firstTrySystemcall) {
+    s.firstTrySystemcall = false;
+    r.beforeRetry = t.getRegs();
+  }
+  if (!untilComplete || retval == 0) {
+    resetState();
+    return true;
+  }
+
+  uint64_t scratch = (uint64_t)s.mmapMemory.getAddr().ptr;
+  bool left;
+  switch (args) {
+  case transferArgs::buffer:
+    left = r.totalBytes < r.beforeRetry.rdx;
+    t.writeArg2(r.beforeRetry.rsi + r.totalBytes);
+    t.writeArg3(r.beforeRetry.rdx - r.totalBytes);
+    break;
+  case transferArgs::iovecs: {
+    size_t count = remainingIovecs(
+        s, r.beforeRetry.rsi, r.beforeRetry.rdx, r.totalBytes,
+        (struct iovec*)scratch);
+    left = count != 0;
+    t.writeArg2(scratch);
+    t.writeArg3(count);
+    break;
+  }
+  case transferArgs::message: {
+    auto msg = t.readFromTracee(
+        traceePtr<struct msghdr>((struct msghdr*)r.beforeRetry.rsi),
+        s.traceePid);
+    struct iovec* iovs = (struct iovec*)(scratch + sizeof(struct msghdr));
+    msg.msg_iovlen = remainingIovecs(
+        s, (uint64_t)msg.msg_iov, msg.msg_iovlen, r.totalBytes, iovs);
+    msg.msg_iov = iovs;
+    // Ancillary data went with the first part.
+    msg.msg_control = nullptr;
+    msg.msg_controllen = 0;
+    left = msg.msg_iovlen != 0;
+    t.writeToTracee(
+        traceePtr<struct msghdr>((struct msghdr*)scratch), msg, s.traceePid);
+    t.writeArg2(scratch);
+    break;
+  }
+  }
+
+  if (!left) {
+    resetState();
+    return true;
+  }
+  gs.log.writeToLog(
+      Importance::info, "Short transfer: Replaying system call!\n");
+  replaySystemCall(gs, t, t.getSystemCallNumber());
+  return false;
+}
+
+/**
+ * Call f(fd) for each descriptor in the SCM_RIGHTS messages of the tracee's
+ * msghdr at addr. Does nothing if the msghdr or its control data can't be
+ * read, the kernel fails the call with EFAULT then.
+ */
+template <typename F>
+static void forEachPassedFd(state& s, ptracer& t, uint64_t addr, F f) {
+  struct msghdr msg;
+  t.readVmCalls++;
+  if (readVmTraceeRaw(
+          traceePtr<struct msghdr>((struct msghdr*)addr), &msg, sizeof(msg),
+          s.traceePid) != (ssize_t)sizeof(msg)) {
+    return;
+  }
+  // The kernel rejects more than a page or so of ancillary data anyway.
+  if (msg.msg_control == nullptr || msg.msg_controllen < sizeof(cmsghdr) ||
+      msg.msg_controllen > 0x10000) {
+    return;
+  }
+  vector<uint8_t> control(msg.msg_controllen);
+  if (readVmTraceeRaw(
+          traceePtr<uint8_t>((uint8_t*)msg.msg_control), control.data(),
+          control.size(), s.traceePid) != (ssize_t)control.size()) {
+    return;
+  }
+
+  msg.msg_control = control.data();
+  for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr;
+       c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS ||
+        c->cmsg_len < CMSG_LEN(0) ||
+        (uint8_t*)c + c->cmsg_len > control.data() + control.size()) {
+      continue;
+    }
+    int* fds = (int*)CMSG_DATA(c);
+    size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      f(fds[i]);
+    }
+  }
+}
+
 // =======================================================================================
 bool recvmsgSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -1788,71 +2499,213 @@ bool recvmsgSystemCall::handleDetPre(
 
 void recvmsgSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  if (!fd_is_nonblocking(s, (int)t.arg1())) {
-    replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
-  }
-}
+  int fd = (int)t.arg1();
+  int flags = (int)t.arg3();
+  if (!s.fd_is_unix(fd)) {
+    if (!fd_is_nonblocking(s, fd)) {
+      replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+    }
+    return;
+  }
+
+  bool nonBlocking = (flags & MSG_DONTWAIT) != 0 || fd_is_nonblocking(s, fd);
+  bool waitAll =
+      (flags & MSG_WAITALL) != 0 && (*s.unixSockets)[fd] == SOCK_STREAM;
+  bool done = retryLocalTransfer(
+      gs, s, t, sched, transferArgs::message, nonBlocking, waitAll);
+  if (!done || (int64_t)t.getReturnValue() < 0) {
+    return;
+  }
+
+  forEachPassedFd(s, t, t.arg2(), [&](int newfd) {
+    fileOpened(gs, s, newfd);
+    auto inode = readInodeFor(gs.log, s.traceePid, newfd);
+    auto it = gs.passedFds.find(inode);
+    if (it == gs.passedFds.end()) {
+      return;
+    }
+    gs.log.writeToLog(Importance::info, "received tracked fd %d\n", newfd);
+    (*s.fdStatus)[newfd] = it->second.nonBlocking
+        ? descriptorType::nonBlocking
+        : descriptorType::blocking;
+    if (it->second.socketType != -1) {
+      (*s.unixSockets)[newfd] = it->second.socketType;
+    }
+    gs.passedFds.erase(it);
+  });
+}
 
 // =======================================================================================
+/**
+ * Pre-hook half of rename-over detection: remember in s.fileExisted whether
+ * the rename is about to replace an existing file.
+ */
+static void checkRenameTarget(
+    globalState& gs, state& s, ptracer& t, int newDirFd, uint64_t newPath) {
+  if ((char*)newPath == nullptr) {
+    return;
+  }
+  string path =
+      t.readTraceeCString(traceePtr<char>((char*)newPath), s.traceePid);
+  s.fileExisted = tracee_file_exists(path, s.traceePid, gs.log, newDirFd);
+}
+
+/**
+ * Post-hook half: a file renamed over an existing one modifies that path, as
+ * far as make is concerned, so it gets a new mtime.
+ */
+static void renamedOver(
+    globalState& gs, state& s, ptracer& t, int newDirFd, uint64_t newPath) {
+  bool replaced = s.fileExisted;
+  s.fileExisted = false;
+  if (t.getReturnValue() != 0 || !replaced) {
+    return;
+  }
+  string path =
+      t.readTraceeCString(traceePtr<char>((char*)newPath), s.traceePid);
+  auto inode = inode_from_tracee(path, s.traceePid, gs.log, newDirFd);
+  if (inode != -1UL) {
+    gs.log.writeToLog(Importance::info, "Renamed over %s\n", path.c_str());
+    gs.setMtime(inode, s, true);
+  }
+}
+
 bool renameSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t, " old path: ");
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " new path: ");
-  return true;
+  checkRenameTarget(gs, s, t, -1, t.arg2());
+  return s.fileExisted;
 }
 
 void renameSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
-  return;
+  renamedOver(gs, s, t, -1, t.arg2());
 }
 // =======================================================================================
 bool renameatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " renaming-ing path: ");
   printInfoString(t.arg4(), gs.log, s.traceePid, t, " to path: ");
-  return true;
+  checkRenameTarget(gs, s, t, (int)t.arg3(), t.arg4());
+  return s.fileExisted;
 }
 
 void renameatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  renamedOver(gs, s, t, (int)t.arg3(), t.arg4());
 }
 // =======================================================================================
 bool renameat2SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t, " renaming-ing path: ");
   printInfoString(t.arg4(), gs.log, s.traceePid, t, " to path: ");
-  return true;
+  checkRenameTarget(gs, s, t, (int)t.arg3(), t.arg4());
+  return s.fileExisted || (t.arg5() & RENAME_EXCHANGE) != 0;
 }
 
 void renameat2SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  // RENAME_EXCHANGE also counts, both paths exist and now have new contents.
+  bool exchange = (t.arg5() & RENAME_EXCHANGE) != 0;
+  renamedOver(gs, s, t, (int)t.arg3(), t.arg4());
+  if (exchange && t.getReturnValue() == 0) {
+    s.fileExisted = true;
+    renamedOver(gs, s, t, (int)t.arg1(), t.arg2());
+  }
 }
 // =======================================================================================
+/**
+ * Pre-hook half of inode reclamation: remember in s.lastLinkInode whether the
+ * path is the last link to an inode we have entries for.
+ * @return True if the post-hook should run.
+ */
+static bool checkLastLink(
+    globalState& gs, state& s, ptracer& t, int dirFd, uint64_t path,
+    bool isDir) {
+  s.lastLinkInode = 0;
+  // Bad paths and directory descriptors fail in the kernel, let them.
+  if (dirFd < -1 && dirFd != AT_FDCWD) {
+    return false;
+  }
+  string strPath;
+  if (!tryReadTraceePath(s.traceePid, path, strPath) || strPath.empty()) {
+    return false;
+  }
+  struct stat st;
+  if (!lstat_from_tracee(strPath, s.traceePid, gs.log, dirFd, st) ||
+      (!isDir && st.st_nlink != 1)) {
+    return false;
+  }
+  if (!gs.inodeMap.realValueExists(st.st_ino) &&
+      gs.mtimeMap.count(st.st_ino) == 0) {
+    return false;
+  }
+  s.lastLinkInode = st.st_ino;
+  s.lastLinkDevice = st.st_dev;
+  return true;
+}
+
+/**
+ * Post-hook half: once the last link is gone and no tracee has the inode open,
+ * nothing can observe its virtual inode or mtime anymore.
+ */
+static void reclaimLastLink(globalState& gs, state& s, ptracer& t) {
+  ino_t inode = s.lastLinkInode;
+  s.lastLinkInode = 0;
+  if (t.getReturnValue() != 0 || inode == 0) {
+    return;
+  }
+  if (inode_open_by_tracees(gs, inode, s.lastLinkDevice)) {
+    gs.log.writeToLog(
+        Importance::info, "Deleted inode still open, keeping its entries\n");
+    return;
+  }
+  gs.forgetInode(inode);
+}
+
 bool rmdirSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
-  return true;
+  return checkLastLink(gs, s, t, -1, t.arg1(), true);
 }
 
 void rmdirSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
+  reclaimLastLink(gs, s, t);
 }
 
 bool rt_sigprocmaskSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  s.requestedMaskHow = -1;
+  // Our own injected calls (see rt_sigsuspend) leave the mask as it was.
+  if (!s.syscallInjected && t.arg2() != 0) {
+    s.requestedMaskHow = (int)t.arg1();
+    s.requestedMask = t.readFromTracee(
+        traceePtr<uint64_t>((uint64_t*)t.arg2()), t.getPid());
+  }
   return true;
 }
 
 void rt_sigprocmaskSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (s.requestedMaskHow != -1 && t.getReturnValue() == 0) {
+    switch (s.requestedMaskHow) {
+    case SIG_BLOCK:
+      s.setBlockedSignals(s.blockedSignals | s.requestedMask);
+      break;
+    case SIG_UNBLOCK:
+      s.setBlockedSignals(s.blockedSignals & ~s.requestedMask);
+      break;
+    case SIG_SETMASK:
+      s.setBlockedSignals(s.requestedMask);
+      break;
+    }
+    gs.log.writeToLog(
+        Importance::info, "blocked signals: 0x%lx\n", s.blockedSignals);
+  }
+  s.requestedMaskHow = -1;
+
   if (s.syscallInjected) {
     s.syscallInjected = false;
     traceePtr<unsigned long> oldset = traceePtr<unsigned long>(
@@ -1914,6 +2767,9 @@ bool rt_sigactionSystemCall::handleDetPre(
     } else {
       s.requestedSignalHandler = SIGHANDLER_CUSTOM;
     }
+    uint64_t self = (sa.sa_flags & SA_NODEFER) ? 0 : state::signalBit(signum);
+    s.requestedHandlerMask = {
+        sa.sa_mask | self, (sa.sa_flags & SA_RESETHAND) != 0};
   }
   gs.log.writeToLog(
       Importance::info, "signal " + to_string(signum) + " handler requested: " +
@@ -1928,8 +2784,15 @@ void rt_sigactionSystemCall::handleDetPost(
   gs.log.writeToLog(Importance::info, "rt_sigaction post-hook\n");
   if (0 == t.getReturnValue()) {
     // signal handler installation was successful
-    s.currentSignalHandlers.get()->insert(
-        {s.requestedSignalToHandle, s.requestedSignalHandler});
+    (*s.currentSignalHandlers)[s.requestedSignalToHandle] =
+        s.requestedSignalHandler;
+    if (s.requestedSignalHandler == SIGHANDLER_CUSTOM ||
+        s.requestedSignalHandler == SIGHANDLER_CUSTOM_1SHOT) {
+      (*s.signalHandlerMasks)[s.requestedSignalToHandle] =
+          s.requestedHandlerMask;
+    } else {
+      s.signalHandlerMasks->erase(s.requestedSignalToHandle);
+    }
 
     gs.log.writeToLog(
         Importance::info,
@@ -1942,41 +2805,6 @@ void rt_sigactionSystemCall::handleDetPost(
   return;
 }
 
-struct PendingSignalInfo {
-  unsigned long pending;
-  unsigned long blocked;
-};
-
-int getPendingSignalInfo(pid_t pid, struct PendingSignalInfo* info) {
-  char fname[32];
-  char buff[4096];
-  snprintf(fname, 32, "/proc/%u/status", pid);
-  int fd = open(fname, O_RDONLY | O_CLOEXEC);
-  if (fd < 0) {
-    return -1;
-  }
-
-  ssize_t n = read(fd, buff, 4096);
-  if (n <= 0) {
-    return -1;
-  }
-
-  char *p = NULL, *q = buff;
-
-  while (1) {
-    p = strsep(&q, "\n");
-    if (!p) break;
-    if (strncmp(p, "SigPnd:\t", 8) == 0) {
-      info->pending = strtoul(8 + p, NULL, 16);
-    } else if (strncmp(p, "SigBlk:\t", 8) == 0) {
-      info->blocked = strtoul(8 + p, NULL, 16);
-      break;
-    }
-  }
-  close(fd);
-  return 0;
-}
-
 // =======================================================================================
 // TODO
 bool rt_sigtimedwaitSystemCall::handleDetPre(
@@ -2013,11 +2841,14 @@ bool rt_sigtimedwaitSystemCall::handleDetPre(
 void rt_sigtimedwaitSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int retval = t.getReturnValue();
-  bool replay;
 
-  replay = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
-  if (replay) {
+  if (retval == -EAGAIN) {
+    // Nothing pending: wait for a signal to be sent to us, instead of polling
+    // with the zero timeout.
     gs.log.writeToLog(Importance::info, "replay rt_sigtimedwait\n");
+    countBlockedReplay(gs, s);
+    sched.parkUntilSignalAndScheduleNext();
+    replaySystemCall(gs, t, t.getSystemCallNumber());
     t.writeArg3(s.originalArg3);
   } else {
     gs.log.writeToLog(
@@ -2028,6 +2859,9 @@ void rt_sigtimedwaitSystemCall::handleDetPost(
         kill(t.getPid(), retval);
         t.setReturnRegister((uint64_t)-EINTR);
       }
+    } else if (retval > 0) {
+      // Signal was consumed without being delivered.
+      s.signalDequeued(retval);
     }
   }
 
@@ -2035,6 +2869,41 @@ void rt_sigtimedwaitSystemCall::handleDetPost(
 }
 
 // =======================================================================================
+/**
+ * Signals the kernel has pending for thread pid or its thread group, 0 if
+ * /proc/pid/status cannot be read.
+ */
+static unsigned long getPendingSignals(pid_t pid) {
+  char fname[32];
+  char buff[4096];
+  hostTraceeQuery(pid);
+  snprintf(fname, 32, "/proc/%u/status", pid);
+  int fd = open(fname, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+
+  ssize_t n = read(fd, buff, sizeof(buff) - 1);
+  close(fd);
+  if (n <= 0) {
+    return 0;
+  }
+  buff[n] = '\0';
+
+  unsigned long pending = 0;
+  char *p = NULL, *q = buff;
+  while (1) {
+    p = strsep(&q, "\n");
+    if (!p) break;
+    if (strncmp(p, "SigPnd:\t", 8) == 0 || strncmp(p, "ShdPnd:\t", 8) == 0) {
+      pending |= strtoul(8 + p, NULL, 16);
+    } else if (strncmp(p, "SigBlk:\t", 8) == 0) {
+      break;
+    }
+  }
+  return pending;
+}
+
 // TODO
 bool rt_sigsuspendSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -2045,18 +2914,22 @@ bool rt_sigsuspendSystemCall::handleDetPre(
   mask = t.readFromTracee(rptr, t.getPid());
   gs.log.writeToLog(Importance::info, "rt_sigsuspend, mask = 0x%lx\n", mask);
 
-  struct PendingSignalInfo info = {
-      0,
-  };
-
   // rt_sigsuspend would block until signal is received
   // we'll change it to something else nonblocking.
   cancelSystemCall(gs, s, t);
 
-  getPendingSignalInfo(t.getPid(), &info);
-  unsigned long unmask = info.pending & ~mask;
+  // Our model covers the signals tracees send each other, SIGCHLD, and the
+  // ones we raise for emulated timers. The kernel also generates some
+  // (SIGPIPE, faults) and outside processes may send more, so if the model has
+  // nothing we ask the kernel. That is once per wait: we are parked until a
+  // signal is sent to us, or nobody else can run.
+  unsigned long unmask = s.pendingSignals() & ~mask;
+  if (unmask == 0) {
+    unmask = getPendingSignals(t.getPid()) & ~mask;
+  }
   if (unmask != 0) {
     s.syscallInjected = true;
+    gs.injectedSystemCalls++;
     s.originalArg1 = t.arg1();
     traceePtr<unsigned long> set =
         traceePtr<unsigned long>((unsigned long*)(s.mmapMemory.getAddr().ptr));
@@ -2070,7 +2943,8 @@ bool rt_sigsuspendSystemCall::handleDetPre(
 
     replaySystemCall(gs, t, SYS_rt_sigprocmask);
   } else {
-    sched.preemptAndScheduleNext();
+    countBlockedReplay(gs, s);
+    sched.parkUntilSignalAndScheduleNext();
     replaySystemCall(gs, t, SYS_rt_sigsuspend);
   }
   return false;
@@ -2080,6 +2954,27 @@ void rt_sigsuspendSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   runtimeError("rt_sigsuspend is not supposed to return\n");
 }
+// =======================================================================================
+bool rt_sigreturnSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // The handler returned into the restorer, popping the return address: the
+  // signal frame's ucontext is at the stack pointer.
+  uint64_t mask;
+  traceePtr<uint64_t> saved((uint64_t*)(
+      (uint64_t)t.getRsp().ptr + offsetof(ucontext_t, uc_sigmask)));
+  if (readVmTraceeRaw(saved, &mask, sizeof(mask), t.getPid()) ==
+      sizeof(mask)) {
+    s.setBlockedSignals(mask);
+    gs.log.writeToLog(
+        Importance::info, "blocked signals: 0x%lx\n", s.blockedSignals);
+  }
+  return false;
+}
+
+void rt_sigreturnSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  runtimeError("rt_sigreturn is not supposed to return\n");
+}
 
 bool rt_sigpendingSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
@@ -2087,9 +2982,113 @@ bool rt_sigpendingSystemCall::handleDetPre(
 }
 void rt_sigpendingSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {}
+// =======================================================================================
+bool signalfdSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "Making this signalfd non-blocking via signalfd4\n");
+
+  s.syscallInjected = true;
+  gs.injectedSystemCalls++;
+  t.changeSystemCall(SYS_signalfd4);
+
+  // Set so we can restore in signalfd4 later.
+  s.originalArg4 = t.arg4();
+  t.writeArg4(SFD_NONBLOCK);
+
+  return true;
+}
+
+void signalfdSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // We always change the call to signalfd to a call to signalfd4.
+  runtimeError("did not expect to arrive a signalfd post hook.");
+}
+// =======================================================================================
+bool signalfd4SystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  s.originalArg4 = t.arg4();
+  t.writeArg4(t.arg4() | SFD_NONBLOCK);
+  return true;
+}
+
+void signalfd4SystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  bool nonBlocking = !s.syscallInjected && (s.originalArg4 & SFD_NONBLOCK);
+  s.syscallInjected = false;
+  t.writeArg4(s.originalArg4);
+
+  // Only new descriptors, with an existing one only the mask changes.
+  int fd = t.getReturnValue();
+  if (fd < 0 || (int)t.arg1() != -1) {
+    return;
+  }
+  s.signalfds->insert(fd);
+  s.setFdStatus(
+      fd, nonBlocking ? descriptorType::nonBlocking : descriptorType::blocking);
+}
+// =======================================================================================
+bool sched_getaffinitySystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // Like the kernel with nr_cpu_ids == vcpus: the mask is a whole number of
+  // longs and the buffer must be able to hold it.
+  size_t maskSize = (gs.vcpus + 63) / 64 * sizeof(uint64_t);
+  size_t cpusetsize = t.arg2();
+  traceePtr<uint8_t> maskPtr((uint8_t*)t.arg3());
+  cancelSystemCall(gs, s, t);
+  if (cpusetsize * 8 < gs.vcpus || cpusetsize % sizeof(uint64_t) != 0) {
+    t.setReturnRegister(-EINVAL);
+    return false;
+  }
+
+  vector<uint8_t> mask(maskSize, 0);
+  for (unsigned cpu = 0; cpu < gs.vcpus; cpu++) {
+    mask[cpu / 8] |= 1 << (cpu % 8);
+  }
+  if (tryWriteVmTraceeRaw(mask.data(), maskPtr, maskSize, t.getPid()) !=
+      (ssize_t)maskSize) {
+    t.setReturnRegister(-EFAULT);
+    return false;
+  }
+  t.setReturnRegister(maskSize);
+  return false;
+}
+
+void sched_getaffinitySystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {}
+// =======================================================================================
+bool sched_setaffinitySystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  // The kernel only looks at the first nr_cpu_ids bits, and fails if none of
+  // them are set.
+  size_t bytes = min<size_t>(t.arg2(), (gs.vcpus + 7) / 8);
+  vector<uint8_t> mask(bytes, 0);
+  if (bytes > 0 &&
+      readVmTraceeRaw(
+          traceePtr<uint8_t>((uint8_t*)t.arg3()), mask.data(), bytes,
+          t.getPid()) == -1) {
+    failSystemCall(gs, s, t, EFAULT);
+    return false;
+  }
+
+  bool anyCpu = false;
+  for (unsigned cpu = 0; cpu < bytes * 8 && cpu < gs.vcpus; cpu++) {
+    anyCpu = anyCpu || (mask[cpu / 8] & (1 << (cpu % 8)));
+  }
+  if (!anyCpu) {
+    failSystemCall(gs, s, t, EINVAL);
+    return false;
+  }
+
+  cancelSystemCall(gs, s, t);
+  t.setReturnRegister(0);
+  return false;
+}
+
+void sched_setaffinitySystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {}
 
 // =======================================================================================
-// TODO
 bool sendtoSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   return true;
@@ -2097,20 +3096,54 @@ bool sendtoSystemCall::handleDetPre(
 
 void sendtoSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int fd = (int)t.arg1();
+  if (!s.fd_is_unix(fd)) {
+    return;
+  }
+  // Datagrams are sent whole or not at all.
+  bool nonBlocking =
+      (t.arg4() & MSG_DONTWAIT) != 0 || fd_is_nonblocking(s, fd);
+  retryLocalTransfer(
+      gs, s, t, sched, transferArgs::buffer, nonBlocking,
+      (*s.unixSockets)[fd] == SOCK_STREAM);
 }
 // =======================================================================================
-// TODO
 bool sendmsgSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   gs.log.writeToLog(
       Importance::info, "sendmsg to fd " + to_string(t.arg1()) + "\n");
+
+  // Remember what we know about descriptors sent along, for the receiver.
+  forEachPassedFd(s, t, t.arg2(), [&](int fd) {
+    if (s.countFdStatus(fd) == 0) {
+      return;
+    }
+    // A stale descriptor fails the call with EBADF.
+    hostTraceeQuery(s.traceePid);
+    string procPath =
+        "/proc/" + to_string(s.traceePid) + "/fd/" + to_string(fd);
+    struct stat st;
+    if (stat(procPath.c_str(), &st) != 0) {
+      return;
+    }
+    auto socket = s.unixSockets->find(fd);
+    int type = socket == s.unixSockets->end() ? -1 : socket->second;
+    gs.passedFds[st.st_ino] = {fd_is_nonblocking(s, fd), type};
+  });
   return true;
 }
 
 void sendmsgSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int fd = (int)t.arg1();
+  if (!s.fd_is_unix(fd)) {
+    return;
+  }
+  bool nonBlocking =
+      (t.arg3() & MSG_DONTWAIT) != 0 || fd_is_nonblocking(s, fd);
+  retryLocalTransfer(
+      gs, s, t, sched, transferArgs::message, nonBlocking,
+      (*s.unixSockets)[fd] == SOCK_STREAM);
 }
 
 bool sendmmsgSystemCall::handleDetPre(
@@ -2134,27 +3167,37 @@ bool recvfromSystemCall::handleDetPre(
 
 void recvfromSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int fd = (int)t.arg1();
+  int flags = (int)t.arg4();
+  if (!s.fd_is_unix(fd)) {
+    return;
+  }
+  bool nonBlocking = (flags & MSG_DONTWAIT) != 0 || fd_is_nonblocking(s, fd);
+  bool waitAll =
+      (flags & MSG_WAITALL) != 0 && (*s.unixSockets)[fd] == SOCK_STREAM;
+  retryLocalTransfer(
+      gs, s, t, sched, transferArgs::buffer, nonBlocking, waitAll);
 }
 
 // =======================================================================================
 bool selectSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  retryState& r = s.retry();
   // Get the original set structs.
   // Set them in the state class.
   if ((void*)t.arg2() != NULL) {
-    s.rdfsNotNull = true;
-    s.origRdfs =
+    r.rdfsNotNull = true;
+    r.origRdfs =
         t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg2()), t.getPid());
   }
   if ((void*)t.arg3() != NULL) {
-    s.wrfsNotNull = true;
-    s.origWrfs =
+    r.wrfsNotNull = true;
+    r.origWrfs =
         t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg3()), t.getPid());
   }
   if ((void*)t.arg4() != NULL) {
-    s.exfsNotNull = true;
-    s.origExfs =
+    r.exfsNotNull = true;
+    r.origExfs =
         t.readFromTracee(traceePtr<fd_set>((fd_set*)t.arg4()), t.getPid());
   }
 
@@ -2184,6 +3227,7 @@ bool selectSystemCall::handleDetPre(
 
 void selectSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  retryState& r = s.retry();
   if (s.userDefinedTimeout) {
     s.userDefinedTimeout = false;
     if (t.getReturnValue() == 0) {
@@ -2196,21 +3240,21 @@ void selectSystemCall::handleDetPost(
     bool replayed = replaySyscallIfBlocked(gs, s, t, sched, 0);
 
     if (replayed) {
-      if (s.rdfsNotNull) {
+      if (r.rdfsNotNull) {
         t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg2()), s.origRdfs, t.getPid());
+            traceePtr<fd_set>((fd_set*)t.arg2()), r.origRdfs, t.getPid());
       }
-      if (s.wrfsNotNull) {
+      if (r.wrfsNotNull) {
         t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg3()), s.origWrfs, t.getPid());
+            traceePtr<fd_set>((fd_set*)t.arg3()), r.origWrfs, t.getPid());
       }
-      if (s.exfsNotNull) {
+      if (r.exfsNotNull) {
         t.writeToTracee(
-            traceePtr<fd_set>((fd_set*)t.arg4()), s.origExfs, t.getPid());
+            traceePtr<fd_set>((fd_set*)t.arg4()), r.origExfs, t.getPid());
       }
-      s.rdfsNotNull = false;
-      s.wrfsNotNull = false;
-      s.exfsNotNull = false;
+      r.rdfsNotNull = false;
+      r.wrfsNotNull = false;
+      r.exfsNotNull = false;
       t.writeArg5((uint64_t)s.originalArg5);
     }
   }
@@ -2311,8 +3355,9 @@ void symlinkSystemCall::handleDetPost(
         t.readTraceeCString(traceePtr<char>((char*)t.arg2()), s.traceePid);
     auto inode = inode_from_tracee(linkpath, s.traceePid, gs.log, -1);
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, linkpath, s.traceePid, -1));
       s.incrementTime();
     }
   }
@@ -2333,8 +3378,9 @@ void symlinkatSystemCall::handleDetPost(
         t.readTraceeCString(traceePtr<char>((char*)t.arg3()), s.traceePid);
     auto inode = inode_from_tracee(linkpath, s.traceePid, gs.log, t.arg2());
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, linkpath, s.traceePid, t.arg2()));
       s.incrementTime();
     }
   }
@@ -2353,8 +3399,9 @@ void mknodSystemCall::handleDetPost(
         t.readTraceeCString(traceePtr<char>((char*)t.arg1()), s.traceePid);
     auto inode = inode_from_tracee(path, s.traceePid, gs.log, -1);
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, path, s.traceePid, -1));
       s.incrementTime();
     }
   }
@@ -2373,8 +3420,9 @@ void mknodatSystemCall::handleDetPost(
         t.readTraceeCString(traceePtr<char>((char*)t.arg2()), s.traceePid);
     auto inode = inode_from_tracee(path, s.traceePid, gs.log, t.arg1());
     if (inode != -1UL) {
-      gs.mtimeMap[inode] = s.getLogicalTime();
-      gs.inodeMap.addRealValue(inode);
+      gs.setMtime(inode, s, false);
+      gs.inodeMap.addRealValue(
+          inode, inode_path_from_tracee(gs, path, s.traceePid, t.arg1()));
       s.incrementTime();
     }
   }
@@ -2407,7 +3455,41 @@ bool tgkillSystemCall::handleDetPre(
 
 void tgkillSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return;
+  int tgid = (int)t.arg1();
+  int tid = (int)t.arg2();
+  int signal = (int)t.arg3();
+  if (t.getReturnValue() != 0 || signal == 0) {
+    return;
+  }
+
+  // Pending for the target thread only, checked against its own mask.
+  auto thread = gs.hostPids.find(tid);
+  auto groupLeader = gs.hostPids.find(tgid);
+  if (thread == gs.hostPids.end() || groupLeader == gs.hostPids.end()) {
+    return;
+  }
+  auto group = gs.threadGroupNumber.find(thread->second);
+  if (group != gs.threadGroupNumber.end() &&
+      group->second == groupLeader->second) {
+    signalSent(gs, sched, thread->second, signal, false);
+  }
+}
+// =======================================================================================
+bool tkillSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "tkill(tid = %d, signal = %d)\n", (int)t.arg1(),
+      (int)t.arg2());
+  return true;
+}
+
+void tkillSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int signal = (int)t.arg2();
+  auto thread = gs.hostPids.find((pid_t)t.arg1());
+  if (t.getReturnValue() == 0 && signal != 0 && thread != gs.hostPids.end()) {
+    signalSent(gs, sched, thread->second, signal, false);
+  }
 }
 // =======================================================================================
 bool timeSystemCall::handleDetPre(
@@ -2429,6 +3511,7 @@ void timeSystemCall::handleDetPost(
   // call it directly.
   else {
     gs.timeCalls++;
+    gs.timeShimCalls += s.syncTimeShim();
     int retVal = t.getReturnValue();
     if (retVal < 0) {
       gs.log.writeToLog(
@@ -2849,27 +3932,24 @@ void unameSystemCall::handleDetPost(
 bool unlinkSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg1(), gs.log, s.traceePid, t);
-  return true;
+  return checkLastLink(gs, s, t, -1, t.arg1(), false);
 }
 
 void unlinkSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
-  return;
+  reclaimLastLink(gs, s, t);
 }
 // =======================================================================================
 bool unlinkatSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   printInfoString(t.arg2(), gs.log, s.traceePid, t);
-  return true;
+  bool isDir = (t.arg3() & AT_REMOVEDIR) != 0;
+  return checkLastLink(gs, s, t, (int)t.arg1(), t.arg2(), isDir);
 }
 
 void unlinkatSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // nothing to do, but return value may be useful for debugging (printed by
-  // handlePostSystemCall)
-  return;
+  reclaimLastLink(gs, s, t);
 }
 
 // =======================================================================================
@@ -3034,19 +4114,20 @@ bool writeSystemCall::handleDetPre(
 
 void writeSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  retryState& r = s.retry();
   int fd = t.arg1();
   bool preemptAndTryLater = false;
 
   auto resetState = [&]() {
     // Nothing left to write.
     gs.log.writeToLog(Importance::info, "All bytes written.\n");
-    t.setReturnRegister(s.totalBytes);
+    t.setReturnRegister(r.totalBytes);
 
-    t.writeArg2(s.beforeRetry.rsi);
-    t.writeArg3(s.beforeRetry.rdx);
+    t.writeArg2(r.beforeRetry.rsi);
+    t.writeArg3(r.beforeRetry.rdx);
 
     s.firstTrySystemcall = true;
-    s.totalBytes = 0;
+    r.totalBytes = 0;
   };
 
   // Pipe exists in our map and it's set to non blocking.
@@ -3063,7 +4144,7 @@ void writeSystemCall::handleDetPost(
         resetState();
         t.setReturnRegister((uint64_t)-EAGAIN);
       } else {
-        auto totalBytes = s.totalBytes;
+        auto totalBytes = r.totalBytes;
         resetState();
         t.setReturnRegister(totalBytes);
       }
@@ -3087,22 +4168,23 @@ void writeSystemCall::handleDetPost(
         Importance::info, "Returned negative: %d.\n", bytes_written);
     return;
   }
+  noteFdWritten(gs, s, fd);
 
-  s.totalBytes += bytes_written;
+  r.totalBytes += bytes_written;
   if (s.firstTrySystemcall) {
     s.firstTrySystemcall = false;
-    s.beforeRetry = t.getRegs();
+    r.beforeRetry = t.getRegs();
   }
   gs.log.writeToLog(Importance::info, "total bytes: %d.\n", bytes_written);
   gs.log.writeToLog(
-      Importance::info, "before retry rdx: %d.\n", s.beforeRetry.rdx);
+      Importance::info, "before retry rdx: %d.\n", r.beforeRetry.rdx);
 
   // Finally wrote all bytes user wanted.
 
   // The zero case should not really happen. But our fuse tests allow for this
   // behavior so we catch it here. Otherwise we forever try to read 0 bytes.
   // https://stackoverflow.com/questions/41904221/can-write2-return-0-bytes-written-and-what-to-do-if-it-does?utm_medium=organic&utm_source=google_rich_qa&utm_campaign=google_rich_qa
-  if (s.totalBytes == s.beforeRetry.rdx || bytes_written == 0) {
+  if (r.totalBytes == r.beforeRetry.rdx || bytes_written == 0) {
     resetState();
   } else {
     gs.log.writeToLog(
@@ -3115,6 +4197,128 @@ void writeSystemCall::handleDetPost(
   return;
 }
 // =======================================================================================
+/**
+ * Shared post-hook for sendfile, copy_file_range and splice. These may copy
+ * fewer bytes than asked for depending on timing, so, like read and write, we
+ * replay with the remaining count until everything was transferred, we hit EOF
+ * or an error. The kernel advances the file offsets (or *offset pointers) for
+ * us between retries. The tracee sees a single call returning the total.
+ * @param countArg which argument holds the byte count, 4 or 5.
+ * @param nonBlocking whether the tracee asked for non-blocking semantics.
+ */
+static void retryTransferUntilComplete(
+    globalState& gs,
+    state& s,
+    ptracer& t,
+    scheduler& sched,
+    int countArg,
+    bool nonBlocking) {
+  retryState& r = s.retry();
+  auto count = [&]() { return countArg == 4 ? t.arg4() : t.arg5(); };
+  auto writeCount = [&](uint64_t val) {
+    countArg == 4 ? t.writeArg4(val) : t.writeArg5(val);
+  };
+  auto resetState = [&]() {
+    if (!s.firstTrySystemcall) {
+      t.setReturnRegister(r.totalBytes);
+      writeCount(countArg == 4 ? r.beforeRetry.r10 : r.beforeRetry.r8);
+    }
+    s.firstTrySystemcall = true;
+    r.totalBytes = 0;
+  };
+
+  ssize_t retval = t.getReturnValue();
+  if (retval == -EAGAIN) {
+    if (nonBlocking) {
+      // Let -EAGAIN through on the first try, otherwise report what we have.
+      resetState();
+      return;
+    }
+    bool preemptAndTryLater = replaySyscallIfBlocked(gs, s, t, sched, EAGAIN);
+    if (preemptAndTryLater) {
+      return;
+    }
+  }
+
+  if (retval < 0) {
+    gs.log.writeToLog(Importance::info, "Returned negative: %d.\n", retval);
+    // Errors after some progress are reported as a short transfer.
+    resetState();
+    return;
+  }
+
+  r.totalBytes += retval;
+  if (s.firstTrySystemcall) {
+    s.firstTrySystemcall = false;
+    r.beforeRetry = t.getRegs();
+  }
+
+  uint64_t requested = countArg == 4 ? r.beforeRetry.r10 : r.beforeRetry.r8;
+  if (retval == 0 || r.totalBytes == requested) {
+    gs.log.writeToLog(Importance::info, "EOF or transferred all bytes.\n");
+    resetState();
+  } else {
+    gs.log.writeToLog(
+        Importance::info, "Short transfer: Replaying system call!\n");
+    writeCount(count() - retval);
+    replaySystemCall(gs, t, t.getSystemCallNumber());
+  }
+}
+// =======================================================================================
+bool sendfileSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "sendfile(%d, %d), bytes to copy %lu\n", (int)t.arg1(),
+      (int)t.arg2(), t.arg4());
+  return true;
+}
+
+void sendfileSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  bool nonBlocking = fd_is_nonblocking(s, (int)t.arg1()) ||
+      fd_is_nonblocking(s, (int)t.arg2());
+  if ((int64_t)t.getReturnValue() > 0) {
+    noteFdWritten(gs, s, (int)t.arg1());
+  }
+  retryTransferUntilComplete(gs, s, t, sched, 4, nonBlocking);
+}
+// =======================================================================================
+bool copy_file_rangeSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "copy_file_range(%d, %d), bytes to copy %lu\n",
+      (int)t.arg1(), (int)t.arg3(), t.arg5());
+  return true;
+}
+
+void copy_file_rangeSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if ((int64_t)t.getReturnValue() > 0) {
+    noteFdWritten(gs, s, (int)t.arg3());
+  }
+  // Only regular files, nothing here can block.
+  retryTransferUntilComplete(gs, s, t, sched, 5, false);
+}
+// =======================================================================================
+bool spliceSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  gs.log.writeToLog(
+      Importance::info, "splice(%d, %d), bytes to move %lu\n", (int)t.arg1(),
+      (int)t.arg3(), t.arg5());
+  return true;
+}
+
+void spliceSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  bool nonBlocking = (t.arg6() & SPLICE_F_NONBLOCK) != 0 ||
+      fd_is_nonblocking(s, (int)t.arg1()) ||
+      fd_is_nonblocking(s, (int)t.arg3());
+  if ((int64_t)t.getReturnValue() > 0) {
+    noteFdWritten(gs, s, (int)t.arg3());
+  }
+  retryTransferUntilComplete(gs, s, t, sched, 5, nonBlocking);
+}
+// =======================================================================================
 bool wait4SystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   s.wait4Blocking = (t.arg3() & WNOHANG) == 0;
@@ -3169,13 +4373,87 @@ void waitidSystemCall::handleDetPost(
 // =======================================================================================
 bool writevSystemCall::handleDetPre(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  return true;
+  // Only stop again if this write gives the file a new mtime, or goes to a
+  // pipe or socket that may be full.
+  int fd = (int)t.arg1();
+  return s.unwrittenFds->count(fd) != 0 || s.countFdStatus(fd) != 0;
 }
 
 void writevSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
-  // TODO: Handle bytes written.
-  return;
+  int fd = (int)t.arg1();
+  if ((int64_t)t.getReturnValue() >= 0) {
+    noteFdWritten(gs, s, fd);
+  }
+  if (s.countFdStatus(fd) != 0) {
+    // Like write, unless this is a datagram socket.
+    auto socket = s.unixSockets->find(fd);
+    bool stream =
+        socket == s.unixSockets->end() || socket->second == SOCK_STREAM;
+    retryLocalTransfer(
+        gs, s, t, sched, transferArgs::iovecs, fd_is_nonblocking(s, fd),
+        stream);
+  }
+}
+// =======================================================================================
+bool pwrite64SystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return s.unwrittenFds->count((int)t.arg1()) != 0;
+}
+
+void pwrite64SystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if ((int64_t)t.getReturnValue() >= 0) {
+    noteFdWritten(gs, s, (int)t.arg1());
+  }
+}
+// =======================================================================================
+bool pwritevSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return s.unwrittenFds->count((int)t.arg1()) != 0;
+}
+
+void pwritevSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if ((int64_t)t.getReturnValue() >= 0) {
+    noteFdWritten(gs, s, (int)t.arg1());
+  }
+}
+// =======================================================================================
+bool ftruncateSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  return true;
+}
+
+void ftruncateSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int fd = (int)t.arg1();
+  if (t.getReturnValue() != 0) {
+    return;
+  }
+  // Unlike a write, every truncate is a modification. Also counts as the first
+  // write through this fd.
+  s.unwrittenFds->erase(fd);
+  auto inode = readInodeFor(gs.log, s.traceePid, fd);
+  gs.setMtime(inode, s, true);
+}
+// =======================================================================================
+bool truncateSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  printInfoString(t.arg1(), gs.log, s.traceePid, t);
+  return true;
+}
+
+void truncateSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  if (t.getReturnValue() == 0 && (char*)t.arg1() != nullptr) {
+    string path =
+        t.readTraceeCString(traceePtr<char>((char*)t.arg1()), s.traceePid);
+    auto inode = inode_from_tracee(path, s.traceePid, gs.log, -1);
+    if (inode != -1UL) {
+      gs.setMtime(inode, s, true);
+    }
+  }
 }
 // =======================================================================================
 
@@ -3196,24 +4474,46 @@ bool socketSystemCall::handleDetPre(
     }
   }
 
+  // Like pipes, see pipe2SystemCall.
+  if (domain == AF_UNIX) {
+    s.originalArg2 = t.arg2();
+    t.writeArg2(t.arg2() | SOCK_NONBLOCK);
+  }
+
   return true;
 }
 
+/**
+ * Track a new Unix socket created with type (including the user's
+ * SOCK_NONBLOCK) as non-blocking in the kernel.
+ */
+static void trackUnixSocket(state& s, int fd, int type) {
+  (*s.fdStatus)[fd] = (type & SOCK_NONBLOCK) ? descriptorType::nonBlocking
+                                             : descriptorType::blocking;
+  (*s.unixSockets)[fd] = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
 void socketSystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  int domain = t.arg1();
+  if (domain == AF_UNIX) {
+    t.writeArg2(s.originalArg2);
+  }
+
   int fd = (int)t.getReturnValue();
   if (fd < 0) {
     return;
   }
 
-  int domain = t.arg1();
   int type = t.arg2();
 
   if (domain == AF_INET || domain == AF_INET6) {
     s.remote_sockfds->insert(fd);
   }
 
-  if (type & SOCK_NONBLOCK) {
+  if (domain == AF_UNIX) {
+    trackUnixSocket(s, fd, type);
+  } else if (type & SOCK_NONBLOCK) {
     (*s.fdStatus)[fd] = descriptorType::nonBlocking;
   }
 
@@ -3221,6 +4521,31 @@ void socketSystemCall::handleDetPost(
       Importance::info, "socket returned " + to_string(fd) + "\n");
 }
 // =======================================================================================
+bool socketpairSystemCall::handleDetPre(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  s.originalArg2 = t.arg2();
+  if (t.arg1() == AF_UNIX) {
+    t.writeArg2(t.arg2() | SOCK_NONBLOCK);
+  }
+  return true;
+}
+
+void socketpairSystemCall::handleDetPost(
+    globalState& gs, state& s, ptracer& t, scheduler& sched) {
+  t.writeArg2(s.originalArg2);
+  if (t.arg1() != AF_UNIX || (int64_t)t.getReturnValue() < 0) {
+    return;
+  }
+
+  int* sv = (int*)t.arg4();
+  int first = t.readFromTracee(traceePtr<int>(sv), s.traceePid);
+  int second = t.readFromTracee(traceePtr<int>(sv + 1), s.traceePid);
+  trackUnixSocket(s, first, t.arg2());
+  trackUnixSocket(s, second, t.arg2());
+  gs.log.writeToLog(
+      Importance::info, "socketpair returned %d, %d\n", first, second);
+}
+// =======================================================================================
 
 // =======================================================================================
 bool listenSystemCall::handleDetPre(
@@ -3258,6 +4583,7 @@ void acceptSystemCall::handleDetPost(
 
 static int get_proc_fd_flags(pid_t pid, int pid_fd) {
   char path[64];
+  hostTraceeQuery(pid);
   snprintf(path, 64, "/proc/%d/fdinfo/%d", pid, pid_fd);
 
   int fd = open(path, O_RDONLY);
@@ -3309,6 +4635,12 @@ bool accept4SystemCall::handleDetPre(
 
   gs.log.writeToLog(Importance::info, "accept4(%d), flags = %d\n", fd, flags);
 
+  s.originalArg4 = flags;
+  // Connections to Unix listeners are tracked like pipes.
+  if (s.fd_is_unix(fd)) {
+    t.writeArg4(flags | SOCK_NONBLOCK);
+  }
+
   auto it = s.fdStatus.get()->find(fd);
   if (it != s.fdStatus.get()->end()) {
     if (it->second == descriptorType::nonBlocking) {
@@ -3330,11 +4662,16 @@ bool accept4SystemCall::handleDetPre(
 void accept4SystemCall::handleDetPost(
     globalState& gs, state& s, ptracer& t, scheduler& sched) {
   int fd = (int)t.arg1();
-  int flags = (int)t.arg4();
+  int flags = (int)s.originalArg4;
   int retval = (int)t.getReturnValue();
+  t.writeArg4(s.originalArg4);
 
   if (retval >= 0) {
-    if ((flags & SOCK_NONBLOCK) == SOCK_NONBLOCK) {
+    s.userDefinedTimeout = false;
+    if (s.fd_is_unix(fd)) {
+      int type = (*s.unixSockets)[fd];
+      trackUnixSocket(s, retval, type | (flags & SOCK_NONBLOCK));
+    } else if ((flags & SOCK_NONBLOCK) == SOCK_NONBLOCK) {
       (*s.fdStatus.get())[retval] = descriptorType::nonBlocking;
     } else {
       (*s.fdStatus.get())[retval] = descriptorType::blocking;
@@ -3349,12 +4686,11 @@ void accept4SystemCall::handleDetPost(
     if (retval == -EAGAIN || retval == -EWOULDBLOCK) {
       gs.log.writeToLog(
           Importance::info, "accetp4 would have blocked! Replaying\n");
-      gs.replayDueToBlocking++;
+      countBlockedReplay(gs, s);
       sched.preemptAndScheduleNext();
       replaySystemCall(gs, t, t.getSystemCallNumber());
     }
     s.userDefinedTimeout = false;
-    t.writeArg4(s.originalArg4);
   }
   return;
 }
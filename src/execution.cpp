@@ -7,9 +7,11 @@
 #include "scheduler.hpp"
 #include "state.hpp"
 #include "systemCallList.hpp"
+#include "timeShim.hpp"
 #include "util.hpp"
 #include "vdso.hpp"
 
+#include <sys/auxv.h>
 #include <sys/utsname.h>
 #include <stack>
 #include <tuple>
@@ -20,7 +22,6 @@ void deleteMultimapEntry(
     unordered_multimap<pid_t, pid_t>& mymap, pid_t key, pid_t value);
 pid_t eraseChildEntry(multimap<pid_t, pid_t>& map, pid_t process);
 bool kernelCheck(int a, int b, int c);
-void trapCPUID(globalState& gs, state& s, ptracer& t);
 
 bool kernelCheck(int a, int b, int c) {
   struct utsname utsname = {};
@@ -62,7 +63,17 @@ execution::execution(
     logical_clock::duration clock_step,
     SysEnter sys_enter_hook,
     SysExit sys_exit_hook,
-    void* user_data)
+    void* user_data,
+    MetricsCallback metrics_hook,
+    unsigned long metrics_interval,
+    traceLimits limits,
+    unsigned vcpus,
+    bool spinWait,
+    bool timeShim,
+    bool pathInodes,
+    string handlerTracePath,
+    FileAccessCallback fileAccessHook,
+    void* fileAccessData)
     : kernelPre4_8{kernelCheck(4, 8, 0)},
       log{logFile, debugLevel, useColor},
       silentLogger{"", 0},
@@ -71,24 +82,52 @@ execution::execution(
       tracer{startingPid},
       // Create our global state once, share across class.
       myGlobalState{
-          log,          ValueMapper<ino_t, ino_t>{log, "inode map", 1},
+          log,          inodeMapper{log, pathInodes},
           ModTimeMap{}, kernelCheck(4, 12, 0),
           prngSeed,     epoch,
-          allow_network},
+          allow_network, vcpus},
       myScheduler{startingPid, log},
       debugLevel{debugLevel},
       vdsoFuncs(vdsoFuncs, vdsoFuncs + nbVdsoFuncs),
+      useTimeShim(timeShim),
       epoch(epoch),
       clock_step(clock_step),
       prngSeed(prngSeed),
       sys_enter_hook(sys_enter_hook),
       sys_exit_hook(sys_exit_hook),
-      user_data(user_data) {
+      user_data(user_data),
+      metrics_hook(metrics_hook),
+      // Zero would mean "every 0 events", treat it as the default.
+      metrics_interval(
+          metrics_interval != 0 ? metrics_interval : DETTRACE_METRICS_INTERVAL),
+      fileAccessHook(fileAccessHook),
+      fileAccessData(fileAccessData),
+      limits(limits),
+      stops(spinWait) {
+  myGlobalState.states = &states;
+  if (!handlerTracePath.empty()) {
+    handlerTraceHeader header{};
+    header.epoch = epoch.time_since_epoch().count();
+    header.clockStep = clock_step.count();
+    header.prngSeed = prngSeed;
+    header.vcpus = vcpus;
+    header.allowNetwork = allow_network;
+    header.pathInodes = pathInodes;
+    header.kernelPre4_12 = myGlobalState.kernelPre4_12;
+    handlerTrace.reset(new handlerRecorder{handlerTracePath, header});
+  }
+  planVdsoPatch();
+  if (spinWait && !stops.spinning()) {
+    log.writeToLog(
+        Importance::inter, "Only one CPU available, ignoring --spin-wait.\n");
+  }
   // Set state for first process.
   states.emplace(
       startingPid, state{startingPid, debugLevel, epoch, clock_step});
   myGlobalState.threadGroups.insert({startingPid, startingPid});
   myGlobalState.threadGroupNumber.insert({startingPid, startingPid});
+  trackVpid(states.at(startingPid));
+  scanOpenFiles(myGlobalState, states.at(startingPid));
 
   // First process is special and we must set the options ourselves.
   // This is done everytime a new process is spawned.
@@ -110,6 +149,26 @@ bool execution::handleNonEventExit(const pid_t traceesPid) {
   pid_t parent = eraseChildEntry(processTree, traceesPid);
   auto tgNumber = myGlobalState.threadGroupNumber.at(traceesPid);
 
+  // A process exiting sends SIGCHLD to its parent, which stays pending if the
+  // parent has it blocked (e.g. around a sigsuspend).
+  if (parent != -1 && myGlobalState.liveThreads.count(traceesPid) == 0) {
+    signalSent(myGlobalState, myScheduler, parent, SIGCHLD, true);
+  }
+
+  // Killed before its exit event, it may still hold its parent's time shim.
+  state* exiting = states.find(traceesPid);
+  if (exiting != nullptr) {
+    returnTimeShim(*exiting);
+    myGlobalState.dirEntriesResized(exiting->dirEntriesBytes(), 0);
+    if (exiting->openFiles.use_count() == 1) {
+      openFilesReleased(myGlobalState, *exiting);
+    }
+    auto vpid = myGlobalState.hostPids.find(exiting->vpid);
+    if (vpid != myGlobalState.hostPids.end() && vpid->second == traceesPid) {
+      myGlobalState.hostPids.erase(vpid);
+    }
+  }
+
   // Erase tracee from our state.
   if (states.erase(traceesPid) != 1) {
     runtimeError("Not such tracee to delete: " + to_string(traceesPid));
@@ -122,17 +181,24 @@ bool execution::handleNonEventExit(const pid_t traceesPid) {
           "Not such thread to delete from liveThreads: " +
           to_string(traceesPid));
     }
-    if (myGlobalState.threadGroupNumber.erase(traceesPid) != 1) {
-      runtimeError(
-          "Not such thread to delete from threadGroupNumber: " +
-          to_string(traceesPid));
-    }
+  }
+  // Processes have an entry for themselves too.
+  if (myGlobalState.threadGroupNumber.erase(traceesPid) != 1) {
+    runtimeError(
+        "Not such tracee to delete from threadGroupNumber: " +
+        to_string(traceesPid));
   }
 
   // If thread, we should always be able to delete this entry.
   // If process, then it should have their own thread group as well.
   deleteMultimapEntry(myGlobalState.threadGroups, tgNumber, traceesPid);
 
+  // A burst of threads shouldn't leave its footprint behind.
+  shrinkIfSparse(myGlobalState.liveThreads);
+  shrinkIfSparse(myGlobalState.threadGroupNumber);
+  shrinkIfSparse(myGlobalState.threadGroups);
+  shrinkIfSparse(myGlobalState.hostPids);
+
   // Parent has no childrent left, and want's to exit! Schedule for exit as it
   // is no longer in our scheduler's heaps.
   if (parent != -1 && // We have no parent, we're root.
@@ -161,12 +227,157 @@ bool execution::handleNonEventExit(const pid_t traceesPid) {
   }
 }
 // =======================================================================================
+flightRecord& execution::recordSystemCall(
+    flightEvent event, pid_t traceesPid, int syscallNum) {
+  flightRecord& rec = recorder.record(event, traceesPid);
+  rec.number = syscallNum;
+  rec.args[0] = tracer.arg1();
+  rec.args[1] = tracer.arg2();
+  rec.args[2] = tracer.arg3();
+  rec.args[3] = tracer.arg4();
+  rec.args[4] = tracer.arg5();
+  rec.args[5] = tracer.arg6();
+  return rec;
+}
+
+uint8_t execution::systemCallDecision(
+    const state& currState, uint32_t replaysBefore) {
+  uint8_t decision = 0;
+  if (myGlobalState.totalReplays != replaysBefore) {
+    decision |= FLIGHT_REPLAY;
+  }
+  if (currState.syscallInjected) {
+    decision |= FLIGHT_INJECTED;
+  }
+  if (currState.noopSystemCall) {
+    decision |= FLIGHT_NOOP;
+  }
+  return decision;
+}
+// =======================================================================================
+void execution::reportFileAccesses(state& currState, int syscallNum) {
+  struct fileAccess {
+    int dirFd;
+    uint64_t path;
+    bool write;
+  };
+  const int openWrites = O_WRONLY | O_RDWR | O_CREAT | O_TRUNC;
+  vector<fileAccess> accesses;
+  switch (syscallNum) {
+  case SYS_open:
+    accesses.push_back(
+        {AT_FDCWD, tracer.arg1(), (tracer.arg2() & openWrites) != 0});
+    break;
+  case SYS_openat:
+    accesses.push_back({(int)tracer.arg1(), tracer.arg2(),
+                        (tracer.arg3() & openWrites) != 0});
+    break;
+  case SYS_execve:
+  case SYS_access:
+  case SYS_stat:
+  case SYS_lstat:
+  case SYS_readlink:
+    accesses.push_back({AT_FDCWD, tracer.arg1(), false});
+    break;
+  case SYS_faccessat:
+  case SYS_newfstatat:
+  case SYS_readlinkat:
+    accesses.push_back({(int)tracer.arg1(), tracer.arg2(), false});
+    break;
+  case SYS_creat:
+  case SYS_mkdir:
+  case SYS_mknod:
+  case SYS_unlink:
+  case SYS_rmdir:
+  case SYS_truncate:
+  case SYS_chmod:
+  case SYS_chown:
+  case SYS_lchown:
+  case SYS_utime:
+  case SYS_utimes:
+    accesses.push_back({AT_FDCWD, tracer.arg1(), true});
+    break;
+  case SYS_mkdirat:
+  case SYS_mknodat:
+  case SYS_unlinkat:
+  case SYS_fchmodat:
+  case SYS_fchownat:
+  case SYS_utimensat:
+  case SYS_futimesat:
+    accesses.push_back({(int)tracer.arg1(), tracer.arg2(), true});
+    break;
+  case SYS_symlink:
+    accesses.push_back({AT_FDCWD, tracer.arg2(), true});
+    break;
+  case SYS_symlinkat:
+    accesses.push_back({(int)tracer.arg2(), tracer.arg3(), true});
+    break;
+  case SYS_link:
+    accesses.push_back({AT_FDCWD, tracer.arg1(), false});
+    accesses.push_back({AT_FDCWD, tracer.arg2(), true});
+    break;
+  case SYS_linkat:
+    accesses.push_back({(int)tracer.arg1(), tracer.arg2(), false});
+    accesses.push_back({(int)tracer.arg3(), tracer.arg4(), true});
+    break;
+  case SYS_rename:
+    accesses.push_back({AT_FDCWD, tracer.arg1(), true});
+    accesses.push_back({AT_FDCWD, tracer.arg2(), true});
+    break;
+  case SYS_renameat:
+  case SYS_renameat2:
+    accesses.push_back({(int)tracer.arg1(), tracer.arg2(), true});
+    accesses.push_back({(int)tracer.arg3(), tracer.arg4(), true});
+    break;
+  default:
+    return;
+  }
+
+  for (const auto& a : accesses) {
+    // Bad pointers and descriptors fail in the kernel. An empty path, e.g.
+    // AT_EMPTY_PATH or utimensat on a descriptor, is about a file the tracee
+    // has open already.
+    string path;
+    if ((a.dirFd < 0 && a.dirFd != AT_FDCWD) ||
+        !tryReadTraceePath(currState.traceePid, a.path, path) ||
+        path.empty()) {
+      continue;
+    }
+    string resolved =
+        resolve_tracee_path(path, currState.traceePid, log, a.dirFd);
+    auto& reported = a.write ? reportedWrites : reportedReads;
+    if (!resolved.empty() && reported.insert(resolved).second) {
+      fileAccessHook(fileAccessData, resolved.c_str(), a.write);
+    }
+  }
+}
+// =======================================================================================
+/**
+ * System calls a thread that is only waiting for time to pass makes.
+ */
+static bool isIdlePoll(int syscallNum) {
+  switch (syscallNum) {
+  case SYS_nanosleep:
+  case SYS_clock_nanosleep:
+  case SYS_clock_gettime:
+  case SYS_gettimeofday:
+  case SYS_time:
+  case SYS_sched_yield:
+    return true;
+  default:
+    return false;
+  }
+}
+
 // Despite what the name will imply, this function is actually called during a
 // ptrace seccomp event. Not a pre-system call event. In newer kernel version
 // there is no need to deal with ptrace pre-system call events. So the only
 // reason we refer to it here is for backward compatibility reasons.
 bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
   int syscallNum = tracer.getSystemCallNumber();
+  flightRecord& rec =
+      recordSystemCall(flightEvent::preHook, traceesPid, syscallNum);
+  uint32_t replaysBefore = myGlobalState.totalReplays;
 
   if (syscallNum < 0 || syscallNum > SYSTEM_CALL_COUNT) {
     runtimeError("Unkown system call number: " + to_string(syscallNum));
@@ -180,8 +391,39 @@ bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
       redColoredSyscall.c_str());
   log.setPadding();
 
+  if (isIdlePoll(syscallNum)) {
+    currState.idlePolls++;
+  } else {
+    currState.idlePolls = 0;
+    // Someone is doing real work, threads parked while polling may be waiting
+    // for it. Retrying a blocked system call is not work, the thread may be
+    // waiting for a parked one.
+    if (currState.blockedReplays == 0) {
+      myScheduler.madeProgress();
+    }
+  }
+
+  if (fileAccessHook) {
+    reportFileAccesses(currState, syscallNum);
+  }
+
+  if (handlerTrace) {
+    handlerTrace->begin(
+        handlerEventKind::preHook, traceesPid, syscallNum, tracer.getRegs(),
+        currState.getLogicalTime());
+  }
   bool callPostHook =
       callPreHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
+  if (handlerTrace) {
+    handlerTrace->end(callPostHook);
+  }
+  rec.decision = systemCallDecision(currState, replaysBefore) |
+                 (callPostHook ? FLIGHT_POST_HOOK : 0);
+  rec.nextPid = myScheduler.getNext();
+  // With a post-hook the system call is only done there.
+  checkBlockedReplays(
+      currState, systemCall,
+      !callPostHook && myGlobalState.totalReplays == replaysBefore);
 
   if (sys_enter_hook && syscallNum != SYS_arch_prctl &&
       !currState.syscallInjected) {
@@ -212,7 +454,7 @@ bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
       // On older version of the kernel, we would need to catch the pre-system
       // call event to forking system calls. This is event needs to be taken off
       // the ptrace queue so we do that here and simply ignore the event.
-      tie(e, newPid, status) = getNextEvent(traceesPid, true);
+      tie(e, newPid, status) = getNextEvent(currState, traceesPid, true);
       if (e != ptraceEvent::syscall) {
         runtimeError("Expected pre-system call event after fork.");
       }
@@ -233,6 +475,10 @@ bool execution::handlePreSystemCall(state& currState, const pid_t traceesPid) {
 // =======================================================================================
 void execution::handlePostSystemCall(state& currState) {
   int syscallNum = tracer.getSystemCallNumber();
+  flightRecord& rec = recordSystemCall(
+      flightEvent::postHook, currState.traceePid, syscallNum);
+  rec.retval = tracer.getReturnValue();
+  uint32_t replaysBefore = myGlobalState.totalReplays;
 
   // No idea what this system call is! error out.
   if (syscallNum < 0 || syscallNum > SYSTEM_CALL_COUNT) {
@@ -254,7 +500,20 @@ void execution::handlePostSystemCall(state& currState) {
         tracer.getReturnValue());
   }
 
+  if (handlerTrace) {
+    handlerTrace->begin(
+        handlerEventKind::postHook, currState.traceePid, syscallNum,
+        tracer.getRegs(), currState.getLogicalTime());
+  }
   callPostHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
+  if (handlerTrace) {
+    handlerTrace->end();
+  }
+  rec.decision = systemCallDecision(currState, replaysBefore);
+  rec.nextPid = myScheduler.getNext();
+
+  checkBlockedReplays(
+      currState, syscallName, myGlobalState.totalReplays == replaysBefore);
 
   if (sys_exit_hook && syscallNum != SYS_arch_prctl &&
       !currState.syscallInjected) {
@@ -270,6 +529,98 @@ void execution::handlePostSystemCall(state& currState) {
   return;
 }
 
+// =======================================================================================
+void execution::countEvent(state& currState) {
+  events++;
+  if (limits.maxLogicalTime != logical_clock::duration::zero() &&
+      currState.getLogicalTime() - epoch > limits.maxLogicalTime) {
+    limitExceeded("logical time (us)", limits.maxLogicalTime.count());
+  }
+  if (metrics_hook != nullptr) {
+    lastLogicalTime = currState.getLogicalTime();
+    if (events % metrics_interval == 0) {
+      publishMetrics();
+    }
+  }
+}
+
+void execution::checkBlockedReplays(
+    state& currState, const string& syscallName, bool completed) {
+  if (completed) {
+    currState.blockedReplays = 0;
+  } else if (
+      limits.maxBlockedReplays != 0 &&
+      currState.blockedReplays > limits.maxBlockedReplays) {
+    limitExceeded(
+        "replays of blocked " + syscallName, limits.maxBlockedReplays);
+  }
+}
+
+bool execution::handleSystemCallEvent(
+    state& currState, ptraceEvent ret, pid_t traceesPid) {
+  // Most common event. We handle the pre-hook for system calls here.
+  if (ret == ptraceEvent::seccomp) {
+    log.writeToLog(Importance::extra, "Is seccomp event!\n");
+    systemCallsEvents++;
+    if (limits.maxSystemCallEvents != 0 &&
+        systemCallsEvents > limits.maxSystemCallEvents) {
+      limitExceeded("system call events", limits.maxSystemCallEvents);
+    }
+    currState.callPostHook = handleSeccomp(currState, traceesPid);
+    return true;
+  }
+
+  // We still need this case even though we use seccomp + bpf. Since we do
+  // post-hook interception of system calls through PTRACE_SYSCALL. Only post
+  // system call events come here.
+  if (ret == ptraceEvent::syscall) {
+    // For older kernels, we see a system call event and we also see a handle
+    // seccomp event. I chose to always handle the pre-system call on the
+    // ptracer seccomp event. So we skip the pre-system call event here on
+    // older kernels.
+    // old-kernel-only ptrace system call event for pre exit hook.
+    if (kernelPre4_8 && currState.onPreExitEvent) {
+      currState.callPostHook = true;
+      currState.onPreExitEvent = false;
+    } else {
+      // Only count here due to comment above (we see this event twice in
+      // older kernels).
+      systemCallsEvents++;
+      tracer.updateState(traceesPid);
+      handlePostSystemCall(currState);
+      // set callPostHook to default value for next iteration.
+      currState.callPostHook = false;
+    }
+    return true;
+  }
+
+  return false;
+}
+
+bool execution::runAlone(
+    state& currState, ptraceEvent& ret, pid_t& traceesPid, int& status) {
+  const pid_t pid = currState.traceePid;
+  log.writeToLog(Importance::info, "Only [%d] is left to run.\n", pid);
+
+  // Handlers may preempt or park the tracee, with nobody else around the
+  // scheduler hands it straight back. Only a handler making another tracee
+  // runnable gets us out without an event.
+  do {
+    tie(ret, traceesPid, status) =
+        getNextEvent(currState, pid, currState.callPostHook);
+    countEvent(currState);
+    aloneEvents++;
+
+    if (!handleSystemCallEvent(currState, ret, traceesPid)) {
+      return true;
+    }
+  } while (myScheduler.alone());
+
+  return false;
+}
+
+// =======================================================================================
+volatile sig_atomic_t execution::timeoutExpired = 0;
 // =======================================================================================
 int execution::runProgram() {
   // When using seccomp, we run with PTRACE_CONT, but seccomp only reports
@@ -287,47 +638,33 @@ int execution::runProgram() {
     pid_t traceesPid;
     ptraceEvent ret;
 
-    pid_t nextPid = myScheduler.getNext();
-    bool post = states.at(nextPid).callPostHook;
-    tie(ret, traceesPid, status) = getNextEvent(nextPid, post);
-
-    // Most common event. We handle the pre-hook for system calls here.
-    if (ret == ptraceEvent::seccomp) {
-      log.writeToLog(Importance::extra, "Is seccomp event!\n");
-      systemCallsEvents++;
-      states.at(traceesPid).callPostHook = handleSeccomp(traceesPid);
-      continue;
+    if (timeoutExpired) {
+      runtimeError("dettrace timeout expired\n");
     }
 
-    // We still need this case even though we use seccomp + bpf. Since we do
-    // post-hook interception of system calls through PTRACE_SYSCALL. Only post
-    // system call events come here.
-    if (ret == ptraceEvent::syscall) {
-      // For older kernels, we see a system call event and we also see a handle
-      // seccomp event. I chose to always handle the pre-system call on the
-      // ptracer seccomp event. So we skip the pre-system call event here on
-      // older kernels.
-      state& currentState = states.at(traceesPid);
-
-      // old-kernel-only ptrace system call event for pre exit hook.
-      if (kernelPre4_8 && currentState.onPreExitEvent) {
-        states.at(traceesPid).callPostHook = true;
-        currentState.onPreExitEvent = false;
-      } else {
-        // Only count here due to comment above (we see this event twice in
-        // older kernels).
-        systemCallsEvents++;
-        tracer.updateState(traceesPid);
-        handlePostSystemCall(currentState);
-        // set callPostHook to default value for next iteration.
-        states.at(traceesPid).callPostHook = false;
+    pid_t nextPid = myScheduler.getNext();
+    // We always waitpid on nextPid, so this is the state for whatever event we
+    // get back. Look it up once and use it for the whole event. Careful, the
+    // reference is invalidated by handleNonEventExit.
+    state& currentState = states.at(nextPid);
+    if (myScheduler.alone()) {
+      if (!runAlone(currentState, ret, traceesPid, status)) {
+        continue;
       }
+    } else {
+      bool post = currentState.callPostHook;
+      tie(ret, traceesPid, status) = getNextEvent(currentState, nextPid, post);
+      countEvent(currentState);
 
-      continue;
+      // Most common events.
+      if (handleSystemCallEvent(currentState, ret, traceesPid)) {
+        continue;
+      }
     }
 
     // Current process was ended by signal.
     if (ret == ptraceEvent::terminatedBySignal) {
+      recorder.record(flightEvent::exit, traceesPid).number = status;
       auto msg = log.makeTextColored(
           Color::blue, "Process [%d] ended by signal %d.\n");
       log.writeToLog(Importance::inter, msg, traceesPid, WTERMSIG(status));
@@ -350,14 +687,16 @@ int execution::runProgram() {
        evenExit when our children have exited.
     */
     if (ret == ptraceEvent::eventExit) {
+      recorder.record(flightEvent::exit, traceesPid).number = status;
       auto msg = log.makeTextColored(
           Color::blue,
           "Process [%d] has finished. "
           "With ptraceEventExit, exit_code: %d.");
       log.writeToLog(Importance::inter, msg, traceesPid, exit_code);
-      states.at(traceesPid).callPostHook = false;
+      currentState.callPostHook = false;
+      returnTimeShim(currentState);
 
-      bool isExitGroup = states.at(traceesPid).isExitGroup;
+      bool isExitGroup = currentState.isExitGroup;
       pid_t threadGroup = myGlobalState.threadGroupNumber.at(traceesPid);
 
       // there is two reasons this is necessary
@@ -368,7 +707,7 @@ int execution::runProgram() {
       // group, it will do the same as #1. Only when we have a non-main thread
       // call exit group, do we not need to set this flag, and that's only
       // because this flag is per process/thread!
-      states.at(traceesPid).isExitGroup = false;
+      currentState.isExitGroup = false;
       // We state that the main process in a thread group was killed by an exit
       // group, this way, the main process ever stops responding, we know why.
       // This is needed as this process may get stuck in getNextEvent
@@ -448,7 +787,8 @@ int execution::runProgram() {
 
     // Current process is finally truly done (unlike eventExit).
     if (ret == ptraceEvent::nonEventExit) {
-      if (states.at(traceesPid).isExitGroup) {
+      recorder.record(flightEvent::exit, traceesPid).number = status;
+      if (currentState.isExitGroup) {
         // never seen this, don't know how to handle.
         runtimeError(
             "We should not see nonEventExit from a exitGroup event.\n");
@@ -460,7 +800,7 @@ int execution::runProgram() {
           "With ptraceNonEventExit.\n");
       log.writeToLog(Importance::inter, msg, traceesPid);
 
-      states.at(traceesPid).callPostHook = false;
+      currentState.callPostHook = false;
       if (processTree.count(traceesPid) != 0) {
         runtimeError(
             "We receieved a nonEventExit with children left."
@@ -478,6 +818,9 @@ int execution::runProgram() {
       int syscallNumber = (int)tracer.getSystemCallNumber();
       string msg = "none";
       bool isThread = false;
+      // The child borrows our address space, and with it the time shim, until
+      // it execs or exits.
+      bool isVfork = false;
 
       // Per ptrace man page: we cannot reliably tell a clone syscall from it's
       // event, so we check explicitly.
@@ -487,11 +830,14 @@ int execution::runProgram() {
         break;
       case SYS_vfork:
         msg = "vfork";
+        isVfork = true;
         break;
       case SYS_clone: {
         msg = "clone";
         unsigned long flags = (unsigned long)tracer.arg1();
         isThread = (flags & CLONE_THREAD) != 0;
+        isVfork = !isThread && (flags & CLONE_VM) != 0 &&
+            (flags & CLONE_VFORK) != 0;
         // if((flags & CLONE_FILES) != 0){
         // runtimeError("We do not support CLONE_FILES\n");
         // }
@@ -508,8 +854,8 @@ int execution::runProgram() {
           log.makeTextColored(Color::blue, "[%d] caught %s event!\n"),
           traceesPid, msg.c_str());
 
-      handleForkEvent(traceesPid, isThread);
-      states.at(traceesPid).callPostHook = false;
+      handleForkEvent(currentState, traceesPid, isThread, isVfork);
+      currentState.callPostHook = false;
       continue;
     }
 
@@ -519,7 +865,7 @@ int execution::runProgram() {
           log.makeTextColored(Color::blue, "[%d] Caught execve event!\n"),
           traceesPid);
       // reset CPUID trap flag
-      states.at(traceesPid).CPUIDTrapSet = false;
+      currentState.CPUIDTrapSet = false;
 
       handleExecEvent(traceesPid);
       continue;
@@ -527,7 +873,7 @@ int execution::runProgram() {
 
     if (ret == ptraceEvent::signal) {
       int signalNum = WSTOPSIG(status);
-      handleSignal(signalNum, traceesPid);
+      handleSignal(currentState, signalNum, traceesPid);
       continue;
     }
 
@@ -536,12 +882,15 @@ int execution::runProgram() {
         " Uknown return value for ptracer::getNextEvent()\n");
   }
 
+  // Our caller closes every descriptor once we return, finish the file first.
+  handlerTrace.reset();
+
   auto msg = log.makeTextColored(
       Color::blue, "All processes done. Finished successfully!\n");
   log.writeToLog(Importance::info, msg);
 
   if (printStatistics) {
-    auto printStat = [&](string type, uint32_t value) {
+    auto printStat = [&](string type, uint64_t value) {
       string preStr = "dettrace Statistic. ";
       cerr << preStr + type + to_string(value) << endl;
     };
@@ -556,17 +905,44 @@ int execution::runProgram() {
     printStat("/dev/urandom opens: ", myGlobalState.devUrandomOpens);
     printStat("/dev/random opens: ", myGlobalState.devRandomOpens);
     printStat("Time Related Sytem Calls: ", myGlobalState.timeCalls);
+    if (useTimeShim) {
+      printStat(
+          "Time calls served in the tracee: ", myGlobalState.timeShimCalls);
+    }
     printStat("Process spawn events: ", processSpawnEvents);
+    printStat("Events with a single tracee: ", aloneEvents);
     printStat(
         "Calls for scheduling next process: ",
         myScheduler.callsToScheduleNextProcess);
+    printStat("Parked polling threads: ", myScheduler.parkedPolls);
     printStat(
         "Replays due to blocking system call: ",
         myGlobalState.replayDueToBlocking);
     printStat("Total replays: ", myGlobalState.totalReplays);
+    printStat("Injected system calls: ", myGlobalState.injectedSystemCalls);
+    printStat("io_uring operations: ", myGlobalState.ioUringOperations);
     printStat("ptrace peeks: ", tracer.ptracePeeks);
     printStat("process_vm_reads: ", tracer.readVmCalls);
     printStat("process_vm_writes: ", tracer.writeVmCalls);
+    tracerMemory mem = memoryUsage();
+    printStat("Inodes tracked: ", mem.inodesTracked);
+    printStat("Inodes reclaimed: ", myGlobalState.reclaimedInodes);
+    printStat("Inode map bytes: ", mem.inodeMapBytes);
+    printStat("Mtime map bytes: ", mem.mtimeMapBytes);
+    printStat(
+        "Peak directory entry bytes: ", myGlobalState.peakDirEntriesBytes);
+    printStat("Thread tracking bytes: ", mem.threadTrackingBytes);
+    if (stops.spinning()) {
+      printStat("Stops caught spinning: ", stops.spinHits);
+      printStat("Stops waited for blocking: ", stops.spinMisses);
+      printStat(
+          "Microseconds spinning: ",
+          chrono::duration_cast<chrono::microseconds>(stops.spinTime).count());
+      printStat(
+          "Microseconds blocked: ",
+          chrono::duration_cast<chrono::microseconds>(stops.blockedTime)
+              .count());
+    }
   }
 
   if (!myGlobalState.liveThreads.empty()) {
@@ -583,13 +959,75 @@ int execution::runProgram() {
     exit(1);
   }
 
+  if (metrics_hook != nullptr) {
+    publishMetrics(true);
+  }
   return exit_code;
   // Add a check for states.empty(). Not adding it now since I don't want a
   // bunch of packages. to fail over this :b
 }
 // =======================================================================================
-pid_t execution::handleForkEvent(const pid_t traceesPid, bool isThread) {
+void execution::limitExceeded(const string& what, uint64_t limit) {
+  myScheduler.killAllProcesses();
+  runtimeError(
+      "dettrace limit exceeded: " + what + " over " + to_string(limit) +
+      " at event " + to_string(events) + "\n");
+}
+// =======================================================================================
+void execution::publishMetrics(bool finished) {
+  TraceMetrics m = {};
+  m.events = events;
+  m.system_call_events = systemCallsEvents;
+  m.rdtsc_events = rdtscEvents;
+  m.rdtscp_events = rdtscpEvents;
+  m.process_spawn_events = processSpawnEvents;
+  m.read_retry_events = myGlobalState.readRetryEvents;
+  m.write_retry_events = myGlobalState.writeRetryEvents;
+  m.replays_due_to_blocking = myGlobalState.replayDueToBlocking;
+  m.total_replays = myGlobalState.totalReplays;
+  m.injected_system_calls = myGlobalState.injectedSystemCalls;
+  m.ptrace_peeks = tracer.ptracePeeks;
+  m.process_vm_reads = tracer.readVmCalls;
+  m.process_vm_writes = tracer.writeVmCalls;
+  // Every tracee has a state, threads other than the group leader are also
+  // in liveThreads.
+  m.live_threads = myGlobalState.liveThreads.size();
+  m.live_processes = states.size() - m.live_threads;
+  m.blocked_processes = myScheduler.blockedCount();
+  m.logical_time_us = lastLogicalTime.time_since_epoch().count();
+  tracerMemory mem = memoryUsage();
+  m.inodes_tracked = mem.inodesTracked;
+  m.inodes_reclaimed = myGlobalState.reclaimedInodes;
+  m.inode_map_bytes = mem.inodeMapBytes;
+  m.mtime_map_bytes = mem.mtimeMapBytes;
+  m.dir_entries_bytes = mem.dirEntriesBytes;
+  m.thread_tracking_bytes = mem.threadTrackingBytes;
+  m.finished = finished;
+  metrics_hook(user_data, &m);
+}
+// =======================================================================================
+tracerMemory execution::memoryUsage() {
+  tracerMemory mem;
+  mem.inodesTracked = myGlobalState.inodeMap.size();
+  mem.inodeMapBytes = myGlobalState.inodeMap.memoryBytes();
+  mem.mtimeMapBytes = myGlobalState.mtimeMap.memoryBytes();
+  mem.dirEntriesBytes = myGlobalState.dirEntriesBytes;
+  mem.threadTrackingBytes = myGlobalState.threadTrackingBytes();
+  return mem;
+}
+// =======================================================================================
+void execution::trackVpid(state& s) {
+  s.vpid = namespacePid(s.traceePid);
+  myGlobalState.hostPids[s.vpid] = s.traceePid;
+}
+// =======================================================================================
+pid_t execution::handleForkEvent(
+    state& parentState, const pid_t traceesPid, bool isThread, bool isVfork) {
   processSpawnEvents++;
+  traceesSpawned++;
+  if (limits.maxProcesses != 0 && traceesSpawned > limits.maxProcesses) {
+    limitExceeded("processes spawned", limits.maxProcesses);
+  }
 
   pid_t newChildPid = ptracer::getEventMessage(traceesPid);
   auto threadGroup = myGlobalState.threadGroupNumber.at(traceesPid);
@@ -625,15 +1063,24 @@ pid_t execution::handleForkEvent(const pid_t traceesPid, bool isThread) {
   // This is where we add new children to the thread group leader.
   processTree.insert(make_pair(threadGroup, newChildPid));
 
-  state& parent_state = states.at(traceesPid);
   // Share fdStatus. Processes get their own, threads share with thread group.
   if (isThread) {
-    states.emplace(newChildPid, parent_state.cloned(newChildPid));
+    states.emplace(newChildPid, parentState.cloned(newChildPid));
   } else {
+    // The child starts from the parent's time shim as it is now.
+    myGlobalState.timeShimCalls += parentState.syncTimeShim();
     // Deep Copy!
-    states.emplace(newChildPid, parent_state.forked(newChildPid));
+    states.emplace(newChildPid, parentState.forked(newChildPid));
+    openFilesInherited(myGlobalState, states.at(newChildPid));
+    // The parent sleeps until the child is done with its time shim, then gets
+    // its clock back, see returnTimeShim.
+    if (isVfork && parentState.timeShim.ptr != nullptr) {
+      states.at(newChildPid).timeShimLender = traceesPid;
+    }
   }
   // Add this new process to our states.
+  trackVpid(states.at(newChildPid));
+  myGlobalState.dirEntriesResized(0, states.at(newChildPid).dirEntriesBytes());
 
   log.writeToLog(
       Importance::info,
@@ -642,6 +1089,13 @@ pid_t execution::handleForkEvent(const pid_t traceesPid, bool isThread) {
 
   // Let child run instead of the parent, inform scheduler of new process.
   myScheduler.addAndScheduleNext(newChildPid);
+  if (handlerTrace) {
+    handlerTrace->spawn(traceesPid, newChildPid, isThread);
+  }
+
+  flightRecord& rec = recorder.record(flightEvent::spawn, traceesPid);
+  rec.number = newChildPid;
+  rec.nextPid = newChildPid;
 
   // during fork, the parent's mmaped memory are COWed, as we set the mapping
   // attributes to MAP_PRIVATE. new child's `mmapMemory` hence must be inherited
@@ -663,6 +1117,11 @@ pid_t execution::handleForkEvent(const pid_t traceesPid, bool isThread) {
   }
   log.writeToLog(
       Importance::info, log.makeTextColored(Color::blue, "Child ready!\n"));
+  if (!isThread) {
+    // The child's copy of the time shim still counts the calls we collected
+    // from the parent.
+    states.at(newChildPid).syncTimeShim();
+  }
   return newChildPid;
 }
 
@@ -670,146 +1129,194 @@ static inline unsigned long alignUp(unsigned long size, int align) {
   return (size + align - 1) & ~(align - 1);
 }
 
-void execution::disableVdso(pid_t pid) {
+void execution::planVdsoPatch() {
   struct ProcMapEntry vdsoMap, vvarMap;
 
   memset(&vdsoMap, 0, sizeof(vdsoMap));
   memset(&vvarMap, 0, sizeof(vvarMap));
 
-  if (proc_get_vdso_vvar(pid, &vdsoMap, &vvarMap) < 0) {
-    // found no [vdso] / [vvar], Nothing to do..
+  // Tracees run on the same kernel, so our own [vdso] has the same bytes and
+  // [vvar] sits at the same distance from it.
+  if (proc_get_vdso_vvar(getpid(), &vdsoMap, &vvarMap) < 0 ||
+      vdsoMap.procMapBase == 0) {
+    // vdso is disabled by kernel command line.
     return;
   }
-
-  // vdso is enabled by kernel command line.
-  if (vdsoMap.procMapBase != 0) {
-    for (auto func : vdsoFuncs) {
-      const auto& sym = func;
-      unsigned long target = vdsoMap.procMapBase + sym.offset;
-      unsigned long nbUpper = alignUp(sym.size, sym.alignment);
-      unsigned long nb = alignUp(sym.code_size, sym.alignment);
-      VERIFY(nb <= nbUpper);
-
-      for (auto i = 0; i < nb / sizeof(long); i++) {
-        uint64_t val;
-        const unsigned char* z = func.code;
-        unsigned long to = target + 8 * i;
-        memcpy(&val, &z[8 * i], sizeof(val));
-        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)to, (void*)val);
-      }
-
-      unsigned long off = target + nb;
-      unsigned long val = 0xccccccccccccccccUL;
-      while (nb < nbUpper) {
-        ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)off, (void*)val);
-        off += sizeof(long);
-        nb += sizeof(long);
-      }
-      VERIFY(nb == nbUpper);
-    }
-  }
-
   if (vvarMap.procMapBase != 0) {
-    struct user_regs_struct regs;
-    ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-    auto oldRegs = regs;
-
-    regs.orig_rax = SYS_mprotect;
-    regs.rax = SYS_mprotect;
-    regs.rdi = vvarMap.procMapBase;
-    regs.rsi = vvarMap.procMapSize;
-    regs.rdx = PROT_NONE;
-    regs.r10 = 0;
-    regs.r8 = 0;
-    regs.r9 = 0;
-    regs.rip += 1; /* 0xcc; syscall(0x0f05); 0xcc */
-
-    int status;
+    vvarDistance = vdsoMap.procMapBase - vvarMap.procMapBase;
+    vvarSize = vvarMap.procMapSize;
+  }
+  if (vdsoFuncs.empty()) {
+    return;
+  }
 
-    ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
-    ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-    VERIFY(waitpid(pid, &status, 0) == pid);
-    VERIFY(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
-    ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-    if ((long)regs.rax < 0) {
-      string err = "unable to inject mprotect, error: \n";
-      runtimeError(err + strerror((long)-regs.rax));
+  unsigned long begin = ULONG_MAX, end = 0;
+  for (const auto& sym : vdsoFuncs) {
+    begin = min(begin, sym.offset);
+    end = max(end, sym.offset + alignUp(sym.size, sym.alignment));
+  }
+  VERIFY(end <= (unsigned long)vdsoMap.procMapSize);
+
+  // One write covering every function, whatever lies between them keeps its
+  // original bytes.
+  const unsigned char* base = (const unsigned char*)vdsoMap.procMapBase;
+  vdsoPatchOffset = begin;
+  vdsoPatch.assign(base + begin, base + end);
+  for (const auto& sym : vdsoFuncs) {
+    unsigned long nbUpper = alignUp(sym.size, sym.alignment);
+    VERIFY(sym.code_size <= nbUpper);
+    unsigned char* target = &vdsoPatch[sym.offset - begin];
+    memcpy(target, sym.code, sym.code_size);
+    memset(target + sym.code_size, 0xcc, nbUpper - sym.code_size);
+    unsigned long entry = useTimeShim ? timeShimEntry(sym.func) : 0;
+    if (entry != 0) {
+      // Same size as the code it replaces, the target comes with each exec.
+      VERIFY(timeShimStubSize == sym.code_size);
+      writeTimeShimStub(target, 0);
+      timeShimStubs.emplace_back(sym.offset - begin, entry);
     }
-    ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &oldRegs);
   }
 }
 
-static unsigned long traceePreinitMmap(pid_t pid, ptracer& t) {
-  struct user_regs_struct regs;
-  unsigned long ret;
-
-  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  auto oldRegs = regs;
+long execution::hideVvar(unsigned long vdsoBase, syscallBatch& setup) {
+  if (vdsoBase == 0 || vvarSize == 0) {
+    return -1;
+  }
+  return setup.add(
+      SYS_mprotect, vdsoBase - vvarDistance, vvarSize, PROT_NONE);
+}
 
-  regs.orig_rax = SYS_mmap;
-  regs.rax = SYS_mmap;
-  regs.rdi = 0;
-  regs.rsi = 0x10000;
-  regs.rdx = PROT_READ | PROT_WRITE | PROT_EXEC;
-  regs.r10 = MAP_PRIVATE | MAP_ANONYMOUS;
-  regs.r8 = -1;
-  regs.r9 = 0;
+void execution::disableVdso(
+    int memFd, unsigned long vdsoBase, uint64_t timeShim) {
+  if (vdsoBase == 0 || vdsoPatch.empty()) {
+    // found no [vdso], Nothing to do..
+    return;
+  }
 
-  int status;
-  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
-  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-  VERIFY(waitpid(pid, &status, 0) == pid);
-  VERIFY(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
-  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  if ((long)regs.rax < 0) {
-    string err = "unable to inject syscall page, error: \n";
-    runtimeError(err + strerror((long)-regs.rax));
+  if (timeShim == 0) {
+    writeTraceeMem(
+        memFd, vdsoBase + vdsoPatchOffset, vdsoPatch.data(), vdsoPatch.size());
+    return;
   }
-  ret = regs.rax;
-  oldRegs.rip = regs.rip - 4; /* 0xcc, syscall, 0xcc = 4 bytes */
-  memcpy(&regs, &oldRegs, sizeof(regs));
-  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+  vector<unsigned char> patch = vdsoPatch;
+  for (const auto& stub : timeShimStubs) {
+    writeTimeShimStub(&patch[stub.first], timeShim + stub.second);
+  }
+  writeTraceeMem(memFd, vdsoBase + vdsoPatchOffset, patch.data(), patch.size());
+}
 
-  return ret;
+void execution::returnTimeShim(state& child) {
+  if (child.timeShimLender == 0) {
+    return;
+  }
+  state* parent = states.find(child.timeShimLender);
+  child.timeShimLender = 0;
+  if (parent != nullptr) {
+    myGlobalState.timeShimCalls += parent->resetTimeShim();
+  }
 }
 
 void execution::handleExecEvent(pid_t pid) {
+  recorder.record(flightEvent::exec, pid).nextPid = pid;
+  // Still on the parent's time shim, which stays behind in its address space.
+  state* vforked = states.find(pid);
+  if (vforked != nullptr) {
+    returnTimeShim(*vforked);
+    // execve resets custom handlers to SIG_DFL.
+    vforked->signalHandlerMasks =
+        make_shared<unordered_map<int, state::handlerMask>>();
+    // Close-on-exec descriptors are gone.
+    scanOpenFiles(myGlobalState, *vforked);
+  }
   struct user_regs_struct regs;
-
   ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
-  auto rip = regs.rip;
-  unsigned long stub = 0xcc050fccUL;
-  errno = 0;
 
-  auto saved_insn = tracer.doPtrace(PTRACE_PEEKTEXT, pid, (void*)rip, 0);
-  ptracer::doPtrace(
-      PTRACE_POKETEXT, pid, (void*)rip,
-      (void*)((saved_insn & ~0xffffffffUL) | stub));
-  ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
-
-  int status;
-  VERIFY(waitpid(pid, &status, 0) == pid);
-  VERIFY(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
+  // Everything a fresh address space needs, run with a single resume: our
+  // scratch page, with the time shim behind it, hiding [vvar] and the CPUID
+  // trap.
+  syscallBatch setup;
+  bool withTimeShim = useTimeShim && !timeShimStubs.empty();
+  size_t mmapCall = setup.add(
+      SYS_mmap, 0, 0x10000 + (withTimeShim ? timeShimSize : 0),
+      PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  int memFd = openTraceeMem(pid);
+  unsigned long vdsoBase = proc_get_auxv_entry(pid, AT_SYSINFO_EHDR);
+  long vvarCall = hideVvar(vdsoBase, setup);
+  long cpuidCall = -1;
+  if (myGlobalState.allow_trapCPUID && !myGlobalState.kernelPre4_12 &&
+      NULL == getenv("DETTRACE_NO_CPUID_INTERCEPTION")) {
+    cpuidCall = setup.add(SYS_arch_prctl, ARCH_SET_CPUID, 0);
+  }
 
-  unsigned long mmapAddr = traceePreinitMmap(pid, tracer);
+  // The loop temporarily replaces the code at the entry point, its table goes
+  // below the stack pointer, past the red zone.
+  uint64_t table = (regs.rsp - 128 - setup.dataBytes()) & ~15UL;
+  setup.run(pid, memFd, regs.rip, table);
+  myGlobalState.injectedSystemCalls += setup.size();
 
-  disableVdso(pid);
+  if (setup.result(mmapCall) < 0) {
+    string err = "unable to inject syscall page, error: \n";
+    runtimeError(err + strerror(-setup.result(mmapCall)));
+  }
+  if (vvarCall != -1 && setup.result(vvarCall) < 0) {
+    string err = "unable to inject mprotect, error: \n";
+    runtimeError(err + strerror(-setup.result(vvarCall)));
+  }
 
-  // TODO When does this ever happen?
-  if (states.find(pid) == states.end()) {
-    states.emplace(pid, state{pid, debugLevel, epoch, clock_step});
+  // TODO When does this ever happen? (emplace is a no-op when pid has a state)
+  state& execState =
+      *states.emplace(pid, pid, debugLevel, epoch, clock_step).first;
+
+  // The old shim went with the old address space, the execve pre-hook saved its
+  // clock.
+  execState.timeShim = traceePtr<timeShimData>(nullptr);
+  uint64_t timeShim = 0;
+  if (withTimeShim) {
+    timeShim = setup.result(mmapCall) + 0x10000;
+    auto image = timeShimImage(
+        execState.getLogicalTime().time_since_epoch().count(),
+        execState.getClockStep().count());
+    writeTraceeMem(memFd, timeShim, image.data(), image.size());
+    execState.timeShim = traceePtr<timeShimData>((timeShimData*)timeShim);
   }
-  // Reset file descriptor state, it is wiped after execve.
-  states.at(pid).fdStatus = make_shared<unordered_map<int, descriptorType>>();
+  disableVdso(memFd, vdsoBase, timeShim);
+  close(memFd);
+  // Reset file descriptor state, it is wiped after execve. Except for Unix
+  // sockets handed down without O_CLOEXEC (socket activation, D-Bus), they
+  // are still non-blocking in the kernel.
+  auto fdStatus = make_shared<unordered_map<int, descriptorType>>();
+  auto unixSockets = make_shared<unordered_map<int, int>>();
+  for (auto& socket : *execState.unixSockets) {
+    struct stat st;
+    string fdPath =
+        "/proc/" + to_string(pid) + "/fd/" + to_string(socket.first);
+    if (lstat(fdPath.c_str(), &st) == 0) {
+      unixSockets->insert(socket);
+      auto status = execState.fdStatus->find(socket.first);
+      if (status != execState.fdStatus->end()) {
+        fdStatus->insert(*status);
+      }
+    }
+  }
+  execState.fdStatus = fdStatus;
+  execState.unixSockets = unixSockets;
+  // io_uring descriptors are always close-on-exec.
+  execState.ioUrings = make_shared<unordered_map<int, shared_ptr<ioUring>>>();
 
-  states.at(pid).mmapMemory.doesExist = true;
-  states.at(pid).mmapMemory.setAddr(traceePtr<void>((void*)mmapAddr));
+  execState.mmapMemory.doesExist = true;
+  execState.mmapMemory.setAddr(
+      traceePtr<void>((void*)setup.result(mmapCall)));
 
-  ptracer::doPtrace(PTRACE_POKETEXT, pid, (void*)rip, (void*)saved_insn);
+  if (cpuidCall != -1) {
+    cpuidTrapResult(myGlobalState, execState, setup.result(cpuidCall));
+  }
+  if (handlerTrace) {
+    handlerTrace->exec(pid, execState);
+  }
 }
 
 // =======================================================================================
-bool execution::handleSeccomp(const pid_t traceesPid) {
+bool execution::handleSeccomp(state& currState, const pid_t traceesPid) {
   long syscallNum;
   ptracer::doPtrace(PTRACE_GETEVENTMSG, traceesPid, nullptr, &syscallNum);
 
@@ -820,6 +1327,7 @@ bool execution::handleSeccomp(const pid_t traceesPid) {
     // Fetch real system call from register.
     tracer.updateState(traceesPid);
     syscallNum = tracer.getSystemCallNumber();
+    recordSystemCall(flightEvent::preHook, traceesPid, syscallNum);
     if (0 <= syscallNum && syscallNum < SYSTEM_CALL_COUNT) {
       runtimeError(
           "No filter rule for system call: " + systemCallMappings[syscallNum]);
@@ -834,16 +1342,26 @@ bool execution::handleSeccomp(const pid_t traceesPid) {
   // small optimization we might not want to...
   // Get registers from tracee.
   tracer.updateState(traceesPid);
+  currState.onVsyscall =
+      ((uint64_t)tracer.getRip().ptr & ~0xc00ULL) == 0xFFFFFFFFFF600000ULL;
 
   if (myGlobalState.allow_trapCPUID) {
-    if (!states.at(traceesPid).CPUIDTrapSet && !myGlobalState.kernelPre4_12 &&
+    if (!currState.CPUIDTrapSet && !myGlobalState.kernelPre4_12 &&
         NULL == getenv("DETTRACE_NO_CPUID_INTERCEPTION")) {
       // check if CPUID needs to be set, if it does, set trap
-      trapCPUID(myGlobalState, states.at(traceesPid), tracer);
+      if (handlerTrace) {
+        handlerTrace->begin(
+            handlerEventKind::cpuidTrap, traceesPid, SYS_arch_prctl,
+            tracer.getRegs(), currState.getLogicalTime());
+      }
+      trapCPUID(myGlobalState, currState, tracer);
+      if (handlerTrace) {
+        handlerTrace->end();
+      }
     }
   }
 
-  auto callPostHook = handlePreSystemCall(states.at(traceesPid), traceesPid);
+  auto callPostHook = handlePreSystemCall(currState, traceesPid);
   return callPostHook;
 }
 
@@ -889,8 +1407,55 @@ static const struct CPUIDRegs extended_cpuids[] =
 };
 // clang-format on
 
+/**
+ * Patch the topology bits of a canonical CPUID leaf to describe a single
+ * package with vcpus cores, no SMT, to match --vcpus.
+ * @param cpuid canonical values from cpuids
+ * @param leaf value of eax
+ * @param subleaf value of ecx
+ * @param vcpus number of virtual CPUs, at least 1
+ */
+static struct CPUIDRegs withVirtualCpus(
+    struct CPUIDRegs cpuid, unsigned leaf, unsigned subleaf, unsigned vcpus) {
+  // APIC ids are 0..vcpus-1, this many bits wide.
+  unsigned idBits = 0;
+  while ((1u << idBits) < vcpus) {
+    idBits++;
+  }
+
+  switch (leaf) {
+  case 0x1:
+    // Logical processors per package, and HTT when there's more than one.
+    cpuid.ebx = (cpuid.ebx & ~0x00FF0000) | (min(vcpus, 255u) << 16);
+    if (vcpus > 1) {
+      cpuid.edx |= 1 << 28;
+    }
+    break;
+  case 0x4:
+    // Cores per package, minus one.
+    cpuid.eax = (cpuid.eax & ~0xFC000000) | ((min(vcpus, 64u) - 1) << 26);
+    break;
+  case 0xB:
+    // Subleaf 0 is the SMT level, subleaf 1 the core level.
+    if (subleaf == 0) {
+      cpuid = {0, 1, 0x100, 0};
+    } else if (subleaf == 1) {
+      cpuid = {idBits, vcpus, 0x200 | subleaf, 0};
+    } else {
+      cpuid = {0, 0, subleaf, 0};
+    }
+    break;
+  }
+  return cpuid;
+}
+
 // =======================================================================================
-void execution::handleSignal(int sigNum, const pid_t traceesPid) {
+void execution::handleSignal(
+    state& currState, int sigNum, const pid_t traceesPid) {
+  flightRecord& rec = recorder.record(flightEvent::signal, traceesPid);
+  rec.number = sigNum;
+  rec.nextPid = traceesPid;
+
   if (sigNum == SIGSEGV) {
     tracer.updateState(traceesPid);
     uint32_t curr_insn32;
@@ -923,7 +1488,8 @@ void execution::handleSignal(int sigNum, const pid_t traceesPid) {
       tracer.writeIp((uint64_t)tracer.getRip().ptr + ip_step);
 
       // Signal is now suppressed.
-      states.at(traceesPid).signalToDeliver = 0;
+      currState.signalToDeliver = 0;
+      rec.decision = FLIGHT_SUPPRESSED;
 
       auto coloredMsg = log.makeTextColored(Color::blue, msg);
 
@@ -946,7 +1512,8 @@ void execution::handleSignal(int sigNum, const pid_t traceesPid) {
       tracer.writeIp((uint64_t)tracer.getRip().ptr + 2);
 
       // suppress SIGSEGV from reaching the tracee
-      states.at(traceesPid).signalToDeliver = 0;
+      currState.signalToDeliver = 0;
+      rec.decision = FLIGHT_SUPPRESSED;
 
       // fill in canonical cpuid return values
 
@@ -960,7 +1527,10 @@ void execution::handleSignal(int sigNum, const pid_t traceesPid) {
       switch (regs.rax) {
       case 0x0 ... nleafs: {
         long leaf = regs.rax;
-        const struct CPUIDRegs& cpuid = cpuids[leaf];
+        struct CPUIDRegs cpuid = cpuids[leaf];
+        if (myGlobalState.vcpus != 0) {
+          cpuid = withVirtualCpus(cpuid, leaf, regs.rcx, myGlobalState.vcpus);
+        }
         tracer.writeRax(cpuid.eax);
         tracer.writeRbx(cpuid.ebx);
         tracer.writeRcx(cpuid.ecx);
@@ -984,7 +1554,10 @@ void execution::handleSignal(int sigNum, const pid_t traceesPid) {
 
   // Remember to deliver this signal to the tracee for next event! Happens in
   // getNextEvent.
-  states.at(traceesPid).signalToDeliver = sigNum;
+  currState.signalToDeliver = sigNum;
+  // A signal-delivery-stop means the kernel dequeued it.
+  currState.signalDequeued(sigNum);
+  currState.enterSignalHandler(sigNum);
 
   auto msg = "[%d] Tracer: Received signal: %d. Forwarding signal to tracee.\n";
   auto coloredMsg = log.makeTextColored(Color::blue, msg);
@@ -1032,6 +1605,9 @@ bool execution::callPreHook(
   case SYS_dup2:
     return dup2SystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_dup3:
+    return dup3SystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_exit_group:
     return exit_groupSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1050,6 +1626,9 @@ bool execution::callPreHook(
   case SYS_faccessat:
     return faccessatSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_fchmodat:
+    return fchmodatSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_fgetxattr:
     return fgetxattrSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1068,6 +1647,9 @@ bool execution::callPreHook(
   case SYS_lchown:
     return lchownSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_fchdir:
+    return fchdirSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_fcntl:
     return fcntlSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1119,6 +1701,18 @@ bool execution::callPreHook(
   case SYS_ioctl:
     return ioctlSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_io_uring_setup:
+    return io_uring_setupSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_io_uring_enter:
+    return io_uring_enterSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_io_uring_register:
+    return io_uring_registerSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_kill:
+    return killSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_llistxattr:
     return llistxattrSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1127,6 +1721,8 @@ bool execution::callPreHook(
 
   case SYS_nanosleep:
     return nanosleepSystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_clock_nanosleep:
+    return clock_nanosleepSystemCall::handleDetPre(gs, s, t, sched);
 
   case SYS_mkdir:
     return mkdirSystemCall::handleDetPre(gs, s, t, sched);
@@ -1206,6 +1802,9 @@ bool execution::callPreHook(
   case SYS_rt_sigsuspend:
     return rt_sigsuspendSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_rt_sigreturn:
+    return rt_sigreturnSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_rt_sigpending:
     return rt_sigpendingSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1239,6 +1838,18 @@ bool execution::callPreHook(
   case SYS_sysinfo:
     return sysinfoSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_signalfd:
+    return signalfdSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_signalfd4:
+    return signalfd4SystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_sched_getaffinity:
+    return sched_getaffinitySystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_sched_setaffinity:
+    return sched_setaffinitySystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_symlink:
     return symlinkSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1254,6 +1865,9 @@ bool execution::callPreHook(
   case SYS_tgkill:
     return tgkillSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_tkill:
+    return tkillSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_time:
     return timeSystemCall::handleDetPre(gs, s, t, sched);
 
@@ -1314,10 +1928,29 @@ bool execution::callPreHook(
   case SYS_write:
     return writeSystemCall::handleDetPre(gs, s, t, sched);
 
+  case SYS_sendfile:
+    return sendfileSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_copy_file_range:
+    return copy_file_rangeSystemCall::handleDetPre(gs, s, t, sched);
+
+  case SYS_splice:
+    return spliceSystemCall::handleDetPre(gs, s, t, sched);
+
   case SYS_writev:
     return writevSystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_pwrite64:
+    return pwrite64SystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_pwritev:
+    return pwritevSystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_ftruncate:
+    return ftruncateSystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_truncate:
+    return truncateSystemCall::handleDetPre(gs, s, t, sched);
   case SYS_socket:
     return socketSystemCall::handleDetPre(gs, s, t, sched);
+  case SYS_socketpair:
+    return socketpairSystemCall::handleDetPre(gs, s, t, sched);
   case SYS_listen:
     return listenSystemCall::handleDetPre(gs, s, t, sched);
   case SYS_accept:
@@ -1385,6 +2018,9 @@ void execution::callPostHook(
   case SYS_dup2:
     return dup2SystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_dup3:
+    return dup3SystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_epoll_ctl:
     return epoll_ctlSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1397,6 +2033,9 @@ void execution::callPostHook(
   case SYS_faccessat:
     return faccessatSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_fchmodat:
+    return fchmodatSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_fgetxattr:
     return fgetxattrSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1409,6 +2048,9 @@ void execution::callPostHook(
   case SYS_fchown:
     return fchownSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_fchdir:
+    return fchdirSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_fcntl:
     return fcntlSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1460,6 +2102,18 @@ void execution::callPostHook(
   case SYS_ioctl:
     return ioctlSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_io_uring_setup:
+    return io_uring_setupSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_io_uring_enter:
+    return io_uring_enterSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_io_uring_register:
+    return io_uring_registerSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_kill:
+    return killSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_llistxattr:
     return llistxattrSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1468,6 +2122,8 @@ void execution::callPostHook(
 
   case SYS_nanosleep:
     return nanosleepSystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_clock_nanosleep:
+    return clock_nanosleepSystemCall::handleDetPost(gs, s, t, sched);
 
   case SYS_mkdir:
     return mkdirSystemCall::handleDetPost(gs, s, t, sched);
@@ -1547,6 +2203,9 @@ void execution::callPostHook(
   case SYS_rt_sigsuspend:
     return rt_sigsuspendSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_rt_sigreturn:
+    return rt_sigreturnSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_rt_sigpending:
     return rt_sigpendingSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1580,6 +2239,18 @@ void execution::callPostHook(
   case SYS_sysinfo:
     return sysinfoSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_signalfd:
+    return signalfdSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_signalfd4:
+    return signalfd4SystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_sched_getaffinity:
+    return sched_getaffinitySystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_sched_setaffinity:
+    return sched_setaffinitySystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_symlink:
     return symlinkSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1595,6 +2266,9 @@ void execution::callPostHook(
   case SYS_tgkill:
     return tgkillSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_tkill:
+    return tkillSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_time:
     return timeSystemCall::handleDetPost(gs, s, t, sched);
 
@@ -1655,10 +2329,29 @@ void execution::callPostHook(
   case SYS_write:
     return writeSystemCall::handleDetPost(gs, s, t, sched);
 
+  case SYS_sendfile:
+    return sendfileSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_copy_file_range:
+    return copy_file_rangeSystemCall::handleDetPost(gs, s, t, sched);
+
+  case SYS_splice:
+    return spliceSystemCall::handleDetPost(gs, s, t, sched);
+
   case SYS_writev:
     return writevSystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_pwrite64:
+    return pwrite64SystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_pwritev:
+    return pwritevSystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_ftruncate:
+    return ftruncateSystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_truncate:
+    return truncateSystemCall::handleDetPost(gs, s, t, sched);
   case SYS_socket:
     return socketSystemCall::handleDetPost(gs, s, t, sched);
+  case SYS_socketpair:
+    return socketpairSystemCall::handleDetPost(gs, s, t, sched);
   case SYS_listen:
     return listenSystemCall::handleDetPost(gs, s, t, sched);
   case SYS_accept:
@@ -1677,7 +2370,7 @@ void execution::callPostHook(
 }
 // =======================================================================================
 tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
-    pid_t pidToContinue, bool ptraceSystemcall) {
+    state& currState, pid_t pidToContinue, bool ptraceSystemcall) {
   // fprintf(stderr, "Getting next event for pid %d\n", pidToContinue);
   // 3rd return value of this function. Holds the status after waitpid call.
   int status = 0;
@@ -1690,10 +2383,12 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
   // @handleSignal
   //
   // 64 bit value to avoid warning when casting to void* below.
-  int64_t signalToDeliver = states.at(pidToContinue).signalToDeliver;
+  int64_t signalToDeliver = currState.signalToDeliver;
 
   // Reset signal field after for next event.
-  states.at(pidToContinue).signalToDeliver = 0;
+  currState.signalToDeliver = 0;
+  // The tracee runs, and with it its time shim.
+  currState.forgetLogicalTime();
 
   // Usually we use PTRACE_CONT below because we are letting seccomp + bpf
   // handle the events. So unlike standard ptrace, we do not rely on system call
@@ -1705,16 +2400,18 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
     log.writeToLog(
         Importance::extra,
         "getNextEvent(): Waiting for next system call event.\n");
-    struct user_regs_struct regs;
-    ptracer::doPtrace(PTRACE_GETREGS, pidToContinue, 0, &regs);
     // old glibc (2.13) calls (buggy) vsyscall for certain syscalls
     // such as time. this doesn't play along well with recent
     // kernels with seccomp-bpf support (4.4+)
     // for more details, see `Caveats` section of kernel document:
     // https://www.kernel.org/doc/Documentation/prctl/seccomp_filter.txt
-    if ((regs.rip & ~0xc00ULL) == 0xFFFFFFFFFF600000ULL) {
+    // handleSeccomp already looked at rip for this stop, see onVsyscall.
+    if (currState.onVsyscall) {
       log.writeToLog(
           Importance::extra, "getNextEvent(): Looking at VDSO in old glibc.\n");
+      currState.onVsyscall = false;
+      struct user_regs_struct regs;
+      ptracer::doPtrace(PTRACE_GETREGS, pidToContinue, 0, &regs);
       int status;
       int syscallNum = regs.orig_rax;
       // vsyscall seccomp stop is a special case
@@ -1732,9 +2429,7 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
 
       // TODO this assumes we wanted to call the post-hook for this system call,
       // is this always true?
-      callPostHook(
-          syscallNum, myGlobalState, states.at(pidToContinue), tracer,
-          myScheduler);
+      callPostHook(syscallNum, myGlobalState, currState, tracer, myScheduler);
 
       // TODO What's the point of this second updateState call?
       tracer.updateState(pidToContinue);
@@ -1771,7 +2466,7 @@ tuple<ptraceEvent, pid_t, int> execution::getNextEvent(
   }
 
   // Wait for next event to intercept.
-  traceesPid = doWithCheck(waitpid(pidToContinue, &status, 0), "waitpid");
+  traceesPid = stops.wait(pidToContinue, &status);
   log.writeToLog(
       Importance::extra, "getNextEvent(): Got event from waitpid().\n");
 
@@ -1881,6 +2576,7 @@ void trapCPUID(globalState& gs, state& s, ptracer& t) {
 
   // Inject arch_prctl system call
   s.syscallInjected = true;
+  gs.injectedSystemCalls++;
 
   // Call arch_prctl
   t.writeArg1(ARCH_SET_CPUID);
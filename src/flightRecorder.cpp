@@ -0,0 +1,94 @@
+#include "flightRecorder.hpp"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <string>
+
+#include "systemCallList.hpp"
+
+flightRecorder::flightRecorder(size_t capacity) : ring(capacity) {}
+
+static const char* eventName(flightEvent event) {
+  switch (event) {
+  case flightEvent::preHook:
+    return "pre";
+  case flightEvent::postHook:
+    return "post";
+  case flightEvent::signal:
+    return "signal";
+  case flightEvent::spawn:
+    return "spawn";
+  case flightEvent::exec:
+    return "exec";
+  case flightEvent::exit:
+    return "exit";
+  }
+  return "?";
+}
+
+static string decisionString(uint8_t decision) {
+  string str;
+  auto add = [&](uint8_t bit, const char* name) {
+    if (decision & bit) {
+      str += str.empty() ? name : string(",") + name;
+    }
+  };
+  add(FLIGHT_POST_HOOK, "post-hook");
+  add(FLIGHT_REPLAY, "replay");
+  add(FLIGHT_INJECTED, "injected");
+  add(FLIGHT_NOOP, "noop");
+  add(FLIGHT_SUPPRESSED, "suppressed");
+  return str.empty() ? "-" : str;
+}
+
+void flightRecorder::dump(FILE* out) {
+  if (dumped) {
+    return;
+  }
+  dumped = true;
+
+  uint64_t first = recorded > ring.size() ? recorded - ring.size() : 0;
+  fprintf(
+      out, "dettrace flight recorder: last %" PRIu64 " of %" PRIu64
+           " events\n",
+      recorded - first, recorded);
+
+  for (uint64_t i = first; i < recorded; i++) {
+    const flightRecord& r = ring[i % ring.size()];
+    fprintf(
+        out, "#%" PRIu64 " [%d] %-6s ", r.seq, r.pid, eventName(r.event));
+
+    switch (r.event) {
+    case flightEvent::preHook:
+    case flightEvent::postHook:
+      fprintf(
+          out, "%s(0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64
+               ", 0x%" PRIx64 ", 0x%" PRIx64 ")",
+          systemCallName(r.number).c_str(), r.args[0], r.args[1], r.args[2],
+          r.args[3], r.args[4], r.args[5]);
+      if (r.event == flightEvent::postHook) {
+        fprintf(out, " = %" PRId64, r.retval);
+      }
+      break;
+    case flightEvent::signal:
+      fprintf(out, "%s", strsignal(r.number));
+      break;
+    case flightEvent::spawn:
+      fprintf(out, "child %d", r.number);
+      break;
+    case flightEvent::exec:
+      break;
+    case flightEvent::exit:
+      fprintf(out, "status 0x%x", r.number);
+      break;
+    }
+
+    fprintf(out, " | %s", decisionString(r.decision).c_str());
+    if (r.nextPid != 0) {
+      fprintf(out, " | next [%d]", r.nextPid);
+    }
+    fprintf(out, "\n");
+  }
+  fflush(out);
+}
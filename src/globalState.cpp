@@ -1,19 +1,53 @@
 #include "globalState.hpp"
 
+#include <algorithm>
+
+#include "state.hpp"
+
 globalState::globalState(
     logger& log,
-    ValueMapper<ino_t, ino_t> inodeMap,
+    inodeMapper inodeMap,
     ModTimeMap mtimeMap,
     bool kernelPre4_12,
     unsigned prngSeed,
     logical_clock::time_point epoch,
-    bool allow_network)
+    bool allow_network,
+    unsigned vcpus)
     : log(log),
       inodeMap{inodeMap},
       mtimeMap{mtimeMap},
       kernelPre4_12{kernelPre4_12},
       prng(prngSeed),
       epoch(epoch),
-      allow_network(allow_network) {
+      latestMtime(epoch),
+      allow_network(allow_network),
+      vcpus(vcpus) {
   allow_trapCPUID = true;
 }
+
+void globalState::setMtime(ino_t inode, const state& s, bool modified) {
+  latestMtime = max(latestMtime, s.getLogicalTime());
+  if (modified) {
+    // At least a microsecond, so a modification is always strictly newer.
+    latestMtime += max(s.getClockStep(), logical_clock::duration(1));
+  }
+  mtimeMap.set(inode, latestMtime);
+}
+
+void globalState::forgetInode(ino_t inode) {
+  bool known = inodeMap.eraseRealValue(inode);
+  known = mtimeMap.erase(inode) != 0 || known;
+  if (known) {
+    reclaimedInodes++;
+  }
+}
+
+void globalState::dirEntriesResized(size_t before, size_t after) {
+  dirEntriesBytes = dirEntriesBytes + after - before;
+  peakDirEntriesBytes = max(peakDirEntriesBytes, dirEntriesBytes);
+}
+
+size_t globalState::threadTrackingBytes() const {
+  return approxHashBytes(liveThreads) + approxHashBytes(threadGroups) +
+         approxHashBytes(threadGroupNumber) + approxHashBytes(hostPids);
+}
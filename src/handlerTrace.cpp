@@ -0,0 +1,606 @@
+#include "handlerTrace.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+
+#include "execution.hpp"
+#include "systemCallList.hpp"
+#include "util.hpp"
+
+static const char traceMagic[] = "dettrace handler trace 2\n";
+
+void memoryImage::store(uint64_t address, const void* bytes, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  uint64_t start = address;
+  uint64_t end = address + size;
+
+  auto first = memory.upper_bound(start);
+  if (first != memory.begin()) {
+    auto before = prev(first);
+    uint64_t beforeEnd = before->first + before->second.size();
+    // Most writes land in memory we already know about.
+    if (end <= beforeEnd) {
+      memcpy(&before->second[start - before->first], bytes, size);
+      return;
+    }
+    if (beforeEnd >= start) {
+      first = before;
+    }
+  }
+
+  // Merge everything overlapping or touching [start, end) into one region.
+  auto last = first;
+  for (; last != memory.end() && last->first <= end; ++last) {
+    start = min(start, last->first);
+    end = max(end, last->first + last->second.size());
+  }
+  vector<uint8_t> merged(end - start);
+  for (auto it = first; it != last; ++it) {
+    memcpy(&merged[it->first - start], it->second.data(), it->second.size());
+  }
+  memcpy(&merged[address - start], bytes, size);
+  memory.erase(first, last);
+  memory.emplace(start, move(merged));
+}
+
+size_t memoryImage::load(uint64_t address, void* bytes, size_t size) const {
+  auto it = memory.upper_bound(address);
+  if (it == memory.begin()) {
+    return 0;
+  }
+  --it;
+  uint64_t end = it->first + it->second.size();
+  if (address >= end) {
+    return 0;
+  }
+  size_t n = min<uint64_t>(size, end - address);
+  memcpy(bytes, &it->second[address - it->first], n);
+  return n;
+}
+
+vector<memoryRegion> memoryImage::regions() const {
+  vector<memoryRegion> r;
+  for (const auto& region : memory) {
+    r.push_back(memoryRegion{region.first, region.second});
+  }
+  return r;
+}
+
+// =======================================================================================
+template <typename T>
+static void put(FILE* out, const T& value) {
+  if (fwrite(&value, sizeof(T), 1, out) != 1) {
+    sysError("Unable to write handler trace");
+  }
+}
+
+template <typename T>
+static bool get(FILE* in, T& value) {
+  return fread(&value, sizeof(T), 1, in) == 1;
+}
+
+template <typename T>
+static void getOrFail(FILE* in, T& value) {
+  if (!get(in, value)) {
+    runtimeError("Truncated handler trace");
+  }
+}
+
+static void putRegions(FILE* out, const vector<memoryRegion>& regions) {
+  put(out, (uint32_t)regions.size());
+  for (const auto& r : regions) {
+    put(out, r.address);
+    put(out, (uint32_t)r.bytes.size());
+    if (!r.bytes.empty() &&
+        fwrite(r.bytes.data(), r.bytes.size(), 1, out) != 1) {
+      sysError("Unable to write handler trace");
+    }
+  }
+}
+
+/**
+ * Bytes left to read in in, so sizes from a damaged trace cannot make us
+ * allocate more than the file holds.
+ */
+static uint64_t bytesLeft(FILE* in) {
+  struct stat st;
+  long at = ftell(in);
+  if (fstat(fileno(in), &st) == -1 || at == -1 || st.st_size < at) {
+    return 0;
+  }
+  return st.st_size - at;
+}
+
+static void getRegions(FILE* in, vector<memoryRegion>& regions) {
+  uint32_t count;
+  getOrFail(in, count);
+  // Every region takes at least its address and size.
+  if ((uint64_t)count * (sizeof(uint64_t) + sizeof(uint32_t)) >
+      bytesLeft(in)) {
+    runtimeError("Truncated handler trace");
+  }
+  regions.resize(count);
+  for (auto& r : regions) {
+    uint32_t size;
+    getOrFail(in, r.address);
+    getOrFail(in, size);
+    if (size > bytesLeft(in)) {
+      runtimeError("Truncated handler trace");
+    }
+    r.bytes.resize(size);
+    if (size != 0 && fread(r.bytes.data(), size, 1, in) != 1) {
+      runtimeError("Truncated handler trace");
+    }
+  }
+}
+
+static memoryRegion region(uint64_t address, const void* bytes, size_t size) {
+  const uint8_t* p = (const uint8_t*)bytes;
+  return memoryRegion{address, vector<uint8_t>(p, p + size)};
+}
+
+// =======================================================================================
+handlerRecorder::handlerRecorder(
+    const string& path, const handlerTraceHeader& header) {
+  out = fopen(path.c_str(), "we");
+  if (out == nullptr) {
+    sysError(("Unable to open handler trace: " + path).c_str());
+  }
+  if (fwrite(traceMagic, sizeof(traceMagic) - 1, 1, out) != 1) {
+    sysError("Unable to write handler trace");
+  }
+  put(out, header.epoch);
+  put(out, header.clockStep);
+  put(out, header.prngSeed);
+  put(out, header.vcpus);
+  put(out, header.allowNetwork);
+  put(out, header.pathInodes);
+  put(out, header.kernelPre4_12);
+}
+
+handlerRecorder::~handlerRecorder() {
+  if (activeTraceeBackend == this) {
+    activeTraceeBackend = nullptr;
+  }
+  fclose(out);
+}
+
+void handlerRecorder::begin(
+    handlerEventKind kind,
+    pid_t pid,
+    int syscallNumber,
+    const struct user_regs_struct& regs,
+    logical_clock::time_point clock) {
+  current.kind = kind;
+  current.pid = pid;
+  current.number = syscallNumber;
+  current.thread = false;
+  current.callPostHook = false;
+  current.replayable = true;
+  current.clock = clock.time_since_epoch().count();
+  current.regsBefore = regs;
+  current.regsAfter = regs;
+  current.reads.clear();
+  current.writes.clear();
+  current.mmapPage = 0;
+  current.timeShim = 0;
+  current.cpuidTrapSet = false;
+  activeTraceeBackend = this;
+}
+
+static void writeEvent(FILE* out, const handlerEvent& e) {
+  put(out, (uint8_t)e.kind);
+  put(out, e.pid);
+  put(out, e.number);
+  uint8_t flags = (e.thread ? 1 : 0) | (e.callPostHook ? 2 : 0) |
+                  (e.replayable ? 4 : 0) | (e.cpuidTrapSet ? 8 : 0);
+  put(out, flags);
+  put(out, e.clock);
+  put(out, e.regsBefore);
+  put(out, e.regsAfter);
+  putRegions(out, e.reads);
+  putRegions(out, e.writes);
+  put(out, e.mmapPage);
+  put(out, e.timeShim);
+}
+
+void handlerRecorder::end(bool callPostHook) {
+  activeTraceeBackend = nullptr;
+  current.callPostHook = callPostHook;
+  writeEvent(out, current);
+}
+
+void handlerRecorder::spawn(pid_t parent, pid_t child, bool thread) {
+  handlerEvent e{};
+  e.kind = handlerEventKind::spawn;
+  e.pid = parent;
+  e.number = child;
+  e.thread = thread;
+  writeEvent(out, e);
+}
+
+void handlerRecorder::exec(pid_t pid, state& s) {
+  handlerEvent e{};
+  e.kind = handlerEventKind::exec;
+  e.pid = pid;
+  e.mmapPage = (uint64_t)s.mmapMemory.getAddr().ptr;
+  e.timeShim = (uint64_t)s.timeShim.ptr;
+  e.cpuidTrapSet = s.CPUIDTrapSet;
+  writeEvent(out, e);
+}
+
+long handlerRecorder::ptraceRequest(
+    enum __ptrace_request request, pid_t pid, void* addr, void* data) {
+  long val = kernel.ptraceRequest(request, pid, addr, data);
+  int err = errno;
+  if (pid != current.pid) {
+    current.replayable = false;
+  }
+
+  switch (request) {
+  case PTRACE_GETREGS:
+    break;
+  case PTRACE_SETREGS:
+    if (val != -1) {
+      current.regsAfter = *(struct user_regs_struct*)data;
+    }
+    break;
+  case PTRACE_PEEKTEXT:
+  case PTRACE_PEEKDATA:
+    // doPtrace clears errno, the kernel only sets it on failure.
+    if (err == 0) {
+      current.reads.push_back(region((uint64_t)addr, &val, sizeof(val)));
+    }
+    break;
+  case PTRACE_POKETEXT:
+  case PTRACE_POKEDATA:
+    if (val != -1) {
+      current.writes.push_back(region((uint64_t)addr, &data, sizeof(data)));
+    }
+    break;
+  default:
+    // Running the tracee, like injecting a system call, is not something we
+    // can replay.
+    current.replayable = false;
+  }
+
+  errno = err;
+  return val;
+}
+
+ssize_t handlerRecorder::readMemory(
+    pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes) {
+  ssize_t n = kernel.readMemory(pid, traceeMemory, localMemory, bytes);
+  int err = errno;
+  if (pid != current.pid) {
+    current.replayable = false;
+  }
+  if (n > 0) {
+    current.reads.push_back(region(traceeMemory, localMemory, n));
+  }
+  errno = err;
+  return n;
+}
+
+ssize_t handlerRecorder::writeMemory(
+    pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes) {
+  ssize_t n = kernel.writeMemory(pid, traceeMemory, localMemory, bytes);
+  int err = errno;
+  if (pid != current.pid) {
+    current.replayable = false;
+  }
+  if (n > 0) {
+    current.writes.push_back(region(traceeMemory, localMemory, n));
+  }
+  errno = err;
+  return n;
+}
+
+void handlerRecorder::hostQuery(pid_t pid) { current.replayable = false; }
+
+// =======================================================================================
+void offlineTracee::load(const handlerEvent& e) {
+  regs = e.regsBefore;
+  memory.clear();
+  written.clear();
+  // Later reads may see what the handler wrote itself, the first read of a
+  // byte is what it was before.
+  for (auto r = e.reads.rbegin(); r != e.reads.rend(); ++r) {
+    memory.store(r->address, r->bytes.data(), r->bytes.size());
+  }
+}
+
+long offlineTracee::ptraceRequest(
+    enum __ptrace_request request, pid_t pid, void* addr, void* data) {
+  switch (request) {
+  case PTRACE_GETREGS:
+    memcpy(data, &regs, sizeof(regs));
+    return 0;
+  case PTRACE_SETREGS:
+    memcpy(&regs, data, sizeof(regs));
+    return 0;
+  case PTRACE_PEEKTEXT:
+  case PTRACE_PEEKDATA: {
+    long word;
+    if (memory.load((uint64_t)addr, &word, sizeof(word)) != sizeof(word)) {
+      errno = EIO;
+      return -1;
+    }
+    return word;
+  }
+  case PTRACE_POKETEXT:
+  case PTRACE_POKEDATA:
+    writeMemory(pid, (uint64_t)addr, &data, sizeof(data));
+    return 0;
+  default:
+    runtimeError(
+        "Offline tracee cannot serve ptrace request " + to_string(request));
+  }
+  return -1;
+}
+
+ssize_t offlineTracee::readMemory(
+    pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes) {
+  size_t n = memory.load(traceeMemory, localMemory, bytes);
+  if (n == 0 && bytes != 0) {
+    errno = EFAULT;
+    return -1;
+  }
+  return n;
+}
+
+ssize_t offlineTracee::writeMemory(
+    pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes) {
+  memory.store(traceeMemory, localMemory, bytes);
+  written.store(traceeMemory, localMemory, bytes);
+  return bytes;
+}
+
+void offlineTracee::hostQuery(pid_t pid) {
+  runtimeError(
+      "Offline tracee cannot answer host queries about " + to_string(pid));
+}
+
+// =======================================================================================
+handlerTraceReader::handlerTraceReader(const string& path) {
+  in = fopen(path.c_str(), "re");
+  if (in == nullptr) {
+    sysError(("Unable to open handler trace: " + path).c_str());
+  }
+  char magic[sizeof(traceMagic) - 1];
+  if (fread(magic, sizeof(magic), 1, in) != 1 ||
+      memcmp(magic, traceMagic, sizeof(magic)) != 0) {
+    runtimeError("Not a handler trace: " + path);
+  }
+  getOrFail(in, header.epoch);
+  getOrFail(in, header.clockStep);
+  getOrFail(in, header.prngSeed);
+  getOrFail(in, header.vcpus);
+  getOrFail(in, header.allowNetwork);
+  getOrFail(in, header.pathInodes);
+  getOrFail(in, header.kernelPre4_12);
+}
+
+handlerTraceReader::~handlerTraceReader() { fclose(in); }
+
+bool handlerTraceReader::next(handlerEvent& e) {
+  uint8_t kind;
+  if (!get(in, kind)) {
+    return false;
+  }
+  if (kind > (uint8_t)handlerEventKind::exec) {
+    runtimeError("Truncated handler trace");
+  }
+  e.kind = (handlerEventKind)kind;
+  getOrFail(in, e.pid);
+  getOrFail(in, e.number);
+  uint8_t flags;
+  getOrFail(in, flags);
+  e.thread = flags & 1;
+  e.callPostHook = flags & 2;
+  e.replayable = flags & 4;
+  e.cpuidTrapSet = flags & 8;
+  getOrFail(in, e.clock);
+  getOrFail(in, e.regsBefore);
+  getOrFail(in, e.regsAfter);
+  getRegions(in, e.reads);
+  getRegions(in, e.writes);
+  getOrFail(in, e.mmapPage);
+  getOrFail(in, e.timeShim);
+  return true;
+}
+
+// =======================================================================================
+/**
+ * Calls and time spent in one handler during a replay.
+ */
+struct handlerProfile {
+  uint64_t calls = 0;
+  chrono::nanoseconds time{0};
+};
+
+static const char* kindName(handlerEventKind kind) {
+  switch (kind) {
+  case handlerEventKind::preHook:
+    return "pre";
+  case handlerEventKind::postHook:
+    return "post";
+  case handlerEventKind::cpuidTrap:
+    return "trap";
+  case handlerEventKind::spawn:
+    return "spawn";
+  case handlerEventKind::exec:
+    return "exec";
+  }
+  return "?";
+}
+
+/**
+ * Why e did not replay as recorded, empty if it did.
+ */
+static string replayDifference(
+    const handlerEvent& e, const offlineTracee& tracee, bool callPostHook) {
+  if (memcmp(&tracee.regs, &e.regsAfter, sizeof(e.regsAfter)) != 0) {
+    return "registers differ";
+  }
+  memoryImage recorded;
+  for (const auto& w : e.writes) {
+    recorded.store(w.address, w.bytes.data(), w.bytes.size());
+  }
+  if (tracee.written.regions() != recorded.regions()) {
+    return "memory writes differ";
+  }
+  if (e.kind == handlerEventKind::preHook && callPostHook != e.callPostHook) {
+    return callPostHook ? "asked for the post-hook" : "skipped the post-hook";
+  }
+  return "";
+}
+
+uint64_t replayHandlerTrace(const string& path, FILE* out, FILE* err) {
+  handlerTraceReader trace{path};
+  const handlerTraceHeader& h = trace.header;
+  logger log{"", 0};
+  auto epoch = logical_clock::time_point{logical_clock::duration{h.epoch}};
+  auto clockStep = logical_clock::duration{h.clockStep};
+  globalState gs{log,
+                 inodeMapper{log, h.pathInodes != 0},
+                 ModTimeMap{},
+                 h.kernelPre4_12 != 0,
+                 h.prngSeed,
+                 epoch,
+                 h.allowNetwork != 0,
+                 h.vcpus};
+  stateTable<state> states;
+  unique_ptr<scheduler> sched;
+  offlineTracee tracee;
+  ptracer t{0, tracee.regs};
+
+  map<pair<int, handlerEventKind>, handlerProfile> profile;
+  uint64_t events = 0, calls = 0, replayed = 0, skipped = 0, differences = 0;
+  handlerEvent e;
+  while (trace.next(e)) {
+    events++;
+    if (!sched) {
+      sched.reset(new scheduler{e.pid, log});
+    }
+    state* s = states.find(e.pid);
+    if (s == nullptr) {
+      s = states.emplace(e.pid, e.pid, 0, epoch, clockStep).first;
+      gs.threadGroups.insert({e.pid, e.pid});
+      gs.threadGroupNumber.insert({e.pid, e.pid});
+    }
+
+    // Like execution::handleForkEvent, as far as the handlers can tell.
+    if (e.kind == handlerEventKind::spawn) {
+      pid_t child = e.number;
+      pid_t threadGroup = e.thread ? gs.threadGroupNumber.at(e.pid) : child;
+      if (e.thread) {
+        gs.liveThreads.insert(child);
+      }
+      gs.threadGroups.insert({threadGroup, child});
+      gs.threadGroupNumber.insert({child, threadGroup});
+      states.emplace(child, e.thread ? s->cloned(child) : s->forked(child));
+      sched->addAndScheduleNext(child);
+      continue;
+    }
+    // Like the end of execution::handleExecEvent. We cannot tell which Unix
+    // sockets survived, say all of them did.
+    if (e.kind == handlerEventKind::exec) {
+      auto fdStatus = make_shared<unordered_map<int, descriptorType>>();
+      for (auto& socket : *s->unixSockets) {
+        auto status = s->fdStatus->find(socket.first);
+        if (status != s->fdStatus->end()) {
+          fdStatus->insert(*status);
+        }
+      }
+      s->fdStatus = fdStatus;
+      s->unixSockets = make_shared<unordered_map<int, int>>(*s->unixSockets);
+      s->ioUrings = make_shared<unordered_map<int, shared_ptr<ioUring>>>();
+      s->mmapMemory.setAddr(traceePtr<void>((void*)e.mmapPage));
+      s->timeShim = traceePtr<timeShimData>((timeShimData*)e.timeShim);
+      s->CPUIDTrapSet = e.cpuidTrapSet;
+      continue;
+    }
+    calls++;
+    if (!e.replayable) {
+      skipped++;
+      continue;
+    }
+
+    replayed++;
+    // Skipped calls may have moved the clock, start from where it was.
+    s->setLogicalTime(
+        logical_clock::time_point{logical_clock::duration{e.clock}});
+    tracee.load(e);
+    activeTraceeBackend = &tracee;
+    t.updateState(e.pid);
+    bool callPostHook = false;
+    string difference;
+    auto start = chrono::steady_clock::now();
+    try {
+      switch (e.kind) {
+      case handlerEventKind::preHook:
+        callPostHook = execution::callPreHook(e.number, gs, *s, t, *sched);
+        break;
+      case handlerEventKind::postHook:
+        execution::callPostHook(e.number, gs, *s, t, *sched);
+        break;
+      default:
+        // The tracer only sets up the trap while it is not set, and every
+        // execve clears it.
+        s->CPUIDTrapSet = false;
+        trapCPUID(gs, *s, t);
+      }
+    } catch (const exception& ex) {
+      difference = string{"failed: "} + ex.what();
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+    activeTraceeBackend = nullptr;
+
+    handlerProfile& p = profile[{e.number, e.kind}];
+    p.calls++;
+    p.time += elapsed;
+
+    if (difference.empty()) {
+      difference = replayDifference(e, tracee, callPostHook);
+    }
+    if (!difference.empty()) {
+      differences++;
+      fprintf(
+          err, "Event %lu, [%d] %s %s: %s\n", (unsigned long)events, e.pid,
+          systemCallName(e.number).c_str(), kindName(e.kind),
+          difference.c_str());
+    }
+  }
+
+  vector<pair<pair<int, handlerEventKind>, handlerProfile>> byTime(
+      profile.begin(), profile.end());
+  stable_sort(byTime.begin(), byTime.end(), [](const auto& a, const auto& b) {
+    return a.second.time > b.second.time;
+  });
+  fprintf(
+      out, "%-24s %-4s %10s %12s\n", "System call", "Hook", "Calls", "ns/call");
+  for (const auto& entry : byTime) {
+    const handlerProfile& p = entry.second;
+    fprintf(
+        out, "%-24s %-4s %10lu %12.1f\n",
+        systemCallName(entry.first.first).c_str(),
+        kindName(entry.first.second), (unsigned long)p.calls,
+        (double)p.time.count() / p.calls);
+  }
+  fprintf(
+      out,
+      "Replayed %lu of %lu handler calls, %lu could not be replayed, %lu "
+      "differ.\n",
+      (unsigned long)replayed, (unsigned long)calls, (unsigned long)skipped,
+      (unsigned long)differences);
+  return differences;
+}
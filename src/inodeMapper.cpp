@@ -0,0 +1,82 @@
+#include "inodeMapper.hpp"
+
+constexpr ino_t inodeMapper::pathInodeBase;
+
+inodeMapper::inodeMapper(logger& logr, bool pathDerived)
+    : ValueMapper<ino_t, ino_t>(logr, "inode map", 1), derived(pathDerived) {}
+
+ino_t inodeMapper::addRealValue(ino_t realValue, const string& path) {
+  if (!derived || path.empty()) {
+    return addRealValue(realValue);
+  }
+
+  uint32_t generation = 0;
+  auto it = paths.find(path);
+  if (it != paths.end()) {
+    const ino_t* known = realToVirtualValue.find(realValue);
+    // Seen again, e.g. creat() truncating a file we already know.
+    if (it->second.real == realValue && known != nullptr) {
+      myLogger.writeToLog(
+          Importance::info, mappingName + ": Path already mapped: " +
+                                to_string(*known) + "\n");
+      return *known;
+    }
+    // Another file now lives at path.
+    generation = it->second.generation + 1;
+    it->second = pathEntry{realValue, generation};
+  } else {
+    paths.emplace(path, pathEntry{realValue, generation});
+  }
+
+  // The path itself, two paths may share a hash.
+  auto identity = make_pair(path, generation);
+  uint64_t pathHash = hashPath(path);
+  ino_t vValue = 0;
+  for (uint32_t probe = 0;; probe++) {
+    vValue = derive(pathHash, generation, probe);
+    auto owner = owners.emplace(vValue, identity).first;
+    if (owner->second == identity) {
+      break;
+    }
+  }
+
+  myLogger.writeToLog(
+      Importance::info,
+      mappingName + ": New virtual value added: " + to_string(vValue) + "\n");
+  myLogger.writeToLog(
+      Importance::extra, "  (Real value was: " + to_string(realValue) +
+                             ", path: " + path + ")\n");
+  realToVirtualValue.set(realValue, vValue);
+  return vValue;
+}
+
+size_t inodeMapper::memoryBytes() const {
+  size_t bytes = ValueMapper<ino_t, ino_t>::memoryBytes() +
+                 approxHashBytes(paths) + approxHashBytes(owners);
+  for (const auto& p : paths) {
+    bytes += p.first.capacity();
+  }
+  for (const auto& o : owners) {
+    bytes += o.second.first.capacity();
+  }
+  return bytes;
+}
+
+uint64_t inodeMapper::hashPath(const string& path) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (unsigned char c : path) {
+    h = (h ^ c) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+ino_t inodeMapper::derive(
+    uint64_t pathHash, uint32_t generation, uint32_t probe) {
+  // splitmix64 finalizer, so nearby paths and generations spread out.
+  uint64_t h = pathHash ^ (((uint64_t)generation << 32) | probe);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  // Keep clear of the ordered values and of the sign bit.
+  return pathInodeBase + h % ((1ULL << 63) - pathInodeBase);
+}
@@ -0,0 +1,189 @@
+#include "ioUring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+/**
+ * Map part of the ring at offset, see io_uring_setup(2).
+ */
+static void* mapRing(int fd, size_t bytes, off_t offset) {
+  void* p =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  if (p == MAP_FAILED) {
+    sysError("Unable to map tracee's io_uring");
+  }
+  return p;
+}
+
+ioUring::ioUring(pid_t tgid, int fd, const struct io_uring_params& params)
+    : setupFlags(params.flags) {
+  int pidfd = doWithCheck(
+      syscall(SYS_pidfd_open, tgid, 0), "pidfd_open on tracee failed");
+  this->fd = syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+  close(pidfd);
+  if (this->fd == -1) {
+    sysError("Unable to get tracee's io_uring file descriptor");
+  }
+
+  sqeBytes = sizeof(struct io_uring_sqe);
+  if (params.flags & IORING_SETUP_SQE128) {
+    sqeBytes *= 2;
+  }
+  cqeBytes = sizeof(struct io_uring_cqe);
+  if (params.flags & IORING_SETUP_CQE32) {
+    cqeBytes *= 2;
+  }
+
+  sqEntries = params.sq_entries;
+  cqEntries = params.cq_entries;
+  sqRingBytes = params.sq_off.array + sqEntries * sizeof(uint32_t);
+  cqRingBytes = params.cq_off.cqes + cqEntries * cqeBytes;
+  sqesBytes = sqEntries * sqeBytes;
+
+  // With IORING_FEAT_SINGLE_MMAP both offsets map the same memory, mapping it
+  // twice is fine.
+  sqRing = mapRing(this->fd, sqRingBytes, IORING_OFF_SQ_RING);
+  cqRing = mapRing(this->fd, cqRingBytes, IORING_OFF_CQ_RING);
+  sqes = (uint8_t*)mapRing(this->fd, sqesBytes, IORING_OFF_SQES);
+
+  uint8_t* sq = (uint8_t*)sqRing;
+  sqHead = (uint32_t*)(sq + params.sq_off.head);
+  sqTail = (uint32_t*)(sq + params.sq_off.tail);
+  sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+  sqArray = (uint32_t*)(sq + params.sq_off.array);
+
+  uint8_t* cq = (uint8_t*)cqRing;
+  cqHead = (uint32_t*)(cq + params.cq_off.head);
+  cqTail = (uint32_t*)(cq + params.cq_off.tail);
+  cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+  cqes = cq + params.cq_off.cqes;
+}
+
+ioUring::~ioUring() {
+  if (sqes != nullptr) {
+    munmap(sqes, sqesBytes);
+  }
+  if (cqRing != nullptr) {
+    munmap(cqRing, cqRingBytes);
+  }
+  if (sqRing != nullptr) {
+    munmap(sqRing, sqRingBytes);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+bool ioUring::supported() {
+  static int result = -1;
+  if (result == -1) {
+    int pidfd = syscall(SYS_pidfd_open, getpid(), 0);
+    int copy = pidfd == -1 ? -1 : syscall(SYS_pidfd_getfd, pidfd, pidfd, 0);
+    result = copy != -1;
+    if (copy != -1) {
+      close(copy);
+    }
+    if (pidfd != -1) {
+      close(pidfd);
+    }
+  }
+  return result;
+}
+
+bool ioUring::allowedSetupFlags(uint32_t flags) {
+  const uint32_t allowed = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP |
+                           IORING_SETUP_R_DISABLED | IORING_SETUP_SUBMIT_ALL |
+                           IORING_SETUP_COOP_TASKRUN |
+                           IORING_SETUP_TASKRUN_FLAG | IORING_SETUP_SQE128 |
+                           IORING_SETUP_CQE32 | IORING_SETUP_SINGLE_ISSUER |
+                           IORING_SETUP_DEFER_TASKRUN;
+  return (flags & ~allowed) == 0;
+}
+
+bool ioUring::allowedRegisterOpcode(unsigned opcode) {
+  switch (opcode) {
+  case IORING_REGISTER_BUFFERS:
+  case IORING_UNREGISTER_BUFFERS:
+  case IORING_REGISTER_FILES:
+  case IORING_UNREGISTER_FILES:
+  case IORING_REGISTER_EVENTFD:
+  case IORING_UNREGISTER_EVENTFD:
+  case IORING_REGISTER_FILES_UPDATE:
+  case IORING_REGISTER_EVENTFD_ASYNC:
+  case IORING_REGISTER_PROBE:
+  case IORING_REGISTER_PERSONALITY:
+  case IORING_UNREGISTER_PERSONALITY:
+  case IORING_REGISTER_RESTRICTIONS:
+  case IORING_REGISTER_ENABLE_RINGS:
+  case IORING_REGISTER_FILES2:
+  case IORING_REGISTER_FILES_UPDATE2:
+  case IORING_REGISTER_BUFFERS2:
+  case IORING_REGISTER_BUFFERS_UPDATE:
+    return true;
+  // Notably IORING_REGISTER_RING_FDS, after which io_uring_enter takes an
+  // index we cannot map back to a ring.
+  default:
+    return false;
+  }
+}
+
+bool ioUring::allowedOpcode(uint8_t opcode) {
+  switch (opcode) {
+  case IORING_OP_NOP:
+  case IORING_OP_READV:
+  case IORING_OP_WRITEV:
+  case IORING_OP_FSYNC:
+  case IORING_OP_READ_FIXED:
+  case IORING_OP_WRITE_FIXED:
+  case IORING_OP_SYNC_FILE_RANGE:
+  case IORING_OP_FALLOCATE:
+  case IORING_OP_READ:
+  case IORING_OP_WRITE:
+  case IORING_OP_FADVISE:
+  case IORING_OP_MADVISE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ioUring::isWrite(uint8_t opcode) {
+  return opcode == IORING_OP_WRITEV || opcode == IORING_OP_WRITE_FIXED ||
+         opcode == IORING_OP_WRITE;
+}
+
+uint32_t ioUring::queuedSubmissions() const {
+  uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(sqTail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+struct io_uring_sqe* ioUring::submission(uint32_t i) const {
+  uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  uint32_t index = sqArray[(head + i) & sqMask];
+  if (index >= sqEntries) {
+    return nullptr;
+  }
+  return (struct io_uring_sqe*)(sqes + index * sqeBytes);
+}
+
+uint32_t ioUring::readyCompletions() const {
+  uint32_t head = __atomic_load_n(cqHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
+
+const struct io_uring_cqe& ioUring::completion(uint32_t i) const {
+  uint32_t head = __atomic_load_n(cqHead, __ATOMIC_ACQUIRE);
+  return *(struct io_uring_cqe*)(cqes + ((head + i) & cqMask) * cqeBytes);
+}
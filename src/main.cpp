@@ -1,5 +1,7 @@
+#include <fcntl.h>
 #include <getopt.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -10,13 +12,18 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "actionCache.hpp"
 #include "dettrace.hpp"
+#include "handlerTrace.hpp"
 #include "logicalclock.hpp"
+#include "sha256.hpp"
 #include "util.hpp"
 #define CXXOPTS_NO_RTTI 1 // no rtti for cxxopts, this should be default.
 #define CXXOPTS_VECTOR_DELIMITER '\0'
@@ -57,6 +64,8 @@ struct programArgs {
 
   bool useColor;
   bool printStatistics;
+  std::string metricsFile;
+  unsigned long metricsInterval;
   // We sometimes want to run dettrace inside a chrooted environment.
   // Annoyingly, Linux does not let us create a user namespace if the current
   // process is chrooted. This is a feature. So we handle this special case, by
@@ -77,11 +86,22 @@ struct programArgs {
   std::vector<std::string> traceeArgs;
 
   unsigned timeoutSeconds;
+  unsigned long maxSyscallEvents;
+  unsigned long maxProcesses;
+  unsigned long maxLogicalTime;
+  unsigned long maxBlockedReplays;
+  bool spinWait;
+  bool timeShim;
+  bool pathInodes;
+  std::string actionCache;
+  std::string recordHandlers;
+  std::string replayHandlers;
   time_t epoch;
   unsigned long clock_step;
   unsigned long clone_ns_flags;
 
   unsigned short prng_seed;
+  unsigned vcpus;
   bool in_docker;
 
   programArgs(int argc, char* argv[]) {
@@ -93,9 +113,21 @@ struct programArgs {
     this->useColor = true;
     this->logFile = "";
     this->printStatistics = false;
+    this->metricsFile = "";
+    this->metricsInterval = DETTRACE_METRICS_INTERVAL;
     this->convertUids = false;
     this->alreadyInChroot = false;
     this->timeoutSeconds = 0;
+    this->maxSyscallEvents = 0;
+    this->maxProcesses = 0;
+    this->maxLogicalTime = 0;
+    this->maxBlockedReplays = 0;
+    this->spinWait = false;
+    this->timeShim = false;
+    this->pathInodes = false;
+    this->actionCache = "";
+    this->recordHandlers = "";
+    this->replayHandlers = "";
     this->epoch = 744847200UL;
     this->clock_step = 1;
     this->allow_network = false;
@@ -105,6 +137,7 @@ struct programArgs {
     this->with_devrand_overrides = true;
     this->with_etc_overrides = true;
     this->prng_seed = 0;
+    this->vcpus = 0;
     this->in_docker = false;
   }
 };
@@ -118,6 +151,14 @@ static std::vector<std::unique_ptr<char[]>> make_envp(
     std::unordered_map<std::string, std::string>& envvars);
 static std::vector<std::unique_ptr<Mount>> make_mounts(
     const std::vector<MountPoint>& mounts);
+static TraceMetrics* map_metrics_file(const std::string& path);
+static void publish_metrics(void* data, const struct TraceMetrics* m);
+static void log_file_access(void* data, const char* path, bool write);
+static int run_cached(
+    programArgs& args,
+    TraceOptions& options,
+    const std::vector<MountPoint>& mounts);
+static int exit_code_of(pid_t pid, bool& exited);
 
 // =======================================================================================
 
@@ -129,6 +170,11 @@ static std::vector<std::unique_ptr<Mount>> make_mounts(
 int main(int argc, char** argv) {
   programArgs args = parseProgramArguments(argc, argv);
 
+  if (!args.replayHandlers.empty()) {
+    uint64_t differences =
+        replayHandlerTrace(args.replayHandlers, stdout, stderr);
+    return differences == 0 ? 0 : 1;
+  }
   return run_main(args);
 }
 
@@ -202,6 +248,11 @@ static int run_main(programArgs& args) {
 
   auto mountPtrs = make_mounts(mounts);
 
+  TraceMetrics* sharedMetrics = nullptr;
+  if (!args.metricsFile.empty()) {
+    sharedMetrics = map_metrics_file(args.metricsFile);
+  }
+
   TraceOptions options{
       .program = argv[0].get(),
       .argv = (char* const*)(argv.data()),
@@ -214,7 +265,7 @@ static int run_main(programArgs& args) {
       .timeout = args.timeoutSeconds,
       .sys_enter = nullptr,
       .sys_exit = nullptr,
-      .user_data = nullptr,
+      .user_data = sharedMetrics,
       .epoch = args.epoch,
       .clock_step = args.clock_step,
       .prng_seed = args.prng_seed,
@@ -228,17 +279,42 @@ static int run_main(programArgs& args) {
       .use_color = args.useColor,
       .print_statistics = args.printStatistics,
       .log_file = args.logFile.c_str(),
+      .metrics = sharedMetrics ? publish_metrics : nullptr,
+      .metrics_interval = args.metricsInterval,
+      .max_syscall_events = args.maxSyscallEvents,
+      .max_processes = args.maxProcesses,
+      .max_logical_time = args.maxLogicalTime,
+      .max_blocked_replays = args.maxBlockedReplays,
+      .vcpus = args.vcpus,
+      .spin_wait = args.spinWait,
+      .time_shim = args.timeShim,
+      .path_inodes = args.pathInodes,
+      .handler_trace =
+          args.recordHandlers.empty() ? nullptr : args.recordHandlers.c_str(),
   };
 
+  if (!args.actionCache.empty()) {
+    return run_cached(args, options, mounts);
+  }
+
   pid_t pid = dettrace(&options);
   if (pid == -1) {
     return 1;
   }
 
-  // Propagate Child's exit status to use as our own exit status.
+  bool exited;
+  return exit_code_of(pid, exited);
+}
+
+/**
+ * Wait for the tracer, and propagate its exit status to use as our own.
+ * @param exited set if it exited rather than being killed.
+ */
+static int exit_code_of(pid_t pid, bool& exited) {
   int status;
   doWithCheck(waitpid(pid, &status, 0), "cannot wait for child");
 
+  exited = WIFEXITED(status);
   if (WIFEXITED(status)) {
     return WEXITSTATUS(status);
   } else if (WIFSIGNALED(status)) {
@@ -248,6 +324,206 @@ static int run_main(programArgs& args) {
   }
 }
 
+/**
+ * Where the tracee will find its program, for hashing it. Only looks through
+ * PATH on the host, like the tracee does without a chroot.
+ */
+static string resolve_program(const programArgs& args) {
+  const string& program = args.args[0];
+  if (program.find('/') != string::npos) {
+    return program[0] == '/' ? program : args.workdir + "/" + program;
+  }
+  auto path = args.envs.find("PATH");
+  if (path == args.envs.end()) {
+    return "";
+  }
+  std::istringstream dirs(path->second);
+  string dir;
+  while (std::getline(dirs, dir, ':')) {
+    string candidate = (dir.empty() ? args.workdir : dir) + "/" + program;
+    if (access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+  }
+  return "";
+}
+
+/**
+ * Everything about a run that can change its outcome, except for the contents
+ * of the input trees, which actionCache hashes itself.
+ */
+static string cache_inputs(
+    const programArgs& args,
+    const TraceOptions& options,
+    const std::vector<MountPoint>& mounts,
+    const string& stdinDigest) {
+  std::ostringstream in;
+  in << APP_VERSION "+build." APP_BUILDID << '\0';
+  for (const auto& arg : args.args) {
+    in << "arg " << arg << '\0';
+  }
+  std::vector<std::pair<string, string>> envs(
+      args.envs.begin(), args.envs.end());
+  std::sort(envs.begin(), envs.end());
+  for (const auto& env : envs) {
+    in << "env " << env.first << '=' << env.second << '\0';
+  }
+  for (const auto& m : mounts) {
+    in << "mount " << m.source << '\0' << m.target << '\0' << m.fstype << '\0'
+       << m.flags << '\0' << m.data << '\0';
+  }
+  in << "workdir " << args.workdir << '\0' << "stdin " << stdinDigest << '\0'
+     << "clone_ns_flags " << options.clone_ns_flags << '\0' << "timeout "
+     << options.timeout << '\0' << "epoch " << options.epoch << '\0'
+     << "clock_step " << options.clock_step << '\0' << "prng_seed "
+     << options.prng_seed << '\0' << "allow_network "
+     << options.allow_network << '\0' << "with_aslr " << options.with_aslr
+     << '\0' << "convert_uids " << options.convert_uids << '\0'
+     << "with_devrand_overrides " << options.with_devrand_overrides << '\0'
+     << "max_syscall_events " << options.max_syscall_events << '\0'
+     << "max_processes " << options.max_processes << '\0'
+     << "max_logical_time " << options.max_logical_time << '\0'
+     << "max_blocked_replays " << options.max_blocked_replays << '\0'
+     << "vcpus " << options.vcpus << '\0' << "time_shim " << options.time_shim
+     << '\0' << "path_inodes " << options.path_inodes << '\0';
+  return in.str();
+}
+
+/**
+ * --action-cache: replay a recorded run with the same inputs, or trace the
+ * program and record what it did.
+ */
+static int run_cached(
+    programArgs& args,
+    TraceOptions& options,
+    const std::vector<MountPoint>& mounts) {
+  // stdin is an input like any other. A terminal cannot be replayed.
+  if (isatty(STDIN_FILENO)) {
+    fprintf(stderr, "dettrace: stdin is a terminal, not using the cache.\n");
+    args.actionCache.clear();
+    return run_main(args);
+  }
+  // A hit would not run any handlers.
+  if (options.handler_trace != nullptr) {
+    fprintf(stderr, "dettrace: recording handlers, not using the cache.\n");
+    args.actionCache.clear();
+    return run_main(args);
+  }
+  // What comes in over the network is not part of the key.
+  if (options.allow_network) {
+    fprintf(stderr, "dettrace: network allowed, not using the cache.\n");
+    args.actionCache.clear();
+    return run_main(args);
+  }
+  int input = doWithCheck(memfd_create("stdin", MFD_CLOEXEC), "memfd_create");
+  sha256 stdinHash;
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    doWithCheck(n, "read stdin");
+    stdinHash.update(buf, n);
+    if (write(input, buf, n) != n) {
+      sysError("write stdin copy");
+    }
+  }
+  doWithCheck(lseek(input, 0, SEEK_SET), "lseek stdin copy");
+  options.stdin = input;
+
+  std::vector<string> trees{args.workdir};
+  for (const auto& m : mounts) {
+    if (!m.source.empty() && m.source[0] == '/') {
+      trees.push_back(m.source);
+    }
+  }
+  string program = resolve_program(args);
+  if (!program.empty()) {
+    trees.push_back(program);
+  }
+
+  actionCache cache(
+      std::unique_ptr<actionCacheBackend>(
+          new localActionCache(args.actionCache)),
+      args.actionCache, trees);
+  string key = cache.computeKey(
+      cache_inputs(args, options, mounts, stdinHash.hexDigest()));
+  int exitCode;
+  if (cache.cacheable() && cache.restore(key, exitCode)) {
+    return exitCode;
+  }
+
+  // The last metrics snapshot tells a completed run from a tracer error,
+  // whatever exit code either ends with.
+  if (options.metrics == nullptr) {
+    void* addr = mmap(
+        nullptr, sizeof(TraceMetrics), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      sysError("Unable to map metrics");
+    }
+    options.metrics = publish_metrics;
+    options.user_data = addr;
+  }
+  auto metrics = static_cast<TraceMetrics*>(options.user_data);
+
+  int outPipe[2], errPipe[2];
+  doWithCheck(pipe2(outPipe, O_CLOEXEC), "pipe2");
+  doWithCheck(pipe2(errPipe, O_CLOEXEC), "pipe2");
+  options.stdout = outPipe[1];
+  options.stderr = errPipe[1];
+  int outCopy, errCopy, accessLog;
+  string outPath = cache.captureFile(outCopy);
+  string errPath = cache.captureFile(errCopy);
+  // Files the tracee uses outside the trees, see actionCache::readAccessLog.
+  string accessPath = cache.captureFile(accessLog);
+  options.file_access = log_file_access;
+  options.file_access_data = &accessLog;
+
+  pid_t pid = dettrace(&options);
+  close(outPipe[1]);
+  close(errPipe[1]);
+  close(input);
+  close(accessLog);
+  if (pid == -1) {
+    unlink(outPath.c_str());
+    unlink(errPath.c_str());
+    unlink(accessPath.c_str());
+    return 1;
+  }
+  teeOutput(outPipe[0], errPipe[0], outCopy, errCopy);
+  close(outPipe[0]);
+  close(errPipe[0]);
+  close(outCopy);
+  close(errCopy);
+
+  bool exited;
+  exitCode = exit_code_of(pid, exited);
+  // A killed run, e.g. by --timeoutSeconds, depends on the host. A tracer
+  // error is ours, not the program's result.
+  bool finished = __atomic_load_n(&metrics->finished, __ATOMIC_ACQUIRE) != 0;
+  if (exited && finished) {
+    // Mount targets and /tmp are the tracee's own only in its mount namespace.
+    std::vector<string> ignored{"/proc", "/sys", "/dev"};
+    if (options.clone_ns_flags & CLONE_NEWNS) {
+      ignored.push_back("/tmp");
+      for (const auto& m : mounts) {
+        ignored.push_back(m.target);
+      }
+    }
+    cache.readAccessLog(accessPath, ignored);
+  }
+  unlink(accessPath.c_str());
+  if (exited && finished && cache.cacheable()) {
+    cache.record(key, exitCode, outPath, errPath);
+  } else {
+    unlink(outPath.c_str());
+    unlink(errPath.c_str());
+  }
+  return exitCode;
+}
+
 // get canonicalized exe path
 static string getExePath(pid_t pid = 0) {
 #define PROC_PID_EXE_LEN 32
@@ -346,6 +622,52 @@ static std::vector<std::unique_ptr<char[]>> make_argv(
   return argv;
 }
 
+/**
+ * Create the --metrics-file and map it shared. The tracer is forked from us
+ * and inherits the mapping, so its updates are visible to anyone else mapping
+ * the file.
+ */
+static TraceMetrics* map_metrics_file(const std::string& path) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    sysError(("Unable to open metrics file: " + path).c_str());
+  }
+  doWithCheck(ftruncate(fd, sizeof(TraceMetrics)), "ftruncate metrics file");
+  void* addr = mmap(
+      nullptr, sizeof(TraceMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      0);
+  if (addr == MAP_FAILED) {
+    sysError("mmap metrics file");
+  }
+  close(fd);
+  return static_cast<TraceMetrics*>(addr);
+}
+
+/**
+ * TraceOptions::metrics callback for --metrics-file. Copies the snapshot under
+ * the sequence lock described in TraceMetrics.
+ */
+static void publish_metrics(void* data, const struct TraceMetrics* m) {
+  auto shared = static_cast<TraceMetrics*>(data);
+  uint64_t sequence = shared->sequence;
+
+  __atomic_store_n(&shared->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  std::memcpy(
+      reinterpret_cast<char*>(shared) + sizeof(m->sequence),
+      reinterpret_cast<const char*>(m) + sizeof(m->sequence),
+      sizeof(TraceMetrics) - sizeof(m->sequence));
+  __atomic_store_n(&shared->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * TraceOptions::file_access callback for --action-cache, data points to the
+ * descriptor of the access log.
+ */
+static void log_file_access(void* data, const char* path, bool write) {
+  actionCache::logAccess(*static_cast<int*>(data), path, write);
+}
+
 // unwrap_or (default) OptionValue
 class OptionValue1 : public cxxopts::OptionValue {
 public:
@@ -412,6 +734,27 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     ( "clock-step",
       "The number of microseconds to increment the clock each time it is queried.",
       cxxopts::value<unsigned long>())
+    ( "time-shim",
+      "Answer clock_gettime, gettimeofday and time calls through the vdso inside the "
+      "guest, without stopping it. Only every 64th call traps, so busy waits still "
+      "let others run. Threads of a process, and children cloned with CLONE_VM but "
+      "without CLONE_VFORK, then share one clock, so they see other times than "
+      "without the flag. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
+    ( "action-cache",
+      "Cache whole runs in this directory. A run with the same command line, "
+      "environment, options, stdin, and contents of the working directory, volumes "
+      "and program is not traced again: the files it created, changed or removed "
+      "there, its output and exit code are restored instead. stdin is read to its end "
+      "before the run. Files the run reads elsewhere on the host are checked before "
+      "a recorded run is restored, and a run that changes files elsewhere is not "
+      "recorded.",
+      cxxopts::value<std::string>())
+    ( "path-inodes",
+      "Derive virtual inode numbers from the path a file was first seen at inside "
+      "the container, instead of from the order files are seen in. Inodes then stay "
+      "the same across runs that look at different files. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
 
     ( "prng-seed",
       "Use this string to seed to the PRNG that is used to supply all "
@@ -419,6 +762,12 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       "system calls that create randomness. (The rdrand instruction is disabled for "
       "the guest.) The default PRNG seed is `4660`. ",
       cxxopts::value<unsigned int>())
+    ( "vcpus",
+      "Present the guest with this many CPUs, consistently across sched_getaffinity, "
+      "CPUID, /proc/cpuinfo, /proc/stat and /sys/devices/system/cpu. Tracees still "
+      "run one at a time. The default is `0`, which only virtualizes CPUID (one core) "
+      "and leaves the other views as they were.",
+      cxxopts::value<unsigned>()->default_value("0"))
     ( "base-env",
       "empty|minimal|host (default is minimal). "
       "The base environment that is set before adding additions via --env. "
@@ -443,7 +792,8 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     ( "v,volume",
       "Specify a directory to bind mount . "
       "The syntax of the argument is `hostdir:targetdir`. "
-      "The `targetdir` mount point must already exist.",
+      "The `targetdir` mount point must already exist. "
+      "Append `:ro` to make it read-only.",
       cxxopts::value<std::vector<std::string>>())
     ( "w,workdir",
       "Specify working directory (CWD) dettrace should use. "
@@ -527,7 +877,25 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     ( "print-statistics",
       "Print metadata about process that just ran including: number of system call events "
       "read/write retries, rdtsc, rdtscp, cpuid. The default is `false`.",
-      cxxopts::value<bool>()->default_value("false"));
+      cxxopts::value<bool>()->default_value("false"))
+    ( "metrics-file",
+      "Keep a live copy of the statistics (see TraceMetrics in dettrace.hpp) in "
+      "this file, mapped shared, so a monitor can watch long running jobs.",
+      cxxopts::value<std::string>())
+    ( "metrics-interval",
+      "Update the metrics file every this many ptrace events. The default is `" +
+      to_string(DETTRACE_METRICS_INTERVAL) + "`.",
+      cxxopts::value<unsigned long>()->default_value(
+          to_string(DETTRACE_METRICS_INTERVAL)))
+    ( "record-handlers",
+      "Write every system call handler call, with the registers and guest memory it "
+      "used and changed, to this file. See --replay-handlers.",
+      cxxopts::value<std::string>())
+    ( "replay-handlers",
+      "Run the handler calls recorded in this file again without a guest, printing "
+      "the time spent per handler. Calls whose effect on registers and memory is not "
+      "the one recorded are reported, and make the exit status 1. No program is run.",
+      cxxopts::value<std::string>());
 
   // internal options
   options.add_options(
@@ -547,6 +915,26 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     ( "timeoutSeconds",
       "Tear down all tracee processes with SIGKILL after this many seconds. The default is `0` (i.e., indefinite).",
       cxxopts::value<unsigned long>()->default_value("0"))
+    ( "max-syscalls",
+      "Fail once the tracees made this many intercepted system calls. Unlike "
+      "--timeoutSeconds this stops at the same point on every run. The default is `0` (unlimited).",
+      cxxopts::value<unsigned long>()->default_value("0"))
+    ( "max-processes",
+      "Fail once the tracees spawned this many processes and threads. The default is `0` (unlimited).",
+      cxxopts::value<unsigned long>()->default_value("0"))
+    ( "max-logical-time",
+      "Fail once any tracee's logical clock is this many microseconds past the epoch. "
+      "The default is `0` (unlimited).",
+      cxxopts::value<unsigned long>()->default_value("0"))
+    ( "max-blocked-replays",
+      "Fail once a single blocking system call was replayed this many times, e.g. a "
+      "livelocked poll loop. The default is `0` (unlimited).",
+      cxxopts::value<unsigned long>()->default_value("0"))
+    ( "spin-wait",
+      "Poll for the next ptrace stop for a few microseconds before sleeping, adapted "
+      "to how quickly recent stops arrived. Cuts the latency of every stop at the cost "
+      "of keeping one core busy, for dedicated build hosts. The default is `false`.",
+      cxxopts::value<bool>()->default_value("false"))
     ( "program",
       "program to run",
       cxxopts::value<std::string>())
@@ -584,10 +972,31 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     args.printStatistics =
         (static_cast<OptionValue1>(result["print-statistics"]))
             .unwrap_or(false);
+    args.metricsFile =
+        (static_cast<OptionValue1>(result["metrics-file"]))
+            .unwrap_or(emptyString);
+    args.metricsInterval =
+        result["metrics-interval"].as<unsigned long>(); // must have default!
     args.convertUids =
         (static_cast<OptionValue1>(result["convert-uids"])).unwrap_or(false);
     args.timeoutSeconds =
         (static_cast<OptionValue1>(result["timeoutSeconds"])).unwrap_or(0);
+    args.maxSyscallEvents = result["max-syscalls"].as<unsigned long>();
+    args.maxProcesses = result["max-processes"].as<unsigned long>();
+    args.maxLogicalTime = result["max-logical-time"].as<unsigned long>();
+    args.maxBlockedReplays =
+        result["max-blocked-replays"].as<unsigned long>();
+    args.spinWait = result["spin-wait"].as<bool>(); // must have default!
+    args.timeShim = result["time-shim"].as<bool>(); // must have default!
+    args.pathInodes = result["path-inodes"].as<bool>(); // must have default!
+    args.actionCache = (static_cast<OptionValue1>(result["action-cache"]))
+                           .unwrap_or(emptyString);
+    args.recordHandlers =
+        (static_cast<OptionValue1>(result["record-handlers"]))
+            .unwrap_or(emptyString);
+    args.replayHandlers =
+        (static_cast<OptionValue1>(result["replay-handlers"]))
+            .unwrap_or(emptyString);
     args.allow_network =
         (static_cast<OptionValue1>(result["network"])).unwrap_or(false);
     args.with_aslr =
@@ -596,6 +1005,7 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     auto base_env = result["base-env"].as<std::string>();
     args.prng_seed =
         (static_cast<OptionValue1>(result["prng-seed"])).unwrap_or(0x1234);
+    args.vcpus = result["vcpus"].as<unsigned>();
 
     char* cwd = get_current_dir_name();
     string host_cwd(cwd);
@@ -657,6 +1067,13 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
       auto mounts = result["volume"].as<std::vector<std::string>>();
       for (auto v : mounts) {
         MountPoint mountPoint;
+        const string readOnly = ":ro";
+        if (v.size() > readOnly.size() &&
+            v.compare(v.size() - readOnly.size(), string::npos, readOnly) ==
+                0) {
+          v.resize(v.size() - readOnly.size());
+          mountPoint.flags |= MS_RDONLY;
+        }
         int j = v.find(':');
         if (j == string::npos) {
           mountPoint.source = v;
@@ -717,6 +1134,9 @@ programArgs parseProgramArguments(int argc, char* argv[]) {
     }
 
     args.args.clear();
+    if (!args.replayHandlers.empty()) {
+      return args;
+    }
     if (!result["program"].count()) {
       std::cout << options.help() << std::endl;
       exit(1);
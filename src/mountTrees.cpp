@@ -0,0 +1,196 @@
+#include "mountTrees.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mount.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+// Older headers lack the new mount API, see open_tree(2) and friends.
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+
+/**
+ * struct mount_attr, which glibc only has since 2.36.
+ */
+struct mountAttr {
+  uint64_t attrSet;
+  uint64_t attrClr;
+  uint64_t propagation;
+  uint64_t usernsFd;
+};
+
+static int openTree(int dirfd, const char* path, unsigned flags) {
+  return syscall(SYS_open_tree, dirfd, path, flags);
+}
+
+static std::string bindError(
+    const std::string& source, const std::string& target) {
+  return "Unable to bind mount: " + source + " to " + target;
+}
+
+mountTrees::~mountTrees() {
+  for (auto& tree : trees) {
+    if (tree.second.fd != -1) {
+      close(tree.second.fd);
+    }
+  }
+}
+
+void mountTrees::prepare(
+    const std::string& source, bool recursive, bool readOnly) {
+  // The tree is only made at the first bind, so binds still see the mounts
+  // made before them.
+  auto inserted = trees.insert({key(source, recursive, readOnly), {-1, 0}});
+  inserted.first->second.binds++;
+}
+
+void mountTrees::bind(
+    const std::string& source,
+    const std::string& target,
+    bool recursive,
+    bool readOnly) {
+  int tree = useNewApi ? attachableTree(source, recursive, readOnly) : -1;
+  if (tree == -1 && useNewApi) {
+    sysError(bindError(source, target).c_str());
+  }
+  if (tree == -1) {
+    bindWithMount(source, target, recursive, readOnly);
+    return;
+  }
+
+  int ret = syscall(
+      SYS_move_mount, tree, "", AT_FDCWD, target.c_str(),
+      MOVE_MOUNT_F_EMPTY_PATH);
+  int err = errno;
+  close(tree);
+  if (ret == -1) {
+    errno = err;
+    sysError(bindError(source, target).c_str());
+  }
+}
+
+int mountTrees::detachedTree(
+    const std::string& source, bool recursive, bool readOnly) {
+  int tree = openTree(
+      AT_FDCWD, source.c_str(),
+      OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | (recursive ? AT_RECURSIVE : 0));
+  if (tree == -1) {
+    if (errno == ENOSYS || errno == EPERM) {
+      useNewApi = false;
+    }
+    return -1;
+  }
+
+  mountAttr attr = {};
+  attr.attrSet = readOnly ? MOUNT_ATTR_RDONLY : 0;
+  attr.propagation = MS_PRIVATE;
+  if (syscall(
+          SYS_mount_setattr, tree, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr,
+          sizeof(attr)) == -1) {
+    // Linux 5.2 to 5.11 have open_tree but no mount_setattr.
+    close(tree);
+    useNewApi = false;
+    return -1;
+  }
+  return tree;
+}
+
+int mountTrees::attachableTree(
+    const std::string& source, bool recursive, bool readOnly) {
+  auto prepared = trees.find(key(source, recursive, readOnly));
+  if (prepared == trees.end()) {
+    return detachedTree(source, recursive, readOnly);
+  }
+
+  preparedTree& tree = prepared->second;
+  if (tree.fd == -1 && tree.binds > 1) {
+    tree.fd = detachedTree(source, recursive, readOnly);
+    if (tree.fd == -1) {
+      return -1;
+    }
+  }
+  if (tree.binds > 1 && cloneDetached) {
+    int clone = openTree(
+        tree.fd, "",
+        OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH | AT_RECURSIVE);
+    if (clone != -1) {
+      tree.binds--;
+      return clone;
+    }
+    if (errno != EINVAL) {
+      return -1;
+    }
+    cloneDetached = false;
+  }
+  if (tree.binds > 1) {
+    tree.binds--;
+    return detachedTree(source, recursive, readOnly);
+  }
+
+  // The last bind attaches the prepared tree itself.
+  int fd = tree.fd;
+  trees.erase(prepared);
+  return fd != -1 ? fd : detachedTree(source, recursive, readOnly);
+}
+
+void mountTrees::bindWithMount(
+    const std::string& source,
+    const std::string& target,
+    bool recursive,
+    bool readOnly) {
+  // Notice that we want a bind mount, so MS_BIND is necessary. MS_REC is
+  // necessary to bind dirs that are themselves bind mounts in an unprivileged
+  // mount namespace, otherwise you will get EINVAL as per `man 2 mount`.
+  // MS_PRIVATE has no effect next to MS_BIND, it is kept for old times' sake.
+  unsigned long flags = MS_BIND | MS_PRIVATE | (recursive ? MS_REC : 0);
+  // Note this line causes spurious false positives when running under
+  // valgrind. It's okay that these arguments are nullptr.
+  if (mount(source.c_str(), target.c_str(), nullptr, flags, nullptr) == -1) {
+    sysError(bindError(source, target).c_str());
+  }
+  if (!readOnly) {
+    return;
+  }
+
+  // A bind mount only becomes read-only by remounting it. Flags locked by the
+  // user namespace have to be passed along or the remount fails with EPERM.
+  struct statvfs stats;
+  doWithCheck(
+      statvfs(target.c_str(), &stats), "statvfs on read-only bind mount");
+  unsigned long locked = 0;
+  locked |= stats.f_flag & ST_NOSUID ? MS_NOSUID : 0;
+  locked |= stats.f_flag & ST_NODEV ? MS_NODEV : 0;
+  locked |= stats.f_flag & ST_NOEXEC ? MS_NOEXEC : 0;
+  locked |= stats.f_flag & ST_NOATIME ? MS_NOATIME : 0;
+  locked |= stats.f_flag & ST_NODIRATIME ? MS_NODIRATIME : 0;
+  locked |= stats.f_flag & ST_RELATIME ? MS_RELATIME : 0;
+  if (mount(
+          nullptr, target.c_str(), nullptr,
+          MS_REMOUNT | MS_BIND | MS_RDONLY | locked, nullptr) == -1) {
+    sysError(("Unable to make bind mount read-only: " + target).c_str());
+  }
+}
@@ -32,6 +32,9 @@ ptracer::ptracer(pid_t pid) {
   }
 }
 
+ptracer::ptracer(pid_t pid, struct user_regs_struct regs)
+    : traceePid(pid), regs(regs) {}
+
 uint64_t ptracer::arg1() { return regs.rdi; }
 uint64_t ptracer::arg2() { return regs.rsi; }
 uint64_t ptracer::arg3() { return regs.rdx; }
@@ -142,7 +145,9 @@ long ptracer::doPtrace(
   */
 
   errno = 0;
-  const long val = ptrace(request, pid, addr, data);
+  const long val = activeTraceeBackend != nullptr
+      ? activeTraceeBackend->ptraceRequest(request, pid, addr, data)
+      : ptrace(request, pid, addr, data);
 
   if (PTRACE_PEEKTEXT == request || PTRACE_PEEKDATA == request ||
       PTRACE_PEEKUSER == request) {
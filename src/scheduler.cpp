@@ -65,6 +65,14 @@ void scheduler::markFinishedAndScheduleNext(pid_t process) {
 // CHECK
 void scheduler::preemptAndScheduleNext() {
   pid_t curr = runnableHeap.top();
+  // Nobody else could run instead, so swapping the heaps would only hand curr
+  // back to us.
+  if (runnableHeap.size() == 1 && blockedHeap.empty()) {
+    callsToScheduleNextProcess++;
+    nextPid = curr;
+    return;
+  }
+
   auto msg = log.makeTextColored(Color::blue, "Preempting process: [%d]\n");
   log.writeToLog(Importance::info, msg, curr);
 
@@ -76,6 +84,52 @@ void scheduler::preemptAndScheduleNext() {
   nextPid = scheduleNextProcess();
 }
 
+void scheduler::parkAndScheduleNext(uint64_t progressEvents) {
+  pid_t curr = runnableHeap.top();
+  auto msg = log.makeTextColored(
+      Color::blue, "Parking process: [%d] for %lu progress events\n");
+  log.writeToLog(Importance::info, msg, curr, progressEvents);
+
+  runnableHeap.pop();
+  parkedProcesses[curr] = progress + max(progressEvents, (uint64_t)1);
+  parkedPolls++;
+
+  nextPid = scheduleNextProcess();
+}
+
+void scheduler::parkUntilSignalAndScheduleNext() {
+  pid_t curr = runnableHeap.top();
+  auto msg =
+      log.makeTextColored(Color::blue, "Parking process: [%d] for a signal\n");
+  log.writeToLog(Importance::info, msg, curr);
+
+  runnableHeap.pop();
+  parkedProcesses[curr] = UINT64_MAX;
+
+  nextPid = scheduleNextProcess();
+}
+
+void scheduler::wake(pid_t process) {
+  auto it = parkedProcesses.find(process);
+  if (it != parkedProcesses.end()) {
+    log.writeToLog(Importance::info, "Waking process: [%d]\n", process);
+    blockedHeap.push(process);
+    parkedProcesses.erase(it);
+  }
+}
+
+void scheduler::unparkUntil(uint64_t until) {
+  for (auto it = parkedProcesses.begin(); it != parkedProcesses.end();) {
+    if (it->second <= until) {
+      log.writeToLog(Importance::info, "Unparking process: [%d]\n", it->first);
+      blockedHeap.push(it->first);
+      it = parkedProcesses.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 // CHECK
 void scheduler::addAndScheduleNext(pid_t newProcess) {
   auto msg = log.makeTextColored(
@@ -101,6 +155,12 @@ void scheduler::remove(pid_t process) {
       Color::blue, "Removing process runnable|blocked heaps: [%d]\n");
   log.writeToLog(Importance::info, msg, process);
 
+  // A parked process can still be killed, e.g. by another thread's
+  // exit_group.
+  if (parkedProcesses.erase(process) != 0) {
+    return;
+  }
+
   // Sanity check that there is at least one process available.
   if (runnableHeap.empty() && blockedHeap.empty()) {
     string err = "scheduler::remove: No such element to delete from scheduler.";
@@ -136,7 +196,8 @@ bool scheduler::removeAndScheduleNext(pid_t process) {
     remove(process);
   }
 
-  if (runnableHeap.empty() && blockedHeap.empty()) {
+  if (runnableHeap.empty() && blockedHeap.empty() &&
+      parkedProcesses.empty()) {
     return true;
   } else {
     nextPid = scheduleNextProcess();
@@ -153,6 +214,12 @@ pid_t scheduler::scheduleNextProcess() {
     pid_t nextProcess = runnableHeap.top();
     return nextProcess;
   } else {
+    // Nobody else can make progress, or nobody did since the last round,
+    // parked processes have to run after all.
+    if (blockedHeap.empty() || progress == progressAtSwap) {
+      unparkUntil(UINT64_MAX);
+    }
+    progressAtSwap = progress;
     if (blockedHeap.empty()) {
       runtimeError("No processes left to run!\n");
     }
@@ -167,6 +234,10 @@ pid_t scheduler::scheduleNextProcess() {
 
 // CHECK
 void scheduler::printProcesses() {
+  // Don't copy the heaps for messages the logger drops anyway.
+  if (log.getDebugLevel() < 5) {
+    return;
+  }
   log.writeToLog(Importance::extra, "Printing runnable processes\n");
   // Print the runnableHeap.
   priority_queue<pid_t> runnableCopy = runnableHeap;
@@ -184,6 +255,10 @@ void scheduler::printProcesses() {
     blockedCopy.pop();
     log.writeToLog(Importance::extra, "Pid [%d], blocked\n", curr);
   }
+
+  for (auto& parked : parkedProcesses) {
+    log.writeToLog(Importance::extra, "Pid [%d], parked\n", parked.first);
+  }
   return;
 }
 
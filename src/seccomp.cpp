@@ -12,17 +12,19 @@
 
 using namespace std;
 
-seccomp::seccomp(int debugLevel, bool convertUids) {
+seccomp::seccomp(
+    int debugLevel, bool convertUids, bool virtualCpus, bool trackFiles) {
   ctx = seccomp_init(SCMP_ACT_TRACE(INT16_MAX));
 
   if (ctx == nullptr) {
     runtimeError("Unable to init seccomp filter.\n");
   }
 
-  loadRules(debugLevel >= 4, convertUids);
+  loadRules(debugLevel >= 4, convertUids, virtualCpus, trackFiles);
 }
 
-void seccomp::loadRules(bool debug, bool convertUids) {
+void seccomp::loadRules(
+    bool debug, bool convertUids, bool virtualCpus, bool trackFiles) {
   // Add other UID functions we might need to intercept here!
   if (convertUids) {
     intercept(SYS_fchownat);
@@ -46,8 +48,6 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // up our bind mounts wrong and might need to allow for recursive mounting.
   // But it will be obvious.
   noIntercept(SYS_bind);
-  noIntercept(SYS_splice);
-  noIntercept(SYS_dup3);
   noIntercept(SYS_capget);
   noIntercept(SYS_capset);
 
@@ -74,16 +74,15 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_fallocate);
   // Variants of regular function that use file descriptor instead of char*
   // path.
-  noIntercept(SYS_fchdir);
   noIntercept(SYS_fchmod);
-  noIntercept(SYS_fchmodat);
+  // Only changes a file the action cache must know about.
+  intercept(SYS_fchmodat, trackFiles);
 
   noIntercept(SYS_fdatasync);
   // TODO Flock may block! In the future this may lead to deadlock.
   // deal with it then :)
   noIntercept(SYS_flock);
   noIntercept(SYS_fsync);
-  noIntercept(SYS_ftruncate);
   // TODO: Add to intercept with debug for path.
   noIntercept(SYS_fsetxattr);
   noIntercept(SYS_getresuid);
@@ -108,13 +107,13 @@ void seccomp::loadRules(bool debug, bool convertUids) {
 
   noIntercept(SYS_prctl);
   noIntercept(SYS_pread64);
-  noIntercept(SYS_pwrite64);
   noIntercept(SYS_listxattr);
   intercept(SYS_rt_sigprocmask);
 
   // intercept(SYS_sigaction); // is mapped to SYS_rt_sigaction on cat16
   // intercept(SYS_signal); // is mapped to SYS_rt_sigaction on cat16
-  noIntercept(SYS_rt_sigreturn);
+  // One stop per handler return, to restore the blocked mask we mirror.
+  intercept(SYS_rt_sigreturn);
   intercept(SYS_rt_sigtimedwait);
   intercept(SYS_rt_sigsuspend);
   noIntercept(SYS_rt_sigpending);
@@ -136,10 +135,11 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_setuid);
   // This seems to be, surprisingly, deterministic. The affinity is set/get by
   // us so it should always be the same mask. User cannot actually observe
-  // differences.
-  noIntercept(SYS_sched_getaffinity);
-  noIntercept(SYS_sched_setaffinity);
+  // differences. Except for the number of CPUs, which --vcpus virtualizes.
+  intercept(SYS_sched_getaffinity, virtualCpus);
+  intercept(SYS_sched_setaffinity, virtualCpus);
   intercept(SYS_socket);
+  intercept(SYS_socketpair);
   noIntercept(SYS_sync);
   noIntercept(SYS_umask);
 
@@ -147,15 +147,11 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_getsockname);
   noIntercept(SYS_getsockopt);
   noIntercept(SYS_setsockopt);
-  noIntercept(SYS_socketpair);
   noIntercept(SYS_mlock);
   noIntercept(SYS_setsid);
 
   noIntercept(SYS_sched_yield);
-  noIntercept(SYS_truncate);
   noIntercept(SYS_eventfd2);
-  // TODO
-  noIntercept(SYS_writev);
 
   // These system calls must be intercepted as to know when a fork even has
   // happened: We handle forks when see the system call pre exit. Since this is
@@ -168,12 +164,15 @@ void seccomp::loadRules(bool debug, bool convertUids) {
 
   noIntercept(SYS_clone);
 
-  intercept(SYS_rename, debug);
-  intercept(SYS_renameat, debug);
-  intercept(SYS_renameat2, debug);
-  intercept(SYS_rmdir, debug);
-  intercept(SYS_unlink, debug);
-  intercept(SYS_unlinkat, debug);
+  // Renaming over a file modifies the target, see setMtime. Costs a pre-hook
+  // stop, and a post-hook stop when the target existed.
+  intercept(SYS_rename);
+  intercept(SYS_renameat);
+  intercept(SYS_renameat2);
+  // To forget the inodes of deleted files.
+  intercept(SYS_rmdir);
+  intercept(SYS_unlink);
+  intercept(SYS_unlinkat);
 
   intercept(SYS_execve);
 
@@ -192,11 +191,12 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_timerfd_gettime);
 
   // These system calls cause an even that is caught by ptrace and determinized:
-  intercept(SYS_access, debug);
+  intercept(SYS_access, debug || trackFiles);
   // Not used, let's figure out who does one!
   intercept(SYS_alarm);
-  intercept(SYS_chdir, debug);
-  intercept(SYS_chmod, debug);
+  // Working directories keep deleted directories' entries, see openInodes.
+  intercept(SYS_chdir);
+  intercept(SYS_chmod, debug || trackFiles);
   intercept(SYS_creat);
   intercept(SYS_clock_gettime);
   intercept(SYS_close);
@@ -206,8 +206,10 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // Duplicate file descriptor.
   intercept(SYS_dup);
   intercept(SYS_dup2);
+  intercept(SYS_dup3);
 
-  intercept(SYS_faccessat, debug);
+  intercept(SYS_faccessat, debug || trackFiles);
+  intercept(SYS_fchdir);
   intercept(SYS_fgetxattr, debug);
   intercept(SYS_flistxattr, debug);
   intercept(SYS_fcntl);
@@ -229,6 +231,10 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   // TODO we might be able to use seccomp to only intercept on the ioctl system
   // calls arguments that we care about
   intercept(SYS_ioctl);
+  // Submissions are inspected and completions ordered, see ioUring.
+  intercept(SYS_io_uring_setup);
+  intercept(SYS_io_uring_enter);
+  intercept(SYS_io_uring_register);
   // TODO
   intercept(SYS_llistxattr);
   // TODO
@@ -238,6 +244,10 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   noIntercept(SYS_mmap);
 
   intercept(SYS_nanosleep);
+  intercept(SYS_clock_nanosleep);
+  // A sleep interrupted by a signal restarts with what is left of our zero
+  // length request.
+  noIntercept(SYS_restart_syscall);
   intercept(SYS_newfstatat);
   intercept(SYS_lstat);
 
@@ -251,10 +261,15 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_open);
   intercept(SYS_openat);
 
+  // Signals between tracees, so receivers waiting for them are woken.
+  intercept(SYS_kill);
+  intercept(SYS_tkill);
   intercept(SYS_tgkill);
+  intercept(SYS_signalfd);
+  intercept(SYS_signalfd4);
 
-  intercept(SYS_link, debug);
-  intercept(SYS_linkat, debug);
+  intercept(SYS_link, debug || trackFiles);
+  intercept(SYS_linkat, debug || trackFiles);
 
   intercept(SYS_pipe);
   intercept(SYS_pipe2);
@@ -263,8 +278,8 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_poll);
   intercept(SYS_prlimit64);
   intercept(SYS_read);
-  intercept(SYS_readlink, debug);
-  intercept(SYS_readlinkat, debug);
+  intercept(SYS_readlink, debug || trackFiles);
+  intercept(SYS_readlinkat, debug || trackFiles);
   // TODO
   intercept(SYS_recvmsg);
   intercept(SYS_sendmsg);
@@ -297,6 +312,18 @@ void seccomp::loadRules(bool debug, bool convertUids) {
   intercept(SYS_waitid);
 
   intercept(SYS_write);
+  // In-kernel copies, short transfers are retried like read/write.
+  intercept(SYS_sendfile);
+  intercept(SYS_copy_file_range);
+  intercept(SYS_splice);
+  // Write-like system calls that give the file a new logical mtime. A filter
+  // cannot tell which descriptors still need one, so each call costs a stop;
+  // the post-hook only runs for the first write after an open.
+  intercept(SYS_writev);
+  intercept(SYS_pwrite64);
+  intercept(SYS_pwritev);
+  intercept(SYS_truncate);
+  intercept(SYS_ftruncate);
 
   noIntercept(SYS_mbind);
 
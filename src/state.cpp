@@ -1,5 +1,7 @@
 #include "state.hpp"
 
+#include <signal.h>
+
 #include "logicalclock.hpp"
 
 state::state(
@@ -9,17 +11,23 @@ state::state(
     logical_clock::duration clock_step)
     : clock(clock),
       clock_step(clock_step),
-      fdStatus(new unordered_map<int, descriptorType>),
       traceePid(traceePid),
       signalToDeliver(0),
+      fdStatus(new unordered_map<int, descriptorType>),
       mmapMemory(2048),
       debugLevel(debugLevel) {
   currentSignalHandlers =
       std::make_shared<unordered_map<int, enum sighandler_type>>();
+  signalHandlerMasks = std::make_shared<unordered_map<int, handlerMask>>();
   timerCreateTimers = std::make_shared<unordered_map<timerID_t, timerInfo>>();
   remote_sockfds = std::make_shared<unordered_set<int>>();
   timerfds = std::make_shared<unordered_map<int, struct itimerspec>>();
   signalfds = std::make_shared<unordered_set<int>>();
+  unwrittenFds = std::make_shared<unordered_map<int, ino_t>>();
+  openFiles = std::make_shared<unordered_map<int, pair<dev_t, ino_t>>>();
+  ioUrings = std::make_shared<unordered_map<int, shared_ptr<ioUring>>>();
+  unixSockets = std::make_shared<unordered_map<int, int>>();
+  sharedPendingSignals = std::make_shared<uint64_t>(0);
 
   poll_retry_count = 0;
   poll_retry_maximum = LONG_MAX;
@@ -31,21 +39,137 @@ void state::setFdStatus(int fd, descriptorType dt) {
   (*fdStatus.get())[fd] = dt;
 }
 
+logical_clock::time_point state::getLogicalTime() const {
+  if (timeShim.ptr == nullptr) {
+    return clock;
+  }
+  if (shimClockFresh) {
+    return shimClock;
+  }
+  int64_t us;
+  // Once the process is gone our copy is all that is left.
+  if (readVmTraceeRaw(
+          traceePtr<int64_t>(&timeShim.ptr->clock), &us, sizeof(us),
+          traceePid) != (ssize_t)sizeof(us)) {
+    return clock;
+  }
+  shimClock = logical_clock::time_point(logical_clock::duration(us));
+  shimClockFresh = true;
+  return shimClock;
+}
+
+void state::incrementTime() {
+  if (timeShim.ptr == nullptr) {
+    clock += clock_step;
+    return;
+  }
+  clock = getLogicalTime() + clock_step;
+  int64_t us = clock.time_since_epoch().count();
+  writeVmTraceeRaw(
+      &us, traceePtr<int64_t>(&timeShim.ptr->clock), sizeof(us), traceePid);
+  shimClock = clock;
+  shimClockFresh = true;
+}
+
+uint32_t state::syncTimeShim() {
+  if (timeShim.ptr == nullptr) {
+    return 0;
+  }
+  timeShimData data;
+  if (readVmTraceeRaw(timeShim, &data, sizeof(data), traceePid) !=
+      (ssize_t)sizeof(data)) {
+    return 0;
+  }
+  clock = logical_clock::time_point(logical_clock::duration(data.clock));
+  shimClock = clock;
+  shimClockFresh = true;
+  if (data.calls != 0) {
+    uint32_t zero = 0;
+    writeVmTraceeRaw(
+        &zero, traceePtr<uint32_t>(&timeShim.ptr->calls), sizeof(zero),
+        traceePid);
+  }
+  return data.calls;
+}
+
+uint32_t state::resetTimeShim() {
+  if (timeShim.ptr == nullptr) {
+    return 0;
+  }
+  timeShimData data;
+  if (readVmTraceeRaw(timeShim, &data, sizeof(data), traceePid) !=
+      (ssize_t)sizeof(data)) {
+    return 0;
+  }
+  uint32_t calls = data.calls;
+  data.clock = clock.time_since_epoch().count();
+  data.calls = 0;
+  writeVmTraceeRaw(&data, timeShim, sizeof(data), traceePid);
+  shimClock = clock;
+  shimClockFresh = true;
+  return calls;
+}
+
 descriptorType state::getFdStatus(int fd) { return fdStatus.get()->at(fd); }
 
 int state::countFdStatus(int fd) { return fdStatus.get()->count(fd); }
 
+void state::queueSignal(int signum, bool shared) {
+  uint64_t bit = signalBit(signum);
+  if ((blockedSignals & bit) == 0) {
+    return;
+  }
+  if (shared) {
+    *sharedPendingSignals |= bit;
+  } else {
+    threadPendingSignals |= bit;
+  }
+}
+
+void state::signalDequeued(int signum) {
+  uint64_t bit = signalBit(signum);
+  // Thread-directed signals are dequeued first, same as the kernel.
+  if (threadPendingSignals & bit) {
+    threadPendingSignals &= ~bit;
+  } else {
+    *sharedPendingSignals &= ~bit;
+  }
+}
+
+void state::setBlockedSignals(uint64_t mask) {
+  // SIGKILL and SIGSTOP cannot be blocked, the kernel silently ignores them.
+  blockedSignals = mask & ~(signalBit(SIGKILL) | signalBit(SIGSTOP));
+  // Newly unblocked signals get delivered on return from rt_sigprocmask. That
+  // includes group-wide ones, which go to any thread not blocking them.
+  threadPendingSignals &= blockedSignals;
+  *sharedPendingSignals &= blockedSignals;
+}
+
+void state::enterSignalHandler(int signum) {
+  auto handler = signalHandlerMasks->find(signum);
+  if (handler == signalHandlerMasks->end()) {
+    return;
+  }
+  setBlockedSignals(blockedSignals | handler->second.mask);
+  if (handler->second.oneShot) {
+    signalHandlerMasks->erase(handler);
+  }
+}
+
 state state::forked(pid_t childPid) const {
   state childState(childPid, this->debugLevel, this->clock, this->clock_step);
   childState.CPUIDTrapSet = this->CPUIDTrapSet;
   childState.currentSignalHandlers =
       make_shared<unordered_map<int, enum sighandler_type>>(
           *(this->currentSignalHandlers));
+  childState.signalHandlerMasks = make_shared<unordered_map<int, handlerMask>>(
+      *(this->signalHandlerMasks));
   childState.dirEntries = this->dirEntries;
 
-  childState.exfsNotNull = this->exfsNotNull;
-  childState.rdfsNotNull = this->rdfsNotNull;
-  childState.wrfsNotNull = this->wrfsNotNull;
+  if (this->coldRetry) {
+    childState.coldRetry.reset(new retryState(*this->coldRetry));
+    childState.coldRetry->rdfsNotNull = false;
+  }
 
   childState.fdStatus =
       make_shared<unordered_map<int, descriptorType>>(*(this->fdStatus));
@@ -56,16 +180,12 @@ state state::forked(pid_t childPid) const {
   childState.mmapMemory = this->mmapMemory;
   childState.noopSystemCall = false;
   childState.onPreExitEvent = false;
-  childState.origExfs = this->origExfs;
-  childState.origRdfs = this->origRdfs;
-  childState.origWrfs = this->origWrfs;
   childState.originalArg1 = 0;
   childState.originalArg2 = 0;
   childState.originalArg3 = 0;
   childState.originalArg4 = 0;
   childState.originalArg5 = 0;
   childState.originalArg6 = 0;
-  childState.rdfsNotNull = false;
   childState.regSaver = this->regSaver;
   childState.requestedSignalHandler = this->requestedSignalHandler;
   childState.requestedSignalToHandle = this->requestedSignalToHandle;
@@ -73,7 +193,6 @@ state state::forked(pid_t childPid) const {
   childState.timerCreateTimers =
       make_shared<unordered_map<timerID_t, timerInfo>>(
           *(this->timerCreateTimers));
-  childState.totalBytes = this->totalBytes;
   childState.traceePid = childPid;
   childState.userDefinedTimeout = false;
   childState.wait4Blocking = false;
@@ -86,7 +205,17 @@ state state::forked(pid_t childPid) const {
   childState.timerfds =
       make_shared<unordered_map<int, struct itimerspec>>(*(this->timerfds));
   childState.signalfds = make_shared<unordered_set<int>>(*(this->signalfds));
+  childState.unwrittenFds =
+      make_shared<unordered_map<int, ino_t>>(*(this->unwrittenFds));
+  childState.openFiles =
+      make_shared<unordered_map<int, pair<dev_t, ino_t>>>(*(this->openFiles));
+  childState.ioUrings =
+      make_shared<unordered_map<int, shared_ptr<ioUring>>>(*(this->ioUrings));
+  childState.unixSockets =
+      make_shared<unordered_map<int, int>>(*(this->unixSockets));
+  childState.blockedSignals = this->blockedSignals;
   childState.clock = this->clock;
+  childState.timeShim = this->timeShim;
   return childState;
 }
 
@@ -94,11 +223,13 @@ state state::cloned(pid_t childPid) const {
   state childState(childPid, this->debugLevel, this->clock, this->clock_step);
   childState.CPUIDTrapSet = this->CPUIDTrapSet;
   childState.currentSignalHandlers = this->currentSignalHandlers;
+  childState.signalHandlerMasks = this->signalHandlerMasks;
   childState.dirEntries = this->dirEntries;
 
-  childState.exfsNotNull = this->exfsNotNull;
-  childState.rdfsNotNull = this->rdfsNotNull;
-  childState.wrfsNotNull = this->wrfsNotNull;
+  if (this->coldRetry) {
+    childState.coldRetry.reset(new retryState(*this->coldRetry));
+    childState.coldRetry->rdfsNotNull = false;
+  }
 
   childState.fdStatus = this->fdStatus;
 
@@ -109,22 +240,17 @@ state state::cloned(pid_t childPid) const {
   childState.mmapMemory = this->mmapMemory;
   childState.noopSystemCall = false;
   childState.onPreExitEvent = false;
-  childState.origExfs = this->origExfs;
-  childState.origRdfs = this->origRdfs;
-  childState.origWrfs = this->origWrfs;
   childState.originalArg1 = 0;
   childState.originalArg2 = 0;
   childState.originalArg3 = 0;
   childState.originalArg4 = 0;
   childState.originalArg5 = 0;
   childState.originalArg6 = 0;
-  childState.rdfsNotNull = false;
   childState.regSaver = this->regSaver;
   childState.requestedSignalHandler = this->requestedSignalHandler;
   childState.requestedSignalToHandle = this->requestedSignalToHandle;
   childState.signalInjected = false;
   childState.timerCreateTimers = this->timerCreateTimers;
-  childState.totalBytes = this->totalBytes;
   childState.traceePid = childPid;
   childState.userDefinedTimeout = false;
   childState.wait4Blocking = false;
@@ -135,6 +261,13 @@ state state::cloned(pid_t childPid) const {
   childState.remote_sockfds = this->remote_sockfds;
   childState.timerfds = this->timerfds;
   childState.signalfds = this->signalfds;
+  childState.unwrittenFds = this->unwrittenFds;
+  childState.openFiles = this->openFiles;
+  childState.ioUrings = this->ioUrings;
+  childState.unixSockets = this->unixSockets;
+  childState.blockedSignals = this->blockedSignals;
+  childState.sharedPendingSignals = this->sharedPendingSignals;
   childState.clock = this->clock;
+  childState.timeShim = this->timeShim;
   return childState;
 }
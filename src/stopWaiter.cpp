@@ -0,0 +1,63 @@
+#include "stopWaiter.hpp"
+
+#include <sched.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "util.hpp"
+
+using namespace std::chrono;
+
+constexpr nanoseconds stopWaiter::maxSpin;
+
+stopWaiter::stopWaiter(bool spin) {
+  // With a single CPU we would only keep the tracee we wait for from running.
+  cpu_set_t cpus;
+  this->spin = spin && sched_getaffinity(0, sizeof(cpus), &cpus) == 0 &&
+      CPU_COUNT(&cpus) > 1;
+  // Start optimistic, the first stops tell us what to expect.
+  window = this->spin ? maxSpin : nanoseconds::zero();
+}
+
+pid_t stopWaiter::wait(pid_t pid, int* status) {
+  if (!spin) {
+    return doWithCheck(waitpid(pid, status, 0), "waitpid");
+  }
+
+  auto start = clock::now();
+  auto now = start;
+  while (now - start < window) {
+    siginfo_t info;
+    // si_pid stays 0 when there is nothing to report.
+    memset(&info, 0, sizeof(info));
+    doWithCheck(
+        waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT), "waitid");
+    now = clock::now();
+    if (info.si_pid != 0) {
+      spinHits++;
+      spinTime += now - start;
+      observe(now - start);
+      // Reap what we saw, waitid does not give us the ptrace event bits.
+      return doWithCheck(waitpid(pid, status, 0), "waitpid");
+    }
+  }
+
+  spinMisses++;
+  spinTime += now - start;
+  pid_t ret = doWithCheck(waitpid(pid, status, 0), "waitpid");
+  auto end = clock::now();
+  blockedTime += end - now;
+  observe(end - start);
+  return ret;
+}
+
+void stopWaiter::observe(nanoseconds waited) {
+  // Long waits only tell us not to spin, keep them from dominating the
+  // average for long after.
+  waited = std::min(waited, 4 * maxSpin);
+  averageWait += (waited - averageWait) / 8;
+  window = 2 * averageWait;
+  if (window > maxSpin) {
+    window = nanoseconds::zero();
+  }
+}
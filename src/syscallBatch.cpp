@@ -0,0 +1,97 @@
+#include "syscallBatch.hpp"
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "ptracer.hpp"
+#include "util.hpp"
+
+// clang-format off
+/**
+ * r12 points at the table, r13 holds the number of entries:
+ *
+ *   loop: mov rax, [r12]
+ *         mov rdi, [r12 + 0x08]
+ *         mov rsi, [r12 + 0x10]
+ *         mov rdx, [r12 + 0x18]
+ *         mov r10, [r12 + 0x20]
+ *         mov r8,  [r12 + 0x28]
+ *         mov r9,  [r12 + 0x30]
+ *         syscall
+ *         mov [r12 + 0x38], rax
+ *         add r12, 0x40
+ *         dec r13
+ *         jnz loop
+ *         int3
+ */
+static const unsigned char batchLoop[] = {
+  0x49, 0x8b, 0x04, 0x24,
+  0x49, 0x8b, 0x7c, 0x24, 0x08,
+  0x49, 0x8b, 0x74, 0x24, 0x10,
+  0x49, 0x8b, 0x54, 0x24, 0x18,
+  0x4d, 0x8b, 0x54, 0x24, 0x20,
+  0x4d, 0x8b, 0x44, 0x24, 0x28,
+  0x4d, 0x8b, 0x4c, 0x24, 0x30,
+  0x0f, 0x05,
+  0x49, 0x89, 0x44, 0x24, 0x38,
+  0x49, 0x83, 0xc4, 0x40,
+  0x49, 0xff, 0xcd,
+  0x75, 0xce,
+  0xcc,
+};
+// clang-format on
+
+size_t syscallBatch::codeBytes() {
+  return sizeof(batchLoop);
+}
+
+size_t syscallBatch::add(
+    long number,
+    uint64_t arg1,
+    uint64_t arg2,
+    uint64_t arg3,
+    uint64_t arg4,
+    uint64_t arg5,
+    uint64_t arg6) {
+  calls.push_back({(uint64_t)number, {arg1, arg2, arg3, arg4, arg5, arg6}, 0});
+  return calls.size() - 1;
+}
+
+void syscallBatch::run(pid_t pid, int memFd, uint64_t code, uint64_t data) {
+  if (calls.empty()) {
+    return;
+  }
+
+  vector<unsigned char> savedCode(codeBytes());
+  readTraceeMem(memFd, code, savedCode.data(), codeBytes());
+  writeTraceeMem(memFd, code, batchLoop, codeBytes());
+  vector<char> savedData(dataBytes());
+  readTraceeMem(memFd, data, savedData.data(), dataBytes());
+  writeTraceeMem(memFd, data, calls.data(), dataBytes());
+
+  struct user_regs_struct regs;
+  ptracer::doPtrace(PTRACE_GETREGS, pid, 0, &regs);
+  auto oldRegs = regs;
+  regs.rip = code;
+  regs.r12 = data;
+  regs.r13 = calls.size();
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &regs);
+
+  int status;
+  for (;;) {
+    ptracer::doPtrace(PTRACE_CONT, pid, 0, 0);
+    VERIFY(waitpid(pid, &status, 0) == pid);
+    // Calls our seccomp filter traces stop here first, let them through.
+    if (!ptracer::isPtraceEvent(status, PTRACE_EVENT_SECCOMP)) {
+      break;
+    }
+  }
+  VERIFY(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
+
+  readTraceeMem(memFd, data, calls.data(), dataBytes());
+  writeTraceeMem(memFd, data, savedData.data(), dataBytes());
+  writeTraceeMem(memFd, code, savedCode.data(), codeBytes());
+  ptracer::doPtrace(PTRACE_SETREGS, pid, 0, &oldRegs);
+}
@@ -0,0 +1,143 @@
+#include "timeShim.hpp"
+
+#include <string.h>
+
+#include "util.hpp"
+
+/*
+ * Machine code of the shim. Each function sits at a fixed offset from the
+ * start of the page, the calls to tick and tick's accesses to timeShimData
+ * are relative to those offsets. Functions take the vdso arguments and return
+ * like the vdso would.
+ */
+// clang-format off
+
+// at 0x20. clock_gettime(clockid, tp), any clock up to CLOCK_TAI except 10,
+// which does not exist.
+static const unsigned char shimClockGettime[] = {
+    0x48, 0x85, 0xf6                              // test %rsi, %rsi
+  , 0x74, 0x2f                                    // je syscall
+  , 0x83, 0xff, 0x0b                              // cmp $11, %edi
+  , 0x77, 0x2a                                    // ja syscall
+  , 0x83, 0xff, 0x0a                              // cmp $10, %edi
+  , 0x74, 0x25                                    // je syscall
+  , 0xe8, 0xac, 0x00, 0x00, 0x00                  // call tick
+  , 0x72, 0x1e                                    // jc syscall
+  , 0x49, 0x89, 0xf0                              // mov %rsi, %r8
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x49, 0x89, 0x00                              // mov %rax, (%r8)
+  , 0x48, 0x69, 0xd2, 0xe8, 0x03, 0x00, 0x00      // imul $1000, %rdx, %rdx
+  , 0x49, 0x89, 0x50, 0x08                        // mov %rdx, 0x8(%r8)
+  , 0x31, 0xc0                                    // xor %eax, %eax
+  , 0xc3                                          // retq
+  , 0xb8, 0xe4, 0x00, 0x00, 0x00                  // syscall: mov SYS_clock_gettime, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3 };                                       // retq
+
+// at 0x60. gettimeofday(tv, tz), without a timezone.
+static const unsigned char shimGettimeofday[] = {
+    0x48, 0x85, 0xff                              // test %rdi, %rdi
+  , 0x74, 0x20                                    // je syscall
+  , 0x48, 0x85, 0xf6                              // test %rsi, %rsi
+  , 0x75, 0x1b                                    // jne syscall
+  , 0xe8, 0x71, 0x00, 0x00, 0x00                  // call tick
+  , 0x72, 0x14                                    // jc syscall
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x48, 0x89, 0x07                              // mov %rax, (%rdi)
+  , 0x48, 0x89, 0x57, 0x08                        // mov %rdx, 0x8(%rdi)
+  , 0x31, 0xc0                                    // xor %eax, %eax
+  , 0xc3                                          // retq
+  , 0xb8, 0x60, 0x00, 0x00, 0x00                  // syscall: mov SYS_gettimeofday, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3 };                                       // retq
+
+// at 0xa0. time(tloc)
+static const unsigned char shimTime[] = {
+    0xe8, 0x3b, 0x00, 0x00, 0x00                  // call tick
+  , 0x72, 0x13                                    // jc syscall
+  , 0x31, 0xd2                                    // xor %edx, %edx
+  , 0xb9, 0x40, 0x42, 0x0f, 0x00                  // mov $1000000, %ecx
+  , 0x48, 0xf7, 0xf1                              // div %rcx
+  , 0x48, 0x85, 0xff                              // test %rdi, %rdi
+  , 0x74, 0x03                                    // je ret
+  , 0x48, 0x89, 0x07                              // mov %rax, (%rdi)
+  , 0xc3                                          // ret: retq
+  , 0xb8, 0xc9, 0x00, 0x00, 0x00                  // syscall: mov SYS_time, %eax
+  , 0x0f, 0x05                                    // syscall
+  , 0xc3 };                                       // retq
+
+// at 0xe0. Returns the time in %rax and advances the clock, or sets the carry
+// flag when this call has to trap.
+static const unsigned char shimTick[] = {
+    0x8b, 0x0d, 0x2a, 0xff, 0xff, 0xff            // mov calls(%rip), %ecx
+  , 0xff, 0xc1                                    // inc %ecx
+  , 0x3b, 0x0d, 0x26, 0xff, 0xff, 0xff            // cmp trapEvery(%rip), %ecx
+  , 0x73, 0x20                                    // jae trap
+  , 0x89, 0x0d, 0x1a, 0xff, 0xff, 0xff            // mov %ecx, calls(%rip)
+  , 0x48, 0x8b, 0x05, 0x03, 0xff, 0xff, 0xff      // mov clock(%rip), %rax
+  , 0x48, 0x8b, 0x0d, 0x04, 0xff, 0xff, 0xff      // mov step(%rip), %rcx
+  , 0x48, 0x01, 0xc1                              // add %rax, %rcx
+  , 0x48, 0x89, 0x0d, 0xf2, 0xfe, 0xff, 0xff      // mov %rcx, clock(%rip)
+  , 0xf8                                          // clc
+  , 0xc3                                          // retq
+  , 0xf9                                          // trap: stc
+  , 0xc3 };                                       // retq
+
+// movabs $entry, %r11; jmp *%r11
+static const unsigned char shimStub[timeShimStubSize] = {
+    0x49, 0xbb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+  , 0x41, 0xff, 0xe3
+  , 0xcc, 0xcc, 0xcc };
+// clang-format on
+
+static_assert(
+    sizeof(timeShimData) <= 0x20, "timeShimData overlaps the shim's code");
+
+static const struct {
+  unsigned long offset;
+  const unsigned char* code;
+  size_t size;
+} shimFunctions[] = {
+    {0x20, shimClockGettime, sizeof(shimClockGettime)},
+    {0x60, shimGettimeofday, sizeof(shimGettimeofday)},
+    {0xa0, shimTime, sizeof(shimTime)},
+    {0xe0, shimTick, sizeof(shimTick)},
+};
+
+std::vector<unsigned char> timeShimImage(int64_t clock, int64_t step) {
+  // tick comes last.
+  std::vector<unsigned char> image(0xe0 + sizeof(shimTick), 0xcc);
+  timeShimData data;
+  memset(&data, 0, sizeof(data));
+  data.clock = clock;
+  data.step = step;
+  data.trapEvery = timeShimTrapEvery;
+  memcpy(image.data(), &data, sizeof(data));
+  for (const auto& f : shimFunctions) {
+    VERIFY(f.offset + f.size <= image.size() && image.size() <= timeShimSize);
+    memcpy(&image[f.offset], f.code, f.size);
+  }
+  return image;
+}
+
+unsigned long timeShimEntry(enum VDSOFunc func) {
+  switch (func) {
+  case VDSO_clock_gettime:
+    return 0x20;
+  case VDSO_gettimeofday:
+    return 0x60;
+  case VDSO_time:
+    return 0xa0;
+  default:
+    return 0;
+  }
+}
+
+void writeTimeShimStub(unsigned char* code, uint64_t entry) {
+  memcpy(code, shimStub, sizeof(shimStub));
+  memcpy(code + 2, &entry, sizeof(entry));
+}
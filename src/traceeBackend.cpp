@@ -0,0 +1,24 @@
+#include "traceeBackend.hpp"
+
+#include <sys/uio.h>
+
+traceeBackend* activeTraceeBackend = nullptr;
+
+long kernelTracee::ptraceRequest(
+    enum __ptrace_request request, pid_t pid, void* addr, void* data) {
+  return ptrace(request, pid, addr, data);
+}
+
+ssize_t kernelTracee::readMemory(
+    pid_t pid, uint64_t traceeMemory, void* localMemory, size_t bytes) {
+  iovec remoteIoVec = {(void*)traceeMemory, bytes};
+  iovec localIoVec = {localMemory, bytes};
+  return process_vm_readv(pid, &localIoVec, 1, &remoteIoVec, 1, 0);
+}
+
+ssize_t kernelTracee::writeMemory(
+    pid_t pid, uint64_t traceeMemory, const void* localMemory, size_t bytes) {
+  iovec remoteIoVec = {(void*)traceeMemory, bytes};
+  iovec localIoVec = {(void*)localMemory, bytes};
+  return process_vm_writev(pid, &localIoVec, 1, &remoteIoVec, 1, 0);
+}
@@ -1,8 +1,10 @@
 #include <err.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <fstream>
 #include <iostream>
 
 #include "util.hpp"
@@ -89,6 +91,45 @@ void sysError(const char* context) {
 
 /*======================================================================================*/
 
+int openTraceeMem(pid_t traceePid) {
+  string path = "/proc/" + to_string(traceePid) + "/mem";
+  return doWithCheck(
+      open(path.c_str(), O_RDWR | O_CLOEXEC), "openTraceeMem: open");
+}
+
+pid_t namespacePid(pid_t pid) {
+  hostTraceeQuery(pid);
+  string path = "/proc/" + to_string(pid) + "/status";
+  ifstream status(path);
+  string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 6, "NSpid:") == 0) {
+      size_t last = line.find_last_of(" \t");
+      return stoi(line.substr(last + 1));
+    }
+  }
+  return pid;
+}
+
+void readTraceeMem(
+    int memFd, uint64_t traceeMemory, void* localMemory, size_t numberOfBytes) {
+  ssize_t n = pread(memFd, localMemory, numberOfBytes, (off_t)traceeMemory);
+  if (n != (ssize_t)numberOfBytes) {
+    sysError("readTraceeMem: short read from /proc/<pid>/mem");
+  }
+}
+
+void writeTraceeMem(
+    int memFd,
+    uint64_t traceeMemory,
+    const void* localMemory,
+    size_t numberOfBytes) {
+  ssize_t n = pwrite(memFd, localMemory, numberOfBytes, (off_t)traceeMemory);
+  if (n != (ssize_t)numberOfBytes) {
+    sysError("writeTraceeMem: short write to /proc/<pid>/mem");
+  }
+}
+
 void throw_runtime_error_if_fail(
     bool cond,
     int os_errno,
@@ -1,5 +1,6 @@
 #include "utilSystemCalls.hpp"
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <sstream>
 
@@ -23,6 +24,48 @@ bool preemptIfBlocked(
   }
 }
 
+// =======================================================================================
+void countBlockedReplay(globalState& gs, state& s) {
+  gs.replayDueToBlocking++;
+  s.blockedReplays++;
+}
+// =======================================================================================
+void signalSent(
+    globalState& gs,
+    scheduler& sched,
+    pid_t pid,
+    int signum,
+    bool toThreadGroup) {
+  if (gs.states == nullptr) {
+    return;
+  }
+  if (!toThreadGroup) {
+    state* target = gs.states->find(pid);
+    if (target != nullptr) {
+      target->queueSignal(signum, false);
+      sched.wake(pid);
+    }
+    return;
+  }
+
+  // The kernel hands it to any thread not blocking it, so it only stays
+  // pending if every thread does. We don't know which thread gets it: wake
+  // them all.
+  state* member = nullptr;
+  bool blocked = true;
+  auto threads = gs.threadGroups.equal_range(pid);
+  for (auto it = threads.first; it != threads.second; ++it) {
+    state* thread = gs.states->find(it->second);
+    if (thread != nullptr) {
+      member = thread;
+      blocked = blocked && (thread->blockedSignals & state::signalBit(signum));
+      sched.wake(it->second);
+    }
+  }
+  if (member != nullptr && blocked) {
+    member->queueSignal(signum, true);
+  }
+}
 // =======================================================================================
 bool replaySyscallIfBlocked(
     globalState& gs,
@@ -34,7 +77,7 @@ bool replaySyscallIfBlocked(
     gs.log.writeToLog(
         Importance::info, "System call would have blocked! Replaying\n");
 
-    gs.replayDueToBlocking++;
+    countBlockedReplay(gs, s);
     sched.preemptAndScheduleNext();
     replaySystemCall(gs, t, t.getSystemCallNumber());
     return true;
@@ -80,6 +123,32 @@ void zeroOutStatfs(struct statfs& stats) {
   stats.f_flags = 1; /* Mount flags of filesystem */
 }
 // =======================================================================================
+// Path the stat family call named its file by, see inodePathFor().
+static string statInodePath(
+    globalState& gs, state& s, ptracer& t, const string& syscallName) {
+  if (!gs.inodeMap.pathDerived()) {
+    return "";
+  }
+  if (syscallName == "fstat") {
+    return inodePathFor(gs, s.traceePid, (int)t.arg1());
+  }
+  bool at = syscallName == "newfstatat";
+  bool follow = syscallName == "stat" ||
+                (at && ((int)t.arg4() & AT_SYMLINK_NOFOLLOW) == 0);
+  char* path = (char*)(at ? t.arg2() : t.arg1());
+  if (path == nullptr) {
+    return "";
+  }
+  string strPath = t.readTraceeCString(traceePtr<char>(path), s.traceePid);
+  if (strPath.empty()) {
+    // AT_EMPTY_PATH, the file is the dirfd itself.
+    return at && (int)t.arg1() >= 0 ? inodePathFor(gs, s.traceePid, t.arg1())
+                                    : "";
+  }
+  return inode_path_from_tracee(
+      gs, strPath, s.traceePid, at ? t.arg1() : -1, follow);
+}
+
 void handleStatFamily(
     globalState& gs, state& s, ptracer& t, string syscallName) {
   struct stat* statPtr;
@@ -113,32 +182,30 @@ void handleStatFamily(
         Importance::extra, "(device,realinode) = (%lu,%lu)\n", theirStat.st_dev,
         realinode);
     // Use inode to check if we created this file during our run.
-    const auto mtime = get_with_default(gs.mtimeMap, realinode, gs.epoch);
+    const auto* knownMtime = gs.mtimeMap.find(realinode);
+    const auto mtime = knownMtime != nullptr ? *knownMtime : gs.epoch;
 
     gs.log.writeToLog(
         Importance::extra, " realinode in mtimeMap %d, resulting mtime: %d\n",
-        gs.mtimeMap.find(realinode) != gs.mtimeMap.end(), mtime);
+        knownMtime != nullptr, mtime);
 
     /* Time of last access */
     myStat.st_atim = logical_clock::to_timespec(gs.epoch);
     /* Time of last status change */
     myStat.st_ctim = logical_clock::to_timespec(gs.epoch);
     /* Time of last modification */
+    // Keep the sub-second part: modifications are only a clock step apart.
     myStat.st_mtim = logical_clock::to_timespec(mtime);
 
-    // TODO: I suspect there is some remaining bug related to #263.
-    // Perhaps it has to do with all the conversions between time formats.
-    // However, I don't think we really need nanosecond granularity for stat
-    // results, so returning a constant here:
-    myStat.st_mtim.tv_nsec = 999;
-
     // TODO: I'm surprised this doesn't break things. I guess so far, we have
     // only used single device filesystems.
     myStat.st_dev = 1; /* ID of device containing file */
 
-    myStat.st_ino = gs.inodeMap.realValueExists(realinode)
-                        ? gs.inodeMap.getVirtualValue(realinode)
-                        : gs.inodeMap.addRealValue(realinode);
+    myStat.st_ino =
+        gs.inodeMap.realValueExists(realinode)
+            ? gs.inodeMap.getVirtualValue(realinode)
+            : gs.inodeMap.addRealValue(
+                  realinode, statInodePath(gs, s, t, syscallName));
 
     // st_mode holds the permissions to the file. If we zero it out libc
     // functions will think we don't have access to this file. Hence we keep our
@@ -200,6 +267,19 @@ void injectPause(globalState& gs, state& s, ptracer& t) {
   replaySystemCall(gs, t, SYS_pause);
 }
 // =======================================================================================
+void cpuidTrapResult(globalState& gs, state& s, long ret) {
+  // arch_prctl could return ENODEV when `cpuid_fault` flag is absent (cpuinfo).
+  if (0 != ret) {
+    string errmsg("cpuid interception (cpuid_fault) via arch_prctl failed: ");
+    errmsg += strerror(-ret);
+    errmsg += "\nPlease check `cpuid_fault` flag from `cat /proc/cpuinfo`";
+    gs.log.writeToLog(Importance::inter, errmsg);
+    gs.allow_trapCPUID = false;
+  } else {
+    s.CPUIDTrapSet = true;
+  }
+}
+// =======================================================================================
 void replaceSystemCallWithNoop(globalState& gs, state& s, ptracer& t) {
   t.changeSystemCall(SYS_time);
   gs.log.writeToLog(Importance::info, "Turning this system call into a NOOP\n");
@@ -291,6 +371,105 @@ bool tracee_file_exists(
   return false;
 }
 // =======================================================================================
+bool lstat_from_tracee(
+    const string& traceePath,
+    pid_t traceePid,
+    logger& log,
+    int traceeDirFd,
+    struct stat& statbuf) {
+  string resolvedPath =
+      resolve_tracee_path(traceePath, traceePid, log, traceeDirFd);
+  if (resolvedPath.empty()) {
+    return false;
+  }
+  return lstat(resolvedPath.c_str(), &statbuf) == 0;
+}
+// =======================================================================================
+bool inode_open_by_tracees(globalState& gs, ino_t inode, dev_t device) {
+  return gs.openInodes.count({device, inode}) != 0;
+}
+// =======================================================================================
+static void uncountOpenFile(globalState& gs, pair<dev_t, ino_t> file) {
+  auto it = gs.openInodes.find(file);
+  if (it != gs.openInodes.end() && --it->second == 0) {
+    gs.openInodes.erase(it);
+  }
+}
+
+static void trackOpenFile(
+    globalState& gs, state& s, int fd, pair<dev_t, ino_t> file) {
+  fileClosed(gs, s, fd);
+  (*s.openFiles)[fd] = file;
+  gs.openInodes[file]++;
+}
+
+void fileOpened(globalState& gs, state& s, int fd) {
+  hostTraceeQuery(s.traceePid);
+  string path = "/proc/" + to_string(s.traceePid) +
+                (fd == AT_FDCWD ? "/cwd" : "/fd/" + to_string(fd));
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    fileClosed(gs, s, fd);
+    return;
+  }
+  trackOpenFile(gs, s, fd, {st.st_dev, st.st_ino});
+}
+
+void fileClosed(globalState& gs, state& s, int fd) {
+  auto it = s.openFiles->find(fd);
+  if (it == s.openFiles->end()) {
+    return;
+  }
+  uncountOpenFile(gs, it->second);
+  s.openFiles->erase(it);
+}
+
+void copyOpenFile(globalState& gs, state& s, int fd, int newfd) {
+  // dup2(fd, fd) does nothing.
+  if (fd == newfd) {
+    return;
+  }
+  auto it = s.openFiles->find(fd);
+  if (it == s.openFiles->end()) {
+    fileClosed(gs, s, newfd);
+    return;
+  }
+  trackOpenFile(gs, s, newfd, it->second);
+}
+
+void openFilesInherited(globalState& gs, state& s) {
+  for (const auto& file : *s.openFiles) {
+    gs.openInodes[file.second]++;
+  }
+}
+
+void openFilesReleased(globalState& gs, state& s) {
+  for (const auto& file : *s.openFiles) {
+    uncountOpenFile(gs, file.second);
+  }
+  s.openFiles->clear();
+}
+
+void scanOpenFiles(globalState& gs, state& s) {
+  openFilesReleased(gs, s);
+  fileOpened(gs, s, AT_FDCWD);
+
+  hostTraceeQuery(s.traceePid);
+  string fdDir = "/proc/" + to_string(s.traceePid) + "/fd";
+  DIR* fds = opendir(fdDir.c_str());
+  if (fds == nullptr) {
+    return;
+  }
+  while (struct dirent* entry = readdir(fds)) {
+    struct stat st;
+    if (entry->d_name[0] != '.' &&
+        fstatat(dirfd(fds), entry->d_name, &st, 0) == 0) {
+      trackOpenFile(gs, s, atoi(entry->d_name), {st.st_dev, st.st_ino});
+    }
+  }
+  closedir(fds);
+}
+// =======================================================================================
 ino_t inode_from_tracee(
     const string& traceePath, pid_t traceePid, logger& log, int traceeDirFd) {
   // Create full absolute path in the hostOS file system.
@@ -330,6 +509,7 @@ ino_t inode_from_tracee(
 }
 // =======================================================================================
 ino_t readInodeFor(logger& log, pid_t traceePid, int fd) {
+  hostTraceeQuery(traceePid);
   std::ostringstream ss;
   // read from /proc/$pid/fd/$fd
   ss << "/proc/" << traceePid << "/fd/" << fd;
@@ -353,6 +533,95 @@ ino_t readInodeFor(logger& log, pid_t traceePid, int fd) {
   return statbuf.st_ino;
 }
 // =======================================================================================
+// Target of a /proc symlink, empty if we cannot read it.
+static string readProcLink(const string& link) {
+  char pathbuf[PATH_MAX + 1] = {0};
+  if (readlink(link.c_str(), pathbuf, PATH_MAX) < 0) {
+    return "";
+  }
+  return pathbuf;
+}
+
+// Turn a canonical path on the host into one relative to the tracee's root,
+// so the identity of a file does not depend on where the chroot lives.
+static string withoutTraceeRoot(const string& hostPath, pid_t traceePid) {
+  string root = readProcLink("/proc/" + to_string(traceePid) + "/root");
+  if (root.empty() || root == "/") {
+    return hostPath;
+  }
+  if (hostPath == root) {
+    return "/";
+  }
+  if (hostPath.compare(0, root.size(), root) == 0 &&
+      hostPath[root.size()] == '/') {
+    return hostPath.substr(root.size());
+  }
+  return hostPath;
+}
+
+string inodePathFor(globalState& gs, pid_t traceePid, int fd) {
+  if (!gs.inodeMap.pathDerived()) {
+    return "";
+  }
+  hostTraceeQuery(traceePid);
+  string path = readProcLink(
+      "/proc/" + to_string(traceePid) + "/fd/" + to_string(fd));
+  // Anonymous files (pipes, sockets, O_TMPFILE) and deleted files are not
+  // reachable through a path, their names may even contain the real inode.
+  const string deleted = " (deleted)";
+  if (path.empty() || path[0] != '/' ||
+      (path.size() > deleted.size() &&
+       path.compare(path.size() - deleted.size(), deleted.size(), deleted) ==
+           0)) {
+    return "";
+  }
+  return withoutTraceeRoot(path, traceePid);
+}
+
+string inode_path_from_tracee(
+    globalState& gs,
+    const string& traceePath,
+    pid_t traceePid,
+    int traceeDirFd,
+    bool followLast) {
+  if (!gs.inodeMap.pathDerived() || traceePath.empty()) {
+    return "";
+  }
+  string resolved =
+      resolve_tracee_path(traceePath, traceePid, gs.log, traceeDirFd);
+  char canonical[PATH_MAX + 1] = {0};
+  if (followLast) {
+    // The call named the file a final symlink points to, use its own name.
+    if (realpath(resolved.c_str(), canonical) == nullptr) {
+      return "";
+    }
+    return withoutTraceeRoot(canonical, traceePid);
+  }
+  while (resolved.size() > 1 && resolved.back() == '/') {
+    resolved.pop_back();
+  }
+
+  // Canonicalize the parent directory only, the file itself may be a symlink.
+  size_t slash = resolved.rfind('/');
+  if (slash == string::npos) {
+    return "";
+  }
+  string dir = resolved.substr(0, slash);
+  string name = resolved.substr(slash + 1);
+  if (name == "." || name == "..") {
+    dir = resolved;
+    name = "";
+  }
+  if (realpath(dir.empty() ? "/" : dir.c_str(), canonical) == nullptr) {
+    return "";
+  }
+  string path = canonical;
+  if (!name.empty()) {
+    path += (path == "/" ? "" : "/") + name;
+  }
+  return withoutTraceeRoot(path, traceePid);
+}
+// =======================================================================================
 bool sendTraceeSignalNow(
     int signum, globalState& gs, state& s, ptracer& t, scheduler& sched) {
   enum sighandler_type sh = SIGHANDLER_DEFAULT;
@@ -379,6 +648,7 @@ bool sendTraceeSignalNow(
           "sending myself signal " + to_string(signum) +
           " failed, tgkill returned " + to_string(retVal));
     }
+    s.queueSignal(signum, false);
     return true; // run pause post-hook
   }
 
@@ -398,6 +668,7 @@ bool sendTraceeSignalNow(
           "sending myself signal " + to_string(signum) +
           " failed, tgkill returned " + to_string(retVal));
     }
+    s.queueSignal(signum, false);
     return true; // run pause post-hook
   }
 
@@ -444,6 +715,7 @@ string resolve_tracee_path(
   if (traceeDirFd < -1 && traceeDirFd != AT_FDCWD) {
     runtimeError("Negative dirfd given to resolve_tracee_path.");
   }
+  hostTraceeQuery(traceePid);
 
   string prefixProcFd;
   // is absolute path:
@@ -483,6 +755,27 @@ string resolve_tracee_path(
   return res;
 }
 // =======================================================================================
+bool tryReadTraceePath(pid_t pid, uint64_t path, string& result) {
+  const uint64_t pageSize = 4096;
+  char buffer[pageSize];
+  result.clear();
+  while (result.size() <= PATH_MAX) {
+    size_t bytes = pageSize - path % pageSize;
+    ssize_t read =
+        readVmTraceeRaw(traceePtr<char>((char*)path), buffer, bytes, pid);
+    if (read <= 0) {
+      return false;
+    }
+    size_t length = strnlen(buffer, read);
+    result.append(buffer, length);
+    if (length < (size_t)read) {
+      return true;
+    }
+    path += read;
+  }
+  return false;
+}
+// =======================================================================================
 void handlePreOpens(
     globalState& gs,
     state& s,
@@ -605,21 +898,48 @@ Linux acghaswellcat16 4.15.0-43-generic #46-Ubuntu SMP Thu Dec 6 14:45:28 UTC
 // =======================================================================================
 void handlePostOpens(globalState& gs, state& s, ptracer& t, int flags) {
   gs.log.writeToLog(Importance::info, "Flags: 0x%x\n", flags);
-  if (t.getReturnValue() >= 0 &&
-      // New regular file created through O_CREAT
-      ((((flags & O_CREAT) == O_CREAT) && !s.fileExisted) ||
-       // Special case for O_TMPFILE, always consider the file to be
-       // newly-created
-       ((flags & O_TMPFILE) == O_TMPFILE))) {
+  int fd = t.getReturnValue();
+  bool created = fd >= 0 &&
+                 // New regular file created through O_CREAT
+                 ((((flags & O_CREAT) == O_CREAT) && !s.fileExisted) ||
+                  // Special case for O_TMPFILE, always consider the file to be
+                  // newly-created
+                  ((flags & O_TMPFILE) == O_TMPFILE));
+  if (created) {
     gs.log.writeToLog(Importance::info, "A new file was created\n!");
     // Use fd to get inode.
-    auto inode = readInodeFor(gs.log, s.traceePid, t.getReturnValue());
-    gs.mtimeMap[inode] = s.getLogicalTime();
-    gs.inodeMap.addRealValue(inode);
+    auto inode = readInodeFor(gs.log, s.traceePid, fd);
+    gs.setMtime(inode, s, false);
+    gs.inodeMap.addRealValue(inode, inodePathFor(gs, s.traceePid, fd));
     s.incrementTime();
   }
+
+  // Opened for writing: the first write through this fd modifies the file.
+  if (fd >= 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    auto inode = readInodeFor(gs.log, s.traceePid, fd);
+    (*s.unwrittenFds)[fd] = inode;
+    if ((flags & O_TRUNC) == O_TRUNC && !created) {
+      gs.log.writeToLog(Importance::info, "Existing file truncated.\n");
+      gs.setMtime(inode, s, true);
+    }
+  } else if (fd >= 0) {
+    s.unwrittenFds->erase(fd);
+  }
+  if (fd >= 0) {
+    fileOpened(gs, s, fd);
+  }
   s.fileExisted = false;
   gs.log.writeToLog(
       Importance::info, "File descriptor: %d\n", t.getReturnValue());
 }
 // =======================================================================================
+// =======================================================================================
+void noteFdWritten(globalState& gs, state& s, int fd) {
+  auto it = s.unwrittenFds->find(fd);
+  if (it == s.unwrittenFds->end()) {
+    return;
+  }
+  gs.log.writeToLog(Importance::info, "First write through fd %d.\n", fd);
+  gs.setMtime(it->second, s, true);
+  s.unwrittenFds->erase(it);
+}
@@ -72,6 +72,14 @@ static const unsigned char __vdso_gettimeofday[] = {
   , 0xc3                                         // retq
   , 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00     // nopl 0x0(%rax, %rax, 1)
   , 0x00 };
+
+// Fails with ENOSYS, so libc falls back to the getrandom system call, which we
+// intercept. The real one draws from the kernel's entropy pool.
+static const unsigned char __vdso_getrandom[] = {
+    0x48, 0xc7, 0xc0, 0xda, 0xff, 0xff, 0xff     // mov $-ENOSYS, %rax
+  , 0xc3                                         // retq
+  , 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00     // nopl 0x0(%rax, %rax, 1)
+  , 0x00 };
 // clang-format on
 
 /*
@@ -177,6 +185,8 @@ static const char* vdsoGetFuncNames(enum VDSOFunc func) {
     return "__vdso_gettimeofday";
   case VDSO_time:
     return "__vdso_time";
+  case VDSO_getrandom:
+    return "__vdso_getrandom";
     // no default let the compiler do exhaustive check
   }
 }
@@ -251,6 +261,34 @@ int proc_get_vdso_vvar(
   return 0;
 }
 
+/// read one entry of /proc/<pid>/auxv.
+/// returns 0 if there is no such entry.
+unsigned long proc_get_auxv_entry(pid_t pid, unsigned long type) {
+  char auxvFile[32];
+  // Pairs of (type, value), ending with AT_NULL. Linux has about 30 types.
+  Elf64_auxv_t auxv[64];
+  snprintf(auxvFile, 32, "/proc/%d/auxv", pid);
+
+  int fd = open(auxvFile, O_RDONLY);
+  VERIFY(fd >= 0);
+  long nb;
+  do {
+    nb = read(fd, auxv, sizeof(auxv));
+  } while (nb < 0 && errno == EINTR);
+  VERIFY(nb >= 0);
+  VERIFY(close(fd) == 0);
+
+  for (long i = 0; i < nb / (long)sizeof(auxv[0]); i++) {
+    if (auxv[i].a_type == AT_NULL) {
+      break;
+    }
+    if (auxv[i].a_type == type) {
+      return auxv[i].a_un.a_val;
+    }
+  }
+  return 0;
+}
+
 /// get vdso symbols from vdso
 /// returns number of vdso functions found.
 int proc_get_vdso_symbols(
@@ -299,6 +337,10 @@ int proc_get_vdso_symbols(
         vdso[res].func = VDSO_time;
         vdso[res].code_size = sizeof(__vdso_time);
         vdso[res].code = (const unsigned char*)__vdso_time;
+      } else if (strcmp("__vdso_getrandom", name) == 0) {
+        vdso[res].func = VDSO_getrandom;
+        vdso[res].code_size = sizeof(__vdso_getrandom);
+        vdso[res].code = (const unsigned char*)__vdso_getrandom;
       } else {
         continue;
       }
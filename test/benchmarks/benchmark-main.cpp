@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include "benchmark.hpp"
+
+/**
+ * Microbenchmarks for the tracer's own data structures and handlers, run
+ * against synthetic inputs. No tracee is involved.
+ *
+ * Usage: ./benchmarks [FILTER]
+ * Only benchmarks whose name contains FILTER run.
+ */
+
+uint64_t allocations = 0;
+std::string benchmarkFilter;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size != 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t size) noexcept { free(p); }
+
+void report(const std::string& name, double nsPerOp, double allocationsPerOp) {
+  printf("%-48s %12.1f ns/op %10.2f allocs/op\n", name.c_str(), nsPerOp,
+         allocationsPerOp);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    benchmarkFilter = argv[1];
+  }
+  dataStructureBenchmarks();
+  handlerBenchmarks();
+  return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * Heap allocations so far, counted by our replacement operator new.
+ */
+extern uint64_t allocations;
+
+/**
+ * Only benchmarks whose name contains this run. Empty runs everything.
+ */
+extern std::string benchmarkFilter;
+
+/**
+ * Print one result line.
+ */
+void report(
+    const std::string& name, double nsPerOp, double allocationsPerOp);
+
+/**
+ * Time run(), which does ops operations, and report ns/op and
+ * allocations/op. run() is called once to warm up, then repeatedly until
+ * a fifth of a second has passed.
+ */
+template <typename F>
+void benchmark(const std::string& name, uint64_t ops, F run) {
+  if (name.find(benchmarkFilter) == std::string::npos) {
+    return;
+  }
+  run();
+
+  using clock = std::chrono::steady_clock;
+  uint64_t rounds = 0;
+  uint64_t allocationsBefore = allocations;
+  auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  do {
+    run();
+    rounds++;
+    elapsed = clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(200));
+
+  double totalOps = (double)rounds * ops;
+  double ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  report(name, ns / totalOps, (allocations - allocationsBefore) / totalOps);
+}
+
+/**
+ * Raw getdents output for count files with made up names and inodes, in
+ * readdir order, i.e. not sorted.
+ */
+template <typename T>
+std::vector<uint8_t> syntheticDirents(size_t count) {
+  std::vector<uint8_t> raw;
+  for (size_t i = 0; i < count; i++) {
+    // Scramble the order so sorting has some work to do.
+    std::string name = "file-" + std::to_string((i * 7919) % count) + ".o";
+    size_t size = (sizeof(T) + name.size() + 1 + 7) & ~(size_t)7;
+    size_t offset = raw.size();
+    raw.resize(offset + size);
+    T* entry = (T*)&raw[offset];
+    entry->d_ino = 1000000 + i * 13;
+    entry->d_reclen = size;
+    strcpy(entry->d_name, name.c_str());
+  }
+  return raw;
+}
+
+void dataStructureBenchmarks();
+void handlerBenchmarks();
+
+#endif
@@ -0,0 +1,129 @@
+#include <string>
+#include <vector>
+
+#include "../../include/ValueMapper.hpp"
+#include "../../include/directoryEntries.hpp"
+#include "../../include/inodeMapper.hpp"
+#include "../../include/logger.hpp"
+#include "../../include/scheduler.hpp"
+#include "benchmark.hpp"
+
+static void valueMapperBenchmarks(logger& log) {
+  const uint64_t n = 100000;
+
+  benchmark("ValueMapper addRealValue 100k", n, [&]() {
+    ValueMapper<ino_t, ino_t> map{log, "inode map", 1};
+    for (ino_t real = 0; real < n; real++) {
+      map.addRealValue(real * 31);
+    }
+  });
+
+  ValueMapper<ino_t, ino_t> map{log, "inode map", 1};
+  for (ino_t real = 0; real < n; real++) {
+    map.addRealValue(real * 31);
+  }
+  benchmark("ValueMapper getVirtualValue 100k", n, [&]() {
+    for (ino_t real = 0; real < n; real++) {
+      map.getVirtualValue(real * 31);
+    }
+  });
+  benchmark("ValueMapper realValueExists miss 100k", n, [&]() {
+    for (ino_t real = 0; real < n; real++) {
+      map.realValueExists(real * 31 + 1);
+    }
+  });
+
+  std::vector<std::string> paths;
+  for (ino_t real = 0; real < n; real++) {
+    paths.push_back("/build/src/dir" + std::to_string(real / 100) + "/file" +
+                    std::to_string(real) + ".o");
+  }
+  benchmark("inodeMapper path addRealValue 100k", n, [&]() {
+    inodeMapper pathMap{log, true};
+    for (ino_t real = 0; real < n; real++) {
+      pathMap.addRealValue(real * 31, paths[real]);
+    }
+  });
+}
+
+static void directoryEntriesBenchmarks(logger& log) {
+  for (size_t count : {10000, 100000}) {
+    std::vector<uint8_t> raw = syntheticDirents<linux_dirent>(count);
+    std::string suffix = " " + std::to_string(count / 1000) + "k";
+
+    // Fill the way handleDents does: one chunk per 32KB getdents call, then
+    // hand everything back in buffers of that size.
+    benchmark("directoryEntries add+sort+fill" + suffix, count, [&]() {
+      directoryEntries<linux_dirent> entries{log};
+      for (size_t offset = 0; offset < raw.size();) {
+        size_t end = offset;
+        while (end < raw.size() &&
+               end + ((linux_dirent*)&raw[end])->d_reclen - offset <= 32768) {
+          end += ((linux_dirent*)&raw[end])->d_reclen;
+        }
+        entries.addChunk({raw.begin() + offset, raw.begin() + end});
+        offset = end;
+      }
+      while (!entries.getSortedEntries(32768).empty()) {
+      }
+    });
+  }
+}
+
+static void schedulerBenchmarks(logger& log) {
+  for (pid_t count : {100, 1000}) {
+    std::string suffix = " " + std::to_string(count);
+
+    // Spawn count processes, let each block once, then let them all exit.
+    benchmark("scheduler spawn+preempt+exit" + suffix, count, [&]() {
+      scheduler sched{1, log};
+      for (pid_t pid = 2; pid <= count; pid++) {
+        sched.addAndScheduleNext(pid);
+      }
+      for (pid_t i = 1; i <= count; i++) {
+        sched.preemptAndScheduleNext();
+      }
+      for (pid_t pid = 1; pid <= count; pid++) {
+        sched.removeAndScheduleNext(pid);
+      }
+    });
+  }
+
+  // A single process yielding, e.g. on every time call.
+  scheduler alone{1, log};
+  benchmark("scheduler preempt alone", 1000, [&]() {
+    for (int i = 0; i < 1000; i++) {
+      alone.preemptAndScheduleNext();
+    }
+  });
+}
+
+static void loggerBenchmarks() {
+  // Messages below the debug level are dropped, the common case.
+  logger quiet{"/dev/null", 0};
+  benchmark("logger writeToLog filtered", 100000, [&]() {
+    for (int i = 0; i < 100000; i++) {
+      quiet.writeToLog(Importance::info, "read(%d, %lu)\n", i, 4096ul);
+    }
+  });
+
+  logger verbose{"/dev/null", 5, false};
+  const Importance levels[] = {
+      Importance::inter, Importance::info, Importance::extra};
+  const char* names[] = {"inter", "info", "extra"};
+  for (int l = 0; l < 3; l++) {
+    benchmark(std::string("logger writeToLog ") + names[l], 10000, [&]() {
+      for (int i = 0; i < 10000; i++) {
+        verbose.writeToLog(levels[l], "read(%d, %lu)\n", i, 4096ul);
+      }
+    });
+  }
+}
+
+void dataStructureBenchmarks() {
+  logger log{"/dev/null", 0};
+  valueMapperBenchmarks(log);
+  directoryEntriesBenchmarks(log);
+  schedulerBenchmarks(log);
+  loggerBenchmarks();
+}
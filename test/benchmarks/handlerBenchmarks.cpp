@@ -0,0 +1,79 @@
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+
+#include <vector>
+
+#include "../../include/dettraceSystemCall.hpp"
+#include "../../include/globalState.hpp"
+#include "../../include/handlerTrace.hpp"
+#include "../../include/logger.hpp"
+#include "../../include/ptracer.hpp"
+#include "../../include/state.hpp"
+#include "../../include/utilSystemCalls.hpp"
+#include "benchmark.hpp"
+
+/**
+ * Handlers run against an offlineTracee, a tracee that only exists in our
+ * memory, so nothing reaches the kernel.
+ */
+
+static void statBenchmarks(globalState& gs) {
+  const size_t files = 1000;
+  struct stat real;
+  stat("/", &real);
+  std::vector<struct stat> originals(files, real);
+  for (size_t i = 0; i < files; i++) {
+    originals[i].st_ino = 5000000 + i * 17;
+  }
+
+  const uint64_t buf = 0x10000;
+  offlineTracee tracee;
+  memset(&tracee.regs, 0, sizeof(tracee.regs));
+  tracee.regs.orig_rax = SYS_stat;
+  tracee.regs.rsi = buf;
+  tracee.regs.rax = 0;
+  ptracer t{1, tracee.regs};
+  state s{1, 0, gs.epoch, chrono::microseconds(1)};
+
+  activeTraceeBackend = &tracee;
+
+  // Half the lookups are for inodes seen before, like a build re-statting
+  // its inputs.
+  benchmark("handleStatFamily stat", 2 * files, [&]() {
+    for (int round = 0; round < 2; round++) {
+      for (size_t i = 0; i < files; i++) {
+        tracee.memory.store(buf, &originals[i], sizeof(struct stat));
+        handleStatFamily(gs, s, t, "stat");
+      }
+    }
+  });
+  activeTraceeBackend = nullptr;
+}
+
+static void direntBenchmarks(logger& log) {
+  for (size_t count : {10000, 100000}) {
+    std::vector<uint8_t> raw = syntheticDirents<linux_dirent>(count);
+
+    benchmark(
+        "virtualizeEntries " + std::to_string(count / 1000) + "k", count,
+        [&]() {
+          inodeMapper inodeMap{log};
+          std::vector<uint8_t> copy = raw;
+          virtualizeEntries<linux_dirent>(copy, inodeMap);
+        });
+  }
+}
+
+void handlerBenchmarks() {
+  logger log{"/dev/null", 0};
+  globalState gs{log,
+                 inodeMapper{log},
+                 ModTimeMap{},
+                 false,
+                 0,
+                 logical_clock::from_time_t(744847200)};
+  statBenchmarks(gs);
+  direntBenchmarks(log);
+}
@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Run three times with --action-cache from actionCache_dir/work (see Makefile).
+Copies in.txt and ../shared.txt, which is outside the cached tree, to out.txt,
+removes old.txt and prints to stdout and stderr. The second run must be
+restored from the cache, the third, after shared.txt changed, traced again.
+*/
+
+static ssize_t readFile(const char* path, char* buf, size_t size) {
+  int fd = open(path, O_RDONLY);
+  assert(fd >= 0);
+  ssize_t n = read(fd, buf, size);
+  assert(n >= 0);
+  close(fd);
+  return n;
+}
+
+int main() {
+  char buf[256];
+  ssize_t n = readFile("in.txt", buf, sizeof(buf) / 2);
+  n += readFile("../shared.txt", buf + n, sizeof(buf) / 2);
+
+  int out = open("out.txt", O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  assert(out >= 0);
+  assert(write(out, buf, n) == n);
+  close(out);
+
+  assert(unlink("old.txt") == 0);
+
+  printf("copied %zd bytes\n", n);
+  fprintf(stderr, "removed old.txt\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+"""
+Usage: ./checkBudget.py [--refresh] [--slack PERCENT] [--dettrace PATH]
+                        PROGRAM [ARGS...]
+
+Runs PROGRAM under dettrace with --print-statistics and compares the counters
+that measure tracing overhead (system call events, replays, ptrace peeks,
+process_vm reads and writes, injected system calls) against the checked-in
+budget in Budgets/PROGRAM.budget. Any counter above its budget fails the check,
+so a handler change that makes a sample program cost more ptrace stops gets
+noticed. --slack allows counters to exceed the budget by PERCENT, to absorb libc
+differences between machines.
+
+With --refresh the budget file is rewritten from this run instead. Use it when
+the extra cost is intended, and commit the new budget along with the change.
+
+Programs without a budget file are skipped.
+"""
+
+import os
+import re
+import subprocess
+import sys
+
+budgetDir = "Budgets/"
+
+# Statistics we hold programs to, as printed by dettrace --print-statistics.
+budgeted = [
+    "System Call Events",
+    "Total replays",
+    "ptrace peeks",
+    "process_vm_reads",
+    "process_vm_writes",
+    "Injected system calls",
+]
+
+statRegex = re.compile(r"^dettrace Statistic\. (.*): (\d+)$")
+
+
+def runProgram(dettrace, command):
+    try:
+        proc = subprocess.run(
+            [dettrace, "--print-statistics", "--"] + command,
+            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, timeout=5)
+    except subprocess.TimeoutExpired:
+        return {}
+    stats = {}
+    for line in proc.stderr.decode(encoding="UTF-8").splitlines():
+        match = statRegex.match(line)
+        if match and match.group(1) in budgeted:
+            stats[match.group(1)] = int(match.group(2))
+    return stats
+
+
+def readBudget(path):
+    budget = {}
+    with open(path, "r") as f:
+        for line in f:
+            line = line.strip()
+            if line == "" or line.startswith("#"):
+                continue
+            name, value = line.rsplit(":", 1)
+            budget[name.strip()] = int(value)
+    return budget
+
+
+def writeBudget(path, stats):
+    with open(path, "w") as f:
+        for name in budgeted:
+            if name in stats:
+                f.write("{}: {}\n".format(name, stats[name]))
+
+
+def main():
+    args = sys.argv[1:]
+    refresh = False
+    slack = 0
+    dettrace = "../../bin/dettrace"
+    while args and args[0].startswith("--"):
+        if args[0] == "--refresh":
+            refresh = True
+            args = args[1:]
+        elif args[0] == "--slack" and len(args) > 1:
+            slack = int(args[1])
+            args = args[2:]
+        elif args[0] == "--dettrace" and len(args) > 1:
+            dettrace = args[1]
+            args = args[2:]
+        else:
+            break
+    if not args:
+        print(__doc__)
+        sys.exit(1)
+
+    prog = os.path.basename(args[0])
+    if prog.endswith(".bin"):
+        prog = prog[:-len(".bin")]
+    path = budgetDir + prog + ".budget"
+
+    if not refresh and not os.path.exists(path):
+        print("   No budget for {}, skipping.".format(prog))
+        sys.exit(0)
+
+    stats = runProgram(dettrace, args)
+    if not stats:
+        if refresh:
+            # Programs that time out or die on purpose have nothing to budget.
+            print("   No statistics for {}, not budgeted.".format(prog))
+            sys.exit(0)
+        print("ERROR: no statistics from dettrace for {}.".format(prog))
+        sys.exit(1)
+
+    if refresh:
+        os.makedirs(budgetDir, exist_ok=True)
+        writeBudget(path, stats)
+        print("   Wrote {}.".format(path))
+        sys.exit(0)
+
+    overBudget = False
+    for name, limit in sorted(readBudget(path).items()):
+        actual = stats.get(name, 0)
+        if actual * 100 > limit * (100 + slack):
+            print("ERROR: {}: {} is {}, over its budget of {}.".format(
+                prog, name, actual, limit))
+            overBudget = True
+
+    if overBudget:
+        print("If this is intended, run: make refresh-budgets")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
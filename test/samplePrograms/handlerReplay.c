@@ -0,0 +1,55 @@
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Run with --record-handlers, then --replay-handlers on the trace, once more
+with --path-inodes (see Makefile). Handlers that only use registers and tracee
+memory must replay with the same effect as when recorded. creat and unlink ask
+the host about the file, through /proc/pid, so the recording marks them as not
+replayable instead.
+*/
+
+int main(void) {
+  struct timespec ts;
+  struct stat st;
+  unsigned char buf[16];
+
+  assert(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+  assert(getrandom(buf, sizeof(buf), 0) == sizeof(buf));
+  assert(stat(".", &st) == 0);
+
+  DIR* dir = opendir(".");
+  assert(dir != NULL);
+  int entries = 0;
+  while (readdir(dir) != NULL) {
+    entries++;
+  }
+  closedir(dir);
+  assert(entries >= 2);
+
+  int fd = creat("handlerReplay.tmp", 0644);
+  assert(fd >= 0);
+  close(fd);
+  assert(unlink("handlerReplay.tmp") == 0);
+
+  pid_t child = fork();
+  assert(child >= 0);
+  if (child == 0) {
+    struct timespec nap = {0, 1000};
+    nanosleep(&nap, NULL);
+    return 0;
+  }
+  int status;
+  assert(waitpid(child, &status, 0) == child);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  printf("time %ld, first byte %u\n", (long)ts.tv_sec, buf[0]);
+  return 0;
+}
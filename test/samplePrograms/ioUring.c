@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+io_uring through raw system calls: a batch of writes, reads and a NOP in one
+io_uring_enter, then ops dettrace does not let through (a timeout and a read
+from a pipe), on their own and in a batch after a write. Natively completions
+of a batch may arrive in any order, under dettrace they are in submission order
+and all there when io_uring_enter returns.
+*/
+
+#define ENTRIES 16
+#define CHUNK 4096
+#define CHUNKS 4
+
+struct ring {
+  int fd;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+};
+
+static int setup(struct ring* r, unsigned flags) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = flags;
+  r->fd = syscall(SYS_io_uring_setup, ENTRIES, &p);
+  if (r->fd < 0) {
+    return -errno;
+  }
+
+  size_t sqBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cqBytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  char* sq = mmap(NULL, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd,
+                  IORING_OFF_SQ_RING);
+  char* cq = mmap(NULL, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd,
+                  IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+  assert(sq != MAP_FAILED && cq != MAP_FAILED && r->sqes != MAP_FAILED);
+
+  r->sqHead = (unsigned*)(sq + p.sq_off.head);
+  r->sqTail = (unsigned*)(sq + p.sq_off.tail);
+  r->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+  r->sqArray = (unsigned*)(sq + p.sq_off.array);
+  r->cqHead = (unsigned*)(cq + p.cq_off.head);
+  r->cqTail = (unsigned*)(cq + p.cq_off.tail);
+  r->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+static struct io_uring_sqe* queue(struct ring* r, int op, int fd,
+                                  unsigned long long user) {
+  unsigned tail = *r->sqTail;
+  unsigned index = tail & *r->sqMask;
+  struct io_uring_sqe* sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->user_data = user;
+  r->sqArray[index] = index;
+  __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+/* Submit everything queued, wait for one completion, print all there are. */
+static void submit(struct ring* r, unsigned count) {
+  int ret = syscall(SYS_io_uring_enter, r->fd, count, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+  printf("io_uring_enter: %d\n", ret);
+
+  unsigned head = *r->cqHead;
+  unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+    printf("  completion %llu: %d\n", cqe->user_data, cqe->res);
+  }
+  __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+int main(void) {
+  struct ring r;
+  int err = setup(&r, IORING_SETUP_SQPOLL);
+  printf("SQPOLL setup: %s\n", strerror(-err));
+  if (err == 0) {
+    close(r.fd);
+  }
+  assert(setup(&r, 0) == 0);
+
+  int fd = open("ioUring.tmp", O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd != -1);
+
+  static char out[CHUNKS][CHUNK];
+  static char in[CHUNKS][CHUNK];
+  struct iovec iov[CHUNKS];
+  for (int i = 0; i < CHUNKS; i++) {
+    memset(out[i], 'a' + i, CHUNK);
+    struct io_uring_sqe* sqe = queue(&r, IORING_OP_WRITE, fd, i);
+    sqe->addr = (unsigned long)out[i];
+    sqe->len = CHUNK;
+    sqe->off = i * CHUNK;
+  }
+  queue(&r, IORING_OP_NOP, -1, 100);
+  submit(&r, CHUNKS + 1);
+
+  for (int i = 0; i < CHUNKS; i++) {
+    iov[i].iov_base = in[i];
+    iov[i].iov_len = CHUNK;
+  }
+  struct io_uring_sqe* sqe = queue(&r, IORING_OP_READV, fd, 200);
+  sqe->addr = (unsigned long)iov;
+  sqe->len = CHUNKS;
+  sqe->off = 0;
+  queue(&r, IORING_OP_FSYNC, fd, 201);
+  submit(&r, 2);
+  printf("read back matches: %d\n", memcmp(in, out, sizeof(in)) == 0);
+
+  struct __kernel_timespec ts = {.tv_sec = 0, .tv_nsec = 1000};
+  sqe = queue(&r, IORING_OP_TIMEOUT, -1, 300);
+  sqe->addr = (unsigned long)&ts;
+  sqe->len = 1;
+  submit(&r, 1);
+
+  int fds[2];
+  assert(pipe(fds) == 0);
+  sqe = queue(&r, IORING_OP_READ, fds[0], 400);
+  sqe->addr = (unsigned long)in[0];
+  sqe->len = CHUNK;
+  submit(&r, 1);
+
+  /* A rejected op after an allowed one, the kernel stops submitting there. */
+  sqe = queue(&r, IORING_OP_WRITE, fd, 500);
+  sqe->addr = (unsigned long)out[0];
+  sqe->len = CHUNK;
+  sqe->off = CHUNKS * CHUNK;
+  sqe = queue(&r, IORING_OP_TIMEOUT, -1, 501);
+  sqe->addr = (unsigned long)&ts;
+  sqe->len = 1;
+  queue(&r, IORING_OP_NOP, -1, 502);
+  submit(&r, 3);
+  submit(&r, 1);
+
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  printf("size %ld, mtime %ld\n", (long)st.st_size, (long)st.st_mtime);
+
+  close(fd);
+  close(r.fd);
+  unlink("ioUring.tmp");
+  return 0;
+}
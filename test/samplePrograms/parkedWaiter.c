@@ -0,0 +1,44 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+A thread that only sleeps and checks the clock gets parked, for a long sleep
+until the others made a lot of progress. Here the main thread blocks on a pipe
+only the parked thread writes to. Retrying the blocked read is no progress, so
+the park has to end once everybody else is blocked, not after a million
+replays: the Makefile runs this with --max-blocked-replays to catch that.
+*/
+
+#define POLLS 10
+
+static int fds[2];
+
+static void* poller(void* arg) {
+  struct timespec delay = {1, 0};
+  struct timespec now;
+  for (int i = 0; i < POLLS; i++) {
+    nanosleep(&delay, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  }
+  char c = POLLS;
+  assert(write(fds[1], &c, 1) == 1);
+  return NULL;
+}
+
+int main(void) {
+  assert(pipe(fds) == 0);
+
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, poller, NULL) == 0);
+
+  char c = 0;
+  assert(read(fds[0], &c, 1) == 1);
+  printf("poller wrote: %d\n", c);
+
+  assert(pthread_join(thread, NULL) == 0);
+  printf("poller joined\n");
+  return 0;
+}
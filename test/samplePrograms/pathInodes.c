@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Virtual inodes with --path-inodes (see Makefile). Run once creating the files
+in order and once in reverse, after looking at an extra file; the inodes
+printed must be the same. Recreating a file gives it a new inode. A symlink
+and its target keep their inodes whether the link is stat'ed or lstat'ed first,
+and so does the mount point /tmp whether it is read from / or stat'ed first.
+*/
+
+static const char* names[] = {"a", "b", "c"};
+#define NAMES 3
+
+static ino_t inodeOf(const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "pathInodes_dir/%s", name);
+  struct stat st;
+  assert(stat(path, &st) == 0);
+  return st.st_ino;
+}
+
+static void create(const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "pathInodes_dir/%s", name);
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  assert(fd >= 0);
+  close(fd);
+}
+
+static ino_t rootEntry(const char* name) {
+  ino_t inode = 0;
+  DIR* dir = opendir("/");
+  assert(dir != NULL);
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, name) == 0) {
+      inode = entry->d_ino;
+    }
+  }
+  closedir(dir);
+  return inode;
+}
+
+int main(int argc, char** argv) {
+  int reverse = argc > 1 && strcmp(argv[1], "reverse") == 0;
+  struct stat st;
+  if (reverse) {
+    assert(stat(".", &st) == 0);
+  }
+
+  assert(mkdir("pathInodes_dir", 0755) == 0);
+  for (int i = 0; i < NAMES; i++) {
+    create(names[reverse ? NAMES - 1 - i : i]);
+  }
+
+  /* Follow the link first in one run, look at the link itself first in the
+     other. */
+  assert(symlink("c", "pathInodes_dir/link") == 0);
+  struct stat target, link;
+  if (reverse) {
+    assert(lstat("pathInodes_dir/link", &link) == 0);
+    assert(stat("pathInodes_dir/link", &target) == 0);
+  } else {
+    assert(stat("pathInodes_dir/link", &target) == 0);
+    assert(lstat("pathInodes_dir/link", &link) == 0);
+  }
+  printf("link: %lu\n", (unsigned long)link.st_ino);
+  printf("link target: %lu\n", (unsigned long)target.st_ino);
+
+  struct stat tmp;
+  ino_t tmpEntry;
+  if (reverse) {
+    assert(stat("/tmp", &tmp) == 0);
+    tmpEntry = rootEntry("tmp");
+  } else {
+    tmpEntry = rootEntry("tmp");
+    assert(stat("/tmp", &tmp) == 0);
+  }
+  printf("/tmp: %lu\n", (unsigned long)tmp.st_ino);
+  printf("readdir / matches stat /tmp: %d\n", tmpEntry == tmp.st_ino);
+
+  ino_t inodes[NAMES];
+  for (int i = 0; i < NAMES; i++) {
+    inodes[i] = inodeOf(names[i]);
+    printf("%s: %lu\n", names[i], (unsigned long)inodes[i]);
+  }
+
+  int matches = 0;
+  DIR* dir = opendir("pathInodes_dir");
+  assert(dir != NULL);
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    for (int i = 0; i < NAMES; i++) {
+      matches += strcmp(entry->d_name, names[i]) == 0 &&
+                 entry->d_ino == inodes[i];
+    }
+  }
+  closedir(dir);
+  printf("readdir matches stat: %d\n", matches == NAMES);
+  printf("link target is c: %d\n", target.st_ino == inodes[2]);
+
+  assert(unlink("pathInodes_dir/b") == 0);
+  create("b");
+  ino_t recreated = inodeOf("b");
+  printf("b recreated: %lu\n", (unsigned long)recreated);
+  printf("recreated b is new: %d\n", recreated != inodes[1]);
+
+  assert(unlink("pathInodes_dir/link") == 0);
+  for (int i = 0; i < NAMES; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "pathInodes_dir/%s", names[i]);
+    assert(unlink(path) == 0);
+  }
+  assert(rmdir("pathInodes_dir") == 0);
+  return 0;
+}
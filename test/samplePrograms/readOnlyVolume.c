@@ -0,0 +1,38 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+One directory bound twice with --volume, once with :ro (see Makefile). Both
+show the same file, only the read-write one can be written to.
+*/
+
+static void tryWrite(const char* dir) {
+  char path[64];
+  snprintf(path, sizeof(path), "readOnlyVolume_dir/%s/file", dir);
+
+  char buf[64] = {0};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || read(fd, buf, sizeof(buf) - 1) < 0) {
+    printf("%s: cannot read: %s\n", dir, strerror(errno));
+  } else {
+    printf("%s: %s", dir, buf);
+  }
+  close(fd);
+
+  fd = open(path, O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    printf("%s: cannot write: %s\n", dir, strerror(errno));
+  } else {
+    printf("%s: writable\n", dir);
+    close(fd);
+  }
+}
+
+int main() {
+  tryWrite("rw");
+  tryWrite("ro");
+  return 0;
+}
@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+In-kernel copies: sendfile and copy_file_range between regular files, and
+splice from a pipe whose writer trickles data in small chunks. Natively the
+splice returns whatever happens to be in the pipe, under dettrace every call
+must transfer the full length in one go.
+*/
+
+#define FILE_BYTES 200000
+#define PIPE_BYTES 100000
+#define PIPE_CHUNK 1000
+
+static unsigned checksum(const char* path) {
+  char buf[4096];
+  unsigned sum = 0;
+  int fd = open(path, O_RDONLY);
+  assert(fd != -1);
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      sum = sum * 31 + (unsigned char)buf[i];
+    }
+  }
+  close(fd);
+  return sum;
+}
+
+int main(void) {
+  static char data[FILE_BYTES];
+  for (int i = 0; i < FILE_BYTES; i++) {
+    data[i] = (char)(i * 7 + i / 251);
+  }
+
+  int in = open("sendfile.in", O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(in != -1);
+  assert(write(in, data, FILE_BYTES) == FILE_BYTES);
+
+  int out = open("sendfile.out1", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(out != -1);
+  off_t offset = 0;
+  ssize_t rv = sendfile(out, in, &offset, FILE_BYTES);
+  printf("sendfile: %zd, offset %ld\n", rv, (long)offset);
+  close(out);
+
+  out = open("sendfile.out2", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(out != -1);
+  loff_t inOffset = 0;
+  rv = copy_file_range(in, &inOffset, out, NULL, FILE_BYTES, 0);
+  printf("copy_file_range: %zd, offset %ld\n", rv, (long)inOffset);
+  close(out);
+  close(in);
+
+  int fds[2];
+  assert(pipe(fds) == 0);
+  pid_t child = fork();
+  assert(child != -1);
+  if (child == 0) {
+    close(fds[0]);
+    for (int i = 0; i < PIPE_BYTES; i += PIPE_CHUNK) {
+      assert(write(fds[1], data + i, PIPE_CHUNK) == PIPE_CHUNK);
+    }
+    // Don't flush the parent's buffered output a second time.
+    _exit(0);
+  }
+
+  close(fds[1]);
+  out = open("sendfile.out3", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(out != -1);
+  rv = splice(fds[0], NULL, out, NULL, PIPE_BYTES, 0);
+  printf("splice: %zd\n", rv);
+  close(out);
+  close(fds[0]);
+  waitpid(child, NULL, 0);
+
+  printf("checksums: %x %x %x %x\n", checksum("sendfile.in"),
+         checksum("sendfile.out1"), checksum("sendfile.out2"),
+         checksum("sendfile.out3"));
+
+  unlink("sendfile.in");
+  unlink("sendfile.out1");
+  unlink("sendfile.out2");
+  unlink("sendfile.out3");
+  return 0;
+}
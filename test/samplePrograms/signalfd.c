@@ -0,0 +1,42 @@
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+/*
+The main thread waits for SIGUSR1 on a blocking signalfd, the other thread
+sends it with kill. Reading the signalfd consumes the signal, so it is no longer
+pending afterwards.
+*/
+
+static void* sender(void* arg) {
+  printf("sending SIGUSR1\n");
+  fflush(stdout);
+  assert(kill(getpid(), SIGUSR1) == 0);
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  assert(sigprocmask(SIG_BLOCK, &set, NULL) == 0);
+
+  int sfd = signalfd(-1, &set, 0);
+  assert(sfd >= 0);
+
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, sender, NULL) == 0);
+
+  struct signalfd_siginfo info;
+  assert(read(sfd, &info, sizeof(info)) == sizeof(info));
+  printf("read signal %u\n", info.ssi_signo);
+
+  assert(pthread_join(thread, NULL) == 0);
+  sigset_t pending;
+  assert(sigpending(&pending) == 0);
+  printf("SIGUSR1 pending: %d\n", sigismember(&pending, SIGUSR1));
+  return 0;
+}
@@ -0,0 +1,63 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+A background thread that does nothing but sleep and check the clock, like Go's
+sysmon, while the main thread does the actual work. dettrace turns the sleeps
+into no-ops, so without parking the poller would get scheduled over and over
+while the main thread waits. The stop count budget catches regressions.
+
+The thread is created with a raw clone(), the way the Go runtime does it.
+*/
+
+#define STACK_SIZE (1024 * 1024)
+#define ROUNDS 200
+
+static volatile int done = 0;
+static int stoppedfd[2];
+
+static int poller(void* arg) {
+  struct timespec delay = {0, 20000};
+  struct timespec now;
+  while (!__atomic_load_n(&done, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_nanosleep, &delay, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  }
+  char c = 0;
+  assert(write(stoppedfd[1], &c, 1) == 1);
+  return 0;
+}
+
+int main(void) {
+  int fds[2];
+  assert(pipe(fds) == 0);
+  assert(pipe(stoppedfd) == 0);
+
+  char* stack = malloc(STACK_SIZE);
+  int tid = clone(
+      poller, stack + STACK_SIZE,
+      CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD, NULL);
+  assert(tid != -1);
+
+  char c = 0;
+  struct timespec now;
+  for (int i = 0; i < ROUNDS; i++) {
+    // Checking the time lets dettrace switch to the poller.
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    assert(write(fds[1], &c, 1) == 1);
+    assert(read(fds[0], &c, 1) == 1);
+    c++;
+  }
+  printf("worker done: %d\n", (unsigned char)c);
+
+  __atomic_store_n(&done, 1, __ATOMIC_SEQ_CST);
+  assert(read(stoppedfd[0], &c, 1) == 1);
+  printf("poller stopped\n");
+  return 0;
+}
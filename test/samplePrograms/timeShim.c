@@ -0,0 +1,53 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Time calls through the vdso, run with --time-shim (see Makefile). The shim
+answers them in the tracee, the times must be the same as without it. A child
+busy waiting on the clock still lets its parent run.
+*/
+
+int main(void) {
+  struct timespec ts;
+  struct timeval tv;
+  for (int i = 0; i < 100; i++) {
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+  }
+  printf("clock_gettime: %ld.%09ld\n", (long)ts.tv_sec, ts.tv_nsec);
+  assert(gettimeofday(&tv, NULL) == 0);
+  printf("gettimeofday: %ld.%06ld\n", (long)tv.tv_sec, (long)tv.tv_usec);
+  time_t t;
+  time_t ret = time(&t);
+  printf("time: %ld %ld\n", (long)ret, (long)t);
+  // There is no clock 10, the shim leaves it to the kernel.
+  printf(
+      "clock 10 fails: %d\n", clock_gettime(10, &ts) == -1 && errno == EINVAL);
+  fflush(stdout);
+
+  volatile int* flag = mmap(
+      NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(flag != MAP_FAILED);
+  pid_t pid = fork();
+  if (pid == 0) {
+    long calls = 0;
+    while (!*flag) {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      calls++;
+    }
+    printf(
+        "child waited %ld calls, until %ld.%09ld\n", calls, (long)ts.tv_sec,
+        ts.tv_nsec);
+    return 0;
+  }
+  *flag = 1;
+  waitpid(pid, NULL, 0);
+  clock_gettime(CLOCK_REALTIME, &ts);
+  printf("parent: %ld.%09ld\n", (long)ts.tv_sec, ts.tv_nsec);
+  return 0;
+}
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Unix sockets between a parent and child: a transfer larger than the socket
+buffer, a request/response exchange, datagrams, a listener and a socket passed
+with SCM_RIGHTS. Blocking calls must wait for the other side, reads return what
+was sent so far, and the passed socket keeps its blocking mode. Bad messages
+fail in the kernel, not in the tracer.
+*/
+
+#define BIG (1 << 20)
+
+static ssize_t sendFd(int sock, int fd) {
+  char byte = 'f';
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(c), &fd, sizeof(int));
+  return sendmsg(sock, &msg, 0);
+}
+
+static int recvFd(int sock) {
+  char byte;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  assert(recvmsg(sock, &msg, 0) == 1);
+  int fd;
+  memcpy(&fd, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(int));
+  return fd;
+}
+
+static void child(int sock, int dgram) {
+  // Larger than the socket buffer, the parent drains it as we go.
+  char* big = malloc(BIG);
+  for (int i = 0; i < BIG; i++) {
+    big[i] = i % 251;
+  }
+  printf("child wrote %zd\n", write(sock, big, BIG));
+  fflush(stdout);
+  free(big);
+
+  char buf[64];
+  ssize_t n = read(sock, buf, sizeof(buf));
+  printf("child got request of %zd bytes: %.*s\n", n, (int)n, buf);
+  fflush(stdout);
+  assert(write(sock, "pong", 4) == 4);
+
+  const char* messages[] = {"one", "datagram two", "three"};
+  for (int i = 0; i < 3; i++) {
+    assert(send(dgram, messages[i], strlen(messages[i]), 0) > 0);
+  }
+
+  int passed = recvFd(sock);
+  printf(
+      "passed socket non-blocking: %d\n",
+      (fcntl(passed, F_GETFL) & O_NONBLOCK) != 0);
+  n = read(passed, buf, sizeof(buf));
+  printf("read %zd bytes from passed socket: %.*s\n", n, (int)n, buf);
+  fflush(stdout);
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strcpy(addr.sun_path, "unixSockets.sock");
+  int client = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(connect(client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  assert(write(client, "connected", 9) == 9);
+  exit(0);
+}
+
+int main(void) {
+  int sv[2], dv[2], pv[2];
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  assert(socketpair(AF_UNIX, SOCK_DGRAM, 0, dv) == 0);
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pv) == 0);
+  printf("non-blocking: %d\n", (fcntl(sv[0], F_GETFL) & O_NONBLOCK) != 0);
+  fflush(stdout);
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strcpy(addr.sun_path, "unixSockets.sock");
+  unlink(addr.sun_path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  assert(listen(listener, 1) == 0);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    child(sv[1], dv[1]);
+  }
+
+  char* big = malloc(BIG);
+  ssize_t n = recv(sv[0], big, BIG, MSG_WAITALL);
+  long sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += big[i];
+  }
+  printf("parent received %zd, checksum %ld\n", n, sum);
+  fflush(stdout);
+  free(big);
+
+  char buf[64];
+  assert(write(sv[0], "ping", 4) == 4);
+  n = read(sv[0], buf, sizeof(buf));
+  printf("parent got response of %zd bytes: %.*s\n", n, (int)n, buf);
+
+  for (int i = 0; i < 3; i++) {
+    n = recv(dv[0], buf, sizeof(buf), 0);
+    printf("datagram of %zd bytes: %.*s\n", n, (int)n, buf);
+  }
+  fflush(stdout);
+
+  assert(sendFd(sv[0], pv[1]) == 1);
+  assert(write(pv[0], "through passed socket", 21) == 21);
+
+  int conn = accept(listener, NULL, NULL);
+  n = read(conn, buf, sizeof(buf));
+  printf("accepted connection sent %zd bytes: %.*s\n", n, (int)n, buf);
+
+  int flags = fcntl(conn, F_GETFL);
+  assert(fcntl(conn, F_SETFL, flags | O_NONBLOCK) == 0);
+  printf("after F_SETFL: %d\n", (fcntl(conn, F_GETFL) & O_NONBLOCK) != 0);
+  assert(fcntl(conn, F_SETFL, flags) == 0);
+  printf("after clearing: %d\n", (fcntl(conn, F_GETFL) & O_NONBLOCK) != 0);
+
+  int status;
+  waitpid(pid, &status, 0);
+  printf("child exited with %d\n", WEXITSTATUS(status));
+
+  ssize_t sent = sendmsg(pv[0], NULL, 0);
+  printf("sendmsg(NULL): %d\n", sent == -1 && errno == EFAULT);
+  sent = sendFd(pv[0], 1000);
+  printf("passing a bad fd: %d\n", sent == -1 && errno == EBADF);
+  unlink(addr.sun_path);
+  return 0;
+}
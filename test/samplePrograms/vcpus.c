@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <cpuid.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Every way a program can count CPUs, run with --vcpus=6 (see Makefile). They all
+have to agree with each other, not with the host.
+*/
+
+static int countLines(const char* path, const char* prefix) {
+  char line[4096];
+  int count = 0;
+  FILE* f = fopen(path, "r");
+  assert(f != NULL);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, prefix, strlen(prefix)) == 0) {
+      count++;
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+int main(void) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+  printf("sched_getaffinity: %d\n", CPU_COUNT(&set));
+  printf("sysconf: %ld online, %ld configured\n",
+         sysconf(_SC_NPROCESSORS_ONLN), sysconf(_SC_NPROCESSORS_CONF));
+
+  // Pinning to a virtual CPU works even if the host doesn't have it.
+  CPU_ZERO(&set);
+  CPU_SET(5, &set);
+  printf("pin to cpu 5: %d\n", sched_setaffinity(0, sizeof(set), &set));
+  CPU_ZERO(&set);
+  CPU_SET(6, &set);
+  printf("pin to cpu 6: %d\n", sched_setaffinity(0, sizeof(set), &set));
+
+  unsigned eax, ebx, ecx, edx;
+  __cpuid(1, eax, ebx, ecx, edx);
+  printf("cpuid 1: %u logical, htt %u\n", (ebx >> 16) & 0xff,
+         (edx >> 28) & 1);
+  __cpuid_count(4, 0, eax, ebx, ecx, edx);
+  printf("cpuid 4: %u cores\n", (eax >> 26) + 1);
+  __cpuid_count(0xb, 1, eax, ebx, ecx, edx);
+  printf("cpuid 0xb: %u logical, shift %u\n", ebx & 0xffff, eax & 0x1f);
+
+  printf("/proc/cpuinfo: %d\n", countLines("/proc/cpuinfo", "processor"));
+  // Minus the aggregate line.
+  printf("/proc/stat: %d\n", countLines("/proc/stat", "cpu") - 1);
+
+  char online[64] = "";
+  FILE* f = fopen("/sys/devices/system/cpu/online", "r");
+  assert(f != NULL);
+  assert(fgets(online, sizeof(online), f) != NULL);
+  fclose(f);
+  printf("/sys/devices/system/cpu/online: %s", online);
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "../catch.hpp"
+#include <unordered_map>
+#include "../../../include/compactMap.hpp"
+
+
+/**
+ * Tests for the class compactMap
+ */
+
+TEST_CASE("compactMap behaves like a map", "compactMap"){
+  compactMap<unsigned long, long> map;
+
+  SECTION("empty map has nothing"){
+    REQUIRE(map.size() == 0);
+    REQUIRE(map.find(1) == nullptr);
+    REQUIRE(map.count(1) == 0);
+    REQUIRE(map.erase(1) == 0);
+  }
+
+  SECTION("set then lookup"){
+    map.set(7, 70);
+    REQUIRE(*map.find(7) == 70);
+    REQUIRE(map.size() == 1);
+
+    SECTION("set on an existing key overwrites it"){
+      map.set(7, 71);
+      REQUIRE(*map.find(7) == 71);
+      REQUIRE(map.size() == 1);
+    }
+
+    SECTION("erase removes the entry"){
+      REQUIRE(map.erase(7) == 1);
+      REQUIRE(map.erase(7) == 0);
+      REQUIRE(map.find(7) == nullptr);
+      REQUIRE(map.size() == 0);
+    }
+  }
+}
+
+TEST_CASE("compactMap keeps entries across merges", "compactMap"){
+  compactMap<unsigned long, long> map;
+  std::unordered_map<unsigned long, long> expected;
+
+  // Enough keys, in no particular order, to merge several times.
+  for (unsigned long i = 0; i < 10000; i++) {
+    unsigned long key = (i * 7919) % 10007;
+    map.set(key, i);
+    expected[key] = i;
+  }
+  REQUIRE(map.size() == expected.size());
+
+  // Erase every third key, then bring some of them back.
+  for (unsigned long key = 0; key < 10007; key += 3) {
+    REQUIRE(map.erase(key) == expected.erase(key));
+  }
+  for (unsigned long key = 0; key < 10007; key += 9) {
+    map.set(key, -1);
+    expected[key] = -1;
+  }
+  REQUIRE(map.size() == expected.size());
+
+  for (unsigned long key = 0; key < 10007; key++) {
+    auto it = expected.find(key);
+    const long* value = map.find(key);
+    if (it == expected.end()) {
+      REQUIRE(value == nullptr);
+    } else {
+      REQUIRE(value != nullptr);
+      REQUIRE(*value == it->second);
+    }
+  }
+
+  SECTION("erasing everything gives most of the memory back"){
+    size_t full = map.memoryBytes();
+    for (auto& entry : expected) {
+      map.erase(entry.first);
+    }
+    REQUIRE(map.size() == 0);
+    // Up to a merge's worth of erased entries may still be around.
+    REQUIRE(map.memoryBytes() < full / 4);
+  }
+}
@@ -0,0 +1,82 @@
+#include "../catch.hpp"
+#include <string>
+#include "../../../include/stateTable.hpp"
+
+
+/**
+ * Tests for the class stateTable
+ */
+
+TEST_CASE("stateTable behaves like a pid keyed map", "stateTable"){
+  stateTable<std::string, 4> table;
+
+  SECTION("empty table has nothing"){
+    REQUIRE(table.empty());
+    REQUIRE(table.find(1) == nullptr);
+    REQUIRE(table.count(1) == 0);
+    REQUIRE_THROWS_AS(table.at(1), const std::out_of_range&);
+  }
+
+  SECTION("emplace then lookup"){
+    auto res = table.emplace(7, "seven");
+    REQUIRE(res.second);
+    REQUIRE(*res.first == "seven");
+    REQUIRE(table.at(7) == "seven");
+    REQUIRE(table.size() == 1);
+
+    SECTION("emplace on an existing pid keeps the old value"){
+      auto again = table.emplace(7, "other");
+      REQUIRE_FALSE(again.second);
+      REQUIRE(*again.first == "seven");
+      REQUIRE(table.size() == 1);
+    }
+
+    SECTION("erase removes the entry"){
+      REQUIRE(table.erase(7) == 1);
+      REQUIRE(table.erase(7) == 0);
+      REQUIRE(table.find(7) == nullptr);
+      REQUIRE(table.empty());
+    }
+  }
+}
+
+TEST_CASE("stateTable references are stable", "stateTable"){
+  stateTable<std::string, 4> table;
+
+  std::string& first = *table.emplace(1, "one").first;
+  // Force several slabs and a few index resizes.
+  for (int pid = 2; pid < 100; pid++) {
+    table.emplace(pid, std::to_string(pid));
+  }
+
+  REQUIRE(&first == &table.at(1));
+  REQUIRE(first == "one");
+  REQUIRE(table.size() == 99);
+  REQUIRE(table.capacity() >= 99);
+
+  SECTION("freed slots are reused"){
+    size_t capacity = table.capacity();
+    for (int pid = 2; pid < 100; pid++) {
+      table.erase(pid);
+    }
+    for (int pid = 200; pid < 298; pid++) {
+      table.emplace(pid, "again");
+    }
+    REQUIRE(table.capacity() == capacity);
+    REQUIRE(table.at(1) == "one");
+  }
+}
+
+TEST_CASE("stateTable forEach visits live records in pid order", "stateTable"){
+  stateTable<std::string, 4> table;
+  table.emplace(9, "nine");
+  table.emplace(3, "three");
+  table.emplace(5, "five");
+  table.erase(5);
+
+  std::string seen;
+  table.forEach([&seen](pid_t pid, const std::string& s) {
+    seen += std::to_string(pid) + s;
+  });
+  REQUIRE(seen == "3three9nine");
+}